@@ -34,15 +34,12 @@
 #include <Arduino.h>
 #include "InputCapture.h"
 
+#ifndef INPUT_CAPTURE_DMA
 
-// convert from microseconds to I/O clock ticks
-#if defined(KINETISK)
-#define CLOCKS_PER_MICROSECOND ((double)F_BUS / 1000000.0)
-#elif defined(KINETISL)
-#define CLOCKS_PER_MICROSECOND ((double)F_PLL / 2000000.0)
-#endif
-
-#define FTM0_SC_VALUE (FTM_SC_TOIE | FTM_SC_CLKS(1) | FTM_SC_PS(0))
+// Keep the compiler from moving loads and stores across the ring
+// index updates.  The Cortex-M4 is single core and does not reorder
+// normal memory accesses, so no DMB is needed between ISR and reader.
+#define RING_BARRIER() __asm__ __volatile__("" ::: "memory")
 
 #if defined(KINETISK)
 #define CSC_CHANGE(reg, val)         ((reg)->csc = (val))
@@ -60,152 +57,537 @@
 
 
 /**
- * Interrupt for the flexible timer module 0.
+ * Timestamp one edge.  This is only called from the timer ISRs and is
+ * inlined into them so that the dispatch costs no call overhead.
+ */
+inline __attribute__((always_inline))
+void InputCapture::isr(InputCaptureEdge * edge, uint32_t count, bool overflowed)
+{
+	uint32_t val = ftm->cv;
+	const uint8_t csc = cscEdge;
+
+	if (cscFlip)
+	{
+		// both edges: wait for the other one next
+		cscEdge = csc ^ cscFlip;
+		CSC_CHANGE_INTACK(ftm, cscEdge);
+	} else
+		CSC_INTACK(ftm, csc); // input capture & interrupt on desired edge
+
+#ifdef INPUT_CAPTURE_PROFILE
+	// how long ago, in cpu cycles, did the edge happen?
+	latency.add(((entry_count - val) & 0xFFFF) * (F_CPU / F_BUS));
+#endif
+
+	// if the pulse happened recently and we registered an overflow
+	// on this interrupt then we assume that the pulse was in the last
+	// window, not this one.
+	if (val > 0xE000 && overflowed)
+		count--;
+
+	// update the high bits on the counter
+	edge->when = val | (count << 16);
+	edge->id = id;
+	edge->rising = csc == 0b01000100;
+}
+
+
+/**
+ * Interrupt for one timer module.
  *
  * This indicates either a timer overflow or a transition on one of
- * the inputs.
+ * the inputs.  The STATUS register has the flags for all of the
+ * channels, so one read tells us which ones to service.
+ *
+ * Every edge that is captured before that read is handled in this
+ * pass, and any that come after it will have later timestamps, so
+ * sorting the few in this pass by time keeps the whole ring in the
+ * order that the edges happened.  Nothing from before the counter
+ * value on entry can come in a later pass, so that time is published
+ * as the module's horizon for read().
  */
-void ftm0_isr(void)
+template <unsigned N>
+inline __attribute__((always_inline))
+void InputCapture::timer_isr()
 {
-	if (FTM0_SC & 0x80) {
+	typedef InputCaptureTimer<N> T;
+
+#ifdef INPUT_CAPTURE_PROFILE
+	const uint32_t start = ARM_DWT_CYCCNT;
+#endif
+	const uint32_t entry = T::cnt();
+#ifdef INPUT_CAPTURE_PROFILE
+	entry_count = entry;
+#endif
+
+	uint32_t count = overflow_count[N];
+	bool overflowed = false;
+
+	if (T::sc() & 0x80) {
 		#if defined(KINETISK)
-		FTM0_SC = FTM0_SC_VALUE;
+		T::sc() = FTM_SC_VALUE;
 		#elif defined(KINETISL)
-		FTM0_SC = FTM0_SC_VALUE | FTM_SC_TOF;
+		T::sc() = FTM_SC_VALUE | FTM_SC_TOF;
 		#endif
-		InputCapture::overflow_count++;
-		InputCapture::overflow_inc = true;
+		overflow_count[N] = ++count;
+		overflowed = true;
 	}
 
-	// TODO: this could be efficient by reading FTM0_STATUS
-	//const uint8_t maskin = 0x18;
-	const uint8_t maskin = InputCapture::channelmask;
-	if ((maskin & 0x01) && (FTM0_C0SC & 0x80)) InputCapture::list[0]->isr();
-	if ((maskin & 0x02) && (FTM0_C1SC & 0x80)) InputCapture::list[1]->isr();
-	if ((maskin & 0x04) && (FTM0_C2SC & 0x80)) InputCapture::list[2]->isr();
-	if ((maskin & 0x08) && (FTM0_C3SC & 0x80)) InputCapture::list[3]->isr();
-	if ((maskin & 0x10) && (FTM0_C4SC & 0x80)) InputCapture::list[4]->isr();
-	if ((maskin & 0x20) && (FTM0_C5SC & 0x80)) InputCapture::list[5]->isr();
-	#if defined(KINETISK)
-	if ((maskin & 0x40) && (FTM0_C6SC & 0x80)) InputCapture::list[6]->isr();
-	if ((maskin & 0x80) && (FTM0_C7SC & 0x80)) InputCapture::list[7]->isr();
-	#endif
-	InputCapture::overflow_inc = false;
+	// the same as for an edge, in case it wrapped after the entry
+	const uint32_t horizon = entry
+		| ((entry > 0xE000 && overflowed ? count - 1 : count) << 16);
+
+	InputCaptureEdge pass[T::channels];
+	unsigned n = 0;
+
+	uint32_t pending = T::status()
+		& (inputmask >> T::first)
+		& ((1 << T::channels) - 1);
+
+	while (pending)
+	{
+		const unsigned channel = __builtin_ctz(pending);
+		pending &= pending - 1;
+
+		InputCaptureEdge edge;
+		list[T::first + channel]->isr(&edge, count, overflowed);
+
+		// insertion sort, usually only one or two
+		unsigned i = n++;
+		for ( ; i > 0 && (int32_t) (edge.when - pass[i-1].when) < 0 ; i--)
+			pass[i] = pass[i-1];
+		pass[i] = edge;
+	}
+
+	// store the edges before publishing them to the reader
+	const uint32_t w = write_index[N];
+	for (unsigned i = 0 ; i < n ; i++)
+		edges[N][(w + i) & SAMPLE_MASK] = pass[i];
+	RING_BARRIER();
+	write_index[N] = w + n;
+	InputCapture::horizon[N] = horizon;
+
+#ifdef INPUT_CAPTURE_PROFILE
+	duration.add(ARM_DWT_CYCCNT - start);
+#endif
 }
 
 // some explanation regarding this C to C++ trickery can be found here:
 // http://forum.pjrc.com/threads/25278-Low-Power-with-Event-based-software-architecture-brainstorm?p=43496&viewfull=1#post43496
 
-uint16_t InputCapture::overflow_count = 0;
-bool InputCapture::overflow_inc = false;
-volatile uint8_t InputCapture::channelmask = 0;
-InputCapture * InputCapture::list[8];
+void ftm0_isr(void)
+{
+	InputCapture::timer_isr<0>();
+}
 
-InputCapture::InputCapture()
+#if INPUT_CAPTURE_TIMERS > 1
+void ftm1_isr(void)
 {
+	InputCapture::timer_isr<1>();
 }
+#endif
 
+#if INPUT_CAPTURE_TIMERS > 2
+void ftm2_isr(void)
+{
+	InputCapture::timer_isr<2>();
+}
+#endif
 
-bool InputCapture::begin(uint8_t pin, int polarity)
+#if INPUT_CAPTURE_TIMERS > 3
+void ftm3_isr(void)
 {
-	uint32_t channel;
-	volatile void *reg;
+	InputCapture::timer_isr<3>();
+}
+#endif
 
-	cscEdge = (polarity == FALLING) ? 0b01001000 : 0b01000100;
+InputCaptureEdge InputCapture::edges[INPUT_CAPTURE_TIMERS][SAMPLE_COUNT];
+volatile uint32_t InputCapture::write_index[INPUT_CAPTURE_TIMERS];
+uint32_t InputCapture::read_index[INPUT_CAPTURE_TIMERS];
+volatile uint32_t InputCapture::horizon[INPUT_CAPTURE_TIMERS];
+uint32_t InputCapture::cut;
+bool InputCapture::lost_edges;
 
-	if (FTM0_MOD != 0xFFFF || (FTM0_SC & 0x7F) != FTM0_SC_VALUE) {
-		FTM0_SC = 0;
-		FTM0_CNT = 0;
-		FTM0_MOD = 0xFFFF;
-		FTM0_SC = FTM0_SC_VALUE;
-		#if defined(KINETISK)
-		FTM0_MODE = 0;
-		#endif
-	}
 
-	switch (pin) {
-	  case  6: channel = 4; reg = &FTM0_C4SC; break;
-	  case  9: channel = 2; reg = &FTM0_C2SC; break;
-	  case 10: channel = 3; reg = &FTM0_C3SC; break;
-	  case 20: channel = 5; reg = &FTM0_C5SC; break;
-	  case 22: channel = 0; reg = &FTM0_C0SC; break;
-	  case 23: channel = 1; reg = &FTM0_C1SC; break;
-	  #if defined(KINETISK)
-	  case 21: channel = 6; reg = &FTM0_C6SC; break;
-	  case  5: channel = 7; reg = &FTM0_C7SC; break;
-	  #endif
-	  default:
-		return false;
+void InputCapture::arm()
+{
+	// input capture & interrupt on desired edge
+	CSC_CHANGE(ftm, cscEdge);
+}
+
+
+void InputCapture::flush()
+{
+	for (unsigned t = 0 ; t < INPUT_CAPTURE_TIMERS ; t++)
+	{
+		read_index[t] = write_index[t];
+		horizon[t] = 0;
 	}
+	lost_edges = false;
+}
 
-	write_index = 0;
-	read_index = 0;
 
-	ftm = (struct ftm_channel_struct *)reg;
+/*
+ * The oldest edge in a timer's ring, without taking it.  Any that the
+ * ISR has overwritten are counted lost.
+ */
+bool InputCapture::peek(unsigned t, InputCaptureEdge * edge)
+{
+	bool lapped = false;
 
-	// Check for already installed on this pin
-	if (channelmask & (1 << channel))
-		return false;
+	while (1)
+	{
+		const uint32_t w = write_index[t];
+		uint32_t r = read_index[t];
+
+		// fast return if no data
+		if (w == r)
+			return false;
+
+		if (w - r > SAMPLE_COUNT)
+		{
+			// we lost data.  catch up to the oldest edge
+			// that is still in the ring.
+			lost += w - r - SAMPLE_COUNT;
+			read_index[t] = r = w - SAMPLE_COUNT;
+			lapped = true;
+		}
+
+		*edge = edges[t][r & SAMPLE_MASK];
+		RING_BARRIER();
+
+		// if the ISR did not lap us while we were reading,
+		// then the edge is good.
+		if (write_index[t] - r <= SAMPLE_COUNT)
+			break;
+
+		// it was overwritten; try again, which will account
+		// for it as lost
+	}
 
-	channelmask |= (1<<channel);
-	list[channel] = this;
+	if (lapped)
+	{
+		if (!lost_edges || (int32_t) (edge->when - cut) > 0)
+			cut = edge->when;
+		lost_edges = true;
+	}
 
-	*portConfigRegister(pin) = PORT_PCR_MUX(4);
+	return true;
+}
 
-	// input capture & interrupt on desired edge
-	CSC_CHANGE(ftm, cscEdge);
 
-	NVIC_SET_PRIORITY(IRQ_FTM0, 32);
-	NVIC_ENABLE_IRQ(IRQ_FTM0);
+// 0 == no data, 1 == data, -1 == lost data
+int InputCapture::take(InputCaptureEdge * edge, bool more)
+{
+	while (1)
+	{
+		// the earliest of the oldest edges in each ring
+		int best = -1;
+		uint32_t empty = 0;
+
+		for (unsigned t = 0 ; t < INPUT_CAPTURE_TIMERS ; t++)
+		{
+			InputCaptureEdge e;
+			if (!peek(t, &e))
+			{
+				empty |= 1 << t;
+				continue;
+			}
+
+			if (best < 0 || (int32_t) (e.when - edge->when) < 0)
+			{
+				best = t;
+				*edge = e;
+			}
+		}
+
+		if (best < 0)
+			return 0;
+
+		// A timer module with nothing in its ring may yet have an
+		// earlier edge that its ISR hasn't run for, unless it has
+		// run since this one.  Later edges in a ring that has some
+		// can't come before its oldest.
+		empty &= timers;
+		while (empty)
+		{
+			const unsigned t = __builtin_ctz(empty);
+			empty &= empty - 1;
+
+			if ((int32_t) (horizon[t] - edge->when) <= 0)
+				return 0;
+		}
+
+		if (more && lost_edges)
+			return 0;
+
+		read_index[best]++;
+
+		// from before some that were lost in another ring
+		if (lost_edges && (int32_t) (edge->when - cut) < 0)
+		{
+			lost++;
+			continue;
+		}
+
+		const int rc = lost_edges ? -1 : 1;
+		lost_edges = false;
+		return rc;
+	}
+}
+#endif
 
-	return true;
+int InputCapture::read(InputCaptureEdge * edge)
+{
+	return take(edge, false);
 }
 
-void InputCapture::isr(void)
+
+int InputCapture::read_batch(InputCaptureEdge * edges, unsigned max)
 {
-	uint32_t count = overflow_count;
-	uint32_t val = ftm->cv;
+	if (max == 0)
+		return 0;
 
-	CSC_INTACK(ftm, cscEdge); // input capture & interrupt on desired edge
+	const int rc = take(&edges[0], false);
+	if (rc == 0)
+		return 0;
 
-	// if the pulse happened recently and we registered an overflow
-	// on this interrupt then we assume that the pulse was in the last
-	// window, not this one.
-	if (val > 0xE000 && overflow_inc)
-		count--;
+	unsigned n = 1;
+	while (n < max && take(&edges[n], true) != 0)
+		n++;
 
-	// update the high bits on the counter
-	val |= (count << 16);
+	return rc < 0 ? -(int) n : (int) n;
+}
+
+
+volatile uint32_t InputCapture::overflow_count[INPUT_CAPTURE_TIMERS];
+volatile uint32_t InputCapture::inputmask = 0;
+uint8_t InputCapture::timers = 0;
+InputCapture * InputCapture::list[INPUT_CAPTURE_INPUTS];
+uint32_t InputCapture::lost;
+
+constexpr InputCapturePin InputCaptureTimer<0>::pins[];
+#if INPUT_CAPTURE_TIMERS > 1
+constexpr InputCapturePin InputCaptureTimer<1>::pins[];
+#endif
+#if INPUT_CAPTURE_TIMERS > 2
+constexpr InputCapturePin InputCaptureTimer<2>::pins[];
+#endif
+#if INPUT_CAPTURE_TIMERS > 3
+constexpr InputCapturePin InputCaptureTimer<3>::pins[];
+#endif
 
-	samples[write_index++ % SAMPLE_COUNT] = val;
+#ifdef INPUT_CAPTURE_PROFILE
+uint16_t InputCapture::entry_count;
+InputCaptureHistogram InputCapture::latency(2);
+InputCaptureHistogram InputCapture::duration(3);
+
+
+void InputCaptureHistogram::reset()
+{
+	for (unsigned i = 0 ; i < buckets ; i++)
+		count[i] = 0;
+	max = 0;
+	samples = 0;
 }
 
 
-// 0 == no data, 1 == data, -1 == lost data
-int InputCapture::read(uint32_t * val)
+void InputCapture::profile_reset()
 {
 	__disable_irq();
-	const uint32_t w = write_index;
+	latency.reset();
+	duration.reset();
+	__enable_irq();
+}
+#endif
 
-	// fast return if no data
-	if (w == read_index)
+InputCapture::InputCapture()
+{
+}
+
+
+// past the last timer module, so the pin has no channel
+template <>
+bool InputCapture::attach<INPUT_CAPTURE_TIMERS>(uint8_t pin, uint8_t * mux)
+{
+	return false;
+}
+
+
+template <unsigned N>
+bool InputCapture::attach(uint8_t pin, uint8_t * mux)
+{
+	typedef InputCaptureTimer<N> T;
+
+	for (const InputCapturePin & p : T::pins)
 	{
-		__enable_irq();
-		return 0;
+		if (p.pin != pin)
+			continue;
+
+		this->timer = N;
+		this->slot = T::first + p.channel;
+		this->ftm = T::channel(p.channel);
+#ifdef INPUT_CAPTURE_DMA
+		this->request = T::dma_source + p.channel;
+#endif
+		*mux = p.mux;
+		return true;
+	}
+
+	return this->attach<N + 1>(pin, mux);
+}
+
+
+template <>
+void InputCapture::setup<INPUT_CAPTURE_TIMERS>(uint8_t timers)
+{
+}
+
+
+/*
+ * Stop each of the timer modules and set them up the same, with the
+ * counter waiting for the global time base.
+ */
+template <unsigned N>
+void InputCapture::setup(uint8_t timers)
+{
+	typedef InputCaptureTimer<N> T;
+
+	if (timers & (1 << N))
+	{
+#ifdef INPUT_CAPTURE_DMA
+		// the channels are on DMA, so FTM0's overflows are the
+		// only interrupt
+		const bool interrupt = N == 0;
+#else
+		const bool interrupt = true;
+#endif
+
+		T::sc() = 0;
+		T::cnt() = 0;
+		T::mod() = 0xFFFF;
+		#if defined(KINETISK)
+		T::mode() = 0;
+		T::conf() = FTM_CONF_GTBEEN;
+		#endif
+		T::sc() = interrupt ? FTM_SC_VALUE : FTM_SC_VALUE & ~FTM_SC_TOIE;
+		overflow_count[N] = 0;
+
+		if (interrupt)
+		{
+			NVIC_SET_PRIORITY(T::irq, 32);
+			NVIC_ENABLE_IRQ(T::irq);
+		}
 	}
 
-	int rc = 1;
+	setup<N + 1>(timers);
+}
+
+
+/*
+ * The timer modules are all clocked from the bus and started together
+ * by FTM0's global time base output, so that their counters stay the
+ * same and an edge's time means the same whichever one captured it.
+ * Adding one means stopping the others to start them all again.
+ */
+void InputCapture::restart(uint8_t timers)
+{
+	__disable_irq();
+	setup<0>(timers);
+	InputCapture::timers = timers;
+	flush();
 
-	if (w - read_index > SAMPLE_COUNT)
+	// the inputs that are already installed start again as well
+	uint32_t pending = inputmask;
+	while (pending)
 	{
-		// we lost data.  catch up.
-		rc = -1;
-		read_index = w - SAMPLE_COUNT+1;
+		const unsigned s = __builtin_ctz(pending);
+		pending &= pending - 1;
+		list[s]->arm();
 	}
 
-	*val = samples[read_index++ % SAMPLE_COUNT];
+	#if defined(KINETISK)
+	FTM0_CONF |= FTM_CONF_GTBEOUT;
+	#endif
+	__enable_irq();
+}
+
 
+bool InputCapture::begin(uint8_t pin, int polarity, uint8_t id)
+{
+	uint8_t mux;
+
+#ifdef INPUT_CAPTURE_DMA
+	// there is no interrupt to flip the edge select
+	if (polarity == CHANGE)
+		return false;
+#endif
+
+	cscEdge = (polarity == FALLING || polarity == CHANGE) ? 0b01001000 : 0b01000100;
+	cscFlip = (polarity == CHANGE) ? 0b00001100 : 0;
+
+	if (!this->attach<0>(pin, &mux))
+		return false;
+
+	this->id = id;
+
+	// Check for already installed on this pin
+	if (inputmask & (1 << this->slot))
+		return false;
+
+#ifdef INPUT_CAPTURE_DMA
+	// every input needs a DMA channel of its own
+	if (this->dma.channel >= DMA_NUM_CHANNELS)
+		return false;
+#endif
+
+	// FTM0 keeps the time, and the timer of every input has to count
+	// along with it
+	const uint8_t need = timers | 1 | (1 << this->timer);
+	if (need != timers || FTM0_MOD != 0xFFFF || (FTM0_SC & 0x7F) != FTM_SC_VALUE)
+		restart(need);
+
+	inputmask |= 1 << this->slot;
+	list[this->slot] = this;
+
+	*portConfigRegister(pin) = PORT_PCR_MUX(mux);
+
+#ifdef INPUT_CAPTURE_PROFILE
+	// start the cycle counter
+	ARM_DEMCR |= ARM_DEMCR_TRCENA;
+	ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+#endif
+
+	this->arm();
+	return true;
+}
+
+uint64_t InputCapture::now()
+{
+	__disable_irq();
+	uint64_t count = overflow_count[0];
+	const uint32_t cnt = FTM0_CNT;
+
+	// the counter has wrapped but the ISR has not counted it yet
+	if ((FTM0_SC & 0x80) && cnt < 0x8000)
+		count++;
 	__enable_irq();
 
-	return rc;
+	return (count << 16) | cnt;
+}
+
+
+/*
+ * The time can't be later than the end of the current overflow period,
+ * so it is the latest time with these low 32 bits that isn't.
+ */
+uint64_t InputCapture::extend(uint32_t when)
+{
+	const uint64_t latest = ((uint64_t) overflow_count[0] << 16) | 0xFFFF;
+	uint64_t t = (latest & ~(uint64_t) 0xFFFFFFFF) | when;
+
+	if (t > latest && t >= (1ull << 32))
+		t -= 1ull << 32;
+
+	return t;
 }
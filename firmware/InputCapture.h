@@ -31,44 +31,449 @@
  * THE SOFTWARE.
  */
 
+#ifndef _InputCapture_h_
+#define _InputCapture_h_
+
 #include <Arduino.h>
 
-#define SAMPLE_COUNT 64
+// convert from microseconds to I/O clock ticks
+#if defined(KINETISK)
+#define CLOCKS_PER_MICROSECOND (F_BUS / 1000000)
+#elif defined(KINETISL)
+// PLL is 48 Mhz, which is 24 clocks per microsecond, but
+// there is a divide by two for some reason.
+#define CLOCKS_PER_MICROSECOND (F_PLL / 2000000)
+#endif
+
+// Depth of the ring buffer that the channels of each timer module
+// share; must be a power of two.  Override on the compiler command line
+// to trade RAM for slack.
+#ifndef SAMPLE_COUNT
+#define SAMPLE_COUNT 256
+#endif
+
+#define SAMPLE_MASK (SAMPLE_COUNT - 1)
+
+static_assert((SAMPLE_COUNT & SAMPLE_MASK) == 0, "SAMPLE_COUNT must be a power of two");
+
+// The bus clock with no prescaler and the overflow interrupt on, for
+// every timer module that captures
+#define FTM_SC_VALUE (FTM_SC_TOIE | FTM_SC_CLKS(1) | FTM_SC_PS(0))
+
+// The timer modules with channels on the pins: FTM0 and FTM1 on the
+// Teensy 3.0, FTM2 as well on the 3.1 and 3.2, and FTM3 on the 3.5 and
+// 3.6.  The Teensy LC only has TPM0.
+#if defined(__MK64FX512__) || defined(__MK66FX1M0__)
+#define INPUT_CAPTURE_TIMERS 4
+#elif defined(__MK20DX256__)
+#define INPUT_CAPTURE_TIMERS 3
+#elif defined(KINETISK)
+#define INPUT_CAPTURE_TIMERS 2
+#else
+#define INPUT_CAPTURE_TIMERS 1
+#endif
+
+#ifdef INPUT_CAPTURE_DMA
+/*
+ * Built with INPUT_CAPTURE_DMA, each channel's captures are copied by
+ * the eDMA into a buffer of its own instead of interrupting for every
+ * edge (see InputCaptureDMA.cpp).  It needs a DMA channel for each
+ * input, so a Teensy 3.1 or later.
+ */
+#include <DMAChannel.h>
+
+#if !defined(KINETISK)
+#error "INPUT_CAPTURE_DMA needs the eDMA of a Teensy 3"
+#endif
+
+// Depth of each channel's DMA buffer; it must be a power of two for
+// the DMA to wrap it and hold more edges than one channel sees in a
+// timer overflow period, 1.37 ms.
+#ifndef DMA_SAMPLE_COUNT
+#define DMA_SAMPLE_COUNT 64
+#endif
+
+#define DMA_SAMPLE_MASK (DMA_SAMPLE_COUNT - 1)
+
+// Overflow periods that the reader can fall behind by before the
+// edges can't be timed any more; a power of two.
+#ifndef DMA_MARK_COUNT
+#define DMA_MARK_COUNT 32
+#endif
+
+#define DMA_MARK_MASK (DMA_MARK_COUNT - 1)
+
+static_assert((DMA_SAMPLE_COUNT & DMA_SAMPLE_MASK) == 0, "DMA_SAMPLE_COUNT must be a power of two");
+static_assert((DMA_MARK_COUNT & DMA_MARK_MASK) == 0, "DMA_MARK_COUNT must be a power of two");
+#endif
+
+#if defined(INPUT_CAPTURE_PROFILE) && !defined(KINETISK)
+#error "INPUT_CAPTURE_PROFILE needs the DWT cycle counter"
+#endif
+
+#ifdef INPUT_CAPTURE_PROFILE
+/**
+ * Histogram of ISR cycle counts, in buckets of (1 << shift) cycles.
+ * Anything past the last bucket is counted in it.
+ */
+struct InputCaptureHistogram
+{
+	static const unsigned buckets = 32;
+
+	InputCaptureHistogram(unsigned shift) : shift(shift) {}
+
+	void add(uint32_t cycles)
+	{
+		unsigned i = cycles >> shift;
+		count[i < buckets ? i : buckets - 1]++;
+		if (cycles > max)
+			max = cycles;
+		samples++;
+	}
+
+	void reset();
+
+	const unsigned shift;
+	volatile uint32_t count[buckets];
+	volatile uint32_t max;
+	volatile uint32_t samples;
+};
+#endif
+
+/**
+ * One captured edge.  id is the one given to begin() for the channel
+ * that captured it.  when is the low 32 bits of the 64-bit time, which
+ * wraps every 89 seconds at 48 MHz; differences of less than that are
+ * right as they are, and extend() gives the whole time.
+ */
+struct InputCaptureEdge
+{
+	uint32_t when;
+	uint8_t id;
+	uint8_t rising;
+};
 
 struct ftm_channel_struct {
 	volatile uint32_t csc;
 	volatile uint32_t cv;
 };
 
+/**
+ * A pin that a timer module can capture on, with the channel and the
+ * port mux setting that connects them.
+ */
+struct InputCapturePin
+{
+	uint8_t pin;
+	uint8_t channel;
+	uint8_t mux;
+};
+
+/**
+ * The registers, interrupt and pins of each timer module, so that its
+ * ISR and setup are compiled for it.  The channels of all of them are
+ * numbered one after the other in the list of inputs, from first.
+ */
+template <unsigned N> struct InputCaptureTimer;
+
+#define INPUT_CAPTURE_TIMER_REGISTERS(n) \
+	static volatile uint32_t & sc() { return FTM##n##_SC; } \
+	static volatile uint32_t & cnt() { return FTM##n##_CNT; } \
+	static volatile uint32_t & mod() { return FTM##n##_MOD; } \
+	static uint32_t status() { return FTM##n##_STATUS; } \
+	static struct ftm_channel_struct * channel(unsigned c) \
+	{ \
+		return (struct ftm_channel_struct *) &FTM##n##_C0SC + c; \
+	}
+
+#if defined(KINETISK)
+#define INPUT_CAPTURE_TIMER_CONFIG(n) \
+	static volatile uint32_t & mode() { return FTM##n##_MODE; } \
+	static volatile uint32_t & conf() { return FTM##n##_CONF; }
+#else
+#define INPUT_CAPTURE_TIMER_CONFIG(n)
+#endif
+
+template <> struct InputCaptureTimer<0>
+{
+#if defined(KINETISK)
+	static const unsigned channels = 8;
+#else
+	static const unsigned channels = 6;
+#endif
+	static const unsigned first = 0;
+	static const IRQ_NUMBER_t irq = IRQ_FTM0;
+#ifdef INPUT_CAPTURE_DMA
+	static const uint8_t dma_source = DMAMUX_SOURCE_FTM0_CH0;
+#endif
+
+	static constexpr InputCapturePin pins[] = {
+		{ 22, 0, 4 },
+		{ 23, 1, 4 },
+		{  9, 2, 4 },
+		{ 10, 3, 4 },
+		{  6, 4, 4 },
+		{ 20, 5, 4 },
+#if defined(KINETISK)
+		{ 21, 6, 4 },
+		{  5, 7, 4 },
+#endif
+	};
+
+	INPUT_CAPTURE_TIMER_REGISTERS(0)
+	INPUT_CAPTURE_TIMER_CONFIG(0)
+};
+
+#if INPUT_CAPTURE_TIMERS > 1
+template <> struct InputCaptureTimer<1>
+{
+	static const unsigned channels = 2;
+	static const unsigned first = InputCaptureTimer<0>::channels;
+	static const IRQ_NUMBER_t irq = IRQ_FTM1;
+#ifdef INPUT_CAPTURE_DMA
+	static const uint8_t dma_source = DMAMUX_SOURCE_FTM1_CH0;
+#endif
+
+	static constexpr InputCapturePin pins[] = {
+		{  3, 0, 3 },
+		{  4, 1, 3 },
+	};
+
+	INPUT_CAPTURE_TIMER_REGISTERS(1)
+	INPUT_CAPTURE_TIMER_CONFIG(1)
+};
+#endif
+
+#if INPUT_CAPTURE_TIMERS > 2
+template <> struct InputCaptureTimer<2>
+{
+	static const unsigned channels = 2;
+	static const unsigned first = InputCaptureTimer<1>::first + InputCaptureTimer<1>::channels;
+	static const IRQ_NUMBER_t irq = IRQ_FTM2;
+#ifdef INPUT_CAPTURE_DMA
+	static const uint8_t dma_source = DMAMUX_SOURCE_FTM2_CH0;
+#endif
+
+	static constexpr InputCapturePin pins[] = {
+#if INPUT_CAPTURE_TIMERS > 3
+		{ 29, 0, 3 },
+		{ 30, 1, 3 },
+#else
+		{ 32, 0, 3 },
+		{ 25, 1, 3 },
+#endif
+	};
+
+	INPUT_CAPTURE_TIMER_REGISTERS(2)
+	INPUT_CAPTURE_TIMER_CONFIG(2)
+};
+#endif
+
+#if INPUT_CAPTURE_TIMERS > 3
+template <> struct InputCaptureTimer<3>
+{
+	static const unsigned channels = 8;
+	static const unsigned first = InputCaptureTimer<2>::first + InputCaptureTimer<2>::channels;
+	static const IRQ_NUMBER_t irq = IRQ_FTM3;
+#ifdef INPUT_CAPTURE_DMA
+	static const uint8_t dma_source = DMAMUX_SOURCE_FTM3_CH0;
+#endif
+
+	static constexpr InputCapturePin pins[] = {
+		{  2, 0, 4 },
+		{ 14, 1, 4 },
+		{  7, 2, 4 },
+		{  8, 3, 4 },
+		{ 35, 4, 3 },
+		{ 36, 5, 3 },
+		{ 37, 6, 3 },
+		{ 38, 7, 3 },
+	};
+
+	INPUT_CAPTURE_TIMER_REGISTERS(3)
+	INPUT_CAPTURE_TIMER_CONFIG(3)
+};
+#endif
+
+// Every channel of every timer module
+#define INPUT_CAPTURE_INPUTS \
+	(InputCaptureTimer<INPUT_CAPTURE_TIMERS - 1>::first \
+	+ InputCaptureTimer<INPUT_CAPTURE_TIMERS - 1>::channels)
+
+#ifdef INPUT_CAPTURE_DMA
+/**
+ * How many edges each input's DMA had written when the overflow
+ * interrupt ran, and the counter then.
+ */
+struct InputCaptureMark
+{
+	uint32_t written[INPUT_CAPTURE_INPUTS];
+	uint16_t cnt;
+};
+#endif
+
 class InputCapture
 {
 public:
 	InputCapture();
 
-	// rxPin can be 5,6,9,10,20,21,22,23
-	// can polarity be both?
-	bool begin(uint8_t rxPin, int polarity=FALLING);
+	// rxPin can be 5,6,9,10,20,21,22,23 on FTM0, 3,4 on FTM1, and
+	// 25,32 (or 29,30 on the 3.5 and 3.6) on FTM2, and 2,7,8,14 and
+	// 35-38 on FTM3, as the board has them.  The timer modules all
+	// count from the same start, so bringing up one that isn't yet
+	// restarts the time; begin every input before using any.
+	// polarity is RISING, FALLING or CHANGE for both edges on the one
+	// channel: the ISR flips the edge select after each edge, starting
+	// with a falling one, and tags the edge with the one that captured
+	// it.  An edge that comes before the ISR has flipped is missed, so
+	// a pulse shorter than the interrupt latency shows as two edges
+	// the same way, never as a wrong one.  CHANGE needs the interrupt,
+	// so not with INPUT_CAPTURE_DMA.
+	bool begin(uint8_t rxPin, int polarity=FALLING, uint8_t id=0);
+
+	// Edges from all of the channels, in the order that they were
+	// captured.  Returns 0 if there are none, 1 for an edge, -1 for an
+	// edge when some before it were overwritten by the ISR (or the DMA)
+	// before they could be read, so any pairing of edges should start
+	// over.  With inputs on more than one timer module, an edge is
+	// held back until the ISR of every module has run since it, which
+	// a quiet one does on its next overflow, up to 1.37 ms at 48 MHz.
+	static int read(InputCaptureEdge * edge);
+
+	// Up to max edges at once, as read() would give them.  Returns
+	// how many, or minus that if some were lost before the first; a
+	// batch ends before an edge that comes after a loss, so that it
+	// starts the next one.
+	static int read_batch(InputCaptureEdge * edges, unsigned max);
+
+	// Total edges overwritten before they were read
+	static uint32_t lost;
+
+	// The current time in timer ticks, from the overflow count and
+	// the counter.  It counts up from begin() for 68 days at 48 MHz.
+	static uint64_t now();
 
-	// 0 == no data, 1 == data, -1 == data, but lost samples
-	int read(uint32_t * val);
+	// The whole time of an edge or anything else timestamped in the
+	// last 89 seconds, from its low 32 bits.  The ISR only keeps the
+	// overflow count, so this costs it nothing.
+	static uint64_t extend(uint32_t when);
 
 	friend void ftm0_isr(void);
+	friend void ftm1_isr(void);
+	friend void ftm2_isr(void);
+	friend void ftm3_isr(void);
+
+#ifdef INPUT_CAPTURE_PROFILE
+	// Edge to ISR entry, from the captured counter value.  There is
+	// no edge interrupt with INPUT_CAPTURE_DMA, so it stays empty.
+	static InputCaptureHistogram latency;
+
+	// ISR entry to exit, from the DWT cycle counter
+	static InputCaptureHistogram duration;
+
+	static void profile_reset();
+#endif
 
 private:
-	void isr(void);
 	struct ftm_channel_struct *ftm;
+	uint8_t id;
+	uint8_t timer;
+	uint8_t slot;
+	uint8_t cscEdge;
 
-	uint32_t samples[SAMPLE_COUNT];
-	volatile uint32_t write_index;
-	uint32_t read_index;
+	// the edge select bits that flip after every edge with CHANGE
+	uint8_t cscFlip;
 
-	uint8_t cscEdge;
+	// find the timer module and channel for the pin, from N up
+	template <unsigned N> bool attach(uint8_t pin, uint8_t * mux);
 
-	// track which channels we have installed
-	static uint16_t overflow_count;
-	static volatile uint8_t channelmask;
-	static bool overflow_inc;
-	static InputCapture *list[8];
-};
+	// set the timer modules to count together and start them
+	static void restart(uint8_t timers);
+	template <unsigned N> static void setup(uint8_t timers);
+
+	// start capturing on the channel
+	void arm();
+
+	// drop everything buffered, when the time starts again
+	static void flush();
+
+	// read(), or with more not an edge that has to return -1
+	static int take(InputCaptureEdge * edge, bool more);
+
+#ifdef INPUT_CAPTURE_DMA
+	DMAChannel dma;
+
+	// the next slot that the DMA will write
+	unsigned position();
 
+	// the DMA request of the channel
+	uint8_t request;
+
+	// Written by the DMA; each is aligned to its size so that the
+	// DMA can wrap it.
+	static volatile uint16_t buffers[INPUT_CAPTURE_INPUTS][DMA_SAMPLE_COUNT];
+
+	// Written by the overflow interrupt, one for each overflow.  An
+	// edge happened before the first mark that counts it as written,
+	// which with the low 16 bits gives the whole time.
+	static InputCaptureMark marks[DMA_MARK_COUNT];
+	static void mark(uint32_t count);
+
+	// The reader's side.  Edges are taken in order from the channels
+	// up to what had been written at the last snapshot, which is
+	// before anything written since.
+	static uint32_t read_count[INPUT_CAPTURE_INPUTS];
+	static uint32_t avail[INPUT_CAPTURE_INPUTS];
+	static uint32_t segment[INPUT_CAPTURE_INPUTS];
+	static uint64_t head[INPUT_CAPTURE_INPUTS];
+	static uint32_t head_ready;
+	static uint64_t bound;
+	static uint32_t bound_overflow;
+	static uint64_t cut;
+	static bool lost_edges;
+
+	static bool snapshot();
+	static void lose(unsigned c, uint32_t r);
+	static uint64_t head_time(unsigned c);
+#else
+	void isr(InputCaptureEdge * edge, uint32_t count, bool overflowed);
+	template <unsigned N> static void timer_isr();
+
+	// One ring for each timer module.  Single producer (its ISR),
+	// single consumer (read).  The ISR never waits for the reader
+	// and overwrites the oldest edge when the ring is full; the
+	// reader checks write_index again after copying to detect that
+	// it was lapped, so neither side needs to disable interrupts.
+	static InputCaptureEdge edges[INPUT_CAPTURE_TIMERS][SAMPLE_COUNT];
+	static volatile uint32_t write_index[INPUT_CAPTURE_TIMERS];
+	static uint32_t read_index[INPUT_CAPTURE_TIMERS];
+
+	// The reader merges the rings by time.  When one has been
+	// lapped, the edges in the others from before its oldest one go
+	// as well, so that -1 comes after everything that was lost.
+	// Each ISR sets its module's horizon to the time it was entered;
+	// no edge from before then can be published by it later.
+	static volatile uint32_t horizon[INPUT_CAPTURE_TIMERS];
+	static uint32_t cut;
+	static bool lost_edges;
+
+	static bool peek(unsigned timer, InputCaptureEdge * edge);
+#endif
+
+	// track which inputs we have installed, and which timer modules
+	// are counting.  The overflow counts are the top 32 bits of each
+	// one's 48-bit time; they all start together, and FTM0's is the
+	// one for now() and extend(), and the only one that the DMA
+	// backend keeps.
+	static volatile uint32_t overflow_count[INPUT_CAPTURE_TIMERS];
+	static volatile uint32_t inputmask;
+	static uint8_t timers;
+	static InputCapture *list[INPUT_CAPTURE_INPUTS];
+
+#ifdef INPUT_CAPTURE_PROFILE
+	// the timer's CNT when the ISR was entered
+	static uint16_t entry_count;
+#endif
+};
 
+#endif
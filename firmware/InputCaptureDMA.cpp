@@ -0,0 +1,332 @@
+/** \file
+ * DMA backend for InputCapture, built with INPUT_CAPTURE_DMA.
+ *
+ * Each input's channel has its DMA request enabled instead of its
+ * interrupt, so a capture makes the eDMA copy the 16-bit CnV into that
+ * input's circular buffer and clear CHF, with no CPU involved.  The
+ * only interrupt left is FTM0's counter overflow, every 1.37 ms, which
+ * notes how far each buffer had been written when it ran; the other
+ * timer modules count along with FTM0, so it stands for them too.
+ *
+ * The high bits of the time are put back by the reader.  An edge that
+ * the DMA had written before an overflow mark happened no later than
+ * the mark, and after the one before, so its time is the latest one
+ * with its low 16 bits that isn't after the mark.  That can only be
+ * wrong for an edge captured in the few cycles while the ISR of the
+ * previous overflow was reading the buffer positions, or between the
+ * two overflows' reads of CNT if their latencies differ, rather than
+ * the 0xE000 guess that the ISR backend makes.
+ *
+ * The edges of the different channels are merged in time order by
+ * the reader, up to what had been written when it last looked, so the
+ * edges that come out of read() are the same as the ISR backend's.
+ * It needs a DMA channel for each input and DMA_SAMPLE_COUNT slots per
+ * channel, and loop() has to read at least every DMA_MARK_COUNT
+ * overflow periods (44 ms by default) or the edges are counted lost.
+ */
+#ifdef INPUT_CAPTURE_DMA
+
+#include <Arduino.h>
+#include "InputCapture.h"
+
+// Keep the mark from being published before it is written
+#define RING_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+
+volatile uint16_t InputCapture::buffers[INPUT_CAPTURE_INPUTS][DMA_SAMPLE_COUNT]
+	__attribute__((aligned(DMA_SAMPLE_COUNT * 2)));
+
+InputCaptureMark InputCapture::marks[DMA_MARK_COUNT];
+
+uint32_t InputCapture::read_count[INPUT_CAPTURE_INPUTS];
+uint32_t InputCapture::avail[INPUT_CAPTURE_INPUTS];
+uint32_t InputCapture::segment[INPUT_CAPTURE_INPUTS];
+uint64_t InputCapture::head[INPUT_CAPTURE_INPUTS];
+uint32_t InputCapture::head_ready;
+uint64_t InputCapture::bound;
+uint32_t InputCapture::bound_overflow;
+uint64_t InputCapture::cut;
+bool InputCapture::lost_edges;
+
+
+/**
+ * Interrupt for the flexible timer module 0, which with the channels
+ * on DMA is only the counter overflow.
+ */
+void ftm0_isr(void)
+{
+#ifdef INPUT_CAPTURE_PROFILE
+	const uint32_t start = ARM_DWT_CYCCNT;
+#endif
+
+	if (FTM0_SC & 0x80) {
+		FTM0_SC = FTM_SC_VALUE;
+
+		const uint32_t count = InputCapture::overflow_count[0] + 1;
+		InputCapture::mark(count);
+		RING_BARRIER();
+		InputCapture::overflow_count[0] = count;
+	}
+
+#ifdef INPUT_CAPTURE_PROFILE
+	InputCapture::duration.add(ARM_DWT_CYCCNT - start);
+#endif
+}
+
+
+unsigned InputCapture::position()
+{
+	const volatile uint16_t * const p = (const volatile uint16_t *) this->dma.destinationAddress();
+	return p - buffers[this->slot];
+}
+
+
+/*
+ * The count of edges written only ever goes up by less than a buffer
+ * between marks, so it follows from the position in the buffer.
+ */
+void InputCapture::mark(uint32_t count)
+{
+	const InputCaptureMark & prev = marks[(count - 1) & DMA_MARK_MASK];
+	InputCaptureMark & m = marks[count & DMA_MARK_MASK];
+
+	uint32_t pending = inputmask;
+	while (pending)
+	{
+		const unsigned c = __builtin_ctz(pending);
+		pending &= pending - 1;
+
+		const uint32_t w = prev.written[c];
+		m.written[c] = w + ((list[c]->position() - w) & DMA_SAMPLE_MASK);
+	}
+
+	// after the positions, so that every edge they count was
+	// captured no later than this
+	m.cnt = FTM0_CNT;
+}
+
+
+void InputCapture::arm()
+{
+	const unsigned c = this->slot;
+	read_count[c] = avail[c] = 0;
+	segment[c] = overflow_count[0] + 1;
+	head_ready &= ~(1u << c);
+
+	// the low half of CnV, which is all that the counter fills
+	volatile const uint16_t * const cv = (volatile const uint16_t *) &this->ftm->cv;
+	this->dma.source(*cv);
+	this->dma.destinationCircular(buffers[c], sizeof(buffers[c]));
+	this->dma.triggerAtHardwareEvent(this->request);
+	this->dma.enable();
+
+	// input capture on the desired edge, with a DMA request for
+	// each one instead of an interrupt
+	this->ftm->csc = this->cscEdge | FTM_CSC_DMA;
+}
+
+
+void InputCapture::flush()
+{
+	memset(marks, 0, sizeof(marks));
+	head_ready = 0;
+	cut = 0;
+	lost_edges = false;
+}
+
+
+/*
+ * How far each channel has been written, and the time, all together.
+ * Returns true if there is anything new to read.
+ */
+bool InputCapture::snapshot()
+{
+	unsigned pos[INPUT_CAPTURE_INPUTS];
+
+	// the positions first, so that the time bounds every edge in them
+	__disable_irq();
+	uint32_t pending = inputmask;
+	while (pending)
+	{
+		const unsigned c = __builtin_ctz(pending);
+		pending &= pending - 1;
+		pos[c] = list[c]->position();
+	}
+
+	const uint32_t count = overflow_count[0];
+	const uint32_t cnt = FTM0_CNT;
+	const bool wrapped = (FTM0_SC & 0x80) && cnt < 0x8000;
+	__enable_irq();
+
+	bound = ((uint64_t) (count + wrapped) << 16) | cnt;
+	bound_overflow = count;
+
+	// the oldest mark that the ISR won't overwrite while we read
+	const uint32_t oldest = count - DMA_MARK_COUNT + 2;
+	const InputCaptureMark & m = marks[count & DMA_MARK_MASK];
+	bool any = false;
+
+	pending = inputmask;
+	while (pending)
+	{
+		const unsigned c = __builtin_ctz(pending);
+		pending &= pending - 1;
+
+		const uint32_t w = m.written[c];
+		avail[c] = w + ((pos[c] - w) & DMA_SAMPLE_MASK);
+
+		uint32_t r = read_count[c];
+
+		// the DMA has lapped the reader; everything before the
+		// oldest edge that is left goes
+		if (avail[c] - r > DMA_SAMPLE_COUNT)
+		{
+			r = avail[c] - DMA_SAMPLE_COUNT;
+			lose(c, r);
+			const uint64_t t = head_time(c);
+			if (t > cut)
+				cut = t;
+		}
+
+		// or the reader is so far behind that the marks for the
+		// edges have been overwritten, so everything before the
+		// oldest mark goes
+		if ((int32_t) (segment[c] - oldest) < 0)
+		{
+			const InputCaptureMark & o = marks[oldest & DMA_MARK_MASK];
+			segment[c] = oldest + 1;
+
+			if ((int32_t) (o.written[c] - r) > 0)
+			{
+				lose(c, r = o.written[c]);
+				const uint64_t t = ((uint64_t) oldest << 16) | o.cnt;
+				if (t > cut)
+					cut = t;
+			}
+		}
+
+		any |= r != avail[c];
+	}
+
+	return any;
+}
+
+
+/*
+ * Drop a channel's edges up to r.  The ones on the other channels from
+ * before the first one left are dropped as well once the cut is set,
+ * so that what is lost is a stretch of time, as with the ISR's ring,
+ * and the -1 goes on the first edge after it.
+ */
+void InputCapture::lose(unsigned c, uint32_t r)
+{
+	lost += r - read_count[c];
+	lost_edges = true;
+	read_count[c] = r;
+	head_ready &= ~(1u << c);
+}
+
+
+/*
+ * The whole time of the next edge on a channel, from the first mark
+ * that counts it as written, or the snapshot if none does yet.
+ */
+uint64_t InputCapture::head_time(unsigned c)
+{
+	const uint32_t r = read_count[c];
+
+	while ((int32_t) (bound_overflow - segment[c]) >= 0
+	&& (int32_t) (marks[segment[c] & DMA_MARK_MASK].written[c] - r) <= 0)
+		segment[c]++;
+
+	uint64_t limit = bound;
+	if ((int32_t) (bound_overflow - segment[c]) >= 0)
+		limit = ((uint64_t) segment[c] << 16) | marks[segment[c] & DMA_MARK_MASK].cnt;
+
+	const uint16_t val = buffers[c][r & DMA_SAMPLE_MASK];
+	uint64_t t = (limit & ~(uint64_t) 0xFFFF) | val;
+	if (t > limit)
+		t -= 0x10000;
+
+	return t;
+}
+
+
+// 0 == no data, 1 == data, -1 == lost data
+int InputCapture::take(InputCaptureEdge * edge, bool more)
+{
+	while (1)
+	{
+		// the channel with the earliest edge
+		int best = -1;
+		uint64_t best_time = 0;
+
+		uint32_t pending = inputmask;
+		while (pending)
+		{
+			const unsigned c = __builtin_ctz(pending);
+			pending &= pending - 1;
+
+			if (read_count[c] == avail[c])
+				continue;
+
+			if ((head_ready & (1u << c)) == 0)
+			{
+				head[c] = head_time(c);
+				head_ready |= 1u << c;
+			}
+
+			if (best < 0 || head[c] < best_time)
+			{
+				best = c;
+				best_time = head[c];
+			}
+		}
+
+		// everything up to the last snapshot has been read
+		if (best < 0)
+		{
+			if (!snapshot())
+				return 0;
+			continue;
+		}
+
+		const unsigned c = best;
+		InputCapture * const ic = list[c];
+		const uint32_t r = read_count[c];
+
+		// if the DMA has come round to the slot since the snapshot
+		// then the value read from it might not be this edge, so
+		// look again
+		const uint32_t written = avail[c] + ((ic->position() - avail[c]) & DMA_SAMPLE_MASK);
+		if (written - r > DMA_SAMPLE_COUNT)
+		{
+			snapshot();
+			continue;
+		}
+
+		if (more && lost_edges)
+			return 0;
+
+		read_count[c] = r + 1;
+		head_ready &= ~(1u << c);
+
+		// from before some that were lost
+		if (best_time < cut)
+		{
+			lost++;
+			lost_edges = true;
+			continue;
+		}
+
+		edge->when = best_time;
+		edge->id = ic->id;
+		edge->rising = ic->cscEdge == 0b01000100;
+
+		const int rc = lost_edges ? -1 : 1;
+		lost_edges = false;
+		return rc;
+	}
+}
+
+#endif
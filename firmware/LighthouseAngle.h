@@ -0,0 +1,165 @@
+/** \file
+ * Sweep angles, as floats or as fixed point binary angles.
+ *
+ * Normally the angles are single precision radians.  Building with
+ * LIGHTHOUSE_FIXED_POINT defined carries them as 32-bit binary angles
+ * instead, where the whole int32_t range is one turn of the rotor
+ * (so it is a Q31 fraction of pi radians), from sweep_pulse() through
+ * the rays and the triangulation in LighthouseXYZ.  That needs no
+ * floating point at all in the hot path, for parts without an FPU like
+ * the Teensy LC.
+ *
+ * lh_sincos_q30() is the fixed point sin/cos; the results are Q30 so
+ * that 1.0 can be represented.  host/bench_fixed measures the error of
+ * the fixed point path against the float one.
+ */
+#ifndef _LighthouseAngle_h_
+#define _LighthouseAngle_h_
+
+#include <stdint.h>
+#include "InputCapture.h"
+#include "LighthouseMath.h"
+
+// binary angle units per timer tick, scaled by 2^16; half a turn of
+// the rotor is 8333 usec
+#define LH_ANGLE_PER_TICK \
+	((uint32_t) (((1ULL << 47) + 8333ULL * CLOCKS_PER_MICROSECOND / 2) \
+		/ (8333ULL * CLOCKS_PER_MICROSECOND)))
+
+// pi in Q29, since it doesn't fit in Q30
+#define LH_PI_Q29 1686629713
+
+
+static LH_INLINE int32_t
+lh_mul30(
+	int32_t a,
+	int32_t b
+)
+{
+	return (int32_t) (((int64_t) a * b + (1 << 29)) >> 30);
+}
+
+
+/**
+ * Binary angle from a tick count relative to the middle of the sweep.
+ */
+static LH_INLINE int32_t
+lh_fixed_from_ticks(
+	int32_t ticks
+)
+{
+	return (int32_t) (((int64_t) ticks * LH_ANGLE_PER_TICK + (1 << 15)) >> 16);
+}
+
+
+static LH_INLINE float
+lh_fixed_radians(
+	int32_t a
+)
+{
+	return a * (float) (M_PI / 2147483648.0);
+}
+
+
+static LH_INLINE int32_t
+lh_fixed_from_radians(
+	float x
+)
+{
+	return (int32_t) lrintf(x * (float) (2147483648.0 / M_PI));
+}
+
+
+/**
+ * Compute sin and cos of a binary angle in Q30.
+ *
+ * The same quadrant reduction as lh_sincosf(), but exact since a
+ * quarter turn is 2^30, then Taylor series on [-pi/4, pi/4] that are
+ * long enough to be within a couple of Q30 ulp.
+ */
+static LH_INLINE void
+lh_sincos_q30(
+	int32_t a,
+	int32_t * s,
+	int32_t * c
+)
+{
+	const uint32_t k = ((uint32_t) a + (1u << 29)) >> 30;
+	const int32_t r = (int32_t) ((uint32_t) a - (k << 30));
+
+	// to radians in Q30, r pi / 2^31
+	const int32_t x = (int32_t) (((int64_t) r * LH_PI_Q29) >> 30);
+	const int32_t x2 = lh_mul30(x, x);
+
+	// 1/3!, 1/5!, ... and 1/2!, 1/4!, ... in Q30
+	int32_t sr = 2959;
+	sr = 1073741824 / 5040 - lh_mul30(x2, sr);
+	sr = 1073741824 / 120 - lh_mul30(x2, sr);
+	sr = 1073741824 / 6 - lh_mul30(x2, sr);
+	sr = x - lh_mul30(lh_mul30(x, x2), sr);
+
+	int32_t cr = 296;
+	cr = 1073741824 / 40320 - lh_mul30(x2, cr);
+	cr = 1073741824 / 720 - lh_mul30(x2, cr);
+	cr = 1073741824 / 24 - lh_mul30(x2, cr);
+	cr = 1073741824 / 2 - lh_mul30(x2, cr);
+	cr = 1073741824 - lh_mul30(x2, cr);
+
+	switch (k & 3)
+	{
+	case 0: *s =  sr; *c =  cr; break;
+	case 1: *s =  cr; *c = -sr; break;
+	case 2: *s = -sr; *c = -cr; break;
+	default: *s = -cr; *c =  sr; break;
+	}
+}
+
+
+#ifdef LIGHTHOUSE_FIXED_POINT
+
+typedef int32_t lh_angle_t;
+
+static LH_INLINE lh_angle_t
+lh_angle_from_ticks(int32_t ticks)
+{
+	return lh_fixed_from_ticks(ticks);
+}
+
+static LH_INLINE float
+lh_angle_radians(lh_angle_t a)
+{
+	return lh_fixed_radians(a);
+}
+
+static LH_INLINE lh_angle_t
+lh_angle(float radians)
+{
+	return lh_fixed_from_radians(radians);
+}
+
+#else
+
+typedef float lh_angle_t;
+
+// the tick count is exact as a float, so this is a single rounding
+static LH_INLINE lh_angle_t
+lh_angle_from_ticks(int32_t ticks)
+{
+	return ticks * (float) (M_PI / (8333 * CLOCKS_PER_MICROSECOND));
+}
+
+static LH_INLINE float
+lh_angle_radians(lh_angle_t a)
+{
+	return a;
+}
+
+static LH_INLINE lh_angle_t
+lh_angle(float radians)
+{
+	return radians;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,255 @@
+/** \file
+ * Base station calibration records in non-volatile storage.
+ *
+ * The storage is divided into fixed size slots, each holding one
+ * LighthouseStoredStation.  A slot is valid if its magic and CRC32
+ * match; erased or half written slots are treated as empty.
+ */
+#include "LighthouseCalibrationStore.h"
+#include <string.h>
+#include <stddef.h>
+
+
+LighthouseCalibrationStore::LighthouseCalibrationStore()
+{
+	storage = 0;
+	slots = 0;
+	generation = 0;
+
+	for (int lh = 0 ; lh < 2 ; lh++)
+	{
+		calibrated[lh] = 0;
+		station_id[lh] = 0;
+	}
+}
+
+
+static uint32_t record_crc(const LighthouseStoredStation & rec)
+{
+	return LighthouseOOTX::crc32(&rec, offsetof(LighthouseStoredStation, crc));
+}
+
+
+bool LighthouseCalibrationStore::read_slot(
+	unsigned slot,
+	LighthouseStoredStation & rec
+)
+{
+	if (!storage->read(slot * sizeof(rec), &rec, sizeof(rec)))
+		return false;
+
+	return rec.magic == LH_STORE_MAGIC
+		&& rec.length <= LH_STORE_PAYLOAD_MAX
+		&& rec.crc == record_crc(rec);
+}
+
+
+void LighthouseCalibrationStore::begin(
+	LighthouseStorage * storage,
+	const lightsource compiled[2]
+)
+{
+	this->storage = storage;
+	this->compiled[0] = compiled[0];
+	this->compiled[1] = compiled[1];
+	this->slots = storage->size() / sizeof(LighthouseStoredStation);
+	if (this->slots > max_slots)
+		this->slots = max_slots;
+
+	// build an index of the serial numbers so that matching a
+	// partial message does not have to read the storage
+	for (unsigned i = 0 ; i < this->slots ; i++)
+	{
+		LighthouseStoredStation rec;
+		if (!read_slot(i, rec))
+		{
+			ids[i] = 0;
+			continue;
+		}
+
+		ids[i] = rec.id;
+		if (rec.generation > generation)
+			generation = rec.generation;
+	}
+}
+
+
+int LighthouseCalibrationStore::lookup(uint32_t id) const
+{
+	if (id == 0)
+		return -1;
+
+	for (unsigned i = 0 ; i < slots ; i++)
+		if (ids[i] == id)
+			return i;
+
+	return -1;
+}
+
+
+bool LighthouseCalibrationStore::find(
+	uint32_t id,
+	LighthouseStoredStation & rec
+)
+{
+	const int slot = lookup(id);
+	if (slot < 0)
+		return false;
+
+	return read_slot(slot, rec);
+}
+
+
+bool LighthouseCalibrationStore::save(
+	uint32_t id,
+	const uint8_t * payload,
+	unsigned length,
+	const lightsource & pose,
+	const lightsource & compiled
+)
+{
+	if (slots == 0 || id == 0 || length > LH_STORE_PAYLOAD_MAX)
+		return false;
+
+	LighthouseStoredStation rec;
+	int slot = lookup(id);
+
+	// nothing to do if it is already stored
+	if (slot >= 0
+	&&  read_slot(slot, rec)
+	&&  rec.length == length
+	&&  memcmp(rec.payload, payload, length) == 0
+	&&  memcmp(&rec.pose, &pose, sizeof(pose)) == 0
+	&&  memcmp(&rec.compiled, &compiled, sizeof(compiled)) == 0)
+		return false;
+
+	if (slot < 0)
+	{
+		// use an empty slot, otherwise replace the oldest
+		uint16_t oldest = 0xFFFF;
+		for (unsigned i = 0 ; i < slots ; i++)
+		{
+			if (ids[i] == 0)
+			{
+				slot = i;
+				break;
+			}
+
+			LighthouseStoredStation old;
+			if (read_slot(i, old) && old.generation < oldest)
+			{
+				oldest = old.generation;
+				slot = i;
+			}
+		}
+
+		if (slot < 0)
+			return false;
+	}
+
+	memset(&rec, 0, sizeof(rec));
+	rec.magic = LH_STORE_MAGIC;
+	rec.id = id;
+	rec.generation = ++generation;
+	rec.length = length;
+	memcpy(rec.payload, payload, length);
+	rec.pose = pose;
+	rec.compiled = compiled;
+	rec.crc = record_crc(rec);
+
+	if (!storage->write(slot * sizeof(rec), &rec, sizeof(rec)))
+		return false;
+
+	ids[slot] = id;
+	return true;
+}
+
+
+/*
+ * The pose to use for a stored base station that is now lighthouse lh:
+ * the stored one, unless the firmware has been rebuilt with another
+ * pose for lh since, which is then newer than anything stored.
+ */
+const lightsource & LighthouseCalibrationStore::stored_pose(
+	unsigned lh,
+	const LighthouseStoredStation & rec
+) const
+{
+	if (memcmp(&rec.compiled, &compiled[lh], sizeof(rec.compiled)) != 0)
+		return compiled[lh];
+
+	return rec.pose;
+}
+
+
+int LighthouseCalibrationStore::update(
+	unsigned lh,
+	const LighthouseOOTX & ootx,
+	lightsource & pose
+)
+{
+	if (lh >= 2 || storage == 0)
+		return NONE;
+
+	if (ootx.complete && ootx.have_calibration)
+	{
+		const uint32_t id = ootx.calibration.id;
+
+		// if this is not who we thought it was, use the pose
+		// that we have stored for it
+		if (!calibrated[lh] || station_id[lh] != id)
+		{
+			LighthouseStoredStation rec;
+			if (find(id, rec))
+				pose = stored_pose(lh, rec);
+		}
+
+		calibrated[lh] = 1;
+		station_id[lh] = id;
+		calibration[lh] = ootx.calibration;
+
+		if (save(id, ootx.bytes, ootx.length, pose, compiled[lh]))
+			return SAVED;
+
+		return CONFIRMED;
+	}
+
+	if (calibrated[lh])
+		return NONE;
+
+	// see if the message that is still arriving is from
+	// a base station that we already know
+	uint32_t id;
+	if (!ootx.peek_id(&id))
+		return NONE;
+
+	LighthouseStoredStation rec;
+	if (!find(id, rec))
+		return NONE;
+
+	if (!LighthouseOOTX::parse(rec.payload, rec.length, calibration[lh]))
+		return NONE;
+
+	pose = stored_pose(lh, rec);
+	calibrated[lh] = 1;
+	station_id[lh] = id;
+
+	return LOADED;
+}
+
+
+bool LighthouseCalibrationStore::save_pose(
+	unsigned lh,
+	const lightsource & pose
+)
+{
+	if (lh >= 2 || !calibrated[lh])
+		return false;
+
+	LighthouseStoredStation rec;
+	if (!find(station_id[lh], rec))
+		return false;
+
+	save(rec.id, rec.payload, rec.length, pose, compiled[lh]);
+	return true;
+}
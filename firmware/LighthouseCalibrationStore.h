@@ -0,0 +1,105 @@
+/** \file
+ * Remember base station calibration across power cycles.
+ *
+ * A full OOTX message arrives one bit per sync pulse, so it takes a
+ * long time after power up before the calibration is known.  Each CRC
+ * checked info block is stored along with the pose of the base station
+ * that sent it, keyed by its serial number.  After a reboot, as soon
+ * as the serial number in the message that is still being received
+ * matches a stored one (the first few words), that base station's
+ * calibration and pose are restored without waiting for the rest.
+ * When the full message arrives the record is rewritten if anything
+ * has changed.
+ *
+ * The record also keeps the compiled in pose (LighthousePoses.h) that
+ * was in use when it was written.  If the firmware has since been built
+ * with a different one, say from a new solve_lighthouse run, the new
+ * compiled pose wins and replaces the stored one; otherwise the stored
+ * pose is used, so one loaded at run time and saved with save_pose()
+ * (the 'l' command in firmware.ino) survives a reboot.
+ */
+#ifndef _LighthouseCalibrationStore_h_
+#define _LighthouseCalibrationStore_h_
+
+#include <stdint.h>
+#include "LighthouseOOTX.h"
+#include "LighthouseXYZ.h"
+#include "LighthouseStorage.h"
+
+#define LH_STORE_MAGIC		0x3243484C // "LHC2"
+#define LH_STORE_PAYLOAD_MAX	36
+
+struct LighthouseStoredStation
+{
+	uint32_t magic;
+	uint32_t id;
+	uint16_t generation;	// higher is newer, to pick one to replace
+	uint8_t length;		// of the OOTX payload
+	uint8_t reserved;
+	uint8_t payload[LH_STORE_PAYLOAD_MAX];
+	lightsource pose;
+	lightsource compiled;	// LighthousePoses.h when it was stored
+	uint32_t crc;		// CRC32 of everything above
+};
+
+
+class LighthouseCalibrationStore
+{
+public:
+	LighthouseCalibrationStore();
+
+	static const unsigned max_slots = 20;
+
+	enum {
+		NONE = 0,
+		LOADED,		// calibration and pose restored from storage
+		SAVED,		// a new or changed message was stored
+		CONFIRMED,	// a complete message matched what was stored
+	};
+
+	// compiled are the poses that the firmware was built with, which
+	// are copied so that the caller can go on to replace its own
+	void begin(LighthouseStorage * storage, const lightsource compiled[2]);
+
+	// Call with the OOTX decoder for lighthouse lh whenever it has
+	// received new bits.  pose is replaced with the stored one when
+	// the base station is recognized, unless the compiled pose for lh
+	// has changed since it was stored.  Returns one of the above.
+	int update(unsigned lh, const LighthouseOOTX & ootx, lightsource & pose);
+
+	// Store a new pose for whichever base station is lighthouse lh.
+	// Fails if it has not been identified and stored yet.
+	bool save_pose(unsigned lh, const lightsource & pose);
+
+	bool find(uint32_t id, LighthouseStoredStation & rec);
+
+	// Returns true if storage was written, false if the record was
+	// already there or could not be stored.
+	bool save(
+		uint32_t id,
+		const uint8_t * payload,
+		unsigned length,
+		const lightsource & pose,
+		const lightsource & compiled
+	);
+
+	// What we know about each of the two lighthouses
+	bool calibrated[2];
+	uint32_t station_id[2];
+	LighthouseCalibration calibration[2];
+
+private:
+	LighthouseStorage * storage;
+	lightsource compiled[2];
+	unsigned slots;
+	uint16_t generation;
+
+	// serial number in each slot, or 0 if it is empty or corrupt
+	uint32_t ids[max_slots];
+
+	bool read_slot(unsigned slot, LighthouseStoredStation & rec);
+	int lookup(uint32_t id) const;
+	const lightsource & stored_pose(unsigned lh, const LighthouseStoredStation & rec) const;
+};
+
+#endif
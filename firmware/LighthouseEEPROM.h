@@ -0,0 +1,44 @@
+/** \file
+ * LighthouseStorage in the Teensy's emulated EEPROM.
+ */
+#ifndef _LighthouseEEPROM_h_
+#define _LighthouseEEPROM_h_
+
+#include <EEPROM.h>
+#include "LighthouseStorage.h"
+
+class LighthouseEEPROM : public LighthouseStorage
+{
+public:
+	unsigned size()
+	{
+		return EEPROM.length();
+	}
+
+	bool read(unsigned addr, void * buf, unsigned len)
+	{
+		if (addr + len > size())
+			return false;
+
+		uint8_t * p = (uint8_t *) buf;
+		for (unsigned i = 0 ; i < len ; i++)
+			p[i] = EEPROM.read(addr + i);
+
+		return true;
+	}
+
+	bool write(unsigned addr, const void * buf, unsigned len)
+	{
+		if (addr + len > size())
+			return false;
+
+		// update() only writes the bytes that have changed
+		const uint8_t * p = (const uint8_t *) buf;
+		for (unsigned i = 0 ; i < len ; i++)
+			EEPROM.update(addr + i, p[i]);
+
+		return true;
+	}
+};
+
+#endif
@@ -0,0 +1,79 @@
+/** \file
+ * Pack capture edges into EDGES telemetry frames.
+ */
+#include "LighthouseEdgeStream.h"
+
+
+void LighthouseEdgeStream::begin(
+	LighthouseTelemetry * telemetry,
+	LighthouseOutput * output
+)
+{
+	this->telemetry = telemetry;
+	this->output = output;
+	this->edges = 0;
+	this->bytes = 0;
+	this->length = 0;
+	this->flags = 0;
+}
+
+
+void LighthouseEdgeStream::add(const InputCaptureEdge & e)
+{
+	if (this->length != 0
+	&& (this->length + max_edge > sizeof(this->payload)
+	||  e.when - this->start > max_span))
+		this->flush();
+
+	if (this->length == 0)
+	{
+		this->start = this->last = e.when;
+		for (int i = 0 ; i < 4 ; i++)
+			this->payload[this->length++] = e.when >> (8 * i);
+	}
+
+	// the queue is in time order, but zigzag costs nothing and
+	// keeps an edge that is out of order from wrapping
+	const int32_t delta = e.when - this->last;
+	const uint32_t zz = ((uint32_t) delta << 1) ^ (uint32_t) (delta >> 31);
+	uint32_t val = zz << 5 | (e.id & 0xF) << 1 | (e.rising ? 1 : 0);
+	this->last = e.when;
+
+	while (val >= 0x80)
+	{
+		this->payload[this->length++] = val | 0x80;
+		val >>= 7;
+	}
+	this->payload[this->length++] = val;
+
+	this->edges++;
+}
+
+
+void LighthouseEdgeStream::lost()
+{
+	this->flush();
+	this->flags |= LH_EDGES_LOST;
+}
+
+
+void LighthouseEdgeStream::poll(uint32_t now)
+{
+	if (this->length != 0 && now - this->start > max_span)
+		this->flush();
+}
+
+
+void LighthouseEdgeStream::flush()
+{
+	if (this->length == 0)
+		return;
+
+	uint8_t buf[LH_FRAME_MAX];
+	const unsigned len = this->telemetry->edges(buf, this->flags, this->payload, this->length);
+	this->output->write(buf, len);
+
+	this->bytes += len;
+	this->length = 0;
+	this->flags = 0;
+}
@@ -0,0 +1,77 @@
+/** \file
+ * Raw edge timestamps for the host, packed small enough to stream.
+ *
+ * For diagnosing problems in the field the host can ask for every edge
+ * that comes out of InputCapture, so that it can be recorded and
+ * decoded again offline (host/lhdecode -e writes it as a trace for
+ * replay).  Each edge is one varint, seven bits per byte with the top
+ * bit set on all but the last, of
+ *
+ *	zigzag(ticks since the previous edge) << 5 | id << 1 | rising
+ *
+ * so the input line and direction tag every edge.  The edges within a
+ * sync flash are a few usec apart and take two bytes; the gap before a
+ * sweep takes three or four.  With the framing that is under two bytes
+ * an edge, about 5.5 KB/s with four sensors.
+ *
+ * The edges are sent in EDGES frames (see LighthouseTelemetry.h), each
+ * starting with the 32-bit time that the first edge's delta is from.
+ * A frame is sent when it is full or its edges span more than
+ * max_span, so the deltas stay well under 32 bits and a frame is not
+ * held back for long while the sensors are seeing the base stations,
+ * and poll() sends it once max_span has passed since its first edge
+ * so that the last edges before the sensors go dark aren't held until
+ * they see something again.
+ * The frame sequence number shows any frames that were lost on the way
+ * to the host and LH_EDGES_LOST any edges that InputCapture lost.
+ */
+#ifndef _LighthouseEdgeStream_h_
+#define _LighthouseEdgeStream_h_
+
+#include <stdint.h>
+#include "InputCapture.h"
+#include "LighthouseTelemetry.h"
+#include "LighthouseOutput.h"
+
+class LighthouseEdgeStream
+{
+public:
+	LighthouseEdgeStream() {}
+
+	void begin(LighthouseTelemetry * telemetry, LighthouseOutput * output);
+
+	// Pack an edge, sending the frame first if it won't fit
+	void add(const InputCaptureEdge & e);
+
+	// InputCapture lost some edges before the next one
+	void lost();
+
+	// Send any edges that are waiting
+	void flush();
+
+	// Send the frame if its first edge was more than max_span before
+	// now, in capture timer ticks; loop() calls this every pass
+	void poll(uint32_t now);
+
+	// edges that have been packed, and the bytes they took
+	uint32_t edges;
+	uint32_t bytes;
+
+	// the longest time that one frame covers
+	static const uint32_t max_span = 20000 * CLOCKS_PER_MICROSECOND;
+
+	// a varint of up to 32 bits is five bytes
+	static const unsigned max_edge = 5;
+
+private:
+	LighthouseTelemetry * telemetry;
+	LighthouseOutput * output;
+
+	uint8_t payload[LH_OOTX_MAX];
+	unsigned length;
+	unsigned flags;
+	uint32_t start;
+	uint32_t last;
+};
+
+#endif
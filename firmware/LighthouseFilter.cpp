@@ -0,0 +1,212 @@
+/** \file
+ * Per-sweep EKF over the position and velocity of one sensor.
+ *
+ * Each measurement is a single scalar angle, so the update needs no
+ * matrix inverse: the innovation variance is a scalar and the gain is
+ * one column of the covariance divided by it.  The measurement only
+ * depends on the position, so H has three non-zero entries.
+ */
+#include "LighthouseFilter.h"
+#include "InputCapture.h"
+#include <math.h>
+
+// innovations outside of this many sigma are rejected
+static const float gate_sigma = 5;
+
+// give up after this many rejected measurements in a row
+static const unsigned max_bad = 8;
+
+
+void
+LighthouseFilter::begin(
+	lightsource * lh1,
+	lightsource * lh2
+)
+{
+	this->lighthouse[0] = lh1;
+	this->lighthouse[1] = lh2;
+
+	// about two timer ticks of jitter, hand held motion
+	this->angle_noise = 1.5e-5f;
+	this->accel_noise = 20.0f;
+	this->max_gap = 0.1f;
+
+	this->running = false;
+	this->rejected = 0;
+}
+
+
+void
+LighthouseFilter::reset(
+	const float pos[3],
+	uint32_t when
+)
+{
+	for (int i = 0 ; i < 3 ; i++)
+	{
+		this->xyz[i] = pos[i];
+		this->vel[i] = 0;
+	}
+
+	for (int i = 0 ; i < 6 ; i++)
+		for (int j = 0 ; j < 6 ; j++)
+			this->P[i][j] = 0;
+
+	// the four angles may have been measured while it was moving,
+	// so allow a couple of cm of error, and we have no idea how fast
+	// it is moving
+	for (int i = 0 ; i < 3 ; i++)
+	{
+		this->P[i][i] = 2e-2f * 2e-2f;
+		this->P[i+3][i+3] = 1.0f;
+	}
+
+	this->when = when;
+	this->bad = 0;
+	this->running = true;
+}
+
+
+/*
+ * Constant velocity: x += v dt, with white acceleration noise q.
+ * The covariance blocks are updated in place:
+ *
+ *	Ppp += dt (Ppv + Pvp) + dt^2 Pvv + q dt^3/3
+ *	Ppv += dt Pvv + q dt^2/2
+ *	Pvv += q dt
+ */
+void
+LighthouseFilter::predict(
+	float dt
+)
+{
+	for (int i = 0 ; i < 3 ; i++)
+		this->xyz[i] += this->vel[i] * dt;
+
+	const float q = this->accel_noise * this->accel_noise;
+	const float dt2 = dt * dt;
+
+	for (int i = 0 ; i < 3 ; i++)
+	{
+		for (int j = 0 ; j < 3 ; j++)
+		{
+			const float pvv = this->P[i+3][j+3];
+			const float ppv = this->P[i][j+3];
+			const float pvp = this->P[i+3][j];
+
+			this->P[i][j] += dt * (ppv + pvp) + dt2 * pvv;
+			this->P[i][j+3] += dt * pvv;
+			this->P[i+3][j] += dt * pvv;
+		}
+
+		this->P[i][i] += q * dt2 * dt / 3;
+		this->P[i][i+3] += q * dt2 / 2;
+		this->P[i+3][i] += q * dt2 / 2;
+		this->P[i+3][i+3] += q * dt;
+	}
+}
+
+
+bool
+LighthouseFilter::update(
+	unsigned ind,
+	float angle,
+	uint32_t when
+)
+{
+	if (!this->running || ind >= 4)
+		return false;
+
+	// sweeps for one sensor arrive in order, but don't go backwards
+	// if they are a few ticks out
+	const int32_t ticks = when - this->when;
+	const float dt = ticks > 0
+		? ticks / (1e6f * CLOCKS_PER_MICROSECOND)
+		: 0;
+
+	if (dt > this->max_gap)
+	{
+		this->running = false;
+		return false;
+	}
+
+	this->predict(dt);
+	if (ticks > 0)
+		this->when = when;
+
+	// position in the lighthouse's frame, P = mat' (xyz - origin)
+	const lightsource * const lh = this->lighthouse[ind / 2];
+	const float * const m = lh->mat;
+	const float dx = this->xyz[0] - lh->origin[0];
+	const float dy = this->xyz[1] - lh->origin[1];
+	const float dz = this->xyz[2] - lh->origin[2];
+	const float p0 = m[0]*dx + m[3]*dy + m[6]*dz;
+	const float p1 = m[1]*dx + m[4]*dy + m[7]*dz;
+	const float p2 = m[2]*dx + m[5]*dy + m[8]*dz;
+
+	if (p2 >= 0)
+		return false;
+
+	// angle 0 is atan2(-p0, -p2), angle 1 is atan2(p1, -p2), and their
+	// derivatives with respect to p0/p1 and p2
+	float predicted, d_lat, d_p2;
+	int lat;
+	if ((ind & 1) == 0)
+	{
+		const float r2 = p0*p0 + p2*p2;
+		predicted = atan2f(-p0, -p2);
+		d_lat = p2 / r2;
+		d_p2 = -p0 / r2;
+		lat = 0;
+	} else {
+		const float r2 = p1*p1 + p2*p2;
+		predicted = atan2f(p1, -p2);
+		d_lat = -p2 / r2;
+		d_p2 = p1 / r2;
+		lat = 1;
+	}
+
+	// chain through P = mat' (xyz - origin)
+	float h[3];
+	for (int j = 0 ; j < 3 ; j++)
+		h[j] = d_lat * m[j*3 + lat] + d_p2 * m[j*3 + 2];
+
+	float pht[6];
+	for (int i = 0 ; i < 6 ; i++)
+		pht[i] = this->P[i][0] * h[0]
+		       + this->P[i][1] * h[1]
+		       + this->P[i][2] * h[2];
+
+	const float s = h[0] * pht[0] + h[1] * pht[1] + h[2] * pht[2]
+		+ this->angle_noise * this->angle_noise;
+	const float y = angle - predicted;
+
+	if (y * y > gate_sigma * gate_sigma * s)
+	{
+		this->rejected++;
+		if (++this->bad > max_bad)
+			this->running = false;
+		return false;
+	}
+
+	this->bad = 0;
+
+	const float inv_s = 1.0f / s;
+	for (int i = 0 ; i < 3 ; i++)
+	{
+		this->xyz[i] += pht[i] * inv_s * y;
+		this->vel[i] += pht[i+3] * inv_s * y;
+	}
+
+	// P -= K H P = P H' H P / s, which is symmetric; only compute the
+	// upper triangle and mirror it so that single precision rounding
+	// can't make it drift.
+	for (int i = 0 ; i < 6 ; i++)
+	{
+		const float k = pht[i] * inv_s;
+		for (int j = i ; j < 6 ; j++)
+			this->P[j][i] = this->P[i][j] -= k * pht[j];
+	}
+
+	return true;
+}
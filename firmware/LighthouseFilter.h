@@ -0,0 +1,66 @@
+/** \file
+ * Track one sensor with an extended Kalman filter.
+ *
+ * LighthouseXYZ needs all four angles before it can triangulate, so
+ * a fix only comes every fourth sweep and mixes angles that were
+ * measured up to 25 ms apart.  This filter keeps the position and
+ * velocity of the sensor and applies each single sweep angle as a
+ * measurement at the time that it was captured, after predicting the
+ * state forward to then with a constant velocity model.  That gives a
+ * motion compensated position after every sweep.
+ *
+ * It is started from a triangulated position, and stops when the
+ * sensor has not been seen for a while or too many measurements in a
+ * row disagree with it, after which it waits for the next one.
+ */
+#ifndef _LighthouseFilter_h_
+#define _LighthouseFilter_h_
+
+#include <stdint.h>
+#include "LighthouseXYZ.h"
+
+class LighthouseFilter
+{
+public:
+	LighthouseFilter() {}
+
+	void begin(lightsource * lh1, lightsource * lh2);
+
+	// Start tracking at a triangulated position, not moving.
+	void reset(const float pos[3], uint32_t when);
+
+	// Apply angle ind (0-1 for lighthouse 0, 2-3 for lighthouse 1)
+	// that was captured at tick when.  Returns true if the position
+	// was updated.
+	bool update(unsigned ind, float angle, uint32_t when);
+
+	bool running;
+
+	// State at time when, meters and meters/second
+	float xyz[3];
+	float vel[3];
+	uint32_t when;
+
+	// Measurements that failed the innovation check
+	unsigned long rejected;
+
+	// Tuning: the 1 sigma angle measurement noise in radians, the
+	// white acceleration noise in meters/second^2 and the longest
+	// gap in seconds before tracking is abandoned.
+	float angle_noise;
+	float accel_noise;
+	float max_gap;
+
+private:
+	lightsource * lighthouse[2];
+
+	// covariance of the position (0-2) and velocity (3-5)
+	float P[6][6];
+
+	// consecutive rejected measurements
+	unsigned bad;
+
+	void predict(float dt);
+};
+
+#endif
@@ -0,0 +1,155 @@
+/** \file
+ * Fixed point rays and triangulation for LIGHTHOUSE_FIXED_POINT.
+ *
+ * This is the same closest approach of two rays as LighthouseXYZ does
+ * in single precision, with the rotation matrices and ray directions
+ * in Q30 and positions in Q20 meters (about a micron, +/- 2 km).  The
+ * rays are not normalized, since the closest approach doesn't need
+ * unit vectors and a square root per ray is expensive without an FPU.
+ *
+ * The helpers are always available so that host/bench_fixed can
+ * compare them with the float path in the same program.
+ */
+#ifndef _LighthouseFixed_h_
+#define _LighthouseFixed_h_
+
+#include "LighthouseAngle.h"
+#include "LighthouseXYZ.h"
+
+#define LH_Q20_METER (1 << 20)
+
+
+static inline void
+lh_fixed_lightsource(
+	const lightsource * l,
+	lightsource_fixed * f
+)
+{
+	for (int i = 0 ; i < 9 ; i++)
+		f->mat[i] = (int32_t) lrintf(l->mat[i] * 1073741824.0f);
+	for (int i = 0 ; i < 3 ; i++)
+		f->origin[i] = (int32_t) lrintf(l->origin[i] * (float) LH_Q20_METER);
+}
+
+
+static inline uint32_t
+lh_isqrt64(
+	uint64_t x
+)
+{
+	uint64_t res = 0;
+	uint64_t bit = 1ULL << 62;
+
+	while (bit > x)
+		bit >>= 2;
+
+	while (bit)
+	{
+		if (x >= res + bit)
+		{
+			x -= res + bit;
+			res = (res >> 1) + bit;
+		} else
+			res >>= 1;
+		bit >>= 2;
+	}
+
+	return (uint32_t) res;
+}
+
+
+static LH_INLINE int32_t
+lh_dot30(
+	const int32_t a[3],
+	const int32_t b[3]
+)
+{
+	return (int32_t) (((int64_t) a[0] * b[0]
+		+ (int64_t) a[1] * b[1]
+		+ (int64_t) a[2] * b[2]
+		+ (1 << 29)) >> 30);
+}
+
+
+/*
+ * Ray from a lighthouse towards a sensor, in XYZ-space, the same cross
+ * product of the sweep planes' normals as calc_ray_vec().  Its length
+ * is the sine of the angle between the planes, so always <= 1.
+ */
+static LH_INLINE void
+lh_fixed_ray(
+	const int32_t m[9],
+	int32_t angle1,
+	int32_t angle2,
+	int32_t res[3]
+)
+{
+	int32_t s1, c1, s2, c2;
+	lh_sincos_q30(angle1, &s1, &c1);
+	lh_sincos_q30(angle2, &s2, &c2);
+
+	const int32_t r[3] = {
+		-lh_mul30(c2, s1),
+		 lh_mul30(s2, c1),
+		-lh_mul30(c1, c2),
+	};
+
+	res[0] = lh_dot30(&m[0], r);
+	res[1] = lh_dot30(&m[3], r);
+	res[2] = lh_dot30(&m[6], r);
+}
+
+
+/**
+ * Triangulate one sensor from its four binary angles.  The position
+ * and the distance between the rays are in Q20 meters.  Returns false
+ * if the rays are too close to parallel.
+ */
+static LH_INLINE bool
+lh_fixed_triangulate(
+	const lightsource_fixed * lh0,
+	const lightsource_fixed * lh1,
+	const int32_t angles[4],
+	int32_t xyz[3],
+	int32_t * dist
+)
+{
+	int32_t u[3], v[3], w0[3];
+	lh_fixed_ray(lh0->mat, angles[0], angles[1], u);
+	lh_fixed_ray(lh1->mat, angles[2], angles[3], v);
+
+	for (int k = 0 ; k < 3 ; k++)
+		w0[k] = lh0->origin[k] - lh1->origin[k];
+
+	const int64_t a = lh_dot30(u, u);
+	const int64_t b = lh_dot30(u, v);
+	const int64_t c = lh_dot30(v, v);
+	const int64_t d = lh_dot30(u, w0);
+	const int64_t e = lh_dot30(v, w0);
+
+	// Q30, and the same 1e-5 limit as the float path, relative to
+	// the lengths of the rays
+	const int64_t denom = (a * c - b * b + (1 << 29)) >> 30;
+	if (denom * 100000 < ((a * c) >> 30))
+		return false;
+
+	// Q50 / Q30, in Q20
+	const int64_t t1 = (b * e - c * d) / denom;
+	const int64_t t2 = (a * e - b * d) / denom;
+	if (t1 > INT32_MAX || t1 < INT32_MIN || t2 > INT32_MAX || t2 < INT32_MIN)
+		return false;
+
+	int64_t dist2 = 0;
+	for (int k = 0 ; k < 3 ; k++)
+	{
+		const int32_t p1 = lh_mul30(u[k], (int32_t) t1);
+		const int32_t dx = p1 - (lh_mul30(v[k], (int32_t) t2) - w0[k]);
+		xyz[k] = lh0->origin[k] + p1 - dx / 2;
+		dist2 += (int64_t) dx * dx;
+	}
+
+	*dist = lh_isqrt64(dist2);
+	return true;
+}
+
+#endif
@@ -0,0 +1,58 @@
+/** \file
+ * Small single precision helpers for the geometry code.
+ *
+ * Everything here is inline so that the compiler can keep the values
+ * in FPU registers; calling into CMSIS-DSP for three element vectors
+ * costs more than the arithmetic itself.
+ */
+#ifndef _LighthouseMath_h_
+#define _LighthouseMath_h_
+
+#include <math.h>
+
+#define LH_INLINE inline __attribute__((__always_inline__))
+
+/**
+ * Compute sin(x) and cos(x) together.
+ *
+ * x is reduced to the nearest multiple of pi/2 in three parts
+ * (Cody-Waite) and both are evaluated as short polynomials on
+ * [-pi/4, pi/4], which shares the range reduction and gives about
+ * one ulp of error.  Good for |x| up to a few thousand; the sweep
+ * angles are all within +/- pi.
+ */
+static LH_INLINE void
+lh_sincosf(
+	float x,
+	float * s,
+	float * c
+)
+{
+	const float q = x * 0.636619772367581f; // 2/pi
+	const int k = (int)(q + (q < 0 ? -0.5f : 0.5f));
+	const float kf = (float) k;
+
+	float r = x - kf * 1.5703125f;
+	r = r - kf * 4.837512969970703125e-4f;
+	r = r - kf * 7.54978995489188216e-8f;
+
+	const float r2 = r * r;
+
+	const float sr = r + r * r2 * (-1.6666654611e-1f
+		+ r2 * (8.3321608736e-3f
+		+ r2 * -1.9515295891e-4f));
+
+	const float cr = 1.0f - 0.5f * r2 + r2 * r2 * (4.166664568298827e-2f
+		+ r2 * (-1.388731625493765e-3f
+		+ r2 * 2.443315711809948e-5f));
+
+	switch (k & 3)
+	{
+	case 0: *s =  sr; *c =  cr; break;
+	case 1: *s =  cr; *c = -sr; break;
+	case 2: *s = -sr; *c = -cr; break;
+	default: *s = -cr; *c =  sr; break;
+	}
+}
+
+#endif
@@ -5,12 +5,18 @@
  */
 
 #include "LighthouseOOTX.h"
+#include <string.h>
+#include <math.h>
 
 LighthouseOOTX::LighthouseOOTX()
 {
 	reset();
 	complete = 0;
 	length = 0;
+	have_calibration = 0;
+	crc_errors = 0;
+	resyncs = 0;
+	zeros = 0;
 }
 
 void LighthouseOOTX::reset()
@@ -20,51 +26,111 @@ void LighthouseOOTX::reset()
 	accumulator = 0;
 	accumulator_bits = 0;
 	rx_bytes = 0;
+	crc = 0xFFFFFFFF;
 }
 
+
+// Standard (zlib) CRC32, a nibble at a time to keep the table small
+static const uint32_t crc32_table[16] = {
+	0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+	0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+	0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+	0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+};
+
+static inline uint32_t crc32_update(uint32_t crc, uint8_t byte)
+{
+	crc ^= byte;
+	crc = (crc >> 4) ^ crc32_table[crc & 0xF];
+	crc = (crc >> 4) ^ crc32_table[crc & 0xF];
+	return crc;
+}
+
+
+void LighthouseOOTX::crc_byte(uint8_t byte)
+{
+	crc = crc32_update(crc, byte);
+}
+
+
+uint32_t LighthouseOOTX::crc32(const void * buf, unsigned len)
+{
+	const uint8_t * p = (const uint8_t *) buf;
+	uint32_t crc = 0xFFFFFFFF;
+
+	while (len--)
+		crc = crc32_update(crc, *p++);
+
+	return ~crc;
+}
+
+
+bool LighthouseOOTX::peek_id(uint32_t * id) const
+{
+	if (waiting_for_preamble || waiting_for_length)
+		return false;
+
+	// fw_version is two bytes, then the four byte serial number
+	if (rx_bytes < 6)
+		return false;
+
+	if ((bytes[0] & 0x3F) != 6)
+		return false;
+
+	*id = 0
+		| (uint32_t) bytes[2] << 0
+		| (uint32_t) bytes[3] << 8
+		| (uint32_t) bytes[4] << 16
+		| (uint32_t) bytes[5] << 24;
+
+	return true;
+}
+
+
 void LighthouseOOTX::add(unsigned bit)
 {
 	if (bit != 0 && bit != 1)
 	{
 		// something is wrong.  dump what we have received so far
 		reset();
+		zeros = 0;
 		return;
 	}
 
-	// add this bit to our incoming word
-	accumulator = (accumulator << 1) | bit;
-	accumulator_bits++;
-
-	if (waiting_for_preamble)
+	if (bit == 0)
 	{
-		// 17 zeros, followed by a 1 == 18 bits
-		if (accumulator_bits != 18)
-			return;
-
-		if (accumulator == 0x1)
-		{
-			// received preamble, start on data
-			// first we'll need the length
-			waiting_for_preamble = 0;
-			waiting_for_length = 1;
-			return;
-		}
-
-		// we've received 18 bits worth of preamble,
-		// but it is not a valid thing.  hold onto the
-		// last 17 bits worth of data
-		accumulator_bits--;
-		accumulator = accumulator & 0x1FFFF;
+		zeros++;
+	} else
+	if (zeros < 17)
+	{
+		zeros = 0;
+	} else {
+		// 17 zeros followed by a 1 can only be a preamble,
+		// so start on the data, first we'll need the length
+		if (!waiting_for_preamble)
+			resyncs++;
+
+		reset();
+		zeros = 0;
+		waiting_for_preamble = 0;
 		return;
 	}
 
+	if (waiting_for_preamble)
+		return;
+
+	// add this bit to our incoming word
+	accumulator = (accumulator << 1) | bit;
+	accumulator_bits++;
+
 	// we're receiving data!  accumulate until we get a sync bit
 	if (accumulator_bits != 17)
 		return;
 
 	if ((accumulator & 1) == 0)
 	{
-		// no sync bit. go back into waiting for preamble mode
+		// no sync bit. go back into waiting for preamble mode,
+		// which may already be under way in the zeros
 		reset();
 		return;
 	}
@@ -82,31 +148,122 @@ void LighthouseOOTX::add_word(unsigned word)
 {
 	if (waiting_for_length)
 	{
-		length = word + 4; // add in the CRC32 length
+		length = word;
 		padding = length & 1;
 		waiting_for_length = 0;
 		rx_bytes = 0;
 
-		// error!
-		if (length > sizeof(bytes))
+		// error!  the payload, padding and CRC32 must fit
+		if (length + padding + 4 > sizeof(bytes))
 			reset();
 
 		return;
 	}
 
-	bytes[rx_bytes++] = (word >> 8) & 0xFF;
-	bytes[rx_bytes++] = (word >> 0) & 0xFF;
+	// only the payload is covered by the CRC, not the
+	// padding byte or the CRC itself
+	const uint8_t b0 = (word >> 8) & 0xFF;
+	const uint8_t b1 = (word >> 0) & 0xFF;
 
-	if (rx_bytes < length + padding)
-		return;
+	if (rx_bytes < length)
+		crc_byte(b0);
+	bytes[rx_bytes++] = b0;
+
+	if (rx_bytes < length)
+		crc_byte(b1);
+	bytes[rx_bytes++] = b1;
 
-	// we are at the end!
+	if (rx_bytes < length + padding + 4)
+		return;
 
-	// todo: check crc32
+	// we are at the end!  the CRC32 is little endian
+	const uint8_t * const p = &bytes[length + padding];
+	const uint32_t rx_crc = 0
+		| (uint32_t) p[0] << 0
+		| (uint32_t) p[1] << 8
+		| (uint32_t) p[2] << 16
+		| (uint32_t) p[3] << 24;
 
-	complete = 1;
-	waiting_for_length = 1;
+	if (rx_crc == ~crc)
+	{
+		have_calibration = parse(bytes, length, calibration);
+		complete = 1;
+	} else {
+		crc_errors++;
+	}
 
 	// reset to wait for a preamble
 	reset();
 }
+
+
+static float
+half_to_float(
+	uint16_t h
+)
+{
+	const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+	const unsigned exp = (h >> 10) & 0x1F;
+	const unsigned mant = h & 0x3FF;
+
+	if (exp == 0)
+	{
+		// zero or subnormal
+		const float val = ldexpf(mant, -24);
+		return sign ? -val : val;
+	}
+
+	// normal, infinity or nan: rebias the exponent
+	const uint32_t bits = sign
+		| (exp == 0x1F ? 0xFF : exp - 15 + 127) << 23
+		| mant << 13;
+
+	float val;
+	memcpy(&val, &bits, sizeof(val));
+	return val;
+}
+
+
+static inline uint16_t get16(const uint8_t * p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+
+bool
+LighthouseOOTX::parse(
+	const uint8_t * b,
+	unsigned length,
+	LighthouseCalibration & cal
+)
+{
+	if (length < 33)
+		return false;
+
+	const uint16_t version = get16(&b[0x00]);
+	if ((version & 0x3F) != 6)
+		return false;
+
+	cal.fw_version = version >> 6;
+	cal.protocol = version & 0x3F;
+	cal.id = get16(&b[0x02]) | (uint32_t) get16(&b[0x04]) << 16;
+	cal.phase[0] = half_to_float(get16(&b[0x06]));
+	cal.phase[1] = half_to_float(get16(&b[0x08]));
+	cal.tilt[0] = half_to_float(get16(&b[0x0A]));
+	cal.tilt[1] = half_to_float(get16(&b[0x0C]));
+	cal.unlock_count = b[0x0E];
+	cal.hw_version = b[0x0F];
+	cal.curve[0] = half_to_float(get16(&b[0x10]));
+	cal.curve[1] = half_to_float(get16(&b[0x12]));
+	cal.accel[0] = (int8_t) b[0x14];
+	cal.accel[1] = (int8_t) b[0x15];
+	cal.accel[2] = (int8_t) b[0x16];
+	cal.gibphase[0] = half_to_float(get16(&b[0x17]));
+	cal.gibphase[1] = half_to_float(get16(&b[0x19]));
+	cal.gibmag[0] = half_to_float(get16(&b[0x1B]));
+	cal.gibmag[1] = half_to_float(get16(&b[0x1D]));
+	cal.mode = b[0x1F];
+	cal.faults = b[0x20];
+
+	return true;
+}
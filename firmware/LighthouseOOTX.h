@@ -1,8 +1,37 @@
 /** \file
  * Record the Lighthouse OOTX messages
+ *
+ * The data words are each followed by a 1 sync bit, so the 17 zeros
+ * and a 1 of the preamble can not appear inside a message.  Whenever
+ * they are seen a new message starts, even if one was in progress, so
+ * that a missed or flipped bit costs only the message it was in.
  */
 #pragma once
 
+#include <stdint.h>
+
+/**
+ * Base station info block, version 6, as sent in the OOTX payload.
+ * The float fields are half precision on the wire.
+ * https://github.com/nairol/LighthouseRedox/blob/master/docs/Base%20Station.md
+ */
+struct LighthouseCalibration
+{
+	uint16_t fw_version;	// firmware version (upper 10 bits of the first word)
+	uint8_t protocol;	// protocol version (lower 6 bits), always 6
+	uint32_t id;		// base station serial number
+	float phase[2];		// per rotor
+	float tilt[2];
+	uint8_t unlock_count;
+	uint8_t hw_version;
+	float curve[2];
+	int8_t accel[3];	// gravity vector, arbitrary scale
+	float gibphase[2];
+	float gibmag[2];
+	uint8_t mode;
+	uint8_t faults;
+};
+
 
 class LighthouseOOTX
 {
@@ -11,17 +40,52 @@ public:
 
 	void add(unsigned bit);
 
+	// Set when a message has been received and its CRC32 matches;
+	// the caller clears it once it has been processed.
 	bool complete;
-	unsigned length; // message length in bytes
+	unsigned length; // payload length in bytes, without padding and CRC
 	unsigned char bytes[256];
 
+	// Set along with complete if the payload was a version 6
+	// base station info block.
+	bool have_calibration;
+	LighthouseCalibration calibration;
+
+	// Messages that were dropped because their CRC did not match
+	unsigned long crc_errors;
+
+	// Messages that were cut short by the next preamble
+	unsigned long resyncs;
+
+	// The serial number of the info block that is being received,
+	// before the rest of the message and the CRC have arrived.
+	// Returns false if it has not been seen yet.
+	bool peek_id(uint32_t * id) const;
+
+	// Standard (zlib) CRC32 of a buffer
+	static uint32_t crc32(const void * buf, unsigned len);
+
+	// Decode an info block payload; returns false if it is not one
+	static bool parse(
+		const uint8_t * bytes,
+		unsigned length,
+		LighthouseCalibration & cal
+	);
+
 private:
 	void reset();
 	void add_word(unsigned word);
+	void crc_byte(uint8_t byte);
+
+	// CRC32 of the payload, updated as each word arrives
+	uint32_t crc;
 
 	bool waiting_for_preamble;
 	bool waiting_for_length;
 
+	// zero bits in a row, for spotting the preamble
+	unsigned zeros;
+
 	unsigned long accumulator;
 	unsigned accumulator_bits;
 
@@ -0,0 +1,193 @@
+/** \file
+ * Telemetry frames queued by class and sent as the port has room.
+ */
+#include "LighthouseOutput.h"
+
+#define QUEUE_MASK	(LH_OUTPUT_QUEUE_SIZE - 1)
+
+
+LighthouseOutput::LighthouseOutput()
+{
+	port = 0;
+	begin(0);
+}
+
+
+void LighthouseOutput::begin(LighthouseOutputPort * port)
+{
+	this->port = port;
+
+	for (int c = 0 ; c < CLASSES ; c++)
+	{
+		queues[c].head = queues[c].tail = 0;
+		drop_policy[c] = c == FIX ? DROP_OLDEST : DROP_NEWEST;
+		queued[c] = 0;
+		dropped[c] = 0;
+		peak[c] = 0;
+	}
+
+	lost = 0;
+	stalls = 0;
+	current_len = current_sent = 0;
+	seq = 0;
+	gap = 0;
+}
+
+
+unsigned LighthouseOutput::frame_class(const uint8_t * frame)
+{
+	switch (frame[1] >> 4)
+	{
+	case LH_FRAME_OOTX:
+	case LH_FRAME_CALIBRATION:
+	case LH_FRAME_TIME:
+		return STATE;
+	case LH_FRAME_EDGES:
+		return EDGES;
+	case LH_FRAME_TEXT:
+		return DEBUG;
+	default:
+		return FIX;
+	}
+}
+
+
+unsigned LighthouseOutput::frame_len(const queue & q, uint32_t at) const
+{
+	return q.buf[at & QUEUE_MASK]
+		| q.buf[(at + 1) & QUEUE_MASK] << 8;
+}
+
+
+void LighthouseOutput::copy_out(
+	const queue & q,
+	uint32_t at,
+	uint8_t * buf,
+	unsigned len
+) const
+{
+	for (unsigned i = 0 ; i < len ; i++)
+		buf[i] = q.buf[(at + i) & QUEUE_MASK];
+}
+
+
+bool LighthouseOutput::write(const uint8_t * frame, unsigned len)
+{
+	// next_frame() rewrites the sequence number and the CRC, and
+	// frame_class() reads the header, so they have to be there
+	if (len < LH_FRAME_MIN)
+		return false;
+
+	const unsigned c = frame_class(frame);
+	queue & q = queues[c];
+	const unsigned need = len + 2;
+
+	if (len > LH_FRAME_MAX || need > LH_OUTPUT_QUEUE_SIZE)
+	{
+		dropped[c]++;
+		lost++;
+		gap++;
+		return false;
+	}
+
+	while (LH_OUTPUT_QUEUE_SIZE - (q.head - q.tail) < need)
+	{
+		dropped[c]++;
+		lost++;
+		gap++;
+
+		if (drop_policy[c] == DROP_NEWEST)
+			return false;
+
+		q.tail += 2 + frame_len(q, q.tail);
+	}
+
+	q.buf[q.head++ & QUEUE_MASK] = len;
+	q.buf[q.head++ & QUEUE_MASK] = len >> 8;
+	for (unsigned i = 0 ; i < len ; i++)
+		q.buf[q.head++ & QUEUE_MASK] = frame[i];
+
+	queued[c]++;
+	if (q.head - q.tail > peak[c])
+		peak[c] = q.head - q.tail;
+
+	return true;
+}
+
+
+/*
+ * Take the next frame from the highest priority class and give it the
+ * next sequence number, skipping any that were dropped.  A skip of a
+ * multiple of 256 would look like no gap at all, so it is kept to 255.
+ * The CRC covers the sequence number so it is redone.
+ */
+bool LighthouseOutput::next_frame()
+{
+	for (int c = 0 ; c < CLASSES ; c++)
+	{
+		queue & q = queues[c];
+		if (q.head == q.tail)
+			continue;
+
+		const unsigned len = frame_len(q, q.tail);
+		copy_out(q, q.tail + 2, current, len);
+		q.tail += 2 + len;
+
+		if (gap)
+			seq += (gap - 1) % 255 + 1;
+		gap = 0;
+		current[2] = seq++;
+		current[len - 1] = lighthouse_crc8(current + 1, len - 2);
+
+		current_len = len;
+		current_sent = 0;
+		return true;
+	}
+
+	return false;
+}
+
+
+unsigned LighthouseOutput::flush()
+{
+	unsigned total = 0;
+
+	while (true)
+	{
+		if (current_sent == current_len && !next_frame())
+			break;
+
+		const unsigned room = port->room();
+		if (room == 0)
+		{
+			stalls++;
+			break;
+		}
+
+		unsigned len = current_len - current_sent;
+		if (len > room)
+			len = room;
+
+		const unsigned wrote = port->write(current + current_sent, len);
+		current_sent += wrote;
+		total += wrote;
+
+		if (wrote < len)
+			break;
+	}
+
+	return total;
+}
+
+
+bool LighthouseOutput::idle() const
+{
+	if (current_sent != current_len)
+		return false;
+
+	for (int c = 0 ; c < CLASSES ; c++)
+		if (queues[c].head != queues[c].tail)
+			return false;
+
+	return true;
+}
@@ -0,0 +1,129 @@
+/** \file
+ * Non-blocking output queue for the telemetry frames.
+ *
+ * Writing to the USB serial port blocks when the host is not reading,
+ * and while loop() is blocked the edge queue fills and angles are lost.
+ * Instead the frames are queued here and flush() only writes as much
+ * as the port says it has room for, so loop() never waits on the host.
+ *
+ * There is one queue for each class of frame, and flush() always takes
+ * the next frame from the highest priority class that has one: base
+ * station calibration and OOTX first since it is rare and takes seconds
+ * to receive again, along with the time frames that should not wait
+ * behind anything, then fixes and poses, then raw edges if the host
+ * has asked for them, then the diagnostic text.
+ * A frame is sent whole once it has been started.  When a class's queue
+ * is full either the oldest queued frame is dropped to make room, which
+ * suits the fixes since a stale one is worth less than a new one, or
+ * the new frame is, which keeps a multi-frame report from losing its
+ * start.
+ *
+ * The sequence number is stamped as each frame is sent rather than
+ * when it is encoded, so that the reordering between classes is not
+ * seen as a gap, and it skips one for every frame that was dropped.
+ * The host then knows exactly how many were lost and that the delta
+ * fixes are no good until the next key frames, as for a lost packet.
+ */
+#ifndef _LighthouseOutput_h_
+#define _LighthouseOutput_h_
+
+#include <stdint.h>
+#include "LighthouseTelemetry.h"
+
+#define LH_OUTPUT_QUEUE_SIZE	1024	// bytes per class, a power of 2
+
+
+// Where the frames go; on the Teensy the USB serial port
+// (see LighthouseUSBPort.h).
+class LighthouseOutputPort
+{
+public:
+	virtual ~LighthouseOutputPort() {}
+
+	// how many bytes can be written without blocking
+	virtual unsigned room() = 0;
+
+	// returns how many were written
+	virtual unsigned write(const uint8_t * buf, unsigned len) = 0;
+};
+
+
+class LighthouseOutput
+{
+public:
+	LighthouseOutput();
+
+	// in the order they are sent
+	enum {
+		STATE = 0,	// calibration, OOTX messages and the time
+		FIX,		// position fixes and poses
+		EDGES,		// raw capture timestamps
+		DEBUG,		// text diagnostics
+		CLASSES,
+	};
+
+	enum policy {
+		DROP_OLDEST,
+		DROP_NEWEST,
+	};
+
+	void begin(LighthouseOutputPort * port);
+
+	// Which class a frame goes into, by its type
+	static unsigned frame_class(const uint8_t * frame);
+
+	// Queue a whole frame from LighthouseTelemetry.  Returns false if
+	// it was dropped rather than an older one, or is too short to be
+	// a frame at all.
+	bool write(const uint8_t * frame, unsigned len);
+
+	// Send what the port has room for.  Returns the bytes written.
+	unsigned flush();
+
+	// Is everything sent?
+	bool idle() const;
+
+	// what to do when a queue is full, DROP_OLDEST for the fixes and
+	// DROP_NEWEST for the others unless set otherwise
+	policy drop_policy[CLASSES];
+
+	// per class: frames queued and dropped, and the most bytes that
+	// have been waiting at once
+	uint32_t queued[CLASSES];
+	uint32_t dropped[CLASSES];
+	uint32_t peak[CLASSES];
+
+	// frames dropped from all of the classes; when it changes the
+	// host will see a gap (see LighthouseTelemetry::key_frames())
+	uint32_t lost;
+
+	// calls to flush() that had something to send and no room
+	uint32_t stalls;
+
+private:
+	LighthouseOutputPort * port;
+
+	// each frame is stored as a length byte pair and the frame, with
+	// free running head and tail indices
+	struct queue {
+		uint8_t buf[LH_OUTPUT_QUEUE_SIZE];
+		uint32_t head;
+		uint32_t tail;
+	};
+
+	queue queues[CLASSES];
+
+	// the frame that is being sent, and how much of it has gone
+	uint8_t current[LH_FRAME_MAX];
+	unsigned current_len;
+	unsigned current_sent;
+
+	uint8_t seq;
+	unsigned gap;
+
+	unsigned frame_len(const queue & q, uint32_t at) const;
+	void copy_out(const queue & q, uint32_t at, uint8_t * buf, unsigned len) const;
+	bool next_frame();
+};
+
+#endif
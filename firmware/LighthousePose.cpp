@@ -0,0 +1,500 @@
+/** \file
+ * Warm started Gauss-Newton fit of the sensor array's pose.
+ *
+ * The pose is the rotation rot and position xyz that take a point b on
+ * the board to q = rot b + xyz in XYZ-space.  A step rotates by a small
+ * rotation vector w in XYZ-space and moves by dt, so for a sweep angle
+ * with gradient h with respect to q the Jacobian row is
+ *
+ *	[ (rot b) x h , h ]
+ *
+ * The normal equations are scaled by their diagonal before solving,
+ * since the rotation columns are about a hundred times smaller than the
+ * translation ones for a 22 mm board.
+ */
+#include "LighthousePose.h"
+#include "LighthouseMath.h"
+#include "InputCapture.h"
+#include <math.h>
+
+// the 22 mm square, sensors 0 to 3
+static const float default_layout[LighthousePose::max_sensors][3] = {
+	{ +0.011f, -0.011f, 0 },
+	{ -0.011f, -0.011f, 0 },
+	{ -0.011f, +0.011f, 0 },
+	{ +0.011f, +0.011f, 0 },
+};
+
+// two full cycles of the four sweeps, so one missed sweep is ok
+static const uint32_t max_age = 2 * 4 * 8333 * CLOCKS_PER_MICROSECOND;
+
+// angles further than this from the current pose are not used
+static const float gate = 0.02f;
+
+// a solve with a worse fit than this has lost track
+static const float max_rms = 0.005f;
+
+static const unsigned max_measurements = LighthousePose::max_sensors * 4;
+
+
+// Solve A x = b in place by Gaussian elimination with partial pivoting.
+// A is n by n, row major.  The solution replaces b.
+static bool
+solve_linear(
+	float * A,
+	float * b,
+	unsigned n
+)
+{
+	for (unsigned col = 0 ; col < n ; col++)
+	{
+		unsigned pivot = col;
+		for (unsigned row = col + 1 ; row < n ; row++)
+			if (fabsf(A[row*n + col]) > fabsf(A[pivot*n + col]))
+				pivot = row;
+
+		if (A[pivot*n + col] == 0)
+			return false;
+
+		if (pivot != col)
+		{
+			for (unsigned k = col ; k < n ; k++)
+			{
+				const float tmp = A[col*n + k];
+				A[col*n + k] = A[pivot*n + k];
+				A[pivot*n + k] = tmp;
+			}
+			const float tmp = b[col];
+			b[col] = b[pivot];
+			b[pivot] = tmp;
+		}
+
+		const float inv = 1.0f / A[col*n + col];
+		for (unsigned row = col + 1 ; row < n ; row++)
+		{
+			const float f = A[row*n + col] * inv;
+			for (unsigned k = col ; k < n ; k++)
+				A[row*n + k] -= f * A[col*n + k];
+			b[row] -= f * b[col];
+		}
+	}
+
+	for (unsigned col = n ; col-- > 0 ; )
+	{
+		float sum = b[col];
+		for (unsigned k = col + 1 ; k < n ; k++)
+			sum -= A[col*n + k] * b[k];
+		b[col] = sum / A[col*n + col];
+	}
+
+	return true;
+}
+
+
+// Make the rows of a nearly orthonormal matrix orthonormal again
+static void
+orthonormalize(
+	float m[9]
+)
+{
+	float * const x = &m[0];
+	float * const y = &m[3];
+	float * const z = &m[6];
+
+	float len = 1.0f / sqrtf(x[0]*x[0] + x[1]*x[1] + x[2]*x[2]);
+	x[0] *= len; x[1] *= len; x[2] *= len;
+
+	const float d = x[0]*y[0] + x[1]*y[1] + x[2]*y[2];
+	y[0] -= d * x[0]; y[1] -= d * x[1]; y[2] -= d * x[2];
+	len = 1.0f / sqrtf(y[0]*y[0] + y[1]*y[1] + y[2]*y[2]);
+	y[0] *= len; y[1] *= len; y[2] *= len;
+
+	z[0] = x[1]*y[2] - x[2]*y[1];
+	z[1] = x[2]*y[0] - x[0]*y[2];
+	z[2] = x[0]*y[1] - x[1]*y[0];
+}
+
+
+void
+LighthousePose::begin(
+	lightsource * lh1,
+	lightsource * lh2,
+	const float (*layout)[3],
+	unsigned sensors
+)
+{
+	if (!layout)
+		layout = default_layout;
+	if (sensors > max_sensors)
+		sensors = max_sensors;
+
+	this->lighthouse[0] = lh1;
+	this->lighthouse[1] = lh2;
+	this->sensors = sensors;
+
+	for (unsigned i = 0 ; i < sensors ; i++)
+	{
+		for (int k = 0 ; k < 3 ; k++)
+			this->layout[i][k] = layout[i][k];
+		this->have[i] = 0;
+	}
+
+	this->tracking = false;
+	this->used = 0;
+	this->rms = 0;
+	this->starts = 0;
+	this->lost = 0;
+}
+
+
+void
+LighthousePose::update(
+	unsigned sensor,
+	unsigned ind,
+	float angle,
+	uint32_t when
+)
+{
+	if (sensor >= this->sensors || ind >= 4)
+		return;
+
+	this->angles[sensor][ind] = angle;
+	this->times[sensor][ind] = when;
+	this->have[sensor] |= 1 << ind;
+}
+
+
+/*
+ * Closed form pose from the four sensors as seen by one lighthouse.
+ * The tangents of the sweep angles are the board's points projected
+ * onto the lighthouse's image plane, so they are related to the board
+ * positions by a homography H = [r1 r2 t] (with the Z row negated since
+ * the lighthouse looks down -Z).  Four points give exactly the eight
+ * unknowns of H with H[2][2] = 1.
+ */
+bool
+LighthousePose::init(
+	unsigned lh
+)
+{
+	if (this->sensors != 4)
+		return false;
+
+	float A[8*8];
+	float h[8];
+
+	for (unsigned i = 0 ; i < 4 ; i++)
+	{
+		// the layout is centimeters here to keep A well scaled
+		const float x = this->layout[i][0] * 100;
+		const float y = this->layout[i][1] * 100;
+		const float u = -tanf(this->angles[i][lh*2 + 0]);
+		const float v = tanf(this->angles[i][lh*2 + 1]);
+
+		float * const ru = &A[(2*i + 0) * 8];
+		float * const rv = &A[(2*i + 1) * 8];
+
+		ru[0] = x; ru[1] = y; ru[2] = 1;
+		ru[3] = 0; ru[4] = 0; ru[5] = 0;
+		ru[6] = -u*x; ru[7] = -u*y;
+		h[2*i + 0] = u;
+
+		rv[0] = 0; rv[1] = 0; rv[2] = 0;
+		rv[3] = x; rv[4] = y; rv[5] = 1;
+		rv[6] = -v*x; rv[7] = -v*y;
+		h[2*i + 1] = v;
+	}
+
+	if (!solve_linear(A, h, 8))
+		return false;
+
+	// columns of H, back to meters
+	const float c1[3] = { h[0] * 100, h[3] * 100, h[6] * 100 };
+	const float c2[3] = { h[1] * 100, h[4] * 100, h[7] * 100 };
+	const float c3[3] = { h[2], h[5], 1 };
+
+	float lambda = 2.0f / (
+		sqrtf(c1[0]*c1[0] + c1[1]*c1[1] + c1[2]*c1[2]) +
+		sqrtf(c2[0]*c2[0] + c2[1]*c2[1] + c2[2]*c2[2]));
+
+	// board to lighthouse rotation, as rows of its transpose so that
+	// orthonormalize() can clean up r1 and r2 and build r3
+	float rt[9];
+	float t[3];
+	for (int k = 0 ; k < 3 ; k++)
+	{
+		const float flip = k == 2 ? -lambda : lambda;
+		rt[0 + k] = c1[k] * flip;
+		rt[3 + k] = c2[k] * flip;
+		t[k] = c3[k] * flip;
+	}
+
+	orthonormalize(rt);
+
+	// and into XYZ-space: rot = mat R, xyz = mat t + origin
+	const lightsource * const l = this->lighthouse[lh];
+	for (int i = 0 ; i < 3 ; i++)
+	{
+		for (int j = 0 ; j < 3 ; j++)
+			this->rot[i*3 + j] = l->mat[i*3 + 0] * rt[j*3 + 0]
+					   + l->mat[i*3 + 1] * rt[j*3 + 1]
+					   + l->mat[i*3 + 2] * rt[j*3 + 2];
+
+		this->xyz[i] = l->origin[i]
+			+ l->mat[i*3 + 0] * t[0]
+			+ l->mat[i*3 + 1] * t[1]
+			+ l->mat[i*3 + 2] * t[2];
+	}
+
+	return true;
+}
+
+
+bool
+LighthousePose::solve(
+	uint32_t now
+)
+{
+	// gather everything that is recent enough
+	uint8_t m_sensor[max_measurements];
+	uint8_t m_ind[max_measurements];
+	unsigned count = 0;
+	unsigned full[2] = { 0, 0 };
+
+	for (unsigned s = 0 ; s < this->sensors ; s++)
+	{
+		for (unsigned ind = 0 ; ind < 4 ; ind++)
+		{
+			if ((this->have[s] & (1 << ind)) == 0)
+				continue;
+			// other sensors may have been hit a few ticks
+			// after the one that now came from
+			const int32_t age = now - this->times[s][ind];
+			if (age > (int32_t) max_age)
+				continue;
+
+			m_sensor[count] = s;
+			m_ind[count] = ind;
+			count++;
+			full[ind / 2] |= 1 << (s * 2 + (ind & 1));
+		}
+	}
+
+	if (!this->tracking)
+	{
+		const unsigned all = (1 << (2 * this->sensors)) - 1;
+		unsigned lh;
+		if (full[0] == all)
+			lh = 0;
+		else
+		if (full[1] == all)
+			lh = 1;
+		else
+			return false;
+
+		if (!this->init(lh))
+			return false;
+
+		this->tracking = true;
+		this->starts++;
+	}
+
+	float sum2 = 0;
+	unsigned used = 0;
+
+	for (unsigned iter = 0 ; iter < iterations ; iter++)
+	{
+		float A[6*6] = {};
+		float g[6] = {};
+		sum2 = 0;
+		used = 0;
+
+		for (unsigned n = 0 ; n < count ; n++)
+		{
+			const unsigned s = m_sensor[n];
+			const unsigned ind = m_ind[n];
+			const float * const b = this->layout[s];
+			const float * const r = this->rot;
+
+			// sensor in XYZ-space, relative to the board's origin
+			const float rb[3] = {
+				r[0]*b[0] + r[1]*b[1] + r[2]*b[2],
+				r[3]*b[0] + r[4]*b[1] + r[5]*b[2],
+				r[6]*b[0] + r[7]*b[1] + r[8]*b[2],
+			};
+
+			// and in the lighthouse's frame, P = mat' (q - origin)
+			const lightsource * const lh = this->lighthouse[ind / 2];
+			const float * const m = lh->mat;
+			const float dx = this->xyz[0] + rb[0] - lh->origin[0];
+			const float dy = this->xyz[1] + rb[1] - lh->origin[1];
+			const float dz = this->xyz[2] + rb[2] - lh->origin[2];
+			const float p0 = m[0]*dx + m[3]*dy + m[6]*dz;
+			const float p1 = m[1]*dx + m[4]*dy + m[7]*dz;
+			const float p2 = m[2]*dx + m[5]*dy + m[8]*dz;
+
+			if (p2 >= 0)
+				continue;
+
+			// same angle model and derivatives as LighthouseFilter
+			float predicted, d_lat, d_p2;
+			int lat;
+			if ((ind & 1) == 0)
+			{
+				const float r2 = p0*p0 + p2*p2;
+				predicted = atan2f(-p0, -p2);
+				d_lat = p2 / r2;
+				d_p2 = -p0 / r2;
+				lat = 0;
+			} else {
+				const float r2 = p1*p1 + p2*p2;
+				predicted = atan2f(p1, -p2);
+				d_lat = -p2 / r2;
+				d_p2 = p1 / r2;
+				lat = 1;
+			}
+
+			const float res = this->angles[s][ind] - predicted;
+			if (fabsf(res) > gate)
+				continue;
+
+			float h[3];
+			for (int j = 0 ; j < 3 ; j++)
+				h[j] = d_lat * m[j*3 + lat] + d_p2 * m[j*3 + 2];
+
+			const float J[6] = {
+				rb[1]*h[2] - rb[2]*h[1],
+				rb[2]*h[0] - rb[0]*h[2],
+				rb[0]*h[1] - rb[1]*h[0],
+				h[0], h[1], h[2],
+			};
+
+			for (int i = 0 ; i < 6 ; i++)
+			{
+				for (int j = i ; j < 6 ; j++)
+					A[i*6 + j] += J[i] * J[j];
+				g[i] += J[i] * res;
+			}
+
+			sum2 += res * res;
+			used++;
+		}
+
+		if (used < 6)
+			break;
+
+		// scale by the diagonal, and fill in the lower triangle
+		float scale[6];
+		for (int i = 0 ; i < 6 ; i++)
+			scale[i] = A[i*6 + i] > 0 ? 1.0f / sqrtf(A[i*6 + i]) : 0;
+
+		for (int i = 0 ; i < 6 ; i++)
+		{
+			for (int j = i ; j < 6 ; j++)
+				A[j*6 + i] = A[i*6 + j] *= scale[i] * scale[j];
+			A[i*6 + i] += 1e-6f;
+			g[i] *= scale[i];
+		}
+
+		if (!solve_linear(A, g, 6))
+		{
+			used = 0;
+			break;
+		}
+
+		for (int i = 0 ; i < 6 ; i++)
+			g[i] *= scale[i];
+
+		// rotate by w, Rodrigues' formula, then move
+		const float theta = sqrtf(g[0]*g[0] + g[1]*g[1] + g[2]*g[2]);
+		if (theta > 0)
+		{
+			const float k[3] = { g[0] / theta, g[1] / theta, g[2] / theta };
+			float s, c;
+			lh_sincosf(theta, &s, &c);
+			c = 1 - c;
+
+			const float E[9] = {
+				1 - c * (k[1]*k[1] + k[2]*k[2]),
+				c * k[0]*k[1] - s * k[2],
+				c * k[0]*k[2] + s * k[1],
+
+				c * k[0]*k[1] + s * k[2],
+				1 - c * (k[0]*k[0] + k[2]*k[2]),
+				c * k[1]*k[2] - s * k[0],
+
+				c * k[0]*k[2] - s * k[1],
+				c * k[1]*k[2] + s * k[0],
+				1 - c * (k[0]*k[0] + k[1]*k[1]),
+			};
+
+			float r[9];
+			for (int i = 0 ; i < 3 ; i++)
+				for (int j = 0 ; j < 3 ; j++)
+					r[i*3 + j] = E[i*3 + 0] * this->rot[0*3 + j]
+						   + E[i*3 + 1] * this->rot[1*3 + j]
+						   + E[i*3 + 2] * this->rot[2*3 + j];
+
+			orthonormalize(r);
+			for (int i = 0 ; i < 9 ; i++)
+				this->rot[i] = r[i];
+		}
+
+		for (int i = 0 ; i < 3 ; i++)
+			this->xyz[i] += g[3 + i];
+	}
+
+	this->used = used;
+	this->rms = used ? sqrtf(sum2 / used) : 0;
+
+	if (used < 6 || this->rms > max_rms)
+	{
+		this->tracking = false;
+		this->lost++;
+		return false;
+	}
+
+	return true;
+}
+
+
+void
+LighthousePose::quaternion(
+	float q[4]
+) const
+{
+	const float * const m = this->rot;
+	const float trace = m[0] + m[4] + m[8];
+
+	// pick the largest of w, x, y, z to divide by
+	if (trace > 0)
+	{
+		const float s = 0.5f / sqrtf(trace + 1);
+		q[0] = 0.25f / s;
+		q[1] = (m[7] - m[5]) * s;
+		q[2] = (m[2] - m[6]) * s;
+		q[3] = (m[3] - m[1]) * s;
+	} else
+	if (m[0] > m[4] && m[0] > m[8])
+	{
+		const float s = 2 * sqrtf(1 + m[0] - m[4] - m[8]);
+		q[0] = (m[7] - m[5]) / s;
+		q[1] = 0.25f * s;
+		q[2] = (m[1] + m[3]) / s;
+		q[3] = (m[2] + m[6]) / s;
+	} else
+	if (m[4] > m[8])
+	{
+		const float s = 2 * sqrtf(1 + m[4] - m[0] - m[8]);
+		q[0] = (m[2] - m[6]) / s;
+		q[1] = (m[1] + m[3]) / s;
+		q[2] = 0.25f * s;
+		q[3] = (m[5] + m[7]) / s;
+	} else {
+		const float s = 2 * sqrtf(1 + m[8] - m[0] - m[4]);
+		q[0] = (m[3] - m[1]) / s;
+		q[1] = (m[2] + m[6]) / s;
+		q[2] = (m[5] + m[7]) / s;
+		q[3] = 0.25f * s;
+	}
+}
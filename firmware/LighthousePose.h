@@ -0,0 +1,82 @@
+/** \file
+ * Rigid body position and orientation of the whole sensor array.
+ *
+ * The sensors are at known positions on the board (by default the
+ * 22 mm square that fits on a breadboard), so rather than triangulating
+ * each one separately every recent sweep angle from every sensor is
+ * used to fit one pose.  Four coplanar sensors seen by a single base
+ * station already give eight angles for the six degrees of freedom, so
+ * this keeps working when the other one is blocked.
+ *
+ * Each solve is a few Gauss-Newton iterations started from the last
+ * pose; the iteration budget is fixed so that the worst case time is
+ * bounded.  The first pose, or one after tracking is lost, comes from
+ * the closed form homography of one base station that sees every
+ * sensor (the same as host/PoseSolver does for the lighthouses).
+ *
+ * With only one base station the distance comes from the spread of the
+ * sensors, so it is much noisier than with two, and a board that is
+ * nearly face on to it can flip to the mirror image orientation.
+ */
+#ifndef _LighthousePose_h_
+#define _LighthousePose_h_
+
+#include <stdint.h>
+#include "LighthouseXYZ.h"
+
+class LighthousePose
+{
+public:
+	LighthousePose() {}
+
+	static const unsigned max_sensors = 4;
+	static const unsigned iterations = 3;
+
+	// layout is the position of each sensor on the board in meters,
+	// with z = 0; NULL uses the 22 mm square.
+	void begin(
+		lightsource * lh1,
+		lightsource * lh2,
+		const float (*layout)[3] = 0,
+		unsigned sensors = max_sensors
+	);
+
+	// Store angle ind (0-1 for lighthouse 0, 2-3 for lighthouse 1)
+	// for a sensor, captured at tick when.
+	void update(unsigned sensor, unsigned ind, float angle, uint32_t when);
+
+	// Fit the pose to all of the angles that are no more than two
+	// sweep cycles older than now.  Returns true if it is tracking.
+	bool solve(uint32_t now);
+
+	// Rotation from the board's frame to XYZ-space as a unit
+	// quaternion, w first.
+	void quaternion(float q[4]) const;
+
+	bool tracking;
+
+	// Position of the board's origin and its rotation matrix
+	float xyz[3];
+	float rot[9];
+
+	// Angles used in the last solve and their rms error in radians
+	unsigned used;
+	float rms;
+
+	// Times that tracking was (re)started and lost
+	unsigned long starts;
+	unsigned long lost;
+
+private:
+	lightsource * lighthouse[2];
+	unsigned sensors;
+	float layout[max_sensors][3];
+
+	float angles[max_sensors][4];
+	uint32_t times[max_sensors][4];
+	uint8_t have[max_sensors];
+
+	bool init(unsigned lh);
+};
+
+#endif
@@ -0,0 +1,27 @@
+/** \file
+ * Lighthouse sources rotation matrix & 3d-position, in the frame of
+ * the sensor board.  host/build/solve_lighthouse rewrites this file
+ * with the poses it measures.
+ *
+ * Once a base station is recognized by its OOTX serial number the pose
+ * stored in EEPROM for it is used, until the firmware is built with a
+ * different pose here, which then replaces the stored one.
+ */
+#ifndef _LighthousePoses_h_
+#define _LighthousePoses_h_
+
+#include "LighthouseXYZ.h"
+
+static lightsource lightsources[2] = {{
+    {  -0.88720f,  0.25875f, -0.38201f,
+       -0.04485f,  0.77566f,  0.62956f,
+        0.45920f,  0.57568f, -0.67656f},
+    {  -1.28658f,  2.32719f, -2.04823f}
+}, {
+    {   0.52584f, -0.64026f,  0.55996f,
+        0.01984f,  0.66739f,  0.74445f,
+       -0.85035f, -0.38035f,  0.36364f},
+    {   1.69860f,  2.62725f,  0.92969f}
+}};
+
+#endif
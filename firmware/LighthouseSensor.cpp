@@ -1,53 +1,75 @@
 #include "LighthouseSensor.h"
+#include "LighthouseSync.h"
 
-#if defined(KINETISK)
-//#define CLOCKS_PER_MICROSECOND ((double)F_BUS / 1000000.0)
-#define CLOCKS_PER_MICROSECOND (F_BUS / 1000000)
-#elif defined(KINETISL)
-// PLL is 48 Mhz, which is 24 clocks per microsecond, but
-// there is a divide by two for some reason.
-#define CLOCKS_PER_MICROSECOND (F_PLL / 2000000)
-#endif
+typedef LighthouseSyncClassifier<CLOCKS_PER_MICROSECOND> SyncClassifier;
+
+
+void
+LighthouseSensor::begin(
+	int id,
+	int icp0,
+	int icp1,
+	LighthouseSyncTracker * sync
+)
+{
+	this->id = id;
+	this->sync = sync;
+	this->sweep_cycle = 0;
+	this->icp_rising.begin(icp0, RISING, id);
+	this->icp_falling.begin(icp1, FALLING, id);
+	this->unpaired = 0;
+	this->resync();
+}
 
 
 void
-LighthouseSensor::begin(int id, int icp0, int icp1)
+LighthouseSensor::begin(
+	int id,
+	int icp,
+	LighthouseSyncTracker * sync
+)
 {
 	this->id = id;
-	this->icp_rising.begin(icp0, RISING);
-	this->icp_falling.begin(icp1, FALLING);
+	this->sync = sync;
+	this->sweep_cycle = 0;
+	this->icp_rising.begin(icp, CHANGE, id);
+	this->unpaired = 0;
+	this->resync();
+}
+
+
+void
+LighthouseSensor::resync()
+{
+	this->in_pulse = false;
 }
 
 
 int
 LighthouseSensor::sweep_pulse(
 	unsigned val,
-	unsigned len,
-	unsigned duty
+	unsigned len
 )
 {
-
 	// Sweep! The 0 degree mark is when the rotor
 	// that was not skpped sent its high pulse.
 	// midpoint of the pulse is what we'll use
 	unsigned now = val - len/2;
-	unsigned delta = now - this->zero_time;
-	const int ind = this->lighthouse*2 + this->axis;
-
-	// todo: filter if we don't know the axis
-	int valid = !this->got_sweep
-		&& this->lighthouse != 9
-		&& delta < 8000 * CLOCKS_PER_MICROSECOND;
-	
+	uint32_t delta;
+	const unsigned lighthouse = this->sync->lighthouse;
+	const unsigned axis = this->sync->axis;
+	const int ind = this->sync->sweep(this->id, now, &this->sweep_cycle, &delta);
+	const int valid = ind >= 0;
+
 	if (debug)
 	{
 		Serial.print(val);
 		Serial.print(",");
 		Serial.print(this->id);
 		Serial.print(",S,");
-		Serial.print(this->lighthouse);
+		Serial.print(lighthouse);
 		Serial.print(",");
-		Serial.print(this->axis);
+		Serial.print(axis);
 		Serial.print(",");
 		Serial.print(delta);
 		Serial.print(",");
@@ -72,19 +94,15 @@ LighthouseSensor::sweep_pulse(
 #endif
 	}
 
-	// flag that we have the sweep for this one already
-	// even if it is not a valid length
-	this->got_sweep = 1;
-	this->got_skip = this->got_not_skip = 0;
-	this->lighthouse = 9;
-
 	if (!valid)
 		return -1;
 
-	// update our angle measurement (raw and floating point)
+	// update our angle measurement (raw and converted), centered
+	// on the middle of the sweep
 	this->raw[ind] = delta;
-	this->angles[ind] = (delta - 4000.0 * CLOCKS_PER_MICROSECOND)
-		* M_PI / (8333 * CLOCKS_PER_MICROSECOND);
+	this->times[ind] = now;
+	this->angles[ind] = lh_angle_from_ticks(
+		(int32_t) (delta - 4000 * CLOCKS_PER_MICROSECOND));
 
 	// let the caller know that we have a new valid measurement
 	return ind;
@@ -92,105 +110,79 @@ LighthouseSensor::sweep_pulse(
 
 
 int
-LighthouseSensor::poll()
+LighthouseSensor::edge(
+	uint32_t val,
+	bool rising
+)
 {
-	uint32_t val;
-	int rc = this->icp_falling.read(&val);
-	if (rc != 0)
+	if (!rising)
 	{
-		// we have a falling edge pulse, store the time stamp
+		// the start of a pulse; if there was already one then
+		// its rising edge went missing
+		if (this->in_pulse)
+			this->unpaired++;
+
 		this->last_falling = val;
+		this->in_pulse = true;
+		return -1;
+	}
+
+	if (!this->in_pulse)
+	{
+		this->unpaired++;
+		return -1;
 	}
 
-	rc = this->icp_rising.read(&val);
-	if (rc <= 0)
+	this->in_pulse = false;
+
+	// the longest sync pulse is about 135 usec, so anything much
+	// longer is two edges from different pulses
+	if (val - this->last_falling > 200 * CLOCKS_PER_MICROSECOND)
+	{
+		this->unpaired++;
 		return -1;
+	}
+
+	return this->pulse(val);
+}
 
+
+int
+LighthouseSensor::pulse(
+	uint32_t val
+)
+{
 	// We have a rising edge pulse, process it
 	const uint32_t len = val - this->last_falling;
-	const uint32_t duty = val - this->last_rising;
-	this->last_rising = val;
 
 	// short pulse means sweep by the laser.
 	if (len < 15 * CLOCKS_PER_MICROSECOND)
-		return this->sweep_pulse(val, len, duty);
+		return this->sweep_pulse(val, len);
 
+	// the tracker works out which lighthouse is sweeping and
+	// the OOTX bit from every sensor's view of the flash
+	this->sync->sync(this->id, this->last_falling, len);
 
-	// this is our first non-sweep pulse,
-	// reset our parameters to wait for our next sync.
-	if (this->got_sweep || duty > 800 * CLOCKS_PER_MICROSECOND)
+	if (debug)
 	{
-		this->lighthouse = 9;  // invalid
-		this->got_sweep = this->got_skip = this->got_not_skip = 0;
-	}
+		int skip = 9;
+		int rotor = 9;
+		int data = 9;
+		const char * name = "??";
 
-	int skip = 9;
-	int rotor = 9;
-	int data = 9;
-	const char * name = "??";
-
-	const unsigned window = 4 * CLOCKS_PER_MICROSECOND;
-
-	static const unsigned midpoints[] = {
-		(unsigned) (62.5 * CLOCKS_PER_MICROSECOND),
-		(unsigned) (83.3 * CLOCKS_PER_MICROSECOND),
-		(unsigned) (72.9 * CLOCKS_PER_MICROSECOND),
-		(unsigned) (93.8 * CLOCKS_PER_MICROSECOND),
-		(unsigned) (104.0 * CLOCKS_PER_MICROSECOND),
-		(unsigned) (125.0 * CLOCKS_PER_MICROSECOND),
-		(unsigned) (115.0 * CLOCKS_PER_MICROSECOND),
-		(unsigned) (135.0 * CLOCKS_PER_MICROSECOND),
-	};
-
-	static const char * const names[] = {
-		"j0", "j1", "k0", "k1", "j2", "j3", "k2", "k3",
-	};
-
-	for (int i = 0 ; i < 8 ; i++)
-	{
-		if (len < midpoints[i] - window)
-			continue;
-		if (len > midpoints[i] + window)
-			continue;
-
-		skip = (i >> 2) & 1;
-		rotor = (i >> 1) & 1;
-		data = (i >> 0) & 1;
-		name = names[i];
-		break;
-	}
+		static const char * const names[] = {
+			"j0", "j1", "k0", "k1", "j2", "j3", "k2", "k3",
+		};
 
-	if (skip == 0)
-	{
-		// store the time of the rising edge of this pulse
-		// and the rotor that is being sent
-		this->zero_time = last_falling;
-		this->axis = rotor;
-		this->got_not_skip = 1;
-
-		// if we have already seen the skip sync pluse,
-		// then this is lighthouse 0,
-		if (this->got_skip)
+		const int i = SyncClassifier::classify(len);
+		if (i >= 0)
 		{
-			this->lighthouse = 0;
-			ootx.add(data);
-			//Serial.println((unsigned) data);
+			skip = (i >> 2) & 1;
+			rotor = (i >> 1) & 1;
+			data = (i >> 0) & 1;
+			name = names[i];
 		}
-	} else
-	if (skip == 1)
-	{
-		this->got_skip = 1;
 
-		// if we have already seen the not-skip sync pulse,
-		// then this is lighthouse 1
-		if (this->got_not_skip)
-			this->lighthouse = 1;
-	}
-
-
-
-	if (debug)
-	{
 		Serial.print(val);
 		Serial.print(",");
 		Serial.print(this->id);
@@ -6,57 +6,81 @@
 #define _LighthouseSensor_h_
 
 #include "InputCapture.h"
-#include "LighthouseOOTX.h"
+#include "LighthouseAngle.h"
+#include "LighthouseSyncTracker.h"
 
 class LighthouseSensor
 {
 public:
 	LighthouseSensor() {}
 
-	// Two input capture pins, one for rising, one for falling
-	void begin(int id, int input_capture0, int input_capture1);
-
-	// Check for any activity,
-	// return the sample index if a new angle measurement is available
-	int poll();
-
-	// Measured angles from the sweep pulses
+	// Two input capture pins, one for rising, one for falling.
+	// Their edges are tagged with the id in the shared queue, and
+	// the sync pulses are shared with the other sensors through
+	// the tracker.
+	void begin(
+		int id,
+		int input_capture0,
+		int input_capture1,
+		LighthouseSyncTracker * sync
+	);
+
+	// One pin that captures both edges (InputCapture's CHANGE), for
+	// half the timer channels.  Its edges come out of the same queue
+	// tagged rising or falling, so edge() is the same.
+	void begin(
+		int id,
+		int input_capture,
+		LighthouseSyncTracker * sync
+	);
+
+	// Process an edge from InputCapture::read() that has this
+	// sensor's id, return the sample index if a new angle
+	// measurement is available
+	int edge(uint32_t when, bool rising);
+
+	// Forget any half seen pulse, after edges have been lost.
+	// The tracker has to be resynced as well.
+	void resync();
+
+	// Edges that did not pair up into a pulse: a rising edge with no
+	// falling one before it, two falling edges in a row, or a pulse
+	// too long to be from a lighthouse
+	uint32_t unpaired;
+
+	// Ticks from the 0 degree time to the middle of each sweep pulse,
+	// rescaled for the measured rotor speed, and the angles from them
+	// in radians or binary angles (see LighthouseAngle.h)
 	uint32_t raw[4];
-	float angles[4];
+	lh_angle_t angles[4];
 
-	static const bool debug = 0;
+	// Capture time of the middle of each sweep pulse
+	uint32_t times[4];
 
-	LighthouseOOTX ootx;
+	static const bool debug = 0;
 
 private:
 	int id;
 	InputCapture icp_rising;
 	InputCapture icp_falling;
 
-	// process a sweep pulse and return -1 if no new pulse detected
-	int sweep_pulse(unsigned when, unsigned len, unsigned duty);
-
-	// What was the last pulse times in each direction?
-	uint32_t last_rising;
-	uint32_t last_falling;
-
-	// When did the non-skipped rotor report 0 degrees?
-	uint32_t zero_time;
+	// process a complete pulse, from falling to rising edge
+	int pulse(uint32_t val);
 
-	// Which rotor was reported by the sync pulse?
-	unsigned axis;
+	// process a sweep pulse and return -1 if no new pulse detected
+	int sweep_pulse(unsigned when, unsigned len);
 
-	// Have we seen a sweep pulse?
-	unsigned got_sweep;
+	// Who knows which lighthouse is sweeping?
+	LighthouseSyncTracker * sync;
 
-	// Have we seen a sync pulse that says skip?
-	unsigned got_skip;
+	// Which flash did we last take a sweep for?
+	uint32_t sweep_cycle;
 
-	// Have we seen a sync pulse that says not-skipped?
-	unsigned got_not_skip;
+	// When did the current pulse start?
+	uint32_t last_falling;
 
-	// Which lighthouse did we compute this sweep was for?
-	unsigned lighthouse;
+	// Is there a falling edge waiting for its rising one?
+	bool in_pulse;
 };
 
 #endif
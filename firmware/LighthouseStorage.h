@@ -0,0 +1,26 @@
+/** \file
+ * Non-volatile storage for calibration data.
+ *
+ * On the Teensy this is the EEPROM (see LighthouseEEPROM.h); the host
+ * build uses a file so that the same code can be exercised on Linux.
+ * Erased storage reads as 0xFF.
+ */
+#ifndef _LighthouseStorage_h_
+#define _LighthouseStorage_h_
+
+class LighthouseStorage
+{
+public:
+	virtual ~LighthouseStorage() {}
+
+	// total size in bytes
+	virtual unsigned size() = 0;
+
+	virtual bool read(unsigned addr, void * buf, unsigned len) = 0;
+
+	// implementations should skip bytes that are unchanged to
+	// save wear on the EEPROM
+	virtual bool write(unsigned addr, const void * buf, unsigned len) = 0;
+};
+
+#endif
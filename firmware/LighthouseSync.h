@@ -0,0 +1,165 @@
+/** \file
+ * Classify Lighthouse sync pulses by their length.
+ *
+ * The sync pulse length encodes three bits: skip, rotor and data.
+ * There are eight nominal lengths from 62.5 to 135 usec, and a pulse
+ * matches one if it is within +/- 4 usec of it.
+ *
+ * Rather than scanning all eight windows, the pulse length is shifted
+ * down to a bucket that is no wider than the gap between windows, so
+ * each bucket overlaps at most one of them.  A table built at compile
+ * time gives the candidate window for each bucket and one unsigned
+ * compare checks the exact edges, so the result is identical to the
+ * scan for every input.
+ *
+ * The tables depend on the capture clock rate, so the classifier is a
+ * template on the number of timer ticks per microsecond; the firmware
+ * uses LighthouseSyncClassifier<CLOCKS_PER_MICROSECOND>.
+ */
+#ifndef _LighthouseSync_h_
+#define _LighthouseSync_h_
+
+#include <stdint.h>
+
+namespace lighthouse_sync {
+
+// nominal pulse lengths, indexed by skip << 2 | rotor << 1 | data
+static constexpr double midpoint_us(unsigned i)
+{
+	return
+		i == 0 ? 62.5 :
+		i == 1 ? 83.3 :
+		i == 2 ? 72.9 :
+		i == 3 ? 93.8 :
+		i == 4 ? 104.0 :
+		i == 5 ? 125.0 :
+		i == 6 ? 115.0 :
+		135.0;
+}
+
+// floor(log2(x)), for x > 0
+static constexpr unsigned ilog2(unsigned x)
+{
+	return x <= 1 ? 0 : 1 + ilog2(x >> 1);
+}
+
+template <unsigned... Is> struct seq {};
+template <unsigned N, unsigned... Is> struct make_seq : make_seq<N-1, N-1, Is...> {};
+template <unsigned... Is> struct make_seq<0, Is...> { typedef seq<Is...> type; };
+
+
+// Window edges and the bucket to window map for one clock rate
+template <unsigned CPM>
+struct windows
+{
+	// +/- this many ticks around the nominal length
+	static constexpr unsigned width = 4 * CPM;
+
+	// the narrowest gap between two windows is about 2.4 usec
+	static constexpr unsigned shift = ilog2(2 * CPM);
+
+	static constexpr unsigned lo(unsigned i)
+	{
+		return (unsigned)(midpoint_us(i) * CPM) - width;
+	}
+
+	static constexpr unsigned hi(unsigned i)
+	{
+		return (unsigned)(midpoint_us(i) * CPM) + width;
+	}
+
+	// one past the last bucket that can hold a sync pulse
+	static constexpr unsigned buckets()
+	{
+		return (hi(7) >> shift) + 1;
+	}
+
+	// does bucket q overlap window i?
+	static constexpr bool overlaps(unsigned q, unsigned i)
+	{
+		return (q << shift) <= hi(i)
+			&& ((q + 1) << shift) - 1 >= lo(i);
+	}
+
+	// first window that overlaps bucket q, starting at i, or -1
+	static constexpr int candidate(unsigned q, unsigned i = 0)
+	{
+		return i >= 8 ? -1
+			: overlaps(q, i) ? (int) i
+			: candidate(q, i + 1);
+	}
+
+	// number of windows that overlap bucket q
+	static constexpr unsigned overlap_count(unsigned q, unsigned i = 0)
+	{
+		return i >= 8 ? 0 : overlaps(q, i) + overlap_count(q, i + 1);
+	}
+
+	static constexpr bool unambiguous(unsigned q = 0)
+	{
+		return q >= buckets() ? true
+			: overlap_count(q) <= 1 && unambiguous(q + 1);
+	}
+};
+
+
+template <unsigned CPM, typename Buckets, typename Windows>
+struct tables;
+
+template <unsigned CPM, unsigned... Qs, unsigned... Is>
+struct tables<CPM, seq<Qs...>, seq<Is...> >
+{
+	static const int8_t candidate[sizeof...(Qs)];
+	static const unsigned lo[sizeof...(Is)];
+};
+
+template <unsigned CPM, unsigned... Qs, unsigned... Is>
+const int8_t tables<CPM, seq<Qs...>, seq<Is...> >::candidate[] = {
+	(int8_t) windows<CPM>::candidate(Qs)...
+};
+
+template <unsigned CPM, unsigned... Qs, unsigned... Is>
+const unsigned tables<CPM, seq<Qs...>, seq<Is...> >::lo[] = {
+	windows<CPM>::lo(Is)...
+};
+
+}
+
+
+template <unsigned CPM>
+class LighthouseSyncClassifier
+{
+public:
+	typedef lighthouse_sync::windows<CPM> windows;
+
+	typedef lighthouse_sync::tables<
+		CPM,
+		typename lighthouse_sync::make_seq<windows::buckets()>::type,
+		typename lighthouse_sync::make_seq<8>::type
+	> tables;
+
+	static_assert(windows::unambiguous(),
+		"sync buckets overlap more than one window");
+
+	/**
+	 * Returns skip << 2 | rotor << 1 | data for the pulse,
+	 * or -1 if it is not a valid sync pulse length.
+	 */
+	static inline int classify(unsigned len)
+	{
+		const unsigned q = len >> windows::shift;
+		if (q >= windows::buckets())
+			return -1;
+
+		const int i = tables::candidate[q];
+		if (i < 0)
+			return -1;
+
+		if (len - tables::lo[i] > 2 * windows::width)
+			return -1;
+
+		return i;
+	}
+};
+
+#endif
@@ -0,0 +1,317 @@
+#include "LighthouseSyncTracker.h"
+#include "LighthouseSync.h"
+
+typedef LighthouseSyncClassifier<CLOCKS_PER_MICROSECOND> SyncClassifier;
+
+
+void
+LighthouseSyncTracker::begin()
+{
+	this->flashes = 0;
+	this->rescued = 0;
+	this->cycle = 0;
+	this->updated = 0;
+	this->disputed = 0;
+	for (int i = 0 ; i < 2 ; i++)
+	{
+		this->missed[i] = 0;
+		this->station_seen[i] = false;
+		this->period[i] = nominal_period << 8;
+		this->period_samples[i] = 0;
+		this->scale[i] = ((uint64_t) (8333 * CLOCKS_PER_MICROSECOND) << 38)
+			/ this->period[i];
+	}
+	this->resync();
+}
+
+
+void
+LighthouseSyncTracker::resync()
+{
+	this->lighthouse = 9;
+	this->axis = 0;
+	this->zero_time = 0;
+	this->zero_seen = 0;
+	this->got_skip = this->got_not_skip = false;
+	this->in_flash = false;
+	this->swept = false;
+}
+
+
+int
+LighthouseSyncTracker::sync(
+	unsigned id,
+	uint32_t start,
+	uint32_t len
+)
+{
+	const int cls = SyncClassifier::classify(len);
+
+	// the pulses are reported at their ends, so a sensor that saw
+	// the flash end later can still have seen it start earlier
+	const int32_t offset = start - this->flash_start;
+
+	if (!this->in_flash
+	||  offset > (int32_t) merge_window
+	||  offset < -(int32_t) merge_window)
+	{
+		// the first flash after a sweep, or one too long after the
+		// last, starts a new pair
+		if (this->in_flash)
+			this->end_flash();
+
+		if (!this->in_flash
+		||  this->swept
+		||  start - this->flash_start > pair_window)
+		{
+			this->lighthouse = 9;
+			this->zero_seen = 0;
+			this->got_skip = this->got_not_skip = false;
+		}
+
+		this->before.lighthouse = this->lighthouse;
+		this->before.axis = this->axis;
+		this->before.zero_time = this->zero_time;
+		this->before.zero_seen = this->zero_seen;
+		this->before.got_skip = this->got_skip;
+		this->before.got_not_skip = this->got_not_skip;
+
+		this->in_flash = true;
+		this->swept = false;
+		this->cycle++;
+		this->flashes++;
+		this->flash_start = start;
+		this->flash_offsets = 0;
+		this->flash_seen = 0;
+		this->voters = 0;
+		this->ones = 0;
+		this->confidence[0] = this->confidence[1] = 0;
+		this->winner = -1;
+		for (int i = 0 ; i < 8 ; i++)
+			this->votes[i] = 0;
+
+		this->station = this->flash_station(start);
+	}
+
+	this->flash_seen |= 1 << id;
+
+	if (cls < 0)
+		return this->winner;
+
+	this->votes[cls]++;
+	this->voters++;
+	this->ones += cls & 1;
+
+	// how far inside the window the length is, 1 at the edges
+	const uint32_t width = SyncClassifier::windows::width;
+	const uint32_t off = len - SyncClassifier::tables::lo[cls];
+	this->confidence[cls & 1] += 1 + width - (off > width ? off - width : width - off);
+	this->flash_offsets += (int32_t) (start - this->flash_start);
+
+	// ties go to the class that was seen first
+	if (this->winner < 0 || this->votes[cls] > this->votes[this->winner])
+		this->winner = cls;
+
+	// redo the pair state with the vote so far
+	this->lighthouse = this->before.lighthouse;
+	this->axis = this->before.axis;
+	this->zero_time = this->before.zero_time;
+	this->zero_seen = this->before.zero_seen;
+	this->got_skip = this->before.got_skip;
+	this->got_not_skip = this->before.got_not_skip;
+
+	const int skip = (this->winner >> 2) & 1;
+	const int rotor = (this->winner >> 1) & 1;
+
+	if (skip == 0)
+	{
+		// the 0 degree time is the start of the flash, averaged
+		// over the sensors that saw it
+		this->zero_time = this->flash_start
+			+ this->flash_offsets / (int32_t) this->voters;
+		this->zero_seen = this->flash_seen;
+		this->axis = rotor;
+		this->got_not_skip = true;
+
+		// if we have already seen the skip sync pulse,
+		// then this is lighthouse 0,
+		if (this->got_skip)
+			this->lighthouse = 0;
+	} else {
+		this->got_skip = true;
+
+		// if we have already seen the not-skip sync pulse,
+		// then this is lighthouse 1
+		if (this->got_not_skip)
+			this->lighthouse = 1;
+	}
+
+	return this->winner;
+}
+
+
+int
+LighthouseSyncTracker::sweep(
+	unsigned id,
+	uint32_t when,
+	uint32_t * cycle,
+	uint32_t * delta
+)
+{
+	*delta = when - this->zero_time;
+
+	const bool valid = this->lighthouse != 9
+		&& *cycle != this->cycle
+		&& *delta < 8000 * CLOCKS_PER_MICROSECOND;
+
+	// flag that this sensor has had its sweep, even if it is
+	// not a valid length, and that the next flash starts a new pair
+	*cycle = this->cycle;
+	this->swept = true;
+
+	if (!valid)
+		return -1;
+
+	// in nominal ticks, as if the rotor and our clock agreed
+	*delta = (uint32_t) (((uint64_t) *delta * this->scale[this->lighthouse]
+		+ (1 << 29)) >> 30);
+
+	if ((this->zero_seen & (1 << id)) == 0)
+		this->rescued++;
+
+	return this->lighthouse*2 + this->axis;
+}
+
+
+/*
+ * Lighthouse 0 flashes 400 usec into the period that lighthouse 1
+ * starts.  Either station's last flash is enough to tell them apart,
+ * so that one of them can be occluded for a long time without the
+ * phase of the other drifting out of the window.
+ */
+unsigned
+LighthouseSyncTracker::flash_station(
+	uint32_t start
+) const
+{
+	const uint32_t window = 50 * CLOCKS_PER_MICROSECOND;
+	const uint32_t second = 400 * CLOCKS_PER_MICROSECOND;
+
+	if (this->station_seen[1])
+	{
+		const uint32_t period = this->period[1] >> 8;
+		const uint32_t phase = (start - this->station_start[1]) % period;
+		if (phase > second - window && phase < second + window)
+			return 0;
+	}
+
+	if (this->station_seen[0])
+	{
+		const uint32_t period = this->period[0] >> 8;
+		const uint32_t phase = (start - this->station_start[0]) % period;
+		if (phase < window || phase > period - window)
+			return 0;
+	}
+
+	return 1;
+}
+
+
+/*
+ * The interval may span a few periods if flashes were missed.  Anything
+ * more than 1000 ppm from the estimate is a misattributed flash, not
+ * drift, since the crystal and the rotor are both much better than that.
+ * The first 64 periods are averaged and then it is a running average
+ * with the same time constant, about half a second.
+ */
+void
+LighthouseSyncTracker::track_period(
+	unsigned lh,
+	uint32_t interval
+)
+{
+	const uint32_t period = this->period[lh] >> 8;
+	const uint32_t n = (interval + period / 2) / period;
+	if (n == 0 || n > 4)
+		return;
+
+	const int32_t err = (int32_t) ((((uint64_t) interval << 8) / n)
+		- this->period[lh]);
+	const int32_t limit = this->period[lh] >> 10;
+	if (err > limit || err < -limit)
+		return;
+
+	if (this->period_samples[lh] < 64)
+		this->period_samples[lh]++;
+
+	this->period[lh] += err / (int32_t) this->period_samples[lh];
+	this->scale[lh] = ((uint64_t) (8333 * CLOCKS_PER_MICROSECOND) << 38)
+		/ this->period[lh];
+}
+
+
+int32_t
+LighthouseSyncTracker::drift_ppm(
+	unsigned lh
+) const
+{
+	const int64_t nominal = (int64_t) nominal_period << 8;
+	return (int32_t) ((((int64_t) this->period[lh] - nominal) * 1000000) / nominal);
+}
+
+
+/*
+ * The flash is over once the next one starts, so all of the sensors
+ * that saw it have voted on its OOTX bit.
+ */
+void
+LighthouseSyncTracker::end_flash()
+{
+	const unsigned lh = this->station;
+	LighthouseOOTX * const o = &this->ootx[lh];
+
+	// a flash without a valid sync length from anyone
+	// is a lost bit, the same as no flash at all
+	const bool have_bit = this->voters != 0;
+
+	if (this->station_seen[lh])
+	{
+		const uint32_t interval = this->flash_start - this->station_start[lh];
+		const uint32_t period = this->period[lh] >> 8;
+		this->track_period(lh, interval);
+
+		// were any of this station's flashes missed since the last one?
+		if (interval > period + period / 2)
+		{
+			this->missed[lh]++;
+			o->add(9);
+		}
+	}
+
+	this->station_start[lh] = this->flash_start;
+	this->station_seen[lh] = true;
+	this->updated |= 1 << lh;
+
+	if (!have_bit)
+	{
+		o->add(9);
+		return;
+	}
+
+	unsigned bit;
+	if (2 * this->ones > this->voters)
+		bit = 1;
+	else
+	if (2 * this->ones < this->voters)
+		bit = 0;
+	else
+	if (this->confidence[1] != this->confidence[0])
+		bit = this->confidence[1] > this->confidence[0];
+	else
+		bit = this->winner & 1;
+
+	if (this->ones != 0 && this->ones != this->voters)
+		this->disputed++;
+
+	o->add(bit);
+}
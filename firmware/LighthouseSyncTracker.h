@@ -0,0 +1,148 @@
+/** \file
+ * Sync flash tracking shared by all of the sensors on the board.
+ *
+ * Every sensor sees the same sync flashes within a few usec of each
+ * other, so rather than each one running its own skip / not-skip state
+ * machine, they report their classified sync pulses here.  Pulses that
+ * start within merge_window of the first one are the same flash, and
+ * their classes are combined by vote since a partly occluded sensor
+ * can see a pulse of the wrong length.  The pair of flashes before each
+ * sweep says which lighthouse and rotor are sweeping, and the start of
+ * the non-skipped flash is the 0 degree time that every sensor's sweep
+ * is measured from, including sensors that missed the flash.
+ *
+ * Every flash also carries one bit of its base station's OOTX message.
+ * The first flash of each pair is lighthouse 1 and the second, 400 usec
+ * later, is lighthouse 0, so the flashes are attributed by their phase
+ * in the sync period even when one of the pair is missed.  The data
+ * bits of the sensors that saw a flash are combined by majority, with
+ * ties going to the pulses closest to their nominal lengths, and go to
+ * one decoder per base station.  A flash that nobody saw drops that
+ * station's message rather than corrupting it.
+ *
+ * The time between a station's flashes is its sync period in our own
+ * timer ticks, so any difference between the Teensy's crystal and the
+ * rotor speed shows up in it.  It is averaged per station and the
+ * sweep times are rescaled by it to the nominal 8333 usec half turn
+ * that the angle conversion assumes, so that the drift doesn't turn
+ * into an angle error.
+ */
+#ifndef _LighthouseSyncTracker_h_
+#define _LighthouseSyncTracker_h_
+
+#include <stdint.h>
+#include "InputCapture.h"
+#include "LighthouseOOTX.h"
+
+class LighthouseSyncTracker
+{
+public:
+	LighthouseSyncTracker() {}
+
+	void begin();
+
+	// Forget the current flashes and wait for the next pair, after
+	// edges have been lost
+	void resync();
+
+	// A sync pulse of len ticks that sensor id saw starting at
+	// `start`.  Returns the class of the whole flash so far, as
+	// LighthouseSyncClassifier::classify() does, or -1.
+	int sync(unsigned id, uint32_t start, uint32_t len);
+
+	// A sweep pulse that sensor id saw centered at `when`.  *cycle is
+	// the sensor's own record of the last flash it took a sweep for,
+	// so that it gets at most one per sweep.  Returns the angle index
+	// and the ticks since the 0 degree time in *delta, or -1 if the
+	// sweep can't be attributed.
+	int sweep(unsigned id, uint32_t when, uint32_t * cycle, uint32_t * delta);
+
+	// Which lighthouse is sweeping (9 if not known yet) and which rotor
+	unsigned lighthouse;
+	unsigned axis;
+
+	// When did the non-skipped rotor report 0 degrees?
+	uint32_t zero_time;
+
+	// Counted once per flash, not per sensor
+	uint32_t flashes;
+
+	// Sweeps for sensors that did not see the non-skipped flash
+	// themselves, which would have been dropped without the tracker
+	uint32_t rescued;
+
+	// One OOTX decoder per lighthouse.  Bit lh of `updated` is set
+	// when ootx[lh] has had a new bit; the caller clears it.
+	LighthouseOOTX ootx[2];
+	uint8_t updated;
+
+	// Flashes that no sensor saw, which cost their station its message
+	uint32_t missed[2];
+
+	// Data bits where the sensors that saw the flash did not agree
+	uint32_t disputed;
+
+	// Sync period of each lighthouse in 1/256 timer ticks, and how
+	// far that is from nominal in parts per million
+	uint32_t period[2];
+	int32_t drift_ppm(unsigned lh) const;
+
+	// pulses that start this close together are one flash
+	static const uint32_t merge_window = 20 * CLOCKS_PER_MICROSECOND;
+
+	// the two flashes of a pair are 400 usec apart
+	static const uint32_t pair_window = 800 * CLOCKS_PER_MICROSECOND;
+
+	// nominal sync period, 120 Hz
+	static const uint32_t nominal_period = 25000 * CLOCKS_PER_MICROSECOND / 3;
+
+private:
+	// the skip / not-skip state, which is redone from the copy taken
+	// before the flash every time another sensor's vote comes in
+	struct state {
+		unsigned lighthouse;
+		unsigned axis;
+		uint32_t zero_time;
+		uint32_t zero_seen;
+		bool got_skip;
+		bool got_not_skip;
+	};
+
+	state before;
+	bool got_skip;
+	bool got_not_skip;
+
+	// sensors that saw the non-skipped flash, one bit per id
+	uint32_t zero_seen;
+
+	// the flash that is being voted on
+	bool in_flash;
+	uint32_t cycle;
+	uint32_t flash_start;
+	int32_t flash_offsets;
+	uint32_t flash_seen;
+	uint8_t votes[8];
+	unsigned voters;
+	unsigned ones;
+	uint32_t confidence[2];
+	int winner;
+	unsigned station;
+
+	// start of the last flash from each station, and if it is known
+	uint32_t station_start[2];
+	bool station_seen[2];
+
+	// sweep ticks to nominal ticks in Q30, and how many periods
+	// have been averaged so far
+	uint32_t scale[2];
+	uint32_t period_samples[2];
+
+	unsigned flash_station(uint32_t start) const;
+	void end_flash();
+	void track_period(unsigned lh, uint32_t interval);
+
+	// has any sensor taken a sweep since the last flash?
+	bool swept;
+};
+
+#endif
@@ -0,0 +1,311 @@
+/** \file
+ * Encode the binary telemetry frames.
+ */
+#include "LighthouseTelemetry.h"
+#include <string.h>
+
+
+LighthouseTelemetry::LighthouseTelemetry()
+{
+	seq = 0;
+
+	// force a key frame as the first fix for every sensor
+	key_frames();
+	memset(last_time, 0, sizeof(last_time));
+}
+
+
+void
+LighthouseTelemetry::key_frames()
+{
+	for (unsigned i = 0 ; i < max_sensors ; i++)
+		since_key[i] = key_interval;
+}
+
+
+static inline unsigned
+put16(
+	uint8_t * buf,
+	uint16_t val
+)
+{
+	buf[0] = val >> 0;
+	buf[1] = val >> 8;
+	return 2;
+}
+
+
+static inline unsigned
+put24(
+	uint8_t * buf,
+	uint32_t val
+)
+{
+	buf[0] = val >> 0;
+	buf[1] = val >> 8;
+	buf[2] = val >> 16;
+	return 3;
+}
+
+
+static inline unsigned
+put32(
+	uint8_t * buf,
+	uint32_t val
+)
+{
+	buf[0] = val >> 0;
+	buf[1] = val >> 8;
+	buf[2] = val >> 16;
+	buf[3] = val >> 24;
+	return 4;
+}
+
+
+static inline unsigned
+put_float(
+	uint8_t * buf,
+	float val
+)
+{
+	uint32_t bits;
+	memcpy(&bits, &val, sizeof(bits));
+	return put32(buf, bits);
+}
+
+
+// convert meters to a saturated signed 16-bit count of units
+static inline int16_t
+clamp16(
+	float val,
+	float scale
+)
+{
+	val *= scale;
+	if (val > 32767)
+		return 32767;
+	if (val < -32767)
+		return -32767;
+	return (int16_t) val;
+}
+
+
+unsigned
+LighthouseTelemetry::start(
+	uint8_t * buf,
+	unsigned type,
+	unsigned id
+)
+{
+	buf[0] = LH_SYNC;
+	buf[1] = (type << 4) | (id & 0xF);
+	buf[2] = seq++;
+	return 3;
+}
+
+
+unsigned
+LighthouseTelemetry::finish(
+	uint8_t * buf,
+	unsigned len
+)
+{
+	buf[len] = lighthouse_crc8(buf + 1, len - 1);
+	return len + 1;
+}
+
+
+unsigned
+LighthouseTelemetry::fix(
+	uint8_t * buf,
+	unsigned id,
+	uint32_t time,
+	const uint32_t raw[4],
+	const float xyz[3],
+	float dist
+)
+{
+	id &= max_sensors - 1;
+	uint32_t * const last = this->last_raw[id];
+
+	// use a delta frame if every tick moved by less than 16 bits
+	// and it is less than 24 bits of ticks since the last fix
+	bool key = ++this->since_key[id] >= key_interval;
+	int32_t delta[4];
+	const uint32_t dt = time - this->last_time[id];
+
+	if (dt >= 1 << 24)
+		key = true;
+
+	for (int i = 0 ; i < 4 ; i++)
+	{
+		delta[i] = raw[i] - last[i];
+		if (delta[i] > 32767 || delta[i] < -32768)
+			key = true;
+	}
+
+	unsigned len;
+
+	if (key)
+	{
+		len = start(buf, LH_FRAME_FIX_KEY, id);
+		len += put32(buf + len, time);
+		for (int i = 0 ; i < 4 ; i++)
+			len += put24(buf + len, raw[i]);
+		this->since_key[id] = 0;
+	} else {
+		len = start(buf, LH_FRAME_FIX_DELTA, id);
+		len += put24(buf + len, dt);
+		for (int i = 0 ; i < 4 ; i++)
+			len += put16(buf + len, delta[i]);
+	}
+
+	memcpy(last, raw, sizeof(this->last_raw[id]));
+	this->last_time[id] = time;
+
+	for (int i = 0 ; i < 3 ; i++)
+		len += put16(buf + len, clamp16(xyz[i], 1000));
+
+	// dist is never negative
+	float d = dist * 10000;
+	len += put16(buf + len, d < 65535 ? (uint16_t) d : 65535);
+
+	return finish(buf, len);
+}
+
+
+unsigned
+LighthouseTelemetry::ootx(
+	uint8_t * buf,
+	unsigned id,
+	const uint8_t * bytes,
+	unsigned length
+)
+{
+	if (length > LH_OOTX_MAX)
+		return 0;
+
+	unsigned len = start(buf, LH_FRAME_OOTX, id);
+	len += put16(buf + len, length);
+	memcpy(buf + len, bytes, length);
+	len += length;
+
+	return finish(buf, len);
+}
+
+
+unsigned
+LighthouseTelemetry::calibration(
+	uint8_t * buf,
+	unsigned id,
+	const LighthouseCalibration & cal
+)
+{
+	unsigned len = start(buf, LH_FRAME_CALIBRATION, id);
+	len += put16(buf + len, cal.fw_version);
+	buf[len++] = cal.protocol;
+	len += put32(buf + len, cal.id);
+
+	for (int i = 0 ; i < 2 ; i++)
+		len += put_float(buf + len, cal.phase[i]);
+	for (int i = 0 ; i < 2 ; i++)
+		len += put_float(buf + len, cal.tilt[i]);
+	for (int i = 0 ; i < 2 ; i++)
+		len += put_float(buf + len, cal.curve[i]);
+	for (int i = 0 ; i < 2 ; i++)
+		len += put_float(buf + len, cal.gibphase[i]);
+	for (int i = 0 ; i < 2 ; i++)
+		len += put_float(buf + len, cal.gibmag[i]);
+
+	for (int i = 0 ; i < 3 ; i++)
+		buf[len++] = cal.accel[i];
+
+	buf[len++] = cal.unlock_count;
+	buf[len++] = cal.hw_version;
+	buf[len++] = cal.mode;
+	buf[len++] = cal.faults;
+
+	return finish(buf, len);
+}
+
+
+unsigned
+LighthouseTelemetry::pose(
+	uint8_t * buf,
+	unsigned id,
+	uint32_t time,
+	const float xyz[3],
+	const float q[4],
+	unsigned used,
+	float rms
+)
+{
+	unsigned len = start(buf, LH_FRAME_POSE, id);
+	len += put32(buf + len, time);
+
+	for (int i = 0 ; i < 3 ; i++)
+		len += put16(buf + len, clamp16(xyz[i], 1000));
+	for (int i = 0 ; i < 4 ; i++)
+		len += put16(buf + len, clamp16(q[i], 32767));
+
+	buf[len++] = used < 255 ? used : 255;
+
+	float r = rms * 1e6f;
+	len += put16(buf + len, r < 65535 ? (uint16_t) r : 65535);
+
+	return finish(buf, len);
+}
+
+
+unsigned
+LighthouseTelemetry::text(
+	uint8_t * buf,
+	unsigned id,
+	const char * msg
+)
+{
+	unsigned length = strlen(msg);
+	if (length > LH_OOTX_MAX)
+		length = LH_OOTX_MAX;
+
+	unsigned len = start(buf, LH_FRAME_TEXT, id);
+	len += put16(buf + len, length);
+	memcpy(buf + len, msg, length);
+	len += length;
+
+	return finish(buf, len);
+}
+
+
+unsigned
+LighthouseTelemetry::edges(
+	uint8_t * buf,
+	unsigned flags,
+	const uint8_t * bytes,
+	unsigned length
+)
+{
+	if (length > LH_OOTX_MAX)
+		return 0;
+
+	unsigned len = start(buf, LH_FRAME_EDGES, flags);
+	len += put16(buf + len, length);
+	memcpy(buf + len, bytes, length);
+	len += length;
+
+	return finish(buf, len);
+}
+
+
+unsigned
+LighthouseTelemetry::time(
+	uint8_t * buf,
+	uint64_t ticks
+)
+{
+	unsigned len = start(buf, LH_FRAME_TIME, 0);
+	len += put32(buf + len, ticks);
+	len += put32(buf + len, ticks >> 32);
+
+	return finish(buf, len);
+}
@@ -0,0 +1,220 @@
+/** \file
+ * Binary telemetry stream from the tracker to the host.
+ *
+ * Every frame starts with a sync byte, then a header byte with the
+ * frame type in the top nibble and the sensor id in the bottom nibble,
+ * then a sequence number that increments on every frame so that the
+ * host can tell when it has lost some.  The payload follows and the
+ * frame ends with a CRC-8 over everything after the sync byte.
+ * Multi-byte values are little endian.
+ *
+ * Times are the low 32 bits of the 64-bit capture timer (see
+ * InputCapture::extend()), and a TIME frame with all 64 bits is sent
+ * every second so that the host can extend them the same way and
+ * relate them to its own clock.
+ *
+ * Position fixes are fixed size.  The time of the sweep and the raw
+ * sweep ticks are sent as deltas from the previous fix for the same
+ * sensor, with a key frame of absolute values every key_interval fixes
+ * or whenever a delta does not fit.  The host must drop delta frames
+ * after a sequence gap until the next key frame.
+ *
+ *	FIX_KEY (28 bytes)		FIX_DELTA (23 bytes)
+ *	 0  sync			 0  sync
+ *	 1  type | sensor		 1  type | sensor
+ *	 2  seq				 2  seq
+ *	 3  time, u32			 3  time delta, u24
+ *	 7  raw[0..3], u24 each		 6  raw[0..3] delta, s16 each
+ *	19  x, y, z in mm, s16 each	14  x, y, z in mm, s16 each
+ *	25  dist in 0.1 mm, u16		20  dist in 0.1 mm, u16
+ *	27  crc8			22  crc8
+ *
+ *	OOTX and TEXT (6 + length bytes)
+ *	 0  sync
+ *	 1  type | lighthouse
+ *	 2  seq
+ *	 3  length, u16
+ *	 5  bytes[length]
+ *	 n  crc8
+ *
+ * TEXT frames carry human readable diagnostics that are only sent
+ * when the host asks for them.
+ *
+ * EDGES frames have the same layout and carry raw capture timestamps
+ * when the host has asked for them (see LighthouseEdgeStream.h).  The
+ * bottom nibble of the header has LH_EDGES_LOST set if InputCapture
+ * lost edges before the first one in the frame.
+ *
+ *	CALIBRATION (58 bytes), a CRC checked base station info block
+ *	 0  sync
+ *	 1  type | lighthouse
+ *	 2  seq
+ *	 3  fw_version, u16
+ *	 5  protocol, u8
+ *	 6  id, u32
+ *	10  phase[2], tilt[2], curve[2], gibphase[2], gibmag[2], f32 each
+ *	50  accel[3], s8 each
+ *	53  unlock_count, hw_version, mode, faults, u8 each
+ *	57  crc8
+ *
+ *	POSE (25 bytes), the rigid body fit of the sensor array
+ *	 0  sync
+ *	 1  type | body
+ *	 2  seq
+ *	 3  time, u32
+ *	 7  x, y, z in mm, s16 each
+ *	13  quaternion w, x, y, z in 1/32767, s16 each
+ *	21  angles used, u8
+ *	22  rms error in urad, u16
+ *	24  crc8
+ *
+ *	TIME (12 bytes), the capture timer when the frame was queued
+ *	 0  sync
+ *	 1  type
+ *	 2  seq
+ *	 3  ticks, u64
+ *	11  crc8
+ */
+#ifndef _LighthouseTelemetry_h_
+#define _LighthouseTelemetry_h_
+
+#include <stdint.h>
+#include "LighthouseOOTX.h"
+
+#define LH_SYNC			0xA5
+
+#define LH_FRAME_FIX_KEY	0x1
+#define LH_FRAME_FIX_DELTA	0x2
+#define LH_FRAME_OOTX		0x3
+#define LH_FRAME_TEXT		0x4
+#define LH_FRAME_CALIBRATION	0x5
+#define LH_FRAME_POSE		0x6
+#define LH_FRAME_EDGES		0x7
+#define LH_FRAME_TIME		0x8
+
+#define LH_EDGES_LOST		0x1
+
+#define LH_FIX_KEY_SIZE		28
+#define LH_FIX_DELTA_SIZE	23
+#define LH_CALIBRATION_SIZE	58
+#define LH_POSE_SIZE		25
+#define LH_TIME_SIZE		12
+#define LH_OOTX_OVERHEAD	6
+#define LH_OOTX_MAX		256
+#define LH_FRAME_MIN		4	// sync, header, seq and crc8
+#define LH_FRAME_MAX		(LH_OOTX_OVERHEAD + LH_OOTX_MAX)
+
+
+// CRC-8, polynomial 0x07, computed a nibble at a time
+static inline uint8_t
+lighthouse_crc8(
+	const uint8_t * buf,
+	unsigned len
+)
+{
+	static const uint8_t table[16] = {
+		0x00, 0x07, 0x0E, 0x09, 0x1C, 0x1B, 0x12, 0x15,
+		0x38, 0x3F, 0x36, 0x31, 0x24, 0x23, 0x2A, 0x2D,
+	};
+
+	uint8_t crc = 0;
+	while (len--)
+	{
+		crc ^= *buf++;
+		crc = (crc << 4) ^ table[crc >> 4];
+		crc = (crc << 4) ^ table[crc >> 4];
+	}
+
+	return crc;
+}
+
+
+class LighthouseTelemetry
+{
+public:
+	LighthouseTelemetry();
+
+	static const unsigned max_sensors = 16;
+	static const unsigned key_interval = 16;
+
+	// Make the next fix for every sensor a key frame, since the host
+	// can't use deltas after frames were lost on the way to it
+	void key_frames();
+
+	// Encode a position fix into buf, which must hold at least
+	// LH_FIX_KEY_SIZE bytes.  Returns the frame length.
+	unsigned fix(
+		uint8_t * buf,
+		unsigned id,
+		uint32_t time,
+		const uint32_t raw[4],
+		const float xyz[3],
+		float dist
+	);
+
+	// Encode an OOTX message into buf, which must hold at least
+	// LH_OOTX_OVERHEAD + len bytes.  Returns the frame length,
+	// or 0 if the message is too long.
+	unsigned ootx(
+		uint8_t * buf,
+		unsigned id,
+		const uint8_t * bytes,
+		unsigned len
+	);
+
+	// Encode a decoded base station info block into buf, which must
+	// hold at least LH_CALIBRATION_SIZE bytes.
+	unsigned calibration(
+		uint8_t * buf,
+		unsigned id,
+		const LighthouseCalibration & cal
+	);
+
+	// Encode the position and orientation of the sensor array into
+	// buf, which must hold at least LH_POSE_SIZE bytes.
+	unsigned pose(
+		uint8_t * buf,
+		unsigned id,
+		uint32_t time,
+		const float xyz[3],
+		const float q[4],
+		unsigned used,
+		float rms
+	);
+
+	// Encode the 64-bit timer into buf, which must hold at least
+	// LH_TIME_SIZE bytes.
+	unsigned time(
+		uint8_t * buf,
+		uint64_t ticks
+	);
+
+	// Encode a block of packed edges, up to LH_OOTX_MAX bytes, into
+	// buf, which must hold LH_OOTX_OVERHEAD + len bytes.  Returns the
+	// frame length, or 0 if the block is too long.
+	unsigned edges(
+		uint8_t * buf,
+		unsigned flags,
+		const uint8_t * bytes,
+		unsigned len
+	);
+
+	// Encode a diagnostic message, truncated to LH_OOTX_MAX bytes,
+	// into buf, which must hold LH_FRAME_MAX bytes.
+	unsigned text(
+		uint8_t * buf,
+		unsigned id,
+		const char * msg
+	);
+
+private:
+	uint8_t seq;
+	uint8_t since_key[max_sensors];
+	uint32_t last_raw[max_sensors][4];
+	uint32_t last_time[max_sensors];
+
+	unsigned start(uint8_t * buf, unsigned type, unsigned id);
+	unsigned finish(uint8_t * buf, unsigned len);
+};
+
+#endif
@@ -0,0 +1,25 @@
+/** \file
+ * LighthouseOutputPort on the Teensy's USB serial port.
+ */
+#ifndef _LighthouseUSBPort_h_
+#define _LighthouseUSBPort_h_
+
+#include <Arduino.h>
+#include "LighthouseOutput.h"
+
+class LighthouseUSBPort : public LighthouseOutputPort
+{
+public:
+	unsigned room()
+	{
+		const int n = Serial.availableForWrite();
+		return n > 0 ? n : 0;
+	}
+
+	unsigned write(const uint8_t * buf, unsigned len)
+	{
+		return Serial.write(buf, len);
+	}
+};
+
+#endif
@@ -1,227 +1,222 @@
 // adapted from https://github.com/ashtuchkin/vive-diy-position-sensor
 #include "LighthouseXYZ.h"
-#include <arm_math.h>
-
-static const int vec3d_size = 3;
-typedef float vec3d[vec3d_size];
-typedef float mat33[3*3];
-
-static void
-vec_cross_product(
-	const vec3d &a,
-	const vec3d &b,
-	vec3d &res
-)
-{
-	res[0] = a[1]*b[2] - a[2]*b[1];
-	res[1] = a[2]*b[0] - a[0]*b[2];
-	res[2] = a[0]*b[1] - a[1]*b[0];
-}
-
-
-static float
-vec_length(
-	vec3d &vec
-)
-{
-	float pow, res;
-
-	arm_power_f32(vec, vec3d_size, &pow);
-	arm_sqrt_f32(pow, &res);
-
-	return res;
-}
+#include "LighthouseMath.h"
+#ifdef LIGHTHOUSE_FIXED_POINT
+#include "LighthouseFixed.h"
+#include <string.h>
+#endif
 
-static void
+/*
+ * Ray from a lighthouse towards a sensor, in XYZ-space.
+ *
+ * The two sweep angles give the normals of the X plane (cos1, 0, -sin1)
+ * and the Y plane (0, cos2, sin2); the ray is their cross product,
+ * expanded here since half of the terms are zero.  It is normalized
+ * and then rotated by the lighthouse's rotation matrix, which
+ * translates the lighthouse-relative ray into the XYZ-space.
+ */
+static LH_INLINE void
 calc_ray_vec(
-	float rotation[9],
+	const float m[9],
 	float angle1,
 	float angle2,
-	vec3d &res
+	float res[3]
 )
 {
-	// Normal vector to X plane
-	vec3d a = {
-		+arm_cos_f32(angle1),
-		0,
-		-arm_sin_f32(angle1),
-	};
-
-	// Normal vector to Y plane
-	vec3d b = {
-		0,
-		+arm_cos_f32(angle2),
-		+arm_sin_f32(angle2),
-	};
-
-	vec3d ray = {};
-
-	// Intersection of two planes -> ray vector.
-	vec_cross_product(b, a, ray);
-
-	// Normalize ray length.
-	float len = vec_length(ray);
-	arm_scale_f32(ray, 1/len, ray, vec3d_size);
-
-	arm_matrix_instance_f32 source_rotation_matrix = {3, 3, rotation};
-	arm_matrix_instance_f32 ray_vec = {3, 1, ray};
-	arm_matrix_instance_f32 ray_rotated_vec = {3, 1, res};
-
-	// rotate the ray by the lighthouse's rotation matrix,
-	// which translates the lighthouse-relative ray into
-	// the XYZ-space.
-	arm_mat_mult_f32(&source_rotation_matrix, &ray_vec, &ray_rotated_vec);
-}
+	float s1, c1, s2, c2;
+	lh_sincosf(angle1, &s1, &c1);
+	lh_sincosf(angle2, &s2, &c2);
+
+	const float r0 = -c2 * s1;
+	const float r1 =  s2 * c1;
+	const float r2 = -c1 * c2;
 
+	const float inv = 1.0f / sqrtf(r0*r0 + r1*r1 + r2*r2);
 
+	res[0] = (m[0]*r0 + m[1]*r1 + m[2]*r2) * inv;
+	res[1] = (m[3]*r0 + m[4]*r1 + m[5]*r2) * inv;
+	res[2] = (m[6]*r0 + m[7]*r1 + m[8]*r2) * inv;
+}
 
 
 void LighthouseXYZ::begin(
-	int id,
+	unsigned sensors,
 	lightsource * lh1,
 	lightsource * lh2
 )
 {
-#if 0
-	// Convert Y up -> Z down; then rotate XY around Z clockwise and inverse X & Y
-	this->ned_rotation[0] = -cosf(ne_angle);
-	this->ned_rotation[1] =  0.0f;
-	this->ned_rotation[2] =  sinf(ne_angle);
-
-	this->ned_rotation[3] = -sinf(ne_angle);
-	this->ned_rotation[4] =  0.0f;
-	this->ned_rotation[5] = -cosf(ne_angle);
-
-	this->ned_rotation[6] =  0.0f;
-	this->ned_rotation[7] = -1.0f;
-	this->ned_rotation[8] =  0.0f;
-#endif
-
-	this->id = id;
+	if (sensors > max_sensors)
+		sensors = max_sensors;
+	this->sensors = sensors;
 
 	// store the lighthouse positions
 	this->lighthouse[0] = lh1;
 	this->lighthouse[1] = lh2;
 
-	this->xyz[0] = 0;
-	this->xyz[1] = 0;
-	this->xyz[2] = 0;
+	this->ready = 0;
+
+#ifdef LIGHTHOUSE_FIXED_POINT
+	// force the poses to be converted on the first compute()
+	memset(this->converted, 0xFF, sizeof(this->converted));
+#endif
+
+	for (unsigned i = 0 ; i < max_sensors ; i++)
+	{
+		this->fresh[i] = 0;
+		this->x[i] = 0;
+		this->y[i] = 0;
+		this->z[i] = 0;
+		this->dist[i] = 0;
+	}
 };
 
 
 /*
- * Algoritm:
+ * First 2 angles - x, y of station B; second 2 angles - x, y of station C.
+ * Center is 4000. 180 deg = 8333.
+ * Y - Up;  X ->   Z v
+ * Station ray is inverse Z axis.
+ *
+ * The point is the middle of the closest approach of the two rays,
+ * and dist is how far apart they pass.  Algorithm:
  *	http://geomalgorithms.com/a07-_distance.html#Distance-between-Lines
+ *
+ * The origins don't change during a pass, so w0 = orig1 - orig2 is
+ * computed once for all of the sensors.
  */
-static bool
-intersect_lines(
-	vec3d &orig1,
-	vec3d &vec1,
-	vec3d &orig2,
-	vec3d &vec2,
-	float res[3],
-	float *dist
-)
+#ifndef LIGHTHOUSE_FIXED_POINT
+uint32_t
+LighthouseXYZ::compute()
 {
-	vec3d w0 = {};
-	arm_sub_f32(orig1, orig2, w0, vec3d_size);
-
-	float a, b, c, d, e;
-	arm_dot_prod_f32(vec1, vec1, vec3d_size, &a);
-	arm_dot_prod_f32(vec1, vec2, vec3d_size, &b);
-	arm_dot_prod_f32(vec2, vec2, vec3d_size, &c);
-	arm_dot_prod_f32(vec1, w0, vec3d_size, &d);
-	arm_dot_prod_f32(vec2, w0, vec3d_size, &e);
-
-	float denom = a * c - b * b;
-	if (fabs(denom) < 1e-5f)
-		return false;
-
-	// Closest point to 2nd line on 1st line
-	float t1 = (b * e - c * d) / denom;
-	vec3d pt1 = {};
-	arm_scale_f32(vec1, t1, pt1, vec3d_size);
-	arm_add_f32(pt1, orig1, pt1, vec3d_size);
-
-	// Closest point to 1st line on 2nd line
-	float t2 = (a * e - b * d) / denom;
-	vec3d pt2 = {};
-	arm_scale_f32(vec2, t2, pt2, vec3d_size);
-	arm_add_f32(pt2, orig2, pt2, vec3d_size);
-
-	// Result is in the middle
-	vec3d tmp = {};
-	arm_add_f32(pt1, pt2, tmp, vec3d_size);
-	arm_scale_f32(tmp, 0.5f, res, vec3d_size);
-
-	// Dist is distance between pt1 and pt2
-	arm_sub_f32(pt1, pt2, tmp, vec3d_size);
-	*dist = vec_length(tmp);
-
-	return true;
+	const lightsource * const lh0 = this->lighthouse[0];
+	const lightsource * const lh1 = this->lighthouse[1];
+
+	const float o1x = lh0->origin[0];
+	const float o1y = lh0->origin[1];
+	const float o1z = lh0->origin[2];
+	const float w0x = o1x - lh1->origin[0];
+	const float w0y = o1y - lh1->origin[1];
+	const float w0z = o1z - lh1->origin[2];
+
+	uint32_t mask = this->ready;
+	uint32_t valid = 0;
+	this->ready = 0;
+
+	while (mask)
+	{
+		const unsigned i = __builtin_ctz(mask);
+		mask &= mask - 1;
+
+		float u[3], v[3];
+		calc_ray_vec(lh0->mat, this->angles[0][i], this->angles[1][i], u);
+		calc_ray_vec(lh1->mat, this->angles[2][i], this->angles[3][i], v);
+
+		const float a = u[0]*u[0] + u[1]*u[1] + u[2]*u[2];
+		const float b = u[0]*v[0] + u[1]*v[1] + u[2]*v[2];
+		const float c = v[0]*v[0] + v[1]*v[1] + v[2]*v[2];
+		const float d = u[0]*w0x + u[1]*w0y + u[2]*w0z;
+		const float e = v[0]*w0x + v[1]*w0y + v[2]*w0z;
+
+		// if the intersection isn't well defined (likely parallel?)
+		// then don't update the position and signal an error.
+		const float denom = a * c - b * b;
+		if (fabsf(denom) < 1e-5f)
+			continue;
+
+		const float inv = 1.0f / denom;
+		const float t1 = (b * e - c * d) * inv;
+		const float t2 = (a * e - b * d) * inv;
+
+		// Closest point to 2nd line on 1st line, relative to orig1,
+		// and from there to the closest point to 1st line on 2nd line
+		const float p1x = u[0] * t1;
+		const float p1y = u[1] * t1;
+		const float p1z = u[2] * t1;
+		const float dx = p1x - (v[0] * t2 - w0x);
+		const float dy = p1y - (v[1] * t2 - w0y);
+		const float dz = p1z - (v[2] * t2 - w0z);
+
+		// Result is in the middle
+		this->x[i] = o1x + p1x - 0.5f * dx;
+		this->y[i] = o1y + p1y - 0.5f * dy;
+		this->z[i] = o1z + p1z - 0.5f * dz;
+		this->dist[i] = sqrtf(dx*dx + dy*dy + dz*dz);
+
+		valid |= 1 << i;
+	}
+
+	return valid;
 }
-
-
-
-// First 2 angles - x, y of station B; second 2 angles - x, y of station C.  Center is 4000. 180 deg = 8333.
-// Y - Up;  X ->   Z v
-// Station ray is inverse Z axis.
-bool
+#else
+/*
+ * The same with binary angles, see LighthouseFixed.h
+ */
+uint32_t
 LighthouseXYZ::compute()
 {
-	vec3d ray1 = {};
-	vec3d ray2 = {};
-
-	// translate the angle measurements of the Lighthouse sweeping
-	// lasers into XYZ-space rays so that we can compute their
-	// intersection in the real space.
-	calc_ray_vec(this->lighthouse[0]->mat, this->angles[0], this->angles[1], ray1);
-
-	calc_ray_vec(this->lighthouse[1]->mat, this->angles[2], this->angles[3], ray2);
-
-
-	// compute the point of closest intersection between the two
-	// XYZ-space rays coming from the lighthouses at their XYZ-space
-	// positions.
-	//
-	// if the intersection isn't well defined (likely parallel?)
-	// then don't update the position and signal an error.
-	if (!intersect_lines(
-		this->lighthouse[0]->origin, ray1,
-		this->lighthouse[1]->origin, ray2,
-		this->xyz,
-		&this->dist
-	))
-		return false;
-
-#if 0
-	// Convert from the XYZ space of the lighthouses into NED
-	// we don't need to do this?
-	arm_matrix_instance_f32 pt_mat = {3, 1, this->xyz};
-	arm_matrix_instance_f32 ned_mat = {3, 1, this->ned };
-	arm_matrix_instance_f32 ned_rotation_mat = {3, 3, this->ned_rotation};
-
-	arm_mat_mult_f32(&ned_rotation_mat, &pt_mat, &ned_mat);
-#endif
-
-	return true;
+	if (!this->ready)
+		return 0;
+
+	// the calibration store may replace the poses at any time, but
+	// converting them is expensive without an FPU
+	for (int k = 0 ; k < 2 ; k++)
+	{
+		if (memcmp(&this->converted[k], this->lighthouse[k], sizeof(lightsource)) == 0)
+			continue;
+		this->converted[k] = *this->lighthouse[k];
+		lh_fixed_lightsource(this->lighthouse[k], &this->fixed[k]);
+	}
+
+	uint32_t mask = this->ready;
+	uint32_t valid = 0;
+	this->ready = 0;
+
+	while (mask)
+	{
+		const unsigned i = __builtin_ctz(mask);
+		mask &= mask - 1;
+
+		const int32_t angles[4] = {
+			this->angles[0][i],
+			this->angles[1][i],
+			this->angles[2][i],
+			this->angles[3][i],
+		};
+
+		int32_t xyz[3], dist;
+		if (!lh_fixed_triangulate(&this->fixed[0], &this->fixed[1], angles, xyz, &dist))
+			continue;
+
+		const float scale = 1.0f / LH_Q20_METER;
+		this->x[i] = xyz[0] * scale;
+		this->y[i] = xyz[1] * scale;
+		this->z[i] = xyz[2] * scale;
+		this->dist[i] = dist * scale;
+
+		valid |= 1 << i;
+	}
+
+	return valid;
 }
+#endif
 
 
 bool
 LighthouseXYZ::update(
+	unsigned sensor,
 	unsigned ind,
-	float angle
+	lh_angle_t angle
 )
 {
-	if (ind >= 4)
+	if (ind >= 4 || sensor >= this->sensors)
 		return false;
 
-	this->angles[ind] = angle;
-	this->fresh |= 1 << ind;
-	if (this->fresh != 0xF)
+	this->angles[ind][sensor] = angle;
+	this->fresh[sensor] |= 1 << ind;
+	if (this->fresh[sensor] != 0xF)
 		return false;
-	this->fresh = 0;
+	this->fresh[sensor] = 0;
 
-	return this->compute();
+	this->ready |= 1 << sensor;
+	return true;
 }
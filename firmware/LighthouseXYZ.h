@@ -1,39 +1,81 @@
 /** \file
- * Geometry for computing the position of a sensor with the Lighthouses.
+ * Geometry for computing the position of the sensors with the Lighthouses.
  *
- * This computes the XYZ position of a single sensor, based on the
+ * This computes the XYZ position of each sensor, based on the
  * four laser angle measurements from the two lighthouses and the
  * computed position/angles of the lighthouses.
+ *
+ * The angles and results are kept as a structure of arrays indexed by
+ * sensor so that compute() can triangulate every sensor that has a
+ * fresh set of angles in one pass, with the per-lighthouse constants
+ * loaded once.
+ *
+ * With LIGHTHOUSE_FIXED_POINT the angles are binary angles and the
+ * rays and triangulation are done in fixed point (LighthouseFixed.h);
+ * only the results are converted to float.
  */
 #ifndef _lighthouse_h_
 #define _lighthouse_h_
 
+#include <stdint.h>
+#include "LighthouseAngle.h"
+
 struct lightsource {
     float mat[9];
     float origin[3];
 };
 
+// The same in fixed point, Q30 and Q20 meters (see LighthouseFixed.h)
+struct lightsource_fixed {
+	int32_t mat[9];
+	int32_t origin[3];
+};
+
 
 class LighthouseXYZ
 {
 public:
 	LighthouseXYZ() {};
 
-	void begin(int id, lightsource * lh1, lightsource * lh2);
+	static const unsigned max_sensors = 16;
 
-	bool update(unsigned ind, float angle);
+	void begin(unsigned sensors, lightsource * lh1, lightsource * lh2);
 
-	float xyz[3];
-	float dist;
+	// Store angle ind (0-1 for lighthouse 0, 2-3 for lighthouse 1)
+	// for a sensor.  Returns true once all four are fresh, which
+	// queues the sensor for the next compute().
+	bool update(unsigned sensor, unsigned ind, lh_angle_t angle);
+
+	// Triangulate every queued sensor.  Returns a bitmask of the
+	// sensors that have a new position; the others had rays that
+	// were too close to parallel and keep their old one.
+	uint32_t compute();
+
+	void position(unsigned sensor, float xyz[3]) const
+	{
+		xyz[0] = this->x[sensor];
+		xyz[1] = this->y[sensor];
+		xyz[2] = this->z[sensor];
+	}
+
+	float x[max_sensors];
+	float y[max_sensors];
+	float z[max_sensors];
+	float dist[max_sensors];
 
 private:
-	int id;
+	unsigned sensors;
 	lightsource * lighthouse[2];
 
-	unsigned fresh;
-	float angles[4];
+	uint32_t ready;
+	uint8_t fresh[max_sensors];
+	lh_angle_t angles[4][max_sensors];
 
-	bool compute();
+#ifdef LIGHTHOUSE_FIXED_POINT
+	// converted poses, and the ones they were converted from
+	lightsource converted[2];
+	lightsource_fixed fixed[2];
+#endif
 };
 
 
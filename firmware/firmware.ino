@@ -12,21 +12,46 @@
  * any pulse *longer* than 8 usec can be discarded since it is not
  * a valid measurement.
  *
- * The Teensy FTM might be able to capture both rising and falling edges,
- * but we can fake it by using all eight input channels for four
- * sensors.
+ * Each sensor is wired to two input channels, one for rising and one
+ * for falling edges.  The edges from all eight go into one queue in
+ * time order, and loop() only does work for the edges that are in it.
+ * Built with LIGHTHOUSE_DUAL_EDGE, each sensor only uses its first pin
+ * and the ISR flips the channel between the two edges, which leaves
+ * the other four channels free.  The other timer modules have channels
+ * for more sensors (see InputCapture.h), but the geometry here is the
+ * four sensor square.
  *
  * If we can't see the lighthouse that this
  * time slot goes with, we'll see the next sync pulse at 8 usec later.
  * If we do see this lighthouse, we'll see a sweep pulse at time T,
  * then roughly 8 usec - T later the next sync.
  *
+ * Built with LIGHTHOUSE_FIXED_POINT, for parts without an FPU, the
+ * float tracking filter and pose fit are left out, so that nothing per
+ * sweep is done in software floating point: every fix is triangulated
+ * from the binary angles and sent as it is, and there are no poses.
+ *
+ * Fixes and OOTX messages are sent to the host as binary frames,
+ * described in LighthouseTelemetry.h; host/lhdecode turns them back
+ * into text.  They go through LighthouseOutput's queues and are only
+ * written as fast as the host reads them, so a slow host costs frames
+ * rather than edges.
+ *
  * Meaning of the sync pulses lengths:
  * https://github.com/nairol/LighthouseRedox/blob/master/docs/Light%20Emissions.md
  */
 
 #include "LighthouseSensor.h"
 #include "LighthouseXYZ.h"
+#include "LighthouseFilter.h"
+#include "LighthousePose.h"
+#include "LighthousePoses.h"
+#include "LighthouseTelemetry.h"
+#include "LighthouseCalibrationStore.h"
+#include "LighthouseEEPROM.h"
+#include "LighthouseOutput.h"
+#include "LighthouseUSBPort.h"
+#include "LighthouseEdgeStream.h"
 
 
 #define IR0 5
@@ -38,98 +63,418 @@
 #define IR6 22
 #define IR7 23
 
-
-// Lighthouse sources rotation matrix & 3d-position
-// needs to be computed and read from EEPROM instead of constant.
-static lightsource lightsources[2] = {{
-    {  -0.88720f,  0.25875f, -0.38201f,
-       -0.04485f,  0.77566f,  0.62956f,
-        0.45920f,  0.57568f, -0.67656f},
-    {  -1.28658f,  2.32719f, -2.04823f}
-}, {
-    {   0.52584f, -0.64026f,  0.55996f,
-        0.01984f,  0.66739f,  0.74445f,
-       -0.85035f, -0.38035f,  0.36364f},
-    {   1.69860f,  2.62725f,  0.92969f}
-}};
+#if defined(LIGHTHOUSE_DUAL_EDGE) && defined(INPUT_CAPTURE_DMA)
+#error "LIGHTHOUSE_DUAL_EDGE flips the edge in the ISR, so not with INPUT_CAPTURE_DMA"
+#endif
 
 
+LighthouseSyncTracker tracker;
 LighthouseSensor sensors[4];
-LighthouseXYZ xyz[4];
+LighthouseXYZ xyz;
+#ifndef LIGHTHOUSE_FIXED_POINT
+LighthouseFilter filters[4];
+LighthousePose pose;
+#endif
+
+static LighthouseEEPROM eeprom;
+static LighthouseCalibrationStore calstore;
+
+// Telemetry frames are built here and queued in one go
+// so that there is no formatting in the loop.
+static LighthouseTelemetry telemetry;
+
+// frames wait here until the host has room for them, so that a
+// slow reader never blocks loop()
+static LighthouseUSBPort usb;
+static LighthouseOutput output;
+
+// every captured edge goes to the host as well while this is on
+static LighthouseEdgeStream edge_stream;
+static bool streaming;
 
 void setup()
 {
-	sensors[0].begin(0, IR0, IR1);
-	sensors[1].begin(1, IR2, IR3);
-	sensors[2].begin(2, IR4, IR5);
-	sensors[3].begin(3, IR6, IR7);
+	tracker.begin();
+#ifdef LIGHTHOUSE_DUAL_EDGE
+	sensors[0].begin(0, IR0, &tracker);
+	sensors[1].begin(1, IR2, &tracker);
+	sensors[2].begin(2, IR4, &tracker);
+	sensors[3].begin(3, IR6, &tracker);
+#else
+	sensors[0].begin(0, IR0, IR1, &tracker);
+	sensors[1].begin(1, IR2, IR3, &tracker);
+	sensors[2].begin(2, IR4, IR5, &tracker);
+	sensors[3].begin(3, IR6, IR7, &tracker);
+#endif
 
+	xyz.begin(4, &lightsources[0], &lightsources[1]);
+
+#ifndef LIGHTHOUSE_FIXED_POINT
 	for(int i = 0 ; i < 4 ; i++)
-		xyz[i].begin(i, &lightsources[0], &lightsources[1]);
+		filters[i].begin(&lightsources[0], &lightsources[1]);
+
+	// the sensors are wired in the order of the 22 mm square
+	pose.begin(&lightsources[0], &lightsources[1]);
+#endif
+
+	calstore.begin(&eeprom, lightsources);
 
 	Serial.begin(115200);
+	output.begin(&usb);
+	edge_stream.begin(&telemetry, &output);
 }
 
-static char hexdigit(unsigned val)
+static uint8_t txbuf[LH_FRAME_MAX];
+
+// Only CRC checked messages are marked complete; send the decoded
+// calibration if it is an info block, otherwise the raw payload.
+static void send_ootx(int id, LighthouseOOTX & o)
 {
-	val &= 0XF;
-	if (val <= 9)
-		return '0' + val;
+	unsigned len;
+	if (o.have_calibration)
+		len = telemetry.calibration(txbuf, id, o.calibration);
 	else
-		return 'A' + val - 0xA;
+		len = telemetry.ootx(txbuf, id, o.bytes, o.length);
+	output.write(txbuf, len);
+
+	// flag that we have processed this message
+	o.complete = 0;
 }
 
-static void print_ootx(LighthouseOOTX & o)
+
+static void send_fix(int i, const float pos[3], uint32_t when)
 {
-	Serial.print(o.length);
-	for(unsigned i = 0 ; i < o.length ; i++)
+	// after a drop the host waits for key frames, so send them now
+	static uint32_t lost;
+	if (output.lost != lost)
 	{
-		const uint8_t b = o.bytes[i];
-		Serial.print(" ");
-		Serial.print(hexdigit(b >> 4));
-		Serial.print(hexdigit(b >> 0));
+		lost = output.lost;
+		telemetry.key_frames();
 	}
 
-	Serial.println();
+	const unsigned len = telemetry.fix(txbuf, i, when, sensors[i].raw, pos, xyz.dist[i]);
+	output.write(txbuf, len);
+}
+
 
-	// flag that we have processed this message
-	o.complete = 0;
+#ifdef INPUT_CAPTURE_PROFILE
+#ifndef LIGHTHOUSE_FIXED_POINT
+// LighthousePose::solve() time, in buckets of 1024 cycles
+static InputCaptureHistogram pose_cycles(10);
+#endif
+
+static void send_histogram(const char * name, const InputCaptureHistogram & h)
+{
+	char msg[LH_OOTX_MAX + 1];
+	unsigned len = snprintf(msg, sizeof(msg), "%s n=%lu max=%lu cycles/bucket=%u",
+		name,
+		(unsigned long) h.samples,
+		(unsigned long) h.max,
+		1 << h.shift
+	);
+
+	// only the buckets that have something in them
+	for (unsigned i = 0 ; i < h.buckets && len < sizeof(msg) ; i++)
+	{
+		if (h.count[i] == 0)
+			continue;
+		len += snprintf(msg + len, sizeof(msg) - len, " %u:%lu",
+			i, (unsigned long) h.count[i]);
+	}
+
+	output.write(txbuf, telemetry.text(txbuf, 0, msg));
+}
+#endif
+
+
+static void send_edge_counts()
+{
+	char msg[LH_OOTX_MAX + 1];
+	snprintf(msg, sizeof(msg), "edges lost=%lu unpaired=%lu,%lu,%lu,%lu flashes=%lu rescued=%lu missed=%lu,%lu disputed=%lu drift=%ld,%ld",
+		(unsigned long) InputCapture::lost,
+		(unsigned long) sensors[0].unpaired,
+		(unsigned long) sensors[1].unpaired,
+		(unsigned long) sensors[2].unpaired,
+		(unsigned long) sensors[3].unpaired,
+		(unsigned long) tracker.flashes,
+		(unsigned long) tracker.rescued,
+		(unsigned long) tracker.missed[0],
+		(unsigned long) tracker.missed[1],
+		(unsigned long) tracker.disputed,
+		(long) tracker.drift_ppm(0),
+		(long) tracker.drift_ppm(1)
+	);
+
+	output.write(txbuf, telemetry.text(txbuf, 0, msg));
+}
+
+
+static void send_output_counts()
+{
+	char msg[LH_OOTX_MAX + 1];
+	snprintf(msg, sizeof(msg), "output dropped=%lu,%lu,%lu,%lu peak=%lu,%lu,%lu,%lu stalls=%lu streamed=%lu",
+		(unsigned long) output.dropped[LighthouseOutput::STATE],
+		(unsigned long) output.dropped[LighthouseOutput::FIX],
+		(unsigned long) output.dropped[LighthouseOutput::EDGES],
+		(unsigned long) output.dropped[LighthouseOutput::DEBUG],
+		(unsigned long) output.peak[LighthouseOutput::STATE],
+		(unsigned long) output.peak[LighthouseOutput::FIX],
+		(unsigned long) output.peak[LighthouseOutput::EDGES],
+		(unsigned long) output.peak[LighthouseOutput::DEBUG],
+		(unsigned long) output.stalls,
+		(unsigned long) edge_stream.edges
+	);
+
+	output.write(txbuf, telemetry.text(txbuf, 0, msg));
+}
+
+
+// 'l' is followed by a line with a lighthouse's pose, as
+// solve_lighthouse prints it: 0 or 1, the nine numbers of the rotation
+// and the three of the origin.
+static char pose_line[192];
+static unsigned pose_len;
+static bool pose_reading;
+
+static bool parse_pose(const char * s, unsigned * lh, lightsource * pose)
+{
+	char * end;
+	const unsigned long n = strtoul(s, &end, 10);
+	if (end == s || n >= 2)
+		return false;
+
+	for (int i = 0 ; i < 12 ; i++)
+	{
+		s = end;
+		const float v = strtof(s, &end);
+		if (end == s)
+			return false;
+
+		if (i < 9)
+			pose->mat[i] = v;
+		else
+			pose->origin[i - 9] = v;
+	}
+
+	*lh = n;
+	return true;
+}
+
+
+// Use the pose from now on, and store it for the base station so
+// that it is used after a reboot too, until the firmware is built
+// with a different LighthousePoses.h
+static void load_pose()
+{
+	char msg[80];
+	unsigned lh;
+	lightsource pose;
+
+	if (!parse_pose(pose_line, &lh, &pose))
+		snprintf(msg, sizeof(msg), "pose not understood");
+	else {
+		lightsources[lh] = pose;
+		if (calstore.save_pose(lh, pose))
+			snprintf(msg, sizeof(msg), "pose %u stored", lh);
+		else
+			snprintf(msg, sizeof(msg), "pose %u in use, not stored until the base station is identified", lh);
+	}
+
+	output.write(txbuf, telemetry.text(txbuf, 0, msg));
+}
+
+
+// The host can turn the raw edge stream on and off with 'e', ask for
+// the edge and output counts with 'p' and load a lighthouse pose with
+// 'l'.  In the profiling build 'p' sends the ISR timing histograms as
+// well, and 'r' clears them.
+static void poll_commands()
+{
+	if (!Serial.available())
+		return;
+
+	const int c = Serial.read();
+	if (pose_reading)
+	{
+		if (c == '\n' || c == '\r')
+		{
+			pose_line[pose_len] = '\0';
+			pose_reading = false;
+			load_pose();
+		} else
+		if (pose_len < sizeof(pose_line) - 1)
+			pose_line[pose_len++] = c;
+		return;
+	}
+
+	if (c == 'l')
+	{
+		pose_reading = true;
+		pose_len = 0;
+	}
+	else
+	if (c == 'e')
+	{
+		streaming = !streaming;
+		edge_stream.flush();
+	}
+	else
+	if (c == 'p')
+	{
+#ifdef INPUT_CAPTURE_PROFILE
+		send_histogram("latency", InputCapture::latency);
+		send_histogram("duration", InputCapture::duration);
+#ifndef LIGHTHOUSE_FIXED_POINT
+		send_histogram("pose", pose_cycles);
+#endif
+#endif
+		send_edge_counts();
+		send_output_counts();
+	}
+#ifdef INPUT_CAPTURE_PROFILE
+	else
+	if (c == 'r')
+	{
+		InputCapture::profile_reset();
+#ifndef LIGHTHOUSE_FIXED_POINT
+		pose_cycles.reset();
+#endif
+	}
+#endif
 }
 
 
 void loop()
 {
-	for(int i = 0 ; i < 4 ; i++)
+	poll_commands();
+
+	uint32_t when[4];
+
+#ifndef LIGHTHOUSE_FIXED_POINT
+	// the four sensors see each sweep within a few tens of usec,
+	// so fit the pose once they have all had a chance to report
+	static bool pose_pending;
+	static uint32_t pose_time;
+	static uint32_t pose_since;
+#endif
+
+	// every edge from every sensor, in the order they happened
+	InputCaptureEdge e;
+	int rc;
+	while ((rc = InputCapture::read(&e)) != 0)
 	{
+		// some were lost, so no half seen pulse can be trusted
+		if (rc < 0)
+		{
+			tracker.resync();
+			for(int i = 0 ; i < 4 ; i++)
+				sensors[i].resync();
+			if (streaming)
+				edge_stream.lost();
+		}
+
+		if (streaming)
+			edge_stream.add(e);
+
+		if (e.id >= 4)
+			continue;
+
+		const int i = e.id;
 		LighthouseSensor * const s = &sensors[i];
-		LighthouseXYZ * const p = &xyz[i];
 
-		int ind = s->poll();
+		int ind = s->edge(e.when, e.rising);
 		if (ind < 0)
 			continue;
 
-		if (s->ootx.complete)
-			print_ootx(s->ootx);
+		xyz.update(i, ind, s->angles[ind]);
+		when[i] = s->times[ind];
+
+#ifndef LIGHTHOUSE_FIXED_POINT
+		// the tracking is always in float
+		const float angle = lh_angle_radians(s->angles[ind]);
+
+		// once a sensor is being tracked every sweep gives a fix
+		LighthouseFilter * const f = &filters[i];
+		if (f->update(ind, angle, s->times[ind]))
+			send_fix(i, f->xyz, s->times[ind]);
 
-		if (!p->update(ind, s->angles[ind]))
+		pose.update(i, ind, angle, s->times[ind]);
+		pose_time = s->times[ind];
+		pose_since = micros();
+		pose_pending = true;
+#endif
+	}
+
+	// the tracker has one OOTX decoder for each lighthouse, fed by
+	// every sensor that saw the flash
+	while (tracker.updated)
+	{
+		const unsigned lh = __builtin_ctz(tracker.updated);
+		tracker.updated &= tracker.updated - 1;
+
+		LighthouseOOTX & o = tracker.ootx[lh];
+		if (calstore.update(lh, o, lightsources[lh]) == LighthouseCalibrationStore::LOADED)
+			output.write(txbuf, telemetry.calibration(txbuf, lh, calstore.calibration[lh]));
+
+		if (o.complete)
+			send_ootx(lh, o);
+	}
+
+#ifndef LIGHTHOUSE_FIXED_POINT
+	if (pose_pending && micros() - pose_since > 100)
+	{
+		pose_pending = false;
+
+#ifdef INPUT_CAPTURE_PROFILE
+		const uint32_t start = ARM_DWT_CYCCNT;
+#endif
+		const bool tracking = pose.solve(pose_time);
+#ifdef INPUT_CAPTURE_PROFILE
+		pose_cycles.add(ARM_DWT_CYCCNT - start);
+#endif
+
+		if (tracking)
+		{
+			float q[4];
+			pose.quaternion(q);
+			output.write(txbuf, telemetry.pose(txbuf, 0, pose_time, pose.xyz, q, pose.used, pose.rms));
+		}
+	}
+#endif
+
+	// triangulate all of the sensors that have new angles together,
+	// which starts the tracking for any that have lost it; without
+	// the filter these are the only fixes
+	uint32_t fixes = xyz.compute();
+	while (fixes)
+	{
+		const unsigned i = __builtin_ctz(fixes);
+		fixes &= fixes - 1;
+
+		float pos[3];
+		xyz.position(i, pos);
+
+#ifndef LIGHTHOUSE_FIXED_POINT
+		if (filters[i].running)
 			continue;
+		filters[i].reset(pos, when[i]);
+#endif
+		send_fix(i, pos, when[i]);
+	}
 
-		Serial.print(i);
-		Serial.print(",");
-		Serial.print(s->raw[0]);
-		Serial.print(",");
-		Serial.print(s->raw[1]);
-		Serial.print(",");
-		Serial.print(s->raw[2]);
-		Serial.print(",");
-		Serial.print(s->raw[3]);
-		Serial.print(",");
-		Serial.print((int)(p->xyz[0]*1000));
-		Serial.print(",");
-		Serial.print((int)(p->xyz[1]*1000));
-		Serial.print(",");
-		Serial.print((int)(p->xyz[2]*1000));
-		Serial.print(",");
-		Serial.println(p->dist);
+	// all 64 bits of the timer every second, so that the host can
+	// extend the 32-bit times and fit its own clock to ours
+	static bool time_sent;
+	static uint32_t time_millis;
+	if (!time_sent || millis() - time_millis >= 1000)
+	{
+		time_sent = true;
+		time_millis = millis();
+		output.write(txbuf, telemetry.time(txbuf, InputCapture::now()));
 	}
+
+	// edges from before the sensors went dark, then as much as the
+	// host will take right now, the rest next time
+	edge_stream.poll(InputCapture::now());
+	output.flush();
 }
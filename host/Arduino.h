@@ -0,0 +1,63 @@
+/** \file
+ * Host stand-in for the Teensyduino core.
+ *
+ * This is just enough of the Arduino API for the Lighthouse decoder
+ * to build and run as a plain Linux library: the integer types,
+ * the edge constants, a Serial that writes to stdout, and the
+ * simulated Kinetis registers from kinetis.h.
+ */
+#ifndef _host_Arduino_h_
+#define _host_Arduino_h_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "kinetis.h"
+
+#define LOW		0
+#define HIGH		1
+#define CHANGE		4
+#define FALLING		2
+#define RISING		3
+
+#define DEC		10
+#define HEX		16
+
+uint32_t micros(void);
+uint32_t millis(void);
+
+
+class HostSerial
+{
+public:
+	void begin(uint32_t baud) { (void) baud; }
+	int available() { return 0; }
+	int read() { return -1; }
+	void flush();
+	int availableForWrite() { return 64; }
+
+	size_t write(uint8_t c);
+	size_t write(const uint8_t * buf, size_t len);
+
+	size_t print(const char * s);
+	size_t print(char c);
+	size_t print(int n, int base = DEC) { return print((long) n, base); }
+	size_t print(unsigned n, int base = DEC) { return print((unsigned long) n, base); }
+	size_t print(long n, int base = DEC);
+	size_t print(unsigned long n, int base = DEC);
+	size_t print(double n, int digits = 2);
+
+	size_t println() { return print("\r\n"); }
+
+	template <typename T>
+	size_t println(T val) { size_t n = print(val); return n + println(); }
+
+	template <typename T>
+	size_t println(T val, int fmt) { size_t n = print(val, fmt); return n + println(); }
+};
+
+extern HostSerial Serial;
+
+#endif
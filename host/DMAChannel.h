@@ -0,0 +1,77 @@
+/** \file
+ * Host stand-in for the Teensyduino DMAChannel class.
+ *
+ * Only the parts that the firmware uses are here: allocating a channel,
+ * a fixed source register, a circular destination buffer and a hardware
+ * trigger.  The transfer control descriptor has the eDMA fields with
+ * host sized pointers.  DMASim.cpp runs one minor loop of every enabled
+ * channel when the simulated FTM raises the channel's DMA request, the
+ * same as the hardware would with no bus contention.
+ */
+#ifndef _host_DMAChannel_h_
+#define _host_DMAChannel_h_
+
+#include <stdint.h>
+#include "kinetis.h"
+
+struct host_dma_tcd_t {
+	volatile const void * volatile SADDR;
+	int16_t SOFF;
+	uint8_t ATTR_DST;	// DMOD << 3 | DSIZE
+	uint8_t ATTR_SRC;	// SMOD << 3 | SSIZE
+	uint32_t NBYTES;
+	int32_t SLAST;
+	volatile void * volatile DADDR;
+	int16_t DOFF;
+	volatile uint16_t CITER;
+	int32_t DLASTSGA;
+	volatile uint16_t CSR;
+	volatile uint16_t BITER;
+};
+
+#define DMA_TCD_CSR_DREQ	0x0008
+
+class DMAChannel
+{
+public:
+	typedef host_dma_tcd_t TCD_t;
+
+	DMAChannel() : TCD(0), channel(DMA_NUM_CHANNELS) { begin(); }
+	~DMAChannel() { release(); }
+
+	// Allocate a channel, if there is one free.  On failure channel
+	// is DMA_NUM_CHANNELS and TCD is null.
+	void begin(bool force_initialization = false);
+	void release();
+
+	// Read the same 16-bit register every time
+	void source(volatile const uint16_t & p);
+
+	// Write into a buffer of len bytes, which must be a power of two
+	// and aligned to its size, wrapping around at the end
+	void destinationCircular(volatile uint16_t p[], unsigned int len);
+
+	void triggerAtHardwareEvent(uint8_t source);
+	void enable();
+	void disable();
+
+	void * destinationAddress() { return (void *) this->TCD->DADDR; }
+
+	TCD_t * TCD;
+	uint8_t channel;
+
+private:
+	DMAChannel(const DMAChannel &);
+	DMAChannel & operator=(const DMAChannel &);
+
+	TCD_t tcd;
+};
+
+// disable every channel's requests, as a reset would
+void dma_sim_reset();
+
+// a peripheral raises a DMA request; returns the number of channels
+// that serviced it, so the caller can clear its flag if any did
+int dma_sim_request(uint8_t source);
+
+#endif
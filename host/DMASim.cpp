@@ -0,0 +1,153 @@
+/** \file
+ * Register level model of the eDMA and DMAMUX for the host build.
+ */
+#include <Arduino.h>
+#include "DMAChannel.h"
+
+static DMAChannel * channels[DMA_NUM_CHANNELS];
+static uint8_t mux[DMA_NUM_CHANNELS];
+static bool requests[DMA_NUM_CHANNELS];
+
+
+void DMAChannel::begin(bool force_initialization)
+{
+	if (!force_initialization && this->TCD)
+		return;
+
+	for (unsigned ch = 0 ; ch < DMA_NUM_CHANNELS ; ch++)
+	{
+		if (channels[ch])
+			continue;
+
+		channels[ch] = this;
+		this->channel = ch;
+		this->TCD = &this->tcd;
+		memset(&this->tcd, 0, sizeof(this->tcd));
+		mux[ch] = 0;
+		requests[ch] = false;
+		return;
+	}
+
+	// no more channels available
+	this->TCD = 0;
+	this->channel = DMA_NUM_CHANNELS;
+}
+
+
+void DMAChannel::release()
+{
+	if (this->channel >= DMA_NUM_CHANNELS)
+		return;
+
+	this->disable();
+	channels[this->channel] = 0;
+	this->channel = DMA_NUM_CHANNELS;
+	this->TCD = 0;
+}
+
+
+void DMAChannel::source(volatile const uint16_t & p)
+{
+	this->TCD->SADDR = &p;
+	this->TCD->SOFF = 0;
+	this->TCD->ATTR_SRC = 1;
+	this->TCD->NBYTES = 2;
+	this->TCD->SLAST = 0;
+}
+
+
+void DMAChannel::destinationCircular(volatile uint16_t p[], unsigned int len)
+{
+	this->TCD->DADDR = p;
+	this->TCD->DOFF = 2;
+	this->TCD->ATTR_DST = ((31 - __builtin_clz(len)) << 3) | 1;
+	this->TCD->NBYTES = 2;
+	this->TCD->DLASTSGA = 0;
+	this->TCD->BITER = len / 2;
+	this->TCD->CITER = len / 2;
+}
+
+
+void DMAChannel::triggerAtHardwareEvent(uint8_t source)
+{
+	mux[this->channel] = source;
+}
+
+
+void DMAChannel::enable()
+{
+	requests[this->channel] = true;
+}
+
+
+void DMAChannel::disable()
+{
+	requests[this->channel] = false;
+}
+
+
+void dma_sim_reset()
+{
+	memset(mux, 0, sizeof(mux));
+	memset(requests, 0, sizeof(requests));
+}
+
+
+// The address after adding an offset, keeping the bits above the
+// modulo field the same
+static uintptr_t dma_advance(uintptr_t addr, int32_t offset, unsigned mod)
+{
+	const uintptr_t next = addr + offset;
+	if (mod == 0)
+		return next;
+
+	const uintptr_t mask = ((uintptr_t) 1 << mod) - 1;
+	return (addr & ~mask) | (next & mask);
+}
+
+
+// One minor loop: NBYTES in transfers of the source size
+static void dma_minor_loop(DMAChannel::TCD_t & tcd)
+{
+	const unsigned ssize = 1 << (tcd.ATTR_SRC & 7);
+	const unsigned dsize = 1 << (tcd.ATTR_DST & 7);
+
+	for (unsigned done = 0 ; done < tcd.NBYTES ; done += ssize)
+	{
+		uint32_t val = 0;
+		memcpy(&val, (const void *) tcd.SADDR, ssize);
+		memcpy((void *) tcd.DADDR, &val, dsize);
+
+		tcd.SADDR = (const void *) dma_advance((uintptr_t) tcd.SADDR, tcd.SOFF, tcd.ATTR_SRC >> 3);
+		tcd.DADDR = (void *) dma_advance((uintptr_t) tcd.DADDR, tcd.DOFF, tcd.ATTR_DST >> 3);
+	}
+
+	if (--tcd.CITER != 0)
+		return;
+
+	// major loop done
+	tcd.CITER = tcd.BITER;
+	tcd.SADDR = (const uint8_t *) tcd.SADDR + tcd.SLAST;
+	tcd.DADDR = (uint8_t *) tcd.DADDR + tcd.DLASTSGA;
+}
+
+
+int dma_sim_request(uint8_t source)
+{
+	int serviced = 0;
+
+	for (unsigned ch = 0 ; ch < DMA_NUM_CHANNELS ; ch++)
+	{
+		if (!channels[ch] || !requests[ch] || mux[ch] != source)
+			continue;
+
+		DMAChannel::TCD_t & tcd = *channels[ch]->TCD;
+		dma_minor_loop(tcd);
+		serviced++;
+
+		if (tcd.CITER == tcd.BITER && (tcd.CSR & DMA_TCD_CSR_DREQ))
+			requests[ch] = false;
+	}
+
+	return serviced;
+}
@@ -0,0 +1,119 @@
+/** \file
+ * Lower edge fit of the tracker's clock against the host's.
+ */
+#include "DeviceClock.h"
+#include <algorithm>
+
+
+DeviceClock::DeviceClock(double hz) :
+	hz(hz),
+	count(0),
+	base(0),
+	base_host(0),
+	rate(1),
+	offset(0),
+	spread(0)
+{
+}
+
+
+void DeviceClock::add(uint64_t ticks, double host)
+{
+	if (this->count == 0)
+	{
+		this->base = ticks;
+		this->base_host = host;
+	}
+
+	this->ticks[this->count % window] = ticks;
+	this->host[this->count % window] = host;
+	this->count++;
+
+	this->fit();
+}
+
+
+void DeviceClock::fit()
+{
+	const unsigned n = this->count < window ? this->count : window;
+
+	// relative to the base so that the doubles keep their precision
+	double x[window], y[window], r[window];
+	for (unsigned i = 0 ; i < n ; i++)
+	{
+		x[i] = (this->ticks[i] - this->base) / this->hz;
+		y[i] = this->host[i] - this->base_host;
+	}
+
+	// least squares over everything, then twice more over only the
+	// samples near the bottom so that the stalls don't tilt it
+	double limit = 0;
+	for (unsigned pass = 0 ; pass < 3 ; pass++)
+	{
+		double sx = 0, sy = 0, sxx = 0, sxy = 0;
+		unsigned m = 0;
+		for (unsigned i = 0 ; i < n ; i++)
+		{
+			if (pass != 0 && r[i] > limit)
+				continue;
+			// about the first sample, since x can be days
+			const double dx = x[i] - x[0];
+			const double dy = y[i] - y[0];
+			sx += dx;
+			sy += dy;
+			sxx += dx * dx;
+			sxy += dx * dy;
+			m++;
+		}
+
+		const double det = m * sxx - sx * sx;
+		if (m >= 2 && det > 0)
+			this->rate = (m * sxy - sx * sy) / det;
+
+		// how far above the lowest each sample is
+		double lo = 0;
+		for (unsigned i = 0 ; i < n ; i++)
+		{
+			r[i] = y[i] - this->rate * x[i];
+			if (i == 0 || r[i] < lo)
+				lo = r[i];
+		}
+
+		double sorted[window];
+		for (unsigned i = 0 ; i < n ; i++)
+			sorted[i] = r[i] -= lo;
+		std::sort(sorted, sorted + n);
+
+		// the line goes through the lowest sample; the ones within a
+		// few times the typical latency of it, or a USB frame, are
+		// the ones to fit to next time
+		this->offset = lo;
+		limit = 3 * sorted[n / 2] + usb_frame;
+
+		this->spread = 0;
+		for (unsigned i = 0 ; i < n ; i++)
+			if (r[i] <= limit && r[i] > this->spread)
+				this->spread = r[i];
+	}
+}
+
+
+double DeviceClock::host_time(uint64_t ticks) const
+{
+	// signed, since the tick can be from before the first sample
+	const double x = (double) (int64_t) (ticks - this->base) / this->hz;
+	return this->base_host + this->offset + this->rate * x;
+}
+
+
+double DeviceClock::ppm() const
+{
+	// the tracker's second is rate host seconds long
+	return (1 / this->rate - 1) * 1e6;
+}
+
+
+double DeviceClock::error() const
+{
+	return this->spread;
+}
@@ -0,0 +1,67 @@
+/** \file
+ * Map the tracker's timer ticks onto the host's monotonic clock.
+ *
+ * Each TIME frame gives a pair of the 64-bit tick when the tracker
+ * queued it and the host time when it arrived.  The arrival is later
+ * by the USB latency, which is never less than some floor and is
+ * usually close to it, with the occasional long stall.  So rather than
+ * averaging through the latency, the rate of the tracker's crystal
+ * against the host clock is fit by least squares to the samples in the
+ * last window that are near the bottom of the spread, and the line is
+ * then put through the lowest of them so that no sample arrived before
+ * the time it maps to.
+ *
+ * host_time() is therefore the earliest that a frame sent at a tick
+ * could have arrived; the latency floor itself can't be seen from one
+ * end of the link.  error() is the furthest that any of the samples
+ * that were fit is above the line, which bounds how far host_time()
+ * is from that earliest arrival (bench_clock checks this).
+ */
+#ifndef _DeviceClock_h_
+#define _DeviceClock_h_
+
+#include <stdint.h>
+
+class DeviceClock
+{
+public:
+	// hz is the nominal tick rate
+	DeviceClock(double hz);
+
+	static const unsigned window = 64;
+
+	// full speed USB polls once a millisecond
+	static constexpr double usb_frame = 1e-3;
+
+	// A TIME frame of `ticks` that arrived at `host` seconds
+	void add(uint64_t ticks, double host);
+
+	// The host time in seconds of a tick
+	double host_time(uint64_t ticks) const;
+
+	// How fast the tracker's clock runs against the host's
+	double ppm() const;
+
+	// How far off host_time() can be, in seconds
+	double error() const;
+
+	unsigned samples() const { return this->count; }
+
+private:
+	const double hz;
+
+	uint64_t ticks[window];
+	double host[window];
+	unsigned count;
+
+	// the fit: host = base_host + offset + rate * (ticks - base) / hz
+	uint64_t base;
+	double base_host;
+	double rate;
+	double offset;
+	double spread;
+
+	void fit();
+};
+
+#endif
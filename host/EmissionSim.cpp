@@ -0,0 +1,408 @@
+/** \file
+ * Generate the edges that the sensors would see from two base stations.
+ */
+#include "EmissionSim.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include "InputCapture.h"
+#include "LighthouseSync.h"
+#include "LighthousePoses.h"
+
+
+EmissionSim::EmissionSim()
+{
+	for (int lh = 0 ; lh < 2 ; lh++)
+	{
+		stations[lh] = lightsources[lh];
+		on[lh] = true;
+
+		LighthouseCalibration cal;
+		memset(&cal, 0, sizeof(cal));
+		cal.fw_version = 436;
+		cal.protocol = 6;
+		cal.id = 0x5EED0000 + lh;
+		cal.phase[0] = 0.025f * (lh + 1);
+		cal.phase[1] = -0.0125f * (lh + 1);
+		cal.hw_version = 9;
+		cal.accel[1] = 127;
+		cal.mode = lh ? 1 : 2;
+
+		uint8_t payload[64];
+		set_payload(lh, payload, info_block(payload, cal));
+	}
+
+	period_usec = 25000.0 / 3;
+	clock_ppm = 0;
+	jitter = 0;
+	sweep_usec = 5;
+	miss_sync = 0;
+	miss_sweep = 0;
+	reflect = 0;
+
+	sensors = 0;
+	position = 0;
+	ctx = 0;
+	seed(1);
+}
+
+
+void
+EmissionSim::begin(
+	unsigned sensors,
+	position_fn position,
+	void * ctx
+)
+{
+	this->sensors = sensors;
+	this->position = position;
+	this->ctx = ctx;
+	this->period_index = 0;
+	this->bit_index[0] = this->bit_index[1] = 0;
+}
+
+
+void
+EmissionSim::seed(
+	uint64_t seed
+)
+{
+	this->random_state = seed * 0x9E3779B97F4A7C15ULL + 1;
+}
+
+
+// xorshift64*, so that runs are the same on every host
+double
+EmissionSim::uniform()
+{
+	uint64_t x = this->random_state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	this->random_state = x;
+	return ((x * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+double
+EmissionSim::gaussian()
+{
+	const double u = 1 - this->uniform();
+	const double v = this->uniform();
+	return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+
+static uint16_t
+float_to_half(
+	float f
+)
+{
+	uint32_t x;
+	memcpy(&x, &f, sizeof(x));
+
+	const uint16_t sign = (x >> 16) & 0x8000;
+	const int exp = (int) ((x >> 23) & 0xFF) - 127 + 15;
+	const uint32_t mant = x & 0x7FFFFF;
+
+	if (exp >= 0x1F)
+		return sign | 0x7C00;
+
+	if (exp <= 0)
+	{
+		// subnormal or zero, rounded to nearest
+		if (exp < -10)
+			return sign;
+		const uint32_t m = mant | 0x800000;
+		const unsigned shift = 14 - exp;
+		return sign | ((m + (1 << (shift - 1))) >> shift);
+	}
+
+	// round to nearest, which may carry into the exponent
+	return sign + ((exp << 10) | (mant >> 13)) + ((mant >> 12) & 1);
+}
+
+
+static inline unsigned put16(uint8_t * p, uint16_t x)
+{
+	p[0] = x >> 0;
+	p[1] = x >> 8;
+	return 2;
+}
+
+
+unsigned
+EmissionSim::info_block(
+	uint8_t * b,
+	const LighthouseCalibration & cal
+)
+{
+	put16(&b[0x00], cal.fw_version << 6 | (cal.protocol & 0x3F));
+	put16(&b[0x02], cal.id & 0xFFFF);
+	put16(&b[0x04], cal.id >> 16);
+	put16(&b[0x06], float_to_half(cal.phase[0]));
+	put16(&b[0x08], float_to_half(cal.phase[1]));
+	put16(&b[0x0A], float_to_half(cal.tilt[0]));
+	put16(&b[0x0C], float_to_half(cal.tilt[1]));
+	b[0x0E] = cal.unlock_count;
+	b[0x0F] = cal.hw_version;
+	put16(&b[0x10], float_to_half(cal.curve[0]));
+	put16(&b[0x12], float_to_half(cal.curve[1]));
+	b[0x14] = cal.accel[0];
+	b[0x15] = cal.accel[1];
+	b[0x16] = cal.accel[2];
+	put16(&b[0x17], float_to_half(cal.gibphase[0]));
+	put16(&b[0x19], float_to_half(cal.gibphase[1]));
+	put16(&b[0x1B], float_to_half(cal.gibmag[0]));
+	put16(&b[0x1D], float_to_half(cal.gibmag[1]));
+	b[0x1F] = cal.mode;
+	b[0x20] = cal.faults;
+
+	return 33;
+}
+
+
+/*
+ * The OOTX frame is a preamble of 17 zeros and a 1, the payload length
+ * as a 16-bit word, then the payload padded to a whole number of words
+ * and its CRC32, little endian.  Every word is sent MSB first and is
+ * followed by a 1 sync bit.
+ */
+void
+EmissionSim::set_payload(
+	unsigned lh,
+	const uint8_t * bytes,
+	unsigned len
+)
+{
+	std::vector<uint8_t> & out = this->bits[lh];
+	out.assign(17, 0);
+	out.push_back(1);
+
+	std::vector<uint8_t> data(bytes, bytes + len);
+	if (len & 1)
+		data.push_back(0);
+
+	const uint32_t crc = LighthouseOOTX::crc32(bytes, len);
+	for (int i = 0 ; i < 4 ; i++)
+		data.push_back(crc >> (8 * i));
+
+	std::vector<uint16_t> words;
+	words.push_back(len);
+	for (unsigned i = 0 ; i < data.size() ; i += 2)
+		words.push_back(data[i] << 8 | data[i+1]);
+
+	for (unsigned i = 0 ; i < words.size() ; i++)
+	{
+		for (int k = 15 ; k >= 0 ; k--)
+			out.push_back((words[i] >> k) & 1);
+		out.push_back(1);
+	}
+
+	this->bit_index[lh] = 0;
+}
+
+
+// bus clock ticks at a time in usec, as our timer sees it
+uint64_t
+EmissionSim::tick(
+	double usec
+)
+{
+	const double ticks = usec * CLOCKS_PER_MICROSECOND
+		* (1 + this->clock_ppm * 1e-6);
+
+	return (uint64_t) llround(ticks + this->jitter * this->gaussian());
+}
+
+
+bool
+EmissionSim::project(
+	const lightsource & l,
+	const double p[3],
+	double a[2]
+)
+{
+	double P[3];
+	for (int k = 0 ; k < 3 ; k++)
+		P[k] = l.mat[0*3+k] * (p[0] - l.origin[0])
+		     + l.mat[1*3+k] * (p[1] - l.origin[1])
+		     + l.mat[2*3+k] * (p[2] - l.origin[2]);
+
+	a[0] = atan2(-P[0], -P[2]);
+	a[1] = atan2(P[1], -P[2]);
+
+	return P[2] < 0 && fabs(a[0]) < M_PI / 3 && fabs(a[1]) < M_PI / 3;
+}
+
+
+// one low pulse on a sensor line, returns the tick of its middle
+uint64_t
+EmissionSim::pulse(
+	std::vector<TraceEdge> & edges,
+	unsigned s,
+	double start,
+	double len
+)
+{
+	TraceEdge e;
+	e.input = s;
+
+	e.rising = 0;
+	e.tick = this->tick(start);
+	edges.push_back(e);
+	const uint64_t falling = e.tick;
+
+	e.rising = 1;
+	e.tick = this->tick(start + len);
+	edges.push_back(e);
+
+	return (falling + e.tick) / 2;
+}
+
+
+static bool
+edge_before(
+	const TraceEdge & a,
+	const TraceEdge & b
+)
+{
+	return a.tick < b.tick;
+}
+
+
+void
+EmissionSim::run(
+	unsigned periods,
+	std::vector<TraceEdge> & edges,
+	std::vector<EmissionTruth> * truth
+)
+{
+	const size_t first = edges.size();
+
+	// the middle of the sweep, as a fraction of the period
+	const double center = 4000.0 / 8333.0;
+
+	for (unsigned n = 0 ; n < periods ; n++, this->period_index++)
+	{
+		// start a millisecond in, so that the first edges don't
+		// land on the very first tick
+		const double t0 = 1000 + this->period_index * this->period_usec;
+
+		// lighthouse 1 sweeps first, then each rotor of the
+		// other takes its turn
+		const unsigned sweeper = (this->period_index & 1) ? 0 : 1;
+		const unsigned axis = (this->period_index >> 1) & 1;
+
+		for (unsigned k = 0 ; k < 2 ; k++)
+		{
+			const unsigned lh = 1 - k;
+			const double start = t0 + k * 400;
+
+			// the bit is sent even if nobody can see it
+			const std::vector<uint8_t> & stream = this->bits[lh];
+			const unsigned data = stream[this->bit_index[lh]++ % stream.size()];
+
+			if (!this->on[lh])
+				continue;
+
+			const unsigned skip = lh != sweeper;
+			const double len = lighthouse_sync::midpoint_us(skip << 2 | axis << 1 | data);
+
+			for (unsigned s = 0 ; s < this->sensors ; s++)
+			{
+				double p[3], a[2];
+				this->position(this->ctx, s, start * 1e-6, p);
+				if (!project(this->stations[lh], p, a))
+					continue;
+				if (this->uniform() < this->miss_sync)
+					continue;
+
+				this->pulse(edges, s, start, len);
+			}
+		}
+
+		if (!this->on[sweeper])
+			continue;
+
+		const double zero = t0 + (sweeper == 1 ? 0 : 400);
+
+		for (unsigned s = 0 ; s < this->sensors ; s++)
+		{
+			// the laser crosses the sensor where it is when
+			// it is crossed, which settles in a couple of steps
+			double t = zero + this->period_usec * center;
+			double p[3], a[2];
+			bool seen = true;
+
+			for (int i = 0 ; i < 3 && seen ; i++)
+			{
+				this->position(this->ctx, s, t * 1e-6, p);
+				seen = project(this->stations[sweeper], p, a);
+				t = zero + this->period_usec * (center + a[axis] / M_PI);
+			}
+
+			if (!seen)
+				continue;
+
+			if (this->uniform() >= this->miss_sweep)
+			{
+				const uint64_t mid = this->pulse(edges, s, t - this->sweep_usec / 2, this->sweep_usec);
+
+				if (truth)
+				{
+					EmissionTruth r;
+					r.tick = mid;
+					r.sensor = s;
+					r.ind = sweeper * 2 + axis;
+					r.angle = a[axis];
+					r.xyz[0] = p[0];
+					r.xyz[1] = p[1];
+					r.xyz[2] = p[2];
+					truth->push_back(r);
+				}
+			}
+
+			// a reflection somewhere else in the field of view,
+			// but not on top of the real pulse
+			if (this->uniform() < this->reflect)
+			{
+				const double r = zero + this->period_usec
+					* (center + (2 * this->uniform() - 1) / 3);
+				if (fabs(r - t) > 2 * this->sweep_usec)
+					this->pulse(edges, s, r - this->sweep_usec / 2, this->sweep_usec);
+			}
+		}
+	}
+
+	std::stable_sort(edges.begin() + first, edges.end(), edge_before);
+}
+
+
+void
+EmissionBoard::position(
+	void * ctx,
+	unsigned s,
+	double t,
+	double xyz[3]
+)
+{
+	const EmissionBoard * const b = (const EmissionBoard *) ctx;
+
+	unsigned cols = 1;
+	while (cols * cols < b->sensors)
+		cols++;
+	const unsigned rows = (b->sensors + cols - 1) / cols;
+
+	// board coordinates, centered on the middle of the grid and
+	// back and forth along the rows
+	const unsigned row = s / cols;
+	const unsigned col = row & 1 ? s % cols : cols - 1 - s % cols;
+	const double x = (col - (cols - 1) / 2.0) * b->spacing;
+	const double y = (row - (rows - 1) / 2.0) * b->spacing;
+
+	const double a = 2 * M_PI * b->speed * t;
+	xyz[0] = 0.2 * cos(a) + x;
+	xyz[1] = 0.1;
+	xyz[2] = 0.2 * sin(a) - y;
+}
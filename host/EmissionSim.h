@@ -0,0 +1,133 @@
+/** \file
+ * Synthetic Lighthouse emissions with ground truth.
+ *
+ * Two base stations at the given poses take turns sweeping, as the real
+ * ones do: every sync period (8.333 ms) both flash their sync pulse,
+ * lighthouse 1 first and lighthouse 0 400 usec later, and the one that
+ * is going to sweep sends it without the skip bit.  Then one of its
+ * rotors sweeps the room, alternating rotors each time it sweeps.  Each
+ * sensor line gets the falling and rising edges that a TS3633 would
+ * give it, in bus clock ticks, exactly as InputCapture records them:
+ *
+ * - sync pulses with the nominal lengths that LighthouseSyncClassifier
+ *   decodes, carrying each station's OOTX message one bit per flash
+ *   (a version 6 info block unless another payload is given), and
+ * - a short sweep pulse centered on the time that the laser plane
+ *   crosses the sensor, for the angle it is at, at that moment.
+ *
+ * A sensor only sees a station when it is in front of it and within
+ * +/- 60 degrees on both axes.  The edges can be perturbed with timing
+ * jitter, a timer clock that is off from the rotors, pulses that a
+ * sensor misses, and reflections that put a second sweep pulse at a
+ * random time in the sweep.  Every sweep that a sensor sees is recorded
+ * with its true angle and position.
+ *
+ * The sweep time is 4000/8333 of the period after the sync flash at 0
+ * degrees and a half turn is one period, which is what sweep_pulse()
+ * assumes once the period has been measured.
+ */
+#ifndef _EmissionSim_h_
+#define _EmissionSim_h_
+
+#include <stdint.h>
+#include <vector>
+#include "Trace.h"
+#include "LighthouseXYZ.h"
+#include "LighthouseOOTX.h"
+
+struct EmissionTruth {
+	uint64_t tick;		// middle of the sweep pulse, with jitter
+	uint8_t sensor;
+	uint8_t ind;		// lighthouse * 2 + axis, as in LighthouseSensor
+	double angle;		// radians
+	double xyz[3];		// where the sensor was, meters
+};
+
+
+// A flat board of sensors on a square grid, face up (its Z is
+// XYZ-space Y), going around a 20 cm circle 10 cm up, at speed turns
+// per second.  0 holds it still.  The sensors go back and forth along
+// the rows, so four 22 mm apart are LighthousePose's default layout.
+struct EmissionBoard
+{
+	unsigned sensors;
+	double spacing;
+	double speed;
+
+	static void position(void * ctx, unsigned s, double t, double xyz[3]);
+};
+
+
+class EmissionSim
+{
+public:
+	EmissionSim();
+
+	// Where sensor s is, in meters, at t seconds from the start
+	typedef void (*position_fn)(void * ctx, unsigned s, double t, double xyz[3]);
+
+	void begin(unsigned sensors, position_fn position, void * ctx = 0);
+
+	// Start the random numbers over for a repeatable run
+	void seed(uint64_t seed);
+
+	// Replace a station's OOTX payload, which can be up to 250 bytes
+	// for LighthouseOOTX to receive it
+	void set_payload(unsigned lh, const uint8_t * bytes, unsigned len);
+
+	// Encode a version 6 base station info block, the inverse of
+	// LighthouseOOTX::parse().  Returns the length, 33 bytes.
+	static unsigned info_block(uint8_t * buf, const LighthouseCalibration & cal);
+
+	// The two sweep angles of a point seen from a station at pose l,
+	// the same as LighthouseFilter predicts.  Returns false if the
+	// station can't see the point, with the angles filled in anyway.
+	static bool project(const lightsource & l, const double p[3], double a[2]);
+
+	// Generate the next `periods` sync periods, appending the edges in
+	// time order and, if truth is not null, the sweeps that were seen.
+	void run(
+		unsigned periods,
+		std::vector<TraceEdge> & edges,
+		std::vector<EmissionTruth> * truth
+	);
+
+	// Base station poses, in the same frame as lightsources[], and
+	// whether they are switched on
+	lightsource stations[2];
+	bool on[2];
+
+	double period_usec;	// sync period, 8333.333 at 120 Hz
+	double clock_ppm;	// how fast the timer runs against the rotors
+	double jitter;		// rms timing noise on every edge, in ticks
+	double sweep_usec;	// length of a sweep pulse
+	double miss_sync;	// chance that a sensor misses a sync pulse
+	double miss_sweep;	// and a sweep pulse
+	double reflect;		// chance of a second sweep pulse per sweep
+
+	// the whole OOTX bit stream of each station, which repeats
+	std::vector<uint8_t> bits[2];
+
+private:
+	unsigned sensors;
+	position_fn position;
+	void * ctx;
+
+	// where we are in time and in each station's bit stream
+	uint64_t period_index;
+	unsigned bit_index[2];
+
+	uint64_t random_state;
+	double uniform();
+	double gaussian();
+
+	uint64_t tick(double usec);
+	uint64_t pulse(
+		std::vector<TraceEdge> & edges,
+		unsigned s,
+		double start_usec,
+		double len_usec
+	);
+};
+
+#endif
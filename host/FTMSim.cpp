@@ -0,0 +1,328 @@
+/** \file
+ * Register level model of the FTM modules for the host build.
+ */
+#include <Arduino.h>
+#include "FTMSim.h"
+#include "DMAChannel.h"
+
+kinetis_ftm_t host_ftm[4];
+volatile uint32_t host_port_pcr[64];
+uint8_t host_nvic_enabled[128];
+uint8_t host_nvic_priority[128];
+volatile uint32_t host_demcr;
+volatile uint32_t host_dwt_ctrl;
+
+static uint64_t sim_now;
+
+// ticks from a flag being set to its ISR running, and the modules
+// whose interrupt is pending until then
+static uint64_t latency;
+static uint64_t due[4];
+static unsigned pending;
+
+// The timer modules of the board, with their interrupts and the DMA
+// request of their first channel
+static const struct {
+	IRQ_NUMBER_t irq;
+	void (* isr)(void);
+	uint8_t dma_source;
+} modules[] = {
+	{ IRQ_FTM0, ftm0_isr, DMAMUX_SOURCE_FTM0_CH0 },
+	{ IRQ_FTM1, ftm1_isr, DMAMUX_SOURCE_FTM1_CH0 },
+	{ IRQ_FTM2, ftm2_isr, DMAMUX_SOURCE_FTM2_CH0 },
+#if defined(__MK66FX1M0__)
+	{ IRQ_FTM3, ftm3_isr, DMAMUX_SOURCE_FTM3_CH0 },
+#endif
+};
+
+static const unsigned num_modules = sizeof(modules) / sizeof(*modules);
+
+// Teensy 3.x pin to timer channel and the port mux that connects them,
+// from the chip's signal multiplexing table
+static const struct {
+	uint8_t pin;
+	uint8_t module;
+	uint8_t channel;
+	uint8_t mux;
+} ftm_pins[] = {
+	{ 22, 0, 0, 4 },
+	{ 23, 0, 1, 4 },
+	{  9, 0, 2, 4 },
+	{ 10, 0, 3, 4 },
+	{  6, 0, 4, 4 },
+	{ 20, 0, 5, 4 },
+#if defined(KINETISK)
+	{ 21, 0, 6, 4 },
+	{  5, 0, 7, 4 },
+	{  3, 1, 0, 3 },
+	{  4, 1, 1, 3 },
+#endif
+#if defined(__MK66FX1M0__)
+	{ 29, 2, 0, 3 },
+	{ 30, 2, 1, 3 },
+	{  2, 3, 0, 4 },
+	{ 14, 3, 1, 4 },
+	{  7, 3, 2, 4 },
+	{  8, 3, 3, 4 },
+	{ 35, 3, 4, 3 },
+	{ 36, 3, 5, 3 },
+	{ 37, 3, 6, 3 },
+	{ 38, 3, 7, 3 },
+#elif defined(__MK20DX256__)
+	{ 32, 2, 0, 3 },
+	{ 25, 2, 1, 3 },
+#endif
+};
+
+
+void ftm_sim_reset()
+{
+	memset((void*) host_ftm, 0, sizeof(host_ftm));
+	memset((void*) host_port_pcr, 0, sizeof(host_port_pcr));
+	memset(host_nvic_enabled, 0, sizeof(host_nvic_enabled));
+	memset(host_nvic_priority, 0, sizeof(host_nvic_priority));
+	dma_sim_reset();
+	sim_now = 0;
+	pending = 0;
+}
+
+
+void ftm_sim_latency(uint64_t ticks)
+{
+	latency = ticks;
+}
+
+
+uint64_t ftm_sim_now()
+{
+	return sim_now;
+}
+
+
+static inline uint64_t ftm_period(const kinetis_ftm_t & ftm)
+{
+	return (uint64_t)(ftm.MOD & 0xFFFF) + 1;
+}
+
+
+// Run the module's ISR, if its interrupt is on and the firmware has
+// one, or with a latency leave it pending until then.  The NVIC only
+// has the one pending bit, and the ISR takes every flag that is set
+// when it runs.
+static void ftm_sim_interrupt(unsigned m)
+{
+	if (!host_nvic_enabled[modules[m].irq] || !modules[m].isr)
+		return;
+
+	if (latency == 0)
+		modules[m].isr();
+	else
+	if ((pending & (1 << m)) == 0)
+	{
+		pending |= 1 << m;
+		due[m] = sim_now + latency;
+	}
+}
+
+
+// Every clocked counter as it is at the tick
+static void ftm_sim_count(uint64_t tick)
+{
+	for (unsigned m = 0 ; m < num_modules ; m++)
+	{
+		kinetis_ftm_t & ftm = host_ftm[m];
+		if (ftm.SC & FTM_SC_CLKS(3))
+			ftm.CNT = tick % ftm_period(ftm);
+	}
+}
+
+
+/*
+ * Run the counters to the tick, taking the wraps and the pending
+ * interrupts in the order that they come.  Every module that is
+ * clocked counts from time zero, as they all do once InputCapture has
+ * started them together on the global time base.  A wrap or a pending
+ * interrupt on the tick itself is left pending if asked, so that an
+ * edge captured on the same tick is latched before the interrupt runs,
+ * as it would be on the hardware; the modules that have one are
+ * returned as a bitmask.
+ */
+static unsigned ftm_sim_run(uint64_t tick, bool hold_last)
+{
+	if (tick < sim_now)
+		tick = sim_now;
+
+	unsigned held = 0;
+
+	while (1)
+	{
+		// the next wrap or pending interrupt, if it is by the tick
+		uint64_t next = tick + 1;
+
+		for (unsigned m = 0 ; m < num_modules ; m++)
+		{
+			const kinetis_ftm_t & ftm = host_ftm[m];
+			if (ftm.SC & FTM_SC_CLKS(3))
+			{
+				const uint64_t period = ftm_period(ftm);
+				const uint64_t wrap = (sim_now / period + 1) * period;
+				if (wrap < next)
+					next = wrap;
+			}
+
+			if ((pending & (1 << m)) && due[m] < next)
+				next = due[m];
+		}
+
+		if (next > tick)
+			break;
+
+		sim_now = next;
+		ftm_sim_count(next);
+
+		for (unsigned m = 0 ; m < num_modules ; m++)
+		{
+			// the counter rolls over; the ISR sees CNT at zero
+			kinetis_ftm_t & ftm = host_ftm[m];
+			if ((ftm.SC & FTM_SC_CLKS(3)) == 0
+			||  next % ftm_period(ftm) != 0
+			||  (ftm.SC & FTM_SC_TOIE) == 0)
+				continue;
+
+			ftm.SC |= FTM_SC_TOF;
+			if (hold_last && next == tick && latency == 0)
+				held |= 1 << m;
+			else
+				ftm_sim_interrupt(m);
+		}
+
+		for (unsigned m = 0 ; m < num_modules ; m++)
+		{
+			if ((pending & (1 << m)) == 0 || due[m] != next)
+				continue;
+			if (hold_last && next == tick)
+			{
+				held |= 1 << m;
+				continue;
+			}
+			pending &= ~(1 << m);
+			modules[m].isr();
+		}
+
+		if (next == tick)
+			break;
+	}
+
+	sim_now = tick;
+	ftm_sim_count(tick);
+	return held;
+}
+
+
+void ftm_sim_advance(uint64_t tick)
+{
+	ftm_sim_run(tick, false);
+}
+
+
+uint64_t ftm_sim_settle()
+{
+	while (pending)
+	{
+		uint64_t next = ~(uint64_t) 0;
+		for (unsigned m = 0 ; m < num_modules ; m++)
+			if ((pending & (1 << m)) && due[m] < next)
+				next = due[m];
+
+		ftm_sim_run(next, false);
+	}
+
+	return sim_now;
+}
+
+
+// Latch an edge on a pin into the channels armed for it
+static int ftm_sim_capture(uint8_t pin, bool rising)
+{
+	const uint32_t edge = rising ? FTM_CSC_ELSA : FTM_CSC_ELSB;
+	int captured = 0;
+
+	for (unsigned i = 0 ; i < sizeof(ftm_pins)/sizeof(*ftm_pins) ; i++)
+	{
+		if (ftm_pins[i].pin != pin)
+			continue;
+		if ((host_port_pcr[pin] & PORT_PCR_MUX_MASK) != PORT_PCR_MUX(ftm_pins[i].mux))
+			continue;
+
+		const unsigned m = ftm_pins[i].module;
+		kinetis_ftm_t & ftm = host_ftm[m];
+		kinetis_ftm_channel_t & ch = ftm.C[ftm_pins[i].channel];
+
+		// input capture mode only
+		if (ch.SC & (FTM_CSC_MSA | FTM_CSC_MSB))
+			continue;
+		if ((ch.SC & edge) == 0)
+			continue;
+
+		ch.V = ftm.CNT;
+		ch.SC |= FTM_CSC_CHF;
+		captured++;
+
+		if ((ch.SC & FTM_CSC_CHIE) == 0)
+			continue;
+
+		// with DMA set the channel requests a transfer instead of
+		// an interrupt, and the transfer clears CHF
+		if (ch.SC & FTM_CSC_DMA)
+		{
+			if (dma_sim_request(modules[m].dma_source + ftm_pins[i].channel))
+				ch.SC &= ~FTM_CSC_CHF;
+		} else
+			ftm_sim_interrupt(m);
+	}
+
+	return captured;
+}
+
+
+int ftm_sim_edge(uint64_t tick, uint8_t pin, bool rising)
+{
+	const unsigned held = ftm_sim_run(tick, true);
+	const int captured = ftm_sim_capture(pin, rising);
+
+	// the interrupts due on this tick, or the overflows if the
+	// capture's interrupt didn't already take them
+	for (unsigned m = 0 ; m < num_modules ; m++)
+	{
+		if ((held & (1 << m)) == 0)
+			continue;
+
+		if (pending & (1 << m))
+		{
+			pending &= ~(1 << m);
+			modules[m].isr();
+		} else
+		if (host_ftm[m].SC & FTM_SC_TOF)
+			ftm_sim_interrupt(m);
+	}
+
+	return captured;
+}
+
+
+uint32_t micros(void)
+{
+	return sim_now / (F_BUS / 1000000);
+}
+
+
+uint32_t millis(void)
+{
+	return sim_now / (F_BUS / 1000);
+}
+
+
+uint32_t host_dwt_cyccnt(void)
+{
+	return sim_now * (F_CPU / F_BUS);
+}
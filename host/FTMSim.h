@@ -0,0 +1,43 @@
+/** \file
+ * Simulated FlexTimer input capture for running the firmware on a host.
+ *
+ * Time is kept as a 64-bit count of bus clocks.  Advancing it runs the
+ * counter of each FTM module that is clocked forward and raises its
+ * overflow interrupt each time it wraps.  An edge on a Teensy pin is
+ * latched by any channel that has the pin muxed to its timer and is
+ * armed for that edge, which sets CHF and calls the module's ISR
+ * synchronously, the same as the hardware would with zero interrupt
+ * latency, or if the channel has DMA enabled runs the DMA transfer
+ * that it requests (see DMAChannel.h).  With a latency set, the ISR
+ * runs that many ticks after the flag is set instead, and the channels
+ * carry on capturing until then, so edges can be missed or overwritten
+ * as they are on the hardware.
+ */
+#ifndef _FTMSim_h_
+#define _FTMSim_h_
+
+#include <stdint.h>
+
+// clear all of the timer, port and interrupt state
+void ftm_sim_reset();
+
+// ticks from an interrupt flag being set to the ISR running, which
+// is zero until this is called
+void ftm_sim_latency(uint64_t ticks);
+
+// current simulated time in bus clocks
+uint64_t ftm_sim_now();
+
+// run the counter forward to the tick, firing overflow interrupts
+void ftm_sim_advance(uint64_t tick);
+
+// run on until no interrupt is pending, as code outside the ISRs can
+// only run then, and return the tick.  The latency has to be less than
+// a counter period for that to come.
+uint64_t ftm_sim_settle();
+
+// present an edge on a pin at the tick.  returns the number of
+// channels that captured it.
+int ftm_sim_edge(uint64_t tick, uint8_t pin, bool rising);
+
+#endif
@@ -0,0 +1,84 @@
+/** \file
+ * File backed storage for the host build.
+ */
+#include "FileStorage.h"
+#include <stdint.h>
+
+
+FileStorage::FileStorage()
+{
+	file = NULL;
+	length = 0;
+	bytes_written = 0;
+}
+
+
+FileStorage::~FileStorage()
+{
+	if (file)
+		fclose(file);
+}
+
+
+bool FileStorage::open(const char * filename, unsigned size)
+{
+	file = fopen(filename, "r+b");
+	if (!file)
+	{
+		file = fopen(filename, "w+b");
+		if (!file)
+			return false;
+
+		// freshly erased
+		for (unsigned i = 0 ; i < size ; i++)
+			putc(0xFF, file);
+		fflush(file);
+	}
+
+	fseek(file, 0, SEEK_END);
+	length = ftell(file);
+	return true;
+}
+
+
+unsigned FileStorage::size()
+{
+	return length;
+}
+
+
+bool FileStorage::read(unsigned addr, void * buf, unsigned len)
+{
+	if (!file || addr + len > length)
+		return false;
+
+	fseek(file, addr, SEEK_SET);
+	return fread(buf, 1, len, file) == len;
+}
+
+
+bool FileStorage::write(unsigned addr, const void * buf, unsigned len)
+{
+	if (!file || addr + len > length)
+		return false;
+
+	// count only the bytes that change, like EEPROM.update()
+	const uint8_t * p = (const uint8_t *) buf;
+	for (unsigned i = 0 ; i < len ; i++)
+	{
+		uint8_t old;
+		fseek(file, addr + i, SEEK_SET);
+		if (fread(&old, 1, 1, file) != 1)
+			return false;
+		if (old == p[i])
+			continue;
+
+		fseek(file, addr + i, SEEK_SET);
+		if (fwrite(&p[i], 1, 1, file) != 1)
+			return false;
+		bytes_written++;
+	}
+
+	fflush(file);
+	return true;
+}
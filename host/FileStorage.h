@@ -0,0 +1,32 @@
+/** \file
+ * LighthouseStorage in a file, standing in for the EEPROM on the host.
+ */
+#ifndef _FileStorage_h_
+#define _FileStorage_h_
+
+#include <stdio.h>
+#include "LighthouseStorage.h"
+
+class FileStorage : public LighthouseStorage
+{
+public:
+	FileStorage();
+	~FileStorage();
+
+	// Open the image, creating it as erased storage of the given
+	// size if it does not exist yet.
+	bool open(const char * filename, unsigned size = 2048);
+
+	unsigned size();
+	bool read(unsigned addr, void * buf, unsigned len);
+	bool write(unsigned addr, const void * buf, unsigned len);
+
+	// bytes that were actually changed by write()
+	unsigned long bytes_written;
+
+private:
+	FILE * file;
+	unsigned length;
+};
+
+#endif
@@ -0,0 +1,59 @@
+/** \file
+ * Serial port for the host build; everything goes to stdout.
+ */
+#include <Arduino.h>
+#include <stdio.h>
+
+HostSerial Serial;
+
+
+void HostSerial::flush()
+{
+	fflush(stdout);
+}
+
+
+size_t HostSerial::write(uint8_t c)
+{
+	return fwrite(&c, 1, 1, stdout);
+}
+
+
+size_t HostSerial::write(const uint8_t * buf, size_t len)
+{
+	return fwrite(buf, 1, len, stdout);
+}
+
+
+size_t HostSerial::print(const char * s)
+{
+	return write((const uint8_t*) s, strlen(s));
+}
+
+
+size_t HostSerial::print(char c)
+{
+	return write((uint8_t) c);
+}
+
+
+size_t HostSerial::print(long n, int base)
+{
+	if (base == DEC)
+		return printf("%ld", n);
+	return print((unsigned long) n, base);
+}
+
+
+size_t HostSerial::print(unsigned long n, int base)
+{
+	if (base == HEX)
+		return printf("%lX", n);
+	return printf("%lu", n);
+}
+
+
+size_t HostSerial::print(double n, int digits)
+{
+	return printf("%.*f", digits, n);
+}
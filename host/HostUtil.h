@@ -0,0 +1,46 @@
+/** \file
+ * Small helpers that the host tools share: a monotonic clock for
+ * timing things, and the random numbers that the benches use to make
+ * up poses, clock offsets and noise.
+ *
+ * The random numbers come from rand(), so a bench that calls srand()
+ * with a fixed seed gets the same run every time.  EmissionSim keeps
+ * its own generator, so that its edges don't depend on how many
+ * numbers the bench around it has drawn.
+ */
+#ifndef _HostUtil_h_
+#define _HostUtil_h_
+
+#include <stdlib.h>
+#include <time.h>
+#include <math.h>
+
+// seconds on CLOCK_MONOTONIC
+static inline double now_sec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// uniform in (0,1), never exactly 0 so that log() of it is safe
+static inline double uniform()
+{
+	return (rand() + 0.5) / (RAND_MAX + 1.0);
+}
+
+// uniform in (lo,hi)
+static inline double frand(double lo, double hi)
+{
+	return lo + (hi - lo) * uniform();
+}
+
+// zero mean, unit variance
+static inline double gaussian()
+{
+	const double u = uniform();
+	const double v = uniform();
+	return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+#endif
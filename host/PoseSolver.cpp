@@ -0,0 +1,483 @@
+/** \file
+ * Closed form plus Levenberg-Marquardt lighthouse pose solver.
+ *
+ * Internally the pose is kept as the board to lighthouse transform
+ * P = R p + t, since that is what the angles are measured from; it is
+ * only inverted into mat/origin for the caller.
+ *
+ * In the lighthouse's frame the ray towards a point P is along -Z and
+ * the two sweep angles satisfy
+ *
+ *	tan(angle1) = -P.x / -P.z
+ *	tan(angle2) =  P.y / -P.z
+ *
+ * which is the same ray that LighthouseXYZ builds from the planes.
+ */
+#include "PoseSolver.h"
+#include <math.h>
+#include <vector>
+
+
+// Solve A x = b in place by Gaussian elimination with partial pivoting.
+// A is n by n, row major.  The solution replaces b.
+static bool solve_linear(double * A, double * b, unsigned n)
+{
+	for (unsigned col = 0 ; col < n ; col++)
+	{
+		unsigned pivot = col;
+		for (unsigned row = col + 1 ; row < n ; row++)
+			if (fabs(A[row*n + col]) > fabs(A[pivot*n + col]))
+				pivot = row;
+
+		if (fabs(A[pivot*n + col]) < 1e-300)
+			return false;
+
+		if (pivot != col)
+		{
+			for (unsigned k = 0 ; k < n ; k++)
+			{
+				const double tmp = A[col*n + k];
+				A[col*n + k] = A[pivot*n + k];
+				A[pivot*n + k] = tmp;
+			}
+			const double tmp = b[col];
+			b[col] = b[pivot];
+			b[pivot] = tmp;
+		}
+
+		for (unsigned row = col + 1 ; row < n ; row++)
+		{
+			const double f = A[row*n + col] / A[col*n + col];
+			for (unsigned k = col ; k < n ; k++)
+				A[row*n + k] -= f * A[col*n + k];
+			b[row] -= f * b[col];
+		}
+	}
+
+	for (unsigned col = n ; col-- > 0 ; )
+	{
+		double sum = b[col];
+		for (unsigned k = col + 1 ; k < n ; k++)
+			sum -= A[col*n + k] * b[k];
+		b[col] = sum / A[col*n + col];
+	}
+
+	return true;
+}
+
+
+static double dot(const double a[3], const double b[3])
+{
+	return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+}
+
+
+static void cross(const double a[3], const double b[3], double res[3])
+{
+	res[0] = a[1]*b[2] - a[2]*b[1];
+	res[1] = a[2]*b[0] - a[0]*b[2];
+	res[2] = a[0]*b[1] - a[1]*b[0];
+}
+
+
+static void normalize(double v[3])
+{
+	const double len = sqrt(dot(v, v));
+	v[0] /= len;
+	v[1] /= len;
+	v[2] /= len;
+}
+
+
+// board to lighthouse transform <-> the caller's mat/origin
+static void to_solution(const double R[9], const double t[3], PoseSolution & sol)
+{
+	for (int i = 0 ; i < 3 ; i++)
+	{
+		for (int j = 0 ; j < 3 ; j++)
+			sol.mat[i*3 + j] = R[j*3 + i];
+
+		sol.origin[i] = -(R[0*3+i]*t[0] + R[1*3+i]*t[1] + R[2*3+i]*t[2]);
+	}
+}
+
+
+static void from_solution(const PoseSolution & sol, double R[9], double t[3])
+{
+	for (int i = 0 ; i < 3 ; i++)
+		for (int j = 0 ; j < 3 ; j++)
+			R[i*3 + j] = sol.mat[j*3 + i];
+
+	for (int i = 0 ; i < 3 ; i++)
+		t[i] = -(R[i*3+0]*sol.origin[0]
+		       + R[i*3+1]*sol.origin[1]
+		       + R[i*3+2]*sol.origin[2]);
+}
+
+
+static bool project(const double R[9], const double t[3], const double p[3], double a[2])
+{
+	double P[3];
+	for (int i = 0 ; i < 3 ; i++)
+		P[i] = R[i*3+0]*p[0] + R[i*3+1]*p[1] + R[i*3+2]*p[2] + t[i];
+
+	a[0] = atan2(-P[0], -P[2]);
+	a[1] = atan2(P[1], -P[2]);
+
+	return P[2] < 0;
+}
+
+
+bool pose_project(const PoseSolution & sol, const double p[3], double angles[2])
+{
+	double R[9], t[3];
+	from_solution(sol, R, t);
+	return project(R, t, p, angles);
+}
+
+
+bool pose_init(
+	const double (*sensors)[3],
+	const double (*angles)[2],
+	unsigned n,
+	PoseSolution & sol
+)
+{
+	if (n < 4)
+		return false;
+
+	// scale the board to about unit size so that the normal
+	// equations are well conditioned
+	double scale = 0;
+	for (unsigned i = 0 ; i < n ; i++)
+	{
+		if (fabs(sensors[i][0]) > scale) scale = fabs(sensors[i][0]);
+		if (fabs(sensors[i][1]) > scale) scale = fabs(sensors[i][1]);
+	}
+	if (scale == 0)
+		return false;
+
+	// Direct linear transform for the homography from the board's
+	// (x,y,1) to the tangent plane (u,v,1), with H[2][2] = 1.
+	// Exactly determined for four sensors, least squares for more.
+	double A[8*8] = {};
+	double b[8] = {};
+
+	for (unsigned i = 0 ; i < n ; i++)
+	{
+		const double x = sensors[i][0] / scale;
+		const double y = sensors[i][1] / scale;
+		const double u = -tan(angles[i][0]);
+		const double v = tan(angles[i][1]);
+
+		const double ru[8] = { x, y, 1, 0, 0, 0, -u*x, -u*y };
+		const double rv[8] = { 0, 0, 0, x, y, 1, -v*x, -v*y };
+
+		for (int j = 0 ; j < 8 ; j++)
+		{
+			for (int k = 0 ; k < 8 ; k++)
+				A[j*8 + k] += ru[j] * ru[k] + rv[j] * rv[k];
+			b[j] += ru[j] * u + rv[j] * v;
+		}
+	}
+
+	if (!solve_linear(A, b, 8))
+		return false;
+
+	// columns of H, undoing the scaling of x and y
+	double h1[3] = { b[0] / scale, b[3] / scale, b[6] / scale };
+	double h2[3] = { b[1] / scale, b[4] / scale, b[7] / scale };
+	double h3[3] = { b[2], b[5], 1 };
+
+	// H is [r1 r2 t] up to scale with the Z row negated; the rotation
+	// columns are unit length, and the board must be in front (-Z)
+	double lambda = 2 / (sqrt(dot(h1, h1)) + sqrt(dot(h2, h2)));
+	if (h3[2] < 0)
+		lambda = -lambda;
+
+	double r1[3], r2[3], r3[3], t[3];
+	for (int i = 0 ; i < 3 ; i++)
+	{
+		const double flip = i == 2 ? -lambda : lambda;
+		r1[i] = h1[i] * flip;
+		r2[i] = h2[i] * flip;
+		t[i] = h3[i] * flip;
+	}
+
+	// noise makes r1 and r2 not quite orthogonal
+	normalize(r1);
+	const double d = dot(r1, r2);
+	for (int i = 0 ; i < 3 ; i++)
+		r2[i] -= d * r1[i];
+	normalize(r2);
+	cross(r1, r2, r3);
+
+	double R[9];
+	for (int i = 0 ; i < 3 ; i++)
+	{
+		R[i*3 + 0] = r1[i];
+		R[i*3 + 1] = r2[i];
+		R[i*3 + 2] = r3[i];
+	}
+
+	to_solution(R, t, sol);
+	sol.iterations = 0;
+	sol.rms = 0;
+
+	return true;
+}
+
+
+// Residuals for the pose, returns the sum of squares
+static double residuals(
+	const double R[9],
+	const double t[3],
+	const double (*sensors)[3],
+	const double (*angles)[2],
+	unsigned n,
+	double * res
+)
+{
+	double sum = 0;
+
+	for (unsigned i = 0 ; i < n ; i++)
+	{
+		double a[2];
+		project(R, t, sensors[i], a);
+
+		res[2*i + 0] = a[0] - angles[i][0];
+		res[2*i + 1] = a[1] - angles[i][1];
+		sum += res[2*i+0] * res[2*i+0] + res[2*i+1] * res[2*i+1];
+	}
+
+	return sum;
+}
+
+
+// Apply a step: rotate R by the small rotation vector w (Rodrigues)
+// and move t by dt.
+static void apply_step(
+	const double R[9],
+	const double t[3],
+	const double step[6],
+	double Rn[9],
+	double tn[3]
+)
+{
+	const double * w = step;
+	const double theta = sqrt(dot(w, w));
+
+	double E[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+	if (theta > 0)
+	{
+		const double k[3] = { w[0]/theta, w[1]/theta, w[2]/theta };
+		const double s = sin(theta);
+		const double c = 1 - cos(theta);
+		const double K[9] = {
+			    0, -k[2],  k[1],
+			 k[2],     0, -k[0],
+			-k[1],  k[0],     0,
+		};
+
+		// E = I + s K + c K^2
+		for (int i = 0 ; i < 3 ; i++)
+		{
+			for (int j = 0 ; j < 3 ; j++)
+			{
+				double k2 = 0;
+				for (int m = 0 ; m < 3 ; m++)
+					k2 += K[i*3+m] * K[m*3+j];
+				E[i*3+j] += s * K[i*3+j] + c * k2;
+			}
+		}
+	}
+
+	for (int i = 0 ; i < 3 ; i++)
+	{
+		for (int j = 0 ; j < 3 ; j++)
+			Rn[i*3+j] = E[i*3+0] * R[0*3+j]
+				  + E[i*3+1] * R[1*3+j]
+				  + E[i*3+2] * R[2*3+j];
+		tn[i] = t[i] + step[3+i];
+	}
+}
+
+
+void pose_refine(
+	const double (*sensors)[3],
+	const double (*angles)[2],
+	unsigned n,
+	PoseSolution & sol,
+	unsigned max_iterations
+)
+{
+	double R[9], t[3];
+	from_solution(sol, R, t);
+
+	const unsigned m = 2 * n;
+	std::vector<double> res(m), res_d(m), J(m * 6);
+
+	double cost = residuals(R, t, sensors, angles, n, &res[0]);
+	double mu = 1e-3;
+	unsigned iter;
+
+	for (iter = 0 ; iter < max_iterations ; iter++)
+	{
+		// forward difference Jacobian, one column per parameter
+		const double eps = 1e-7;
+		for (int k = 0 ; k < 6 ; k++)
+		{
+			double step[6] = {};
+			step[k] = eps;
+
+			double Rd[9], td[3];
+			apply_step(R, t, step, Rd, td);
+			residuals(Rd, td, sensors, angles, n, &res_d[0]);
+
+			for (unsigned i = 0 ; i < m ; i++)
+				J[i*6 + k] = (res_d[i] - res[i]) / eps;
+		}
+
+		double JtJ[36] = {};
+		double Jtr[6] = {};
+		for (unsigned i = 0 ; i < m ; i++)
+		{
+			for (int j = 0 ; j < 6 ; j++)
+			{
+				for (int k = 0 ; k < 6 ; k++)
+					JtJ[j*6 + k] += J[i*6 + j] * J[i*6 + k];
+				Jtr[j] += J[i*6 + j] * res[i];
+			}
+		}
+
+		// raise the damping until a step reduces the cost
+		bool improved = false;
+		double step_size = 0;
+
+		while (mu < 1e12)
+		{
+			double A[36], step[6];
+			for (int j = 0 ; j < 36 ; j++)
+				A[j] = JtJ[j];
+			for (int j = 0 ; j < 6 ; j++)
+			{
+				A[j*6 + j] += mu * (JtJ[j*6 + j] + 1e-12);
+				step[j] = -Jtr[j];
+			}
+
+			if (!solve_linear(A, step, 6))
+			{
+				mu *= 10;
+				continue;
+			}
+
+			double Rn[9], tn[3];
+			apply_step(R, t, step, Rn, tn);
+			const double new_cost = residuals(Rn, tn, sensors, angles, n, &res_d[0]);
+
+			if (new_cost < cost)
+			{
+				for (int j = 0 ; j < 9 ; j++)
+					R[j] = Rn[j];
+				for (int j = 0 ; j < 3 ; j++)
+					t[j] = tn[j];
+				res.swap(res_d);
+
+				step_size = sqrt(dot(step, step) + dot(step+3, step+3));
+				improved = cost - new_cost > 1e-15 * cost;
+				cost = new_cost;
+				mu = mu > 1e-9 ? mu / 10 : mu;
+				break;
+			}
+
+			mu *= 10;
+		}
+
+		if (!improved || step_size < 1e-12)
+			break;
+	}
+
+	to_solution(R, t, sol);
+	sol.iterations = iter;
+	sol.rms = sqrt(cost / m);
+}
+
+
+/*
+ * The other pose that a small flat board looks almost the same from:
+ * tilted the other way about the line of sight to its center.  Seen
+ * from far enough away the sensors' directions differ by much less
+ * than the noise, so the closed form can start next to either one.
+ * Reflecting the board's points through the plane across the line of
+ * sight leaves their directions as they were to first order, and
+ * reflecting the board's Z as well keeps it a rotation, which is the
+ * same for points on the board at z = 0.
+ */
+static void flipped_pose(
+	const double (*sensors)[3],
+	unsigned n,
+	const PoseSolution & sol,
+	PoseSolution & flip
+)
+{
+	double R[9], t[3];
+	from_solution(sol, R, t);
+
+	double c[3] = { 0, 0, 0 };
+	for (unsigned i = 0 ; i < n ; i++)
+		for (int j = 0 ; j < 3 ; j++)
+			c[j] += sensors[i][j] / n;
+
+	double P[3];
+	for (int i = 0 ; i < 3 ; i++)
+		P[i] = R[i*3+0]*c[0] + R[i*3+1]*c[1] + R[i*3+2]*c[2] + t[i];
+
+	double s[3] = { P[0], P[1], P[2] };
+	normalize(s);
+
+	// R' = (I - 2 s s^T) R diag(1,1,-1)
+	double Rf[9];
+	for (int i = 0 ; i < 3 ; i++)
+	{
+		for (int j = 0 ; j < 3 ; j++)
+		{
+			double h = 0;
+			for (int k = 0 ; k < 3 ; k++)
+				h += ((i == k) - 2 * s[i] * s[k]) * R[k*3+j];
+			Rf[i*3+j] = j == 2 ? -h : h;
+		}
+	}
+
+	// with the center of the board where it was
+	double tf[3];
+	for (int i = 0 ; i < 3 ; i++)
+		tf[i] = P[i] - (Rf[i*3+0]*c[0] + Rf[i*3+1]*c[1] + Rf[i*3+2]*c[2]);
+
+	to_solution(Rf, tf, flip);
+	flip.iterations = 0;
+	flip.rms = 0;
+}
+
+
+bool pose_solve(
+	const double (*sensors)[3],
+	const double (*angles)[2],
+	unsigned n,
+	PoseSolution & sol
+)
+{
+	if (!pose_init(sensors, angles, n, sol))
+		return false;
+
+	// refine both and keep whichever fits the angles better
+	PoseSolution flip;
+	flipped_pose(sensors, n, sol, flip);
+
+	pose_refine(sensors, angles, n, sol);
+	pose_refine(sensors, angles, n, flip);
+
+	if (flip.rms < sol.rms)
+		sol = flip;
+
+	return true;
+}
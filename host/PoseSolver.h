@@ -0,0 +1,66 @@
+/** \file
+ * Solve for the pose of a Lighthouse from one set of sweep angles.
+ *
+ * The sensors are at known positions on a flat board (z = 0 in the
+ * board's frame, in meters).  The four sensor solution is closed form:
+ * the sweep angles give each sensor's tangent plane coordinates as
+ * seen from the lighthouse, which are related to the board positions
+ * by a homography; that is solved directly and split into a rotation
+ * and translation.  Levenberg-Marquardt then refines all six degrees
+ * of freedom to minimize the error in the measured angles.  A small
+ * flat board seen from a distance looks almost the same tilted either
+ * way about the line of sight, so pose_solve() refines both tilts and
+ * keeps the better fit.
+ *
+ * The result is in the form that LighthouseXYZ uses: mat rotates a
+ * lighthouse-relative ray into the board's frame, and origin is the
+ * position of the lighthouse in it.
+ */
+#ifndef _PoseSolver_h_
+#define _PoseSolver_h_
+
+struct PoseSolution {
+	double mat[9];
+	double origin[3];
+
+	double rms;		// residual angle error, radians
+	unsigned iterations;
+};
+
+
+// Closed form initial pose from n >= 4 coplanar sensors.
+// angles[i] are the two sweep angles for sensor i, in radians.
+// Returns false if the sensors are degenerate.
+bool pose_init(
+	const double (*sensors)[3],
+	const double (*angles)[2],
+	unsigned n,
+	PoseSolution & sol
+);
+
+// Refine the pose in sol with Levenberg-Marquardt and update rms.
+void pose_refine(
+	const double (*sensors)[3],
+	const double (*angles)[2],
+	unsigned n,
+	PoseSolution & sol,
+	unsigned max_iterations = 50
+);
+
+// Both of the above
+bool pose_solve(
+	const double (*sensors)[3],
+	const double (*angles)[2],
+	unsigned n,
+	PoseSolution & sol
+);
+
+// The sweep angles that a lighthouse with the given pose would measure
+// for a point in the board's frame.  Returns false if it is behind it.
+bool pose_project(
+	const PoseSolution & sol,
+	const double p[3],
+	double angles[2]
+);
+
+#endif
@@ -0,0 +1,67 @@
+/** \file
+ * Lock-free queue between one producer thread and one consumer thread.
+ *
+ * The same ring as InputCapture's between its ISR and loop(): each side
+ * only writes its own index, and the slot is filled before the write
+ * index that publishes it is stored (and read before the read index
+ * that frees it), with release and acquire ordering since the host
+ * threads can be on different cores.  Unlike the ISR, push() does not
+ * overwrite when the queue is full but says so, so the producer can
+ * wait for the consumer.  The indices are a cache line apart so that
+ * the two sides don't contend for one.
+ */
+#ifndef _SPSCQueue_h_
+#define _SPSCQueue_h_
+
+#include <stdint.h>
+#include <atomic>
+
+template <typename T, unsigned N>
+class SPSCQueue
+{
+public:
+	static_assert((N & (N - 1)) == 0, "N must be a power of two");
+
+	SPSCQueue() : head(0), tail(0) {}
+
+	// Producer: false if the queue is full
+	bool push(const T & item)
+	{
+		const uint32_t w = this->head.load(std::memory_order_relaxed);
+		if (w - this->tail.load(std::memory_order_acquire) == N)
+			return false;
+
+		this->slots[w & (N - 1)] = item;
+		this->head.store(w + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer: false if the queue is empty
+	bool pop(T * item)
+	{
+		const uint32_t r = this->tail.load(std::memory_order_relaxed);
+		if (this->head.load(std::memory_order_acquire) == r)
+			return false;
+
+		*item = this->slots[r & (N - 1)];
+		this->tail.store(r + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Either side, though it may be out of date by the time it returns
+	bool empty() const
+	{
+		return this->head.load(std::memory_order_acquire)
+			== this->tail.load(std::memory_order_acquire);
+	}
+
+private:
+	// padded rather than aligned, which new can't do in C++11
+	std::atomic<uint32_t> head;
+	uint8_t pad0[64];
+	std::atomic<uint32_t> tail;
+	uint8_t pad1[64];
+	T slots[N];
+};
+
+#endif
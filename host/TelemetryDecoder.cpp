@@ -0,0 +1,431 @@
+/** \file
+ * Streaming decoder for the binary telemetry frames.
+ */
+#include "TelemetryDecoder.h"
+#include <string.h>
+
+// frame_length() result for a header that can not be valid
+static const unsigned BAD_FRAME = ~0u;
+
+
+TelemetryDecoder::TelemetryDecoder()
+{
+	len = 0;
+	have_seq = false;
+	next_seq = 0;
+	edges_lost = false;
+	device_time = 0;
+	time_anchor = 0;
+	bytes = frames = crc_errors = lost_frames = dropped_deltas = 0;
+	bad_edges = 0;
+
+	for (unsigned i = 0 ; i < LighthouseTelemetry::max_sensors ; i++)
+		have_key[i] = false;
+}
+
+
+static inline uint16_t get16(const uint8_t * p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+
+static inline uint32_t get24(const uint8_t * p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16);
+}
+
+
+static inline uint32_t get32(const uint8_t * p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+
+static inline float get_float(const uint8_t * p)
+{
+	const uint32_t bits = get32(p);
+	float val;
+	memcpy(&val, &bits, sizeof(val));
+	return val;
+}
+
+
+// 0 if not enough of the frame has arrived to tell
+unsigned TelemetryDecoder::frame_length(const uint8_t * f, unsigned len)
+{
+	if (len < 2)
+		return 0;
+
+	switch (f[1] >> 4)
+	{
+	case LH_FRAME_FIX_KEY: return LH_FIX_KEY_SIZE;
+	case LH_FRAME_FIX_DELTA: return LH_FIX_DELTA_SIZE;
+	case LH_FRAME_CALIBRATION: return LH_CALIBRATION_SIZE;
+	case LH_FRAME_POSE: return LH_POSE_SIZE;
+	case LH_FRAME_TIME: return LH_TIME_SIZE;
+	case LH_FRAME_OOTX:
+	case LH_FRAME_TEXT:
+	case LH_FRAME_EDGES:
+		if (len < 5)
+			return 0;
+		if (get16(&f[3]) > LH_OOTX_MAX)
+			return BAD_FRAME;
+		return LH_OOTX_OVERHEAD + get16(&f[3]);
+	default:
+		return BAD_FRAME;
+	}
+}
+
+
+// drop the leading sync byte and hunt for the next one
+void TelemetryDecoder::resync()
+{
+	unsigned i;
+	for (i = 1 ; i < len ; i++)
+		if (buf[i] == LH_SYNC)
+			break;
+
+	len -= i;
+	memmove(buf, buf + i, len);
+}
+
+
+int TelemetryDecoder::feed(uint8_t c)
+{
+	bytes++;
+
+	if (len == 0 && c != LH_SYNC)
+		return 0;
+
+	buf[len++] = c;
+
+	while (len != 0)
+	{
+		const unsigned need = frame_length(buf, len);
+		if (need == 0 || (need != BAD_FRAME && len < need))
+			return 0;
+
+		if (need == BAD_FRAME
+		||  lighthouse_crc8(buf + 1, need - 2) != buf[need - 1])
+		{
+			crc_errors++;
+			resync();
+			continue;
+		}
+
+		const int type = decode(buf);
+
+		// keep anything after this frame for next time
+		len -= need;
+		memmove(buf, buf + need, len);
+		if (len != 0 && buf[0] != LH_SYNC)
+			resync();
+
+		if (type != 0)
+			return type;
+	}
+
+	return 0;
+}
+
+
+int TelemetryDecoder::feed(const uint8_t * p, unsigned n, unsigned * used)
+{
+	unsigned i = 0;
+
+	// finish a frame that the last block started
+	while (len != 0 && i < n)
+	{
+		const int type = feed(p[i++]);
+		if (type != 0)
+		{
+			*used = i;
+			return type;
+		}
+	}
+
+	const unsigned start = i;
+
+	while (i < n)
+	{
+		// hunt for the sync byte
+		if (p[i] != LH_SYNC)
+		{
+			i++;
+			continue;
+		}
+
+		const unsigned need = frame_length(p + i, n - i);
+		if (need == 0 || (need != BAD_FRAME && n - i < need))
+			break;
+
+		if (need == BAD_FRAME
+		||  lighthouse_crc8(p + i + 1, need - 2) != p[i + need - 1])
+		{
+			crc_errors++;
+			i++;
+			continue;
+		}
+
+		const int type = decode(p + i);
+		i += need;
+
+		if (type != 0)
+		{
+			bytes += i - start;
+			*used = i;
+			return type;
+		}
+	}
+
+	bytes += i - start;
+
+	// the start of a frame that the next block finishes
+	while (i < n)
+		feed(p[i++]);
+
+	*used = n;
+	return 0;
+}
+
+
+int TelemetryDecoder::decode(const uint8_t * f)
+{
+	const unsigned type = f[1] >> 4;
+	const unsigned id = f[1] & 0xF;
+	const uint8_t seq = f[2];
+
+	frames++;
+
+	if (have_seq && seq != next_seq)
+	{
+		// delta fixes are no good until the next key frames
+		lost_frames += (uint8_t)(seq - next_seq);
+		for (unsigned i = 0 ; i < LighthouseTelemetry::max_sensors ; i++)
+			have_key[i] = false;
+		edges_lost = true;
+	}
+
+	have_seq = true;
+	next_seq = seq + 1;
+
+	const uint8_t * p = &f[3];
+
+	if (type == LH_FRAME_EDGES)
+		return decode_edges(id, p + 2, get16(p));
+
+	if (type == LH_FRAME_TIME)
+	{
+		device_time = get32(p) | (uint64_t) get32(p + 4) << 32;
+		time_anchor = device_time;
+		return type;
+	}
+
+	if (type == LH_FRAME_OOTX || type == LH_FRAME_TEXT)
+	{
+		ootx.id = id;
+		ootx.length = get16(p);
+		memcpy(ootx.bytes, p + 2, ootx.length);
+		return type;
+	}
+
+	if (type == LH_FRAME_CALIBRATION)
+	{
+		LighthouseCalibration & cal = calibration;
+		calibration_id = id;
+
+		cal.fw_version = get16(p); p += 2;
+		cal.protocol = *p++;
+		cal.id = get32(p); p += 4;
+
+		for (int i = 0 ; i < 2 ; i++, p += 4)
+			cal.phase[i] = get_float(p);
+		for (int i = 0 ; i < 2 ; i++, p += 4)
+			cal.tilt[i] = get_float(p);
+		for (int i = 0 ; i < 2 ; i++, p += 4)
+			cal.curve[i] = get_float(p);
+		for (int i = 0 ; i < 2 ; i++, p += 4)
+			cal.gibphase[i] = get_float(p);
+		for (int i = 0 ; i < 2 ; i++, p += 4)
+			cal.gibmag[i] = get_float(p);
+
+		for (int i = 0 ; i < 3 ; i++)
+			cal.accel[i] = (int8_t) *p++;
+
+		cal.unlock_count = *p++;
+		cal.hw_version = *p++;
+		cal.mode = *p++;
+		cal.faults = *p++;
+
+		return type;
+	}
+
+	if (type == LH_FRAME_POSE)
+	{
+		pose.id = id;
+		pose.time = extend(get32(p)); p += 4;
+		for (int i = 0 ; i < 3 ; i++, p += 2)
+			pose.xyz[i] = (int16_t) get16(p);
+		for (int i = 0 ; i < 4 ; i++, p += 2)
+			pose.q[i] = (int16_t) get16(p) / 32767.0f;
+		pose.used = *p++;
+		pose.rms = get16(p) * 1e-6f;
+		return type;
+	}
+
+	uint32_t * const last = last_raw[id];
+
+	if (type == LH_FRAME_FIX_KEY)
+	{
+		last_time[id] = get32(p); p += 4;
+		for (int i = 0 ; i < 4 ; i++, p += 3)
+			last[i] = get24(p);
+		have_key[id] = true;
+	} else {
+		if (!have_key[id])
+		{
+			dropped_deltas++;
+			return 0;
+		}
+
+		last_time[id] += get24(p); p += 3;
+		for (int i = 0 ; i < 4 ; i++, p += 2)
+			last[i] += (int16_t) get16(p);
+	}
+
+	fix.id = id;
+	fix.time = extend(last_time[id]);
+	memcpy(fix.raw, last, sizeof(fix.raw));
+	for (int i = 0 ; i < 3 ; i++, p += 2)
+		fix.xyz[i] = (int16_t) get16(p);
+	fix.dist = get16(p) / 10000.0f;
+
+	return type;
+}
+
+
+uint64_t TelemetryDecoder::extend(uint32_t t)
+{
+	uint64_t ext = (time_anchor & ~(uint64_t) 0xFFFFFFFF) | t;
+
+	if (ext > time_anchor + 0x80000000u)
+	{
+		if (ext >= (1ull << 32))
+			ext -= 1ull << 32;
+	} else
+	if (ext + 0x80000000u < time_anchor)
+		ext += 1ull << 32;
+
+	if (ext > time_anchor)
+		time_anchor = ext;
+
+	return ext;
+}
+
+
+// see LighthouseEdgeStream.h for the packing
+int TelemetryDecoder::decode_edges(
+	unsigned flags,
+	const uint8_t * p,
+	unsigned len
+)
+{
+	if (len < 4)
+	{
+		bad_edges++;
+		return 0;
+	}
+
+	uint32_t when = get32(p);
+	unsigned n = 0;
+
+	for (unsigned i = 4 ; i < len ; )
+	{
+		uint32_t val = 0;
+		unsigned shift = 0;
+
+		while (i < len && shift < 35)
+		{
+			const uint8_t c = p[i++];
+			val |= (uint32_t) (c & 0x7F) << shift;
+			shift += 7;
+			if ((c & 0x80) == 0)
+				break;
+		}
+
+		if ((p[i-1] & 0x80) || n == LH_OOTX_MAX)
+		{
+			bad_edges++;
+			return 0;
+		}
+
+		const uint32_t zz = val >> 5;
+		when += (int32_t) ((zz >> 1) ^ -(zz & 1));
+
+		edges.when[n] = when;
+		edges.id[n] = (val >> 1) & 0xF;
+		edges.rising[n] = val & 1;
+		n++;
+	}
+
+	edges.count = n;
+	edges.lost = edges_lost || (flags & LH_EDGES_LOST);
+	edges_lost = false;
+
+	return LH_FRAME_EDGES;
+}
+
+
+void
+telemetry_write_fix(
+	FILE * f,
+	const TelemetryFix & p
+)
+{
+	fprintf(f, "%u,%u,%u,%u,%u,%d,%d,%d,%.2f\n",
+		p.id,
+		p.raw[0], p.raw[1], p.raw[2], p.raw[3],
+		p.xyz[0], p.xyz[1], p.xyz[2],
+		p.dist
+	);
+}
+
+
+void
+telemetry_write_pose(
+	FILE * f,
+	const TelemetryPose & p
+)
+{
+	fprintf(f, "pose %u %d,%d,%d %.4f,%.4f,%.4f,%.4f %u %.3f\n",
+		p.id,
+		p.xyz[0], p.xyz[1], p.xyz[2],
+		p.q[0], p.q[1], p.q[2], p.q[3],
+		p.used,
+		p.rms * 1000
+	);
+}
+
+
+void
+telemetry_write_calibration(
+	FILE * f,
+	unsigned lh,
+	const LighthouseCalibration & c
+)
+{
+	fprintf(f, "cal %u id=%08X fw=%u hw=%u"
+		" phase=%f,%f tilt=%f,%f curve=%f,%f"
+		" gibphase=%f,%f gibmag=%f,%f"
+		" accel=%d,%d,%d mode=%u faults=%u\n",
+		lh, c.id, c.fw_version, c.hw_version,
+		c.phase[0], c.phase[1],
+		c.tilt[0], c.tilt[1],
+		c.curve[0], c.curve[1],
+		c.gibphase[0], c.gibphase[1],
+		c.gibmag[0], c.gibmag[1],
+		c.accel[0], c.accel[1], c.accel[2],
+		c.mode, c.faults
+	);
+}
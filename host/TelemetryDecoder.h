@@ -0,0 +1,128 @@
+/** \file
+ * Decode the binary telemetry stream from the tracker.
+ *
+ * Bytes are fed in one at a time or in blocks; whenever a complete
+ * frame with a valid CRC has arrived feed() returns its type and the decoded
+ * contents are in fix, pose, calibration, edges or ootx (which also
+ * holds TEXT messages).
+ * Corrupt frames are skipped by hunting for the next sync byte, and
+ * delta fixes that arrive after a lost frame are dropped until that
+ * sensor's next key frame.
+ *
+ * The 32-bit times in the fixes and poses are extended to the 64-bit
+ * timer ticks from the TIME frames, by taking the one closest to the
+ * last time seen, so they keep counting up past the 89 second wrap.
+ *
+ * telemetry_write_fix() and friends print the decoded records in the
+ * text format that the firmware used to, one line each, for lhdecode
+ * and lhtrackd to put after their own time stamps.
+ */
+#ifndef _TelemetryDecoder_h_
+#define _TelemetryDecoder_h_
+
+#include <stdint.h>
+#include <stdio.h>
+#include "LighthouseTelemetry.h"
+
+struct TelemetryFix {
+	unsigned id;
+	uint64_t time;		// timer ticks
+	uint32_t raw[4];
+	int xyz[3];		// mm
+	float dist;		// meters
+};
+
+struct TelemetryPose {
+	unsigned id;
+	uint64_t time;		// timer ticks
+	int xyz[3];		// mm
+	float q[4];		// w, x, y, z
+	unsigned used;
+	float rms;		// radians
+};
+
+// Raw capture edges, unpacked.  lost is set if edges were lost before
+// the first one, either by InputCapture or with a lost frame.
+struct TelemetryEdges {
+	bool lost;
+	unsigned count;
+	uint32_t when[LH_OOTX_MAX];
+	uint8_t id[LH_OOTX_MAX];
+	uint8_t rising[LH_OOTX_MAX];
+};
+
+struct TelemetryOOTX {
+	unsigned id;
+	unsigned length;
+	uint8_t bytes[LH_OOTX_MAX];
+};
+
+class TelemetryDecoder
+{
+public:
+	TelemetryDecoder();
+
+	// returns 0 if no frame is ready, otherwise the frame type
+	int feed(uint8_t c);
+
+	// The same for a block of bytes, decoding the frames where they
+	// are rather than copying them in, unless one is split across
+	// blocks.  Returns the type of the first frame with *used set to
+	// how many of the bytes it took to finish it, or 0 with them all
+	// used.
+	int feed(const uint8_t * p, unsigned n, unsigned * used);
+
+	TelemetryFix fix;
+	TelemetryOOTX ootx;
+	TelemetryPose pose;
+	TelemetryEdges edges;
+
+	unsigned calibration_id;
+	LighthouseCalibration calibration;
+
+	// from the last TIME frame
+	uint64_t device_time;
+
+	// statistics
+	unsigned long bytes;
+	unsigned long frames;
+	unsigned long crc_errors;
+	unsigned long lost_frames;
+	unsigned long dropped_deltas;
+	unsigned long bad_edges;
+
+private:
+	uint8_t buf[LH_FRAME_MAX];
+	unsigned len;
+
+	bool have_seq;
+	uint8_t next_seq;
+
+	// edges are only known to follow on from the last EDGES frame
+	// if no frame was lost in between
+	bool edges_lost;
+
+	bool have_key[LighthouseTelemetry::max_sensors];
+	uint32_t last_raw[LighthouseTelemetry::max_sensors][4];
+	uint32_t last_time[LighthouseTelemetry::max_sensors];
+
+	// the latest 64-bit time, to extend the next 32-bit one from
+	uint64_t time_anchor;
+	uint64_t extend(uint32_t t);
+
+	static unsigned frame_length(const uint8_t * f, unsigned len);
+	int decode(const uint8_t * f);
+	int decode_edges(unsigned flags, const uint8_t * p, unsigned len);
+	void resync();
+};
+
+// sensor,raw0,raw1,raw2,raw3,x_mm,y_mm,z_mm,dist
+void telemetry_write_fix(FILE * f, const TelemetryFix & p);
+
+// pose body x_mm,y_mm,z_mm qw,qx,qy,qz used rms_mrad
+void telemetry_write_pose(FILE * f, const TelemetryPose & p);
+
+// cal lighthouse id=... fw=... ...
+void telemetry_write_calibration(FILE * f, unsigned lh, const LighthouseCalibration & c);
+
+#endif
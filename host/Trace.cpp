@@ -0,0 +1,68 @@
+/** \file
+ * Read and write the text edge trace format.
+ */
+#include "Trace.h"
+#include <stdlib.h>
+#include <ctype.h>
+#include <inttypes.h>
+
+
+bool trace_read(FILE * f, std::vector<TraceEdge> & edges)
+{
+	char line[128];
+	unsigned lineno = 0;
+
+	while (fgets(line, sizeof(line), f))
+	{
+		lineno++;
+
+		char * p = line;
+		while (isspace(*p))
+			p++;
+		if (*p == '\0' || *p == '#')
+			continue;
+
+		TraceEdge e;
+		char * end;
+
+		e.tick = strtoull(p, &end, 0);
+		if (end == p)
+			goto error;
+
+		p = end;
+		e.input = strtoul(p, &end, 0);
+		if (end == p)
+			goto error;
+
+		p = end;
+		while (isspace(*p))
+			p++;
+
+		if (*p == 'R' || *p == 'r')
+			e.rising = 1;
+		else
+		if (*p == 'F' || *p == 'f')
+			e.rising = 0;
+		else
+			goto error;
+
+		edges.push_back(e);
+		continue;
+
+	error:
+		fprintf(stderr, "trace: parse error on line %u\n", lineno);
+		return false;
+	}
+
+	return true;
+}
+
+
+void trace_write(FILE * f, const TraceEdge & e)
+{
+	fprintf(f, "%" PRIu64 " %u %c\n",
+		e.tick,
+		e.input,
+		e.rising ? 'R' : 'F'
+	);
+}
@@ -0,0 +1,35 @@
+/** \file
+ * Recorded edge traces.
+ *
+ * A trace is a text file with one edge per line:
+ *
+ *	<tick> <input> <R|F>
+ *
+ * where tick is the absolute time in bus clocks (48 MHz on the
+ * Teensy 3.2), input is the sensor line number and R/F is the
+ * edge direction.  Blank lines and lines starting with # are ignored.
+ * Edges must be in time order.
+ *
+ * Inputs are sensor lines, not timer channels; how each line is wired
+ * to capture pins is up to whoever replays the trace.
+ */
+#ifndef _Trace_h_
+#define _Trace_h_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+struct TraceEdge {
+	uint64_t tick;
+	uint8_t input;
+	uint8_t rising;
+};
+
+// append all of the edges in the file to the vector.
+// returns false and reports the line number on a parse error.
+bool trace_read(FILE * f, std::vector<TraceEdge> & edges);
+
+void trace_write(FILE * f, const TraceEdge & e);
+
+#endif
@@ -0,0 +1,384 @@
+/** \file
+ * Reader threads, decode workers and the time merge for several boards.
+ */
+#include <Arduino.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "TrackerHub.h"
+#include "DeviceClock.h"
+#include "SPSCQueue.h"
+#include "HostUtil.h"
+
+// chunks that each board's reader can have filled ahead of its worker;
+// the tty driver holds more after that, and then the board drops frames
+static const unsigned CHUNKS = 16;
+static const unsigned CHUNK_SIZE = 4096;
+
+// records that each worker can have waiting for next()
+static const unsigned RECORDS = 4096;
+
+// how long a thread with nothing to do sleeps, in usec
+static const unsigned IDLE = 200;
+
+
+struct TrackerChunk
+{
+	double host;
+	unsigned len;
+	uint8_t bytes[CHUNK_SIZE];
+};
+
+
+struct TrackerBoard
+{
+	TrackerBoard(unsigned index, int fd) : index(index), fd(fd),
+		clock(F_BUS), records(0), unsynced(0),
+		closed(false), finished(false) {}
+
+	const unsigned index;
+	const int fd;
+
+	// the reader takes chunks from free and gives them back full
+	TrackerChunk chunks[CHUNKS];
+	SPSCQueue<TrackerChunk *, CHUNKS> free;
+	SPSCQueue<TrackerChunk *, CHUNKS> full;
+
+	// only the worker that has the board uses these
+	TelemetryDecoder decoder;
+	DeviceClock clock;
+	unsigned long records;
+	unsigned long unsynced;
+
+	// the device has closed, and everything from it has been decoded
+	std::atomic<bool> closed;
+	std::atomic<bool> finished;
+};
+
+
+struct TrackerWorker
+{
+	std::vector<TrackerBoard *> boards;
+	SPSCQueue<TrackerRecord, RECORDS> records;
+};
+
+
+int tracker_open(const char * path)
+{
+	const int fd = open(path, O_RDWR | O_NOCTTY);
+	if (fd < 0)
+		return -1;
+
+	// the frames are binary, so no line discipline at all
+	struct termios t;
+	if (tcgetattr(fd, &t) < 0)
+	{
+		const int e = errno;
+		close(fd);
+		errno = e;
+		return -1;
+	}
+
+	cfmakeraw(&t);
+	t.c_cc[VMIN] = 1;
+	t.c_cc[VTIME] = 0;
+	tcsetattr(fd, TCSANOW, &t);
+
+	return fd;
+}
+
+
+TrackerHub::TrackerHub(double delay) :
+	late(0),
+	delay(delay),
+	running(false),
+	last(0)
+{
+}
+
+
+TrackerHub::~TrackerHub()
+{
+	this->stop();
+
+	for (TrackerBoard * b : this->board_list)
+		delete b;
+	for (TrackerWorker * w : this->worker_list)
+		delete w;
+}
+
+
+unsigned TrackerHub::add(int fd)
+{
+	TrackerBoard * const b = new TrackerBoard(this->board_list.size(), fd);
+	for (unsigned i = 0 ; i < CHUNKS ; i++)
+		b->free.push(&b->chunks[i]);
+
+	this->board_list.push_back(b);
+	return this->board_list.size() - 1;
+}
+
+
+void TrackerHub::start(unsigned workers)
+{
+	if (workers == 0)
+		workers = std::thread::hardware_concurrency();
+	if (workers > this->board_list.size())
+		workers = this->board_list.size();
+	if (workers == 0)
+		workers = 1;
+
+	for (unsigned i = 0 ; i < workers ; i++)
+		this->worker_list.push_back(new TrackerWorker);
+
+	// the boards go round the workers, so that each one has the same
+	// number to within one
+	for (unsigned i = 0 ; i < this->board_list.size() ; i++)
+		this->worker_list[i % workers]->boards.push_back(this->board_list[i]);
+
+	this->running = true;
+
+	for (TrackerBoard * b : this->board_list)
+		this->threads.push_back(std::thread(&TrackerHub::reader, this, b));
+	for (TrackerWorker * w : this->worker_list)
+		this->threads.push_back(std::thread(&TrackerHub::worker, this, w));
+}
+
+
+void TrackerHub::stop()
+{
+	this->running = false;
+
+	for (std::thread & t : this->threads)
+		t.join();
+	this->threads.clear();
+}
+
+
+/*
+ * Read the device into chunks until it closes.  The time is taken as
+ * soon as the read returns, since that is when the TIME frames in the
+ * chunk arrived as far as the clock fit is concerned.
+ */
+void TrackerHub::reader(TrackerBoard * b)
+{
+	while (this->running)
+	{
+		TrackerChunk * c;
+		if (!b->free.pop(&c))
+		{
+			// the worker is behind; let the tty hold it
+			usleep(IDLE);
+			continue;
+		}
+
+		ssize_t n = 0;
+		while (this->running)
+		{
+			// poll so that stop() doesn't wait for the board
+			struct pollfd pfd = { b->fd, POLLIN, 0 };
+			if (poll(&pfd, 1, 100) == 0)
+				continue;
+
+			n = read(b->fd, c->bytes, sizeof(c->bytes));
+			if (n < 0 && (errno == EINTR || errno == EAGAIN))
+				continue;
+			break;
+		}
+
+		// gone, or a pseudo-terminal with nothing on the other end
+		if (n <= 0)
+		{
+			b->free.push(c);
+			break;
+		}
+
+		c->host = now_sec();
+		c->len = n;
+		b->full.push(c);
+	}
+
+	b->closed.store(true, std::memory_order_release);
+}
+
+
+void TrackerHub::publish(TrackerWorker * w, const TrackerRecord & r)
+{
+	// next() is behind; wait for it rather than lose the record
+	while (!w->records.push(r))
+	{
+		if (!this->running)
+			return;
+		usleep(IDLE);
+	}
+}
+
+
+void TrackerHub::decode(TrackerWorker * w, TrackerBoard * b, const TrackerChunk * c)
+{
+	TelemetryDecoder & d = b->decoder;
+	unsigned off = 0;
+
+	while (off < c->len)
+	{
+		unsigned used;
+		const int type = d.feed(c->bytes + off, c->len - off, &used);
+		off += used;
+
+		if (type == LH_FRAME_TIME)
+		{
+			b->clock.add(d.device_time, c->host);
+			continue;
+		}
+
+		TrackerRecord r;
+		r.board = b->index;
+
+		// no time of its own, and the host doesn't need the clock
+		if (type == LH_FRAME_CALIBRATION)
+		{
+			r.type = LH_FRAME_CALIBRATION;
+			r.calibration.id = d.calibration_id;
+			r.calibration.cal = d.calibration;
+			r.host = c->host;
+			b->records++;
+			this->publish(w, r);
+			continue;
+		}
+
+		if (type != LH_FRAME_FIX_KEY
+		&&  type != LH_FRAME_FIX_DELTA
+		&&  type != LH_FRAME_POSE)
+			continue;
+
+		if (b->clock.samples() == 0)
+		{
+			b->unsynced++;
+			continue;
+		}
+
+		if (type == LH_FRAME_POSE)
+		{
+			r.type = LH_FRAME_POSE;
+			r.pose = d.pose;
+			r.host = b->clock.host_time(d.pose.time);
+		} else {
+			r.type = LH_FRAME_FIX_KEY;
+			r.fix = d.fix;
+			r.host = b->clock.host_time(d.fix.time);
+		}
+
+		b->records++;
+		this->publish(w, r);
+	}
+}
+
+
+void TrackerHub::worker(TrackerWorker * w)
+{
+	while (this->running)
+	{
+		bool busy = false;
+
+		for (TrackerBoard * b : w->boards)
+		{
+			if (b->finished.load(std::memory_order_relaxed))
+				continue;
+
+			// closed before empty, so that nothing can be pushed
+			// after it is found empty
+			const bool closed = b->closed.load(std::memory_order_acquire);
+
+			TrackerChunk * c;
+			if (b->full.pop(&c))
+			{
+				this->decode(w, b, c);
+				b->free.push(c);
+				busy = true;
+			} else
+			if (closed)
+				b->finished.store(true, std::memory_order_release);
+		}
+
+		if (!busy)
+			usleep(IDLE);
+	}
+}
+
+
+bool TrackerHub::finished() const
+{
+	for (const TrackerBoard * b : this->board_list)
+		if (!b->finished.load(std::memory_order_acquire))
+			return false;
+	return true;
+}
+
+
+// everything that the workers have done so far, into the merge
+void TrackerHub::drain()
+{
+	for (TrackerWorker * w : this->worker_list)
+	{
+		TrackerRecord r;
+		while (w->records.pop(&r))
+			this->pending.push(r);
+	}
+}
+
+
+bool TrackerHub::next(TrackerRecord * r)
+{
+	// once the boards are all finished nothing earlier can come, so
+	// there is no need to wait; it has to be known before draining
+	// for that to hold
+	const bool flush = this->finished();
+	this->drain();
+
+	if (this->pending.empty())
+		return false;
+
+	const TrackerRecord & top = this->pending.top();
+	if (!flush && top.host > now_sec() - this->delay)
+		return false;
+
+	*r = top;
+	this->pending.pop();
+
+	if (r->host < this->last)
+		this->late++;
+	else
+		this->last = r->host;
+
+	return true;
+}
+
+
+bool TrackerHub::done()
+{
+	if (!this->finished())
+		return false;
+
+	this->drain();
+	return this->pending.empty();
+}
+
+
+void TrackerHub::stats(unsigned board, TrackerStats * s) const
+{
+	const TrackerBoard * const b = this->board_list[board];
+	const TelemetryDecoder & d = b->decoder;
+
+	s->bytes = d.bytes;
+	s->frames = d.frames;
+	s->crc_errors = d.crc_errors;
+	s->lost_frames = d.lost_frames;
+	s->records = b->records;
+	s->unsynced = b->unsynced;
+	s->clock_samples = b->clock.samples();
+	s->clock_ppm = s->clock_samples ? b->clock.ppm() : 0;
+	s->clock_error = s->clock_samples ? b->clock.error() : 0;
+}
@@ -0,0 +1,142 @@
+/** \file
+ * Read the telemetry of several tracker boards at once and merge their
+ * fixes and poses on the host's clock.
+ *
+ * Each board has a reader thread that does nothing but read its serial
+ * device into chunks, stamped with the CLOCK_MONOTONIC time that they
+ * arrived, and pass them on through a lock-free queue (SPSCQueue.h).
+ * The boards are shared out between a pool of worker threads, and the
+ * one that has a board decodes its chunks where they are (see
+ * TelemetryDecoder::feed()) and maps the times of its fixes and poses
+ * to the host clock from its TIME frames (see DeviceClock.h), so each
+ * board's state only ever belongs to one thread and nothing is locked.
+ * Nothing is shared between the boards until the records from each
+ * worker come through another queue to next(), which merges them in
+ * host time order once they are older than the delay, so that a board
+ * whose frames take longer to arrive still lands in order.
+ *
+ * The fixes and poses of a board from before its first TIME frame
+ * can't be put on the host clock, and are only counted as unsynced.
+ * Base station calibrations are passed on as well, at the time that
+ * they arrived.
+ */
+#ifndef _TrackerHub_h_
+#define _TrackerHub_h_
+
+#include <stdint.h>
+#include <atomic>
+#include <queue>
+#include <thread>
+#include <vector>
+#include "TelemetryDecoder.h"
+
+struct TrackerChunk;
+struct TrackerBoard;
+struct TrackerWorker;
+
+// A base station's info block, as the board decoded it from OOTX
+struct TrackerCalibration
+{
+	unsigned id;		// lighthouse
+	LighthouseCalibration cal;
+};
+
+struct TrackerRecord
+{
+	double host;		// CLOCK_MONOTONIC seconds
+	unsigned board;
+	int type;		// LH_FRAME_FIX_KEY, LH_FRAME_POSE or LH_FRAME_CALIBRATION
+	union {
+		TelemetryFix fix;
+		TelemetryPose pose;
+		TrackerCalibration calibration;
+	};
+};
+
+struct TrackerStats
+{
+	unsigned long bytes;
+	unsigned long frames;
+	unsigned long crc_errors;
+	unsigned long lost_frames;
+	unsigned long records;
+	unsigned long unsynced;
+	unsigned clock_samples;
+	double clock_ppm;
+	double clock_error;	// seconds
+};
+
+// Open a serial device or pseudo-terminal for add(), in raw mode.
+// Returns -1 with errno set if it can't be.
+int tracker_open(const char * path);
+
+class TrackerHub
+{
+public:
+	// next() holds each record for delay seconds in case one from
+	// another board turns up that is earlier
+	TrackerHub(double delay = 0.02);
+	~TrackerHub();
+
+	// Add a board's open device, before start().  Returns its number,
+	// from 0 in the order they are added.
+	unsigned add(int fd);
+
+	// Start the readers and the workers; 0 workers is one for each
+	// CPU, and there are never more than the boards.
+	void start(unsigned workers = 0);
+
+	// The next record in host time order, if there is one that is
+	// old enough.  Only one thread may call it.
+	bool next(TrackerRecord * r);
+
+	// Every board's device has closed and everything from them has
+	// come out of next()
+	bool done();
+
+	// Stop the threads.  Anything that next() hasn't returned yet is
+	// dropped.
+	void stop();
+
+	unsigned boards() const { return this->board_list.size(); }
+	unsigned workers() const { return this->worker_list.size(); }
+
+	// A board's statistics, once the threads have stopped
+	void stats(unsigned board, TrackerStats * s) const;
+
+	// Records that next() returned earlier than one it had already
+	// returned, because they came after the delay
+	unsigned long late;
+
+private:
+	const double delay;
+	std::atomic<bool> running;
+
+	std::vector<TrackerBoard *> board_list;
+	std::vector<TrackerWorker *> worker_list;
+	std::vector<std::thread> threads;
+
+	struct Later {
+		bool operator()(const TrackerRecord & a, const TrackerRecord & b) const
+		{
+			if (a.host != b.host)
+				return a.host > b.host;
+			return a.board > b.board;
+		}
+	};
+
+	// the records that next() has taken from the workers, earliest
+	// first
+	std::priority_queue<TrackerRecord, std::vector<TrackerRecord>, Later> pending;
+	double last;
+
+	bool finished() const;
+	void drain();
+
+	void reader(TrackerBoard * b);
+	void worker(TrackerWorker * w);
+	void decode(TrackerWorker * w, TrackerBoard * b, const TrackerChunk * c);
+	void publish(TrackerWorker * w, const TrackerRecord & r);
+};
+
+#endif
@@ -0,0 +1,367 @@
+/** \file
+ * The shared memory segment and its seqlocks.
+ *
+ * The segment is the header followed by the slots: the latest fixes by
+ * board and then sensor, the latest poses by board, the latest
+ * calibrations by board and then lighthouse, and then the ring.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "TrackerShm.h"
+
+static_assert(sizeof(TrackerShmHeader) == 64, "header is one cache line");
+static_assert(sizeof(TrackerShmSlot) % 64 == 0, "slots are whole cache lines");
+
+
+static size_t segment_size(unsigned boards, unsigned sensors, unsigned lighthouses, unsigned ring)
+{
+	const size_t slots = (size_t) boards * sensors
+		+ boards
+		+ (size_t) boards * lighthouses
+		+ ring;
+
+	return sizeof(TrackerShmHeader) + slots * sizeof(TrackerShmSlot);
+}
+
+
+TrackerShmWriter::TrackerShmWriter() :
+	name(NULL),
+	base(MAP_FAILED),
+	size(0),
+	header(NULL),
+	written(0)
+{
+}
+
+
+TrackerShmWriter::~TrackerShmWriter()
+{
+	this->close();
+}
+
+
+bool TrackerShmWriter::create(const char * name, unsigned boards, unsigned ring)
+{
+	this->close();
+
+	unsigned slots = 1;
+	while (slots < ring)
+		slots <<= 1;
+
+	const size_t size = segment_size(boards,
+		TRACKER_SHM_SENSORS, TRACKER_SHM_LIGHTHOUSES, slots);
+
+	// one left by a writer that didn't close would have other sizes,
+	// and readers that still have it open would never see new records
+	shm_unlink(name);
+
+	const int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0)
+		return false;
+
+	// a new segment is zeros, which is every slot empty
+	void * base = MAP_FAILED;
+	if (ftruncate(fd, size) == 0)
+		base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	const int e = errno;
+	::close(fd);
+
+	if (base == MAP_FAILED)
+	{
+		shm_unlink(name);
+		errno = e;
+		return false;
+	}
+
+	this->name = strdup(name);
+	this->base = base;
+	this->size = size;
+	this->written = 0;
+
+	TrackerShmHeader * const h = this->header = (TrackerShmHeader *) base;
+	h->version = TRACKER_SHM_VERSION;
+	h->record_size = sizeof(TrackerRecord);
+	h->boards = boards;
+	h->sensors = TRACKER_SHM_SENSORS;
+	h->lighthouses = TRACKER_SHM_LIGHTHOUSES;
+	h->ring = slots;
+
+	// the rest of the header before the magic that says it is there
+	std::atomic_thread_fence(std::memory_order_release);
+	h->magic = TRACKER_SHM_MAGIC;
+
+	this->fixes = (TrackerShmSlot *) (h + 1);
+	this->poses = this->fixes + boards * TRACKER_SHM_SENSORS;
+	this->calibrations = this->poses + boards;
+	this->ring = this->calibrations + boards * TRACKER_SHM_LIGHTHOUSES;
+
+	return true;
+}
+
+
+void TrackerShmWriter::close()
+{
+	if (this->base != MAP_FAILED)
+		munmap(this->base, this->size);
+	if (this->name)
+		shm_unlink(this->name);
+
+	free(this->name);
+	this->name = NULL;
+	this->base = MAP_FAILED;
+	this->header = NULL;
+}
+
+
+/*
+ * Odd while the record is going in and even once it is all there; the
+ * fence keeps the words from being seen before the odd sequence, and
+ * the release the even one from being seen before the words.
+ */
+void TrackerShmWriter::store(TrackerShmSlot * s, uint64_t seq, const TrackerRecord & r)
+{
+	uint32_t words[TrackerShmSlot::RECORD_WORDS];
+	memcpy(words, &r, sizeof(r));
+
+	s->seq.store(seq, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	for (unsigned i = 0 ; i < TrackerShmSlot::RECORD_WORDS ; i++)
+		s->words[i].store(words[i], std::memory_order_relaxed);
+
+	s->seq.store(seq + 1, std::memory_order_release);
+}
+
+
+void TrackerShmWriter::publish(const TrackerRecord & r)
+{
+	if (!this->header)
+		return;
+
+	const TrackerShmHeader * const h = this->header;
+	TrackerShmSlot * latest = NULL;
+
+	if (r.board < h->boards)
+	{
+		if (r.type == LH_FRAME_FIX_KEY && r.fix.id < h->sensors)
+			latest = &this->fixes[r.board * h->sensors + r.fix.id];
+		else
+		if (r.type == LH_FRAME_POSE)
+			latest = &this->poses[r.board];
+		else
+		if (r.type == LH_FRAME_CALIBRATION && r.calibration.id < h->lighthouses)
+			latest = &this->calibrations[r.board * h->lighthouses + r.calibration.id];
+	}
+
+	// only this thread writes the sequences, so its own view is current
+	if (latest)
+		store(latest, latest->seq.load(std::memory_order_relaxed) + 1, r);
+
+	// the slot says which record it holds, for a reader that is behind
+	const uint64_t n = this->written++;
+	store(&this->ring[n & (h->ring - 1)], 2 * n + 1, r);
+	this->header->written.store(n + 1, std::memory_order_release);
+}
+
+
+TrackerShmReader::TrackerShmReader() :
+	lost(0),
+	base(MAP_FAILED),
+	size(0),
+	header(NULL),
+	next(0),
+	lapped(false)
+{
+}
+
+
+TrackerShmReader::~TrackerShmReader()
+{
+	this->close();
+}
+
+
+bool TrackerShmReader::open(const char * name)
+{
+	this->close();
+
+	const int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	void * base = MAP_FAILED;
+	if (fstat(fd, &st) == 0)
+	{
+		if ((size_t) st.st_size < sizeof(TrackerShmHeader))
+			errno = EPROTO;
+		else
+			base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	}
+
+	const int e = errno;
+	::close(fd);
+
+	if (base == MAP_FAILED)
+	{
+		errno = e;
+		return false;
+	}
+
+	const TrackerShmHeader * const h = (const TrackerShmHeader *) base;
+	const bool ok = h->magic == TRACKER_SHM_MAGIC;
+	std::atomic_thread_fence(std::memory_order_acquire);
+
+	if (!ok
+	||  h->version != TRACKER_SHM_VERSION
+	||  h->record_size != sizeof(TrackerRecord)
+	||  h->ring == 0
+	||  (h->ring & (h->ring - 1)) != 0
+	||  (size_t) st.st_size < segment_size(h->boards, h->sensors, h->lighthouses, h->ring))
+	{
+		munmap(base, st.st_size);
+		errno = EPROTO;
+		return false;
+	}
+
+	this->base = base;
+	this->size = st.st_size;
+	this->header = h;
+	this->fixes = (const TrackerShmSlot *) (h + 1);
+	this->poses = this->fixes + h->boards * h->sensors;
+	this->calibrations = this->poses + h->boards;
+	this->ring = this->calibrations + h->boards * h->lighthouses;
+
+	this->next = h->written.load(std::memory_order_acquire);
+	this->lapped = false;
+	this->lost = 0;
+
+	return true;
+}
+
+
+void TrackerShmReader::close()
+{
+	if (this->base != MAP_FAILED)
+		munmap(this->base, this->size);
+
+	this->base = MAP_FAILED;
+	this->header = NULL;
+}
+
+
+/*
+ * Copy a slot's record out, if the writer wasn't in it at the time.
+ * The acquire keeps the words from being read before the first look at
+ * the sequence, and the fence the second look from being before them.
+ */
+bool TrackerShmReader::load(const TrackerShmSlot * s, uint64_t * seq, TrackerRecord * r)
+{
+	const uint64_t before = s->seq.load(std::memory_order_acquire);
+	if (before & 1)
+		return false;
+
+	uint32_t words[TrackerShmSlot::RECORD_WORDS];
+	for (unsigned i = 0 ; i < TrackerShmSlot::RECORD_WORDS ; i++)
+		words[i] = s->words[i].load(std::memory_order_relaxed);
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (s->seq.load(std::memory_order_relaxed) != before)
+		return false;
+
+	memcpy(r, words, sizeof(*r));
+	*seq = before;
+	return true;
+}
+
+
+/*
+ * The writer is only in a slot for as long as a copy takes, so a few
+ * tries get past it, unless it was preempted or killed part way through
+ * and left the sequence odd; that is given up on rather than waited for.
+ */
+bool TrackerShmReader::latest(const TrackerShmSlot * s, TrackerRecord * r)
+{
+	for (unsigned i = 0 ; i < LATEST_TRIES ; i++)
+	{
+		uint64_t seq;
+		if (load(s, &seq, r))
+			return seq != 0;
+	}
+
+	return false;
+}
+
+
+bool TrackerShmReader::fix(unsigned board, unsigned sensor, TrackerRecord * r) const
+{
+	const TrackerShmHeader * const h = this->header;
+	if (board >= h->boards || sensor >= h->sensors)
+		return false;
+
+	return latest(&this->fixes[board * h->sensors + sensor], r);
+}
+
+
+bool TrackerShmReader::pose(unsigned board, TrackerRecord * r) const
+{
+	if (board >= this->header->boards)
+		return false;
+
+	return latest(&this->poses[board], r);
+}
+
+
+bool TrackerShmReader::calibration(unsigned board, unsigned lighthouse, TrackerRecord * r) const
+{
+	const TrackerShmHeader * const h = this->header;
+	if (board >= h->boards || lighthouse >= h->lighthouses)
+		return false;
+
+	return latest(&this->calibrations[board * h->lighthouses + lighthouse], r);
+}
+
+
+int TrackerShmReader::read(TrackerRecord * r)
+{
+	const uint64_t ring = this->header->ring;
+
+	while (1)
+	{
+		const uint64_t w = this->header->written.load(std::memory_order_acquire);
+		if (w == this->next)
+			return 0;
+
+		if (w - this->next > ring)
+		{
+			// catch up to the oldest record still in the ring
+			this->lost += w - this->next - ring;
+			this->next = w - ring;
+			this->lapped = true;
+		}
+
+		uint64_t seq;
+		const TrackerShmSlot * const s = &this->ring[this->next & (ring - 1)];
+		if (load(s, &seq, r) && seq == 2 * this->next + 2)
+			break;
+
+		// the writer has already started on the one that goes there
+		// next time round, so this one is lost too
+		this->lost++;
+		this->next++;
+		this->lapped = true;
+	}
+
+	// the first one after a gap says so, even if the gap was found
+	// by an earlier call that then had nothing to return
+	const bool lapped = this->lapped;
+	this->lapped = false;
+	this->next++;
+	return lapped ? -1 : 1;
+}
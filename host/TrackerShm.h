@@ -0,0 +1,166 @@
+/** \file
+ * Publish TrackerHub's records in POSIX shared memory, for any number
+ * of local processes to read without a socket or a pipe in the way.
+ *
+ * One writer (lhtrackd -m) creates the segment and puts every record
+ * into it; readers open it by name, read-only, and can look at it
+ * however they like without the writer knowing they are there:
+ *
+ *  - the latest fix of each sensor of each board, the latest pose of
+ *    each board and the latest calibration of each lighthouse seen by
+ *    each board, for a renderer or a controller that only wants now;
+ *  - a ring of every record in the order that they were published, for
+ *    a logger that wants them all and can keep up.
+ *
+ * Every slot is a seqlock: the writer makes its sequence odd, writes
+ * the record and makes it even again, and a reader copies the record
+ * out between two reads of the sequence and tries again if they differ
+ * or were odd.  The writer never waits for anyone, and a latest-fix
+ * read is a few loads from memory that is usually already in cache;
+ * nor does a reader wait for long on a writer that has stopped in the
+ * middle of a slot, it just doesn't get that record.
+ * A ring slot's sequence also says which record it holds, so a reader
+ * that has been lapped finds out from the slot itself, and skips ahead
+ * and counts what it missed as InputCapture::read() does.
+ *
+ * The records are copied a word at a time through relaxed atomics with
+ * fences either side, which is the only way to copy something that may
+ * be written at the same time without it being a data race, and it
+ * needs 64-bit atomics that don't take a lock since the two sides are
+ * different processes.
+ */
+#ifndef _TrackerShm_h_
+#define _TrackerShm_h_
+
+#include <stdint.h>
+#include <atomic>
+#include "TrackerHub.h"
+
+#define TRACKER_SHM_MAGIC	0x4853484C	// "LHSH"
+#define TRACKER_SHM_VERSION	1
+
+// latest fixes are kept for sensor ids below this; the ring has them all
+#define TRACKER_SHM_SENSORS	16
+#define TRACKER_SHM_LIGHTHOUSES	2
+
+// the name that lhtrackd -m uses if it isn't given another
+#define TRACKER_SHM_NAME	"/lhtrackd"
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+	"shared memory needs lock-free atomics");
+
+// a record and its sequence, padded to whole cache lines so that the
+// writer updating one sensor doesn't disturb readers of the next
+struct TrackerShmSlot
+{
+	static const unsigned RECORD_WORDS =
+		(sizeof(TrackerRecord) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+	static const unsigned WORDS =
+		((sizeof(uint64_t) + sizeof(TrackerRecord) + 63) / 64 * 64
+			- sizeof(uint64_t)) / sizeof(uint32_t);
+
+	std::atomic<uint64_t> seq;
+	std::atomic<uint32_t> words[WORDS];
+};
+
+struct TrackerShmHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t record_size;	// sizeof(TrackerRecord) of the writer
+	uint32_t boards;
+	uint32_t sensors;
+	uint32_t lighthouses;
+	uint32_t ring;		// slots, a power of two
+	uint32_t pad0;
+
+	// records put in the ring so far; record n is in slot n % ring
+	std::atomic<uint64_t> written;
+
+	uint8_t pad1[64 - 40];
+};
+
+
+class TrackerShmWriter
+{
+public:
+	TrackerShmWriter();
+	~TrackerShmWriter();
+
+	// Create the segment, replacing one of the same name that is left
+	// over, with ring slots rounded up to a power of two.  Returns
+	// false with errno set if it can't be.  The name is a single
+	// component starting with a slash, as for shm_open().
+	bool create(const char * name, unsigned boards, unsigned ring = 4096);
+
+	// Put a record in the ring and, if it is a fix, pose or
+	// calibration that has a slot, as the latest one.  Only one thread
+	// may publish.
+	void publish(const TrackerRecord & r);
+
+	// Unmap, and take the name away so no new reader finds stale data;
+	// readers that have it open keep what was last written
+	void close();
+
+private:
+	char * name;
+	void * base;
+	size_t size;
+	TrackerShmHeader * header;
+	TrackerShmSlot * fixes;
+	TrackerShmSlot * poses;
+	TrackerShmSlot * calibrations;
+	TrackerShmSlot * ring;
+	uint64_t written;
+
+	static void store(TrackerShmSlot * s, uint64_t seq, const TrackerRecord & r);
+};
+
+
+class TrackerShmReader
+{
+public:
+	TrackerShmReader();
+	~TrackerShmReader();
+
+	// Map the segment read-only.  Returns false with errno set if it
+	// can't be, or EPROTO if it isn't one this was built to read.
+	bool open(const char * name);
+	void close();
+
+	unsigned boards() const { return this->header->boards; }
+
+	// The latest of each, or false if there hasn't been one yet, or
+	// if the writer was in the slot for all of LATEST_TRIES looks,
+	// which a writer that has stopped or died in the middle of
+	// writing it will be from then on
+	bool fix(unsigned board, unsigned sensor, TrackerRecord * r) const;
+	bool pose(unsigned board, TrackerRecord * r) const;
+	bool calibration(unsigned board, unsigned lighthouse, TrackerRecord * r) const;
+
+	// The next record from the ring, starting with the first published
+	// after open(): 1 if there was one, 0 if there is nothing new, and
+	// -1 if there was one but the writer had lapped this reader, so
+	// that the records before it were lost and are added to lost.
+	int read(TrackerRecord * r);
+
+	unsigned long lost;
+
+	static const unsigned LATEST_TRIES = 100;
+
+private:
+	void * base;
+	size_t size;
+	const TrackerShmHeader * header;
+	const TrackerShmSlot * fixes;
+	const TrackerShmSlot * poses;
+	const TrackerShmSlot * calibrations;
+	const TrackerShmSlot * ring;
+	uint64_t next;
+	bool lapped;
+
+	static bool load(const TrackerShmSlot * s, uint64_t * seq, TrackerRecord * r);
+	static bool latest(const TrackerShmSlot * s, TrackerRecord * r);
+};
+
+#endif
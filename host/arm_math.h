@@ -0,0 +1,118 @@
+/** \file
+ * Host stand-in for the subset of CMSIS-DSP used by the firmware.
+ *
+ * Same names and argument order as arm_math.h, implemented with libm
+ * so that the results match the single precision code on the Teensy
+ * to within the accuracy of the CMSIS sin/cos tables.
+ */
+#ifndef _host_arm_math_h_
+#define _host_arm_math_h_
+
+#include <stdint.h>
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define PI 3.14159265358979f
+
+typedef float float32_t;
+
+typedef enum {
+	ARM_MATH_SUCCESS = 0,
+	ARM_MATH_ARGUMENT_ERROR = -1,
+	ARM_MATH_LENGTH_ERROR = -2,
+	ARM_MATH_SIZE_MISMATCH = -3,
+} arm_status;
+
+typedef struct {
+	uint16_t numRows;
+	uint16_t numCols;
+	float32_t * pData;
+} arm_matrix_instance_f32;
+
+
+static inline float32_t arm_sin_f32(float32_t x) { return sinf(x); }
+static inline float32_t arm_cos_f32(float32_t x) { return cosf(x); }
+
+static inline arm_status
+arm_sqrt_f32(float32_t in, float32_t * out)
+{
+	if (in < 0)
+	{
+		*out = 0;
+		return ARM_MATH_ARGUMENT_ERROR;
+	}
+
+	*out = sqrtf(in);
+	return ARM_MATH_SUCCESS;
+}
+
+static inline void
+arm_power_f32(const float32_t * src, uint32_t len, float32_t * res)
+{
+	float32_t sum = 0;
+	for (uint32_t i = 0 ; i < len ; i++)
+		sum += src[i] * src[i];
+	*res = sum;
+}
+
+static inline void
+arm_dot_prod_f32(const float32_t * a, const float32_t * b, uint32_t len, float32_t * res)
+{
+	float32_t sum = 0;
+	for (uint32_t i = 0 ; i < len ; i++)
+		sum += a[i] * b[i];
+	*res = sum;
+}
+
+static inline void
+arm_scale_f32(const float32_t * src, float32_t scale, float32_t * dst, uint32_t len)
+{
+	for (uint32_t i = 0 ; i < len ; i++)
+		dst[i] = src[i] * scale;
+}
+
+static inline void
+arm_add_f32(const float32_t * a, const float32_t * b, float32_t * dst, uint32_t len)
+{
+	for (uint32_t i = 0 ; i < len ; i++)
+		dst[i] = a[i] + b[i];
+}
+
+static inline void
+arm_sub_f32(const float32_t * a, const float32_t * b, float32_t * dst, uint32_t len)
+{
+	for (uint32_t i = 0 ; i < len ; i++)
+		dst[i] = a[i] - b[i];
+}
+
+static inline arm_status
+arm_mat_mult_f32(
+	const arm_matrix_instance_f32 * a,
+	const arm_matrix_instance_f32 * b,
+	arm_matrix_instance_f32 * dst
+)
+{
+	if (a->numCols != b->numRows
+	||  dst->numRows != a->numRows
+	||  dst->numCols != b->numCols)
+		return ARM_MATH_SIZE_MISMATCH;
+
+	for (unsigned i = 0 ; i < a->numRows ; i++)
+	{
+		for (unsigned j = 0 ; j < b->numCols ; j++)
+		{
+			float32_t sum = 0;
+			for (unsigned k = 0 ; k < a->numCols ; k++)
+				sum += a->pData[i*a->numCols + k]
+				     * b->pData[k*b->numCols + j];
+			dst->pData[i*dst->numCols + j] = sum;
+		}
+	}
+
+	return ARM_MATH_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,319 @@
+/** \file
+ * Check the input capture backend against the simulated FTM.
+ *
+ * Every channel of every timer module that the board has is installed,
+ * as sensors' rising and falling inputs, and random edges are run
+ * through them, so that the timers' edges have to be merged, for a few
+ * 32-bit wraps of the capture time: bursts a few ticks apart, gaps
+ * like the sweeps and syncs, and long quiet times across many counter
+ * overflows.  The reader drains the queue at random intervals, as
+ * loop() would, and now and then stalls for long enough that edges
+ * are lost.
+ *
+ * Every edge that comes out must be one that went in, with the same
+ * time, input and direction, in the order they happened; any that are
+ * skipped must be counted in InputCapture::lost and the next edge
+ * read must return -1.  Build with "make DMA=1" to check the DMA
+ * backend instead of the ISR one.
+ *
+ * With -c there is a sensor on every input instead, each capturing
+ * both edges on its one channel, and its edges take turns rising and
+ * falling as they would from one pin.  With -l the ISR runs that many
+ * ticks after the edge or overflow instead of straight away, so a
+ * channel can capture again before it runs, or with -c see the other
+ * edge before it has been flipped to it; the reader only runs when no
+ * interrupt is pending, as loop() would.  Those edges are missed by
+ * the timer and not counted lost, so then the skipped edges are only
+ * checked to be at least the lost ones, but the ones that are read
+ * must still be right, with -c their direction as well.
+ *
+ * With -u as well the reader doesn't wait for the pending interrupts,
+ * as if it had been preempted part way through a read, so that one
+ * timer module's ISR can publish an edge after a later one of another
+ * module's has been seen.  The order must still be right.
+ *
+ * With -b the reader drains the queue with read_batch() that many at a
+ * time instead of read(), and the -1 is the first edge of a batch that
+ * comes back negative.
+ *
+ * Usage: bench_capture [-c] [-l ticks [-u]] [-b batch] [-s seconds] [-r seed]
+ *
+ * Exits non-zero on any mismatch.
+ */
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <deque>
+#include "FTMSim.h"
+#include "InputCapture.h"
+#include "HostUtil.h"
+
+
+struct Expected {
+	uint64_t tick;
+	uint8_t id;
+	uint8_t rising;
+};
+
+// rising and falling pins of each sensor: the four of firmware.ino on
+// FTM0, then the other timer modules' channels
+static const uint8_t pins[][2] = {
+	{ 5, 6 }, { 9, 10 }, { 20, 21 }, { 22, 23 },
+#if INPUT_CAPTURE_TIMERS > 1
+	{ 3, 4 },
+#endif
+#if INPUT_CAPTURE_TIMERS > 3
+	{ 29, 30 },
+	{ 2, 14 }, { 7, 8 }, { 35, 36 }, { 37, 38 },
+#elif INPUT_CAPTURE_TIMERS > 2
+	{ 32, 25 },
+#endif
+};
+
+static const unsigned num_pairs = sizeof(pins) / sizeof(*pins);
+static_assert(num_pairs * 2 == INPUT_CAPTURE_INPUTS, "every input is used");
+
+static InputCapture inputs[INPUT_CAPTURE_INPUTS];
+
+// with -c, one sensor on each pin, and whether the pin is high
+static bool change;
+static unsigned num_sensors = num_pairs;
+static bool high[INPUT_CAPTURE_INPUTS];
+
+static std::deque<Expected> queue;
+static unsigned long edges;
+
+// with -b, what is left of the last batch
+static unsigned batch_size;
+static InputCaptureEdge batch[256];
+static unsigned batch_len;
+static unsigned batch_next;
+static bool batch_lost;
+
+
+// An edge from a sensor at the tick, on the pin that takes it
+static void send(uint64_t t, unsigned sensor)
+{
+	bool rising;
+	uint8_t pin;
+
+	if (change)
+	{
+		rising = high[sensor] = !high[sensor];
+		pin = pins[sensor / 2][sensor % 2];
+	} else {
+		rising = rand() % 2;
+		pin = pins[sensor][rising ? 0 : 1];
+	}
+
+	ftm_sim_edge(t, pin, rising);
+	queue.push_back({ t, (uint8_t) sensor, rising });
+	edges++;
+}
+
+
+// The next edge, as read() returns it, from read() or a batch
+static int next(InputCaptureEdge * e)
+{
+	if (batch_size == 0)
+		return InputCapture::read(e);
+
+	if (batch_next == batch_len)
+	{
+		const int n = InputCapture::read_batch(batch, batch_size);
+		if (n == 0)
+			return 0;
+
+		batch_lost = n < 0;
+		batch_len = n < 0 ? -n : n;
+		batch_next = 0;
+	}
+
+	*e = batch[batch_next];
+	return batch_next++ == 0 && batch_lost ? -1 : 1;
+}
+
+
+static uint64_t gap()
+{
+	const unsigned kind = rand() % 100;
+	if (kind < 50)
+		return 1 + rand() % 500;		// within a pulse
+	if (kind < 90)
+		return 5000 + rand() % 400000;		// sweeps and syncs
+	if (kind < 99)
+		return 65536 + rand() % (4 * 65536);	// a few overflows
+	return rand() % (F_BUS / 1000 * 100);		// up to 100 ms
+}
+
+
+int main(int argc, char ** argv)
+{
+	unsigned seconds = 400;
+	unsigned seed = 1;
+	uint64_t latency = 0;
+	bool unsettled = false;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "cl:ub:s:r:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'c': change = true; break;
+		case 'l': latency = strtoull(optarg, NULL, 0); break;
+		case 'u': unsettled = true; break;
+		case 'b':
+			batch_size = atoi(optarg);
+			if (batch_size > sizeof(batch) / sizeof(*batch))
+				batch_size = sizeof(batch) / sizeof(*batch);
+			break;
+		case 's': seconds = atoi(optarg); break;
+		case 'r': seed = atoi(optarg); break;
+		default:
+			fprintf(stderr, "Usage: %s [-c] [-l ticks [-u]] [-b batch] [-s seconds] [-r seed]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	ftm_sim_reset();
+	ftm_sim_latency(latency);
+
+	if (change)
+	{
+		num_sensors = num_pairs * 2;
+		for (unsigned i = 0 ; i < num_sensors ; i++)
+		{
+			high[i] = true;
+			if (!inputs[i].begin(pins[i / 2][i % 2], CHANGE, i))
+			{
+				fprintf(stderr, "sensor %u: could not install\n", i);
+				return 1;
+			}
+		}
+	} else
+	for (unsigned i = 0 ; i < num_sensors ; i++)
+	{
+		if (!inputs[2*i].begin(pins[i][0], RISING, i)
+		||  !inputs[2*i+1].begin(pins[i][1], FALLING, i))
+		{
+			fprintf(stderr, "sensor %u: could not install\n", i);
+			return 1;
+		}
+	}
+
+	const uint64_t end = (uint64_t) seconds * F_BUS;
+	uint64_t t = 0;
+	srand(seed);
+
+	// The DMA backend's first overflow period runs from the start to
+	// the first overflow's late mark, so an edge in its first ticks
+	// can't be told from one a period later; start after it.
+	if (latency)
+	{
+		ftm_sim_advance(0x10000);
+		t = ftm_sim_settle();
+	}
+
+	unsigned long read = 0;
+	unsigned long skipped = 0;
+	unsigned long stalls = 0;
+	unsigned long errors = 0;
+	unsigned long unflagged = 0;
+	const uint32_t lost_before = InputCapture::lost;
+	double read_time = 0;
+
+	while (t < end)
+	{
+		t += gap();
+		send(t, rand() % num_sensors);
+
+		// loop() comes round every few edges, and after the last
+		// one, or stalls for a while with the edges piling up
+		if (rand() % 4 != 0 && t < end)
+			continue;
+
+		// once the ISRs have taken what came in, and with more than
+		// one timer module the last edges wait for all of their ISRs
+		// to run after them, which an overflow does
+		if (t >= end)
+			ftm_sim_advance(t + 0x10000);
+		if (!unsettled || t >= end)
+			t = ftm_sim_settle();
+
+		if (rand() % 2000 == 0)
+		{
+			stalls++;
+			for (unsigned n = 300 + rand() % 300 ; n > 0 ; n--)
+			{
+				t += 1 + rand() % 20000;
+				send(t, rand() % num_sensors);
+			}
+			t += rand() % (F_BUS / 1000 * 60);
+			ftm_sim_advance(t);
+		}
+
+		const double start = now_sec();
+		InputCaptureEdge e;
+		int rc;
+		while ((rc = next(&e)) != 0)
+		{
+			read++;
+
+			// skip any that were lost on the way
+			size_t missed = 0;
+			while (missed < queue.size()
+			&& (uint32_t) queue[missed].tick != e.when)
+				missed++;
+
+			if (missed == queue.size())
+			{
+				if (errors++ < 10)
+					fprintf(stderr, "edge %u %u at %u was never sent\n",
+						e.id, e.rising, e.when);
+				continue;
+			}
+
+			queue.erase(queue.begin(), queue.begin() + missed);
+			const Expected x = queue.front();
+			queue.pop_front();
+			skipped += missed;
+
+			if (x.id != e.id || x.rising != e.rising)
+			{
+				if (errors++ < 10)
+					fprintf(stderr, "edge at %u: sensor %u %u, expected %u %u\n",
+						e.when, e.id, e.rising, x.id, x.rising);
+			}
+
+			if (missed && rc != -1 && latency == 0 && unflagged++ < 10)
+				fprintf(stderr, "%zu edges before %u lost without -1\n",
+					missed, e.when);
+		}
+		read_time += now_sec() - start;
+	}
+
+	// the last read emptied the ring, so what is still queued was lost
+	skipped += queue.size();
+	const unsigned long lost = InputCapture::lost - lost_before;
+
+	printf("%lu edges to %.1f s, %lu read, %lu skipped in %lu stalls,"
+		" %lu counted lost, %.1f ns per read\n",
+		edges, t / (double) F_BUS, read, skipped, stalls, lost,
+		read ? read_time * 1e9 / read : 0.0);
+
+	// the timer misses some when the ISR is late, which nothing counts
+	if (latency && skipped >= lost)
+		printf("%lu missed by the timer with %llu ticks of latency\n",
+			skipped - lost, (unsigned long long) latency);
+	else
+	if (skipped != lost)
+	{
+		fprintf(stderr, "%lu edges skipped but %lu counted lost\n",
+			skipped, lost);
+		errors++;
+	}
+
+	return errors || unflagged ? 1 : 0;
+}
@@ -0,0 +1,214 @@
+/** \file
+ * Check the 64-bit timebase and the host's model of the tracker clock.
+ *
+ * First the simulated FTM is run through several 32-bit wraps of the
+ * capture time, checking that InputCapture::now() matches the
+ * simulated clock, including when the counter has wrapped but the
+ * overflow interrupt has not run yet, and that extend() gives back the
+ * whole time of edges and of anything else from the last 89 seconds.
+ *
+ * Then DeviceClock is fed TIME frames from a tracker whose crystal is
+ * off by a few tens of ppm, arriving over a simulated USB link with a
+ * latency floor, random jitter, 1 ms frames and the occasional long
+ * stall.  Between frames a tick is mapped back to the host, and the
+ * error against the time it would have arrived with the least latency
+ * seen in the window is checked against DeviceClock::error(), and the
+ * fitted rate against the crystal's.
+ *
+ * Usage: bench_clock [-s seconds]
+ *
+ * Exits non-zero if anything is out.
+ */
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+#include "FTMSim.h"
+#include "InputCapture.h"
+#include "DeviceClock.h"
+#include "HostUtil.h"
+
+
+static unsigned long check_timebase()
+{
+	unsigned long errors = 0;
+	unsigned long checks = 0;
+
+	ftm_sim_reset();
+	InputCapture ic;
+	ic.begin(5, RISING, 0);
+
+	// four and a bit wraps of the 32-bit time, in steps of up to a
+	// quarter second
+	const uint64_t end = (4ull << 32) + (1ull << 30);
+	uint64_t t = 0;
+	srand(1);
+
+	while (t < end)
+	{
+		t += rand() % (F_BUS / 4);
+
+		// sometimes land just past a counter wrap with the overflow
+		// interrupt held off, as if another ISR were running
+		const bool held = rand() % 8 == 0;
+		if (held)
+		{
+			const uint64_t wrap = (t | 0xFFFF) + 1;
+			ftm_sim_advance(wrap - 1);
+			NVIC_DISABLE_IRQ(IRQ_FTM0);
+			t = wrap + rand() % 0x100;
+		}
+
+		ftm_sim_advance(t);
+		const uint64_t now = InputCapture::now();
+		if (now != t && errors++ < 10)
+			fprintf(stderr, "now %llu != %llu%s\n",
+				(unsigned long long) now,
+				(unsigned long long) t,
+				held ? " (overflow pending)" : "");
+
+		NVIC_ENABLE_IRQ(IRQ_FTM0);
+
+		// an edge captured now; the ISR also catches up on the
+		// overflow that it missed
+		ftm_sim_edge(t, 5, true);
+		InputCaptureEdge e;
+		while (InputCapture::read(&e) > 0)
+		{
+			const uint64_t x = InputCapture::extend(e.when);
+			if (x != t && errors++ < 10)
+				fprintf(stderr, "edge %llu extended to %llu\n",
+					(unsigned long long) t,
+					(unsigned long long) x);
+		}
+
+		// and anything from the last 89 seconds
+		const uint64_t back = (uint64_t) (uniform() * 0xFFFF0000u);
+		if (back <= t)
+		{
+			const uint64_t then = t - back;
+			const uint64_t x = InputCapture::extend(then);
+			if (x != then && errors++ < 10)
+				fprintf(stderr, "%llu extended to %llu at %llu\n",
+					(unsigned long long) then,
+					(unsigned long long) x,
+					(unsigned long long) t);
+		}
+
+		checks++;
+	}
+
+	printf("timebase: %lu checks to %.1f s, %lu errors\n",
+		checks, t / (double) F_BUS, errors);
+
+	return errors;
+}
+
+
+// USB latency: the tracker's side, the wait for the next 1 ms frame,
+// waking up the reader on the host and once in a while a long stall
+static double arrival(double sent)
+{
+	double t = sent + 125e-6 - log(uniform()) * 150e-6;
+	t = ceil(t * 1000) / 1000;
+	t += 20e-6 - log(uniform()) * 30e-6;
+	if (rand() % 100 == 0)
+		t += uniform() * 20e-3;
+	return t;
+}
+
+
+static unsigned long check_clock(double ppm, unsigned seconds)
+{
+	DeviceClock clock(F_BUS);
+
+	// the tracker was turned on a while before the host started
+	const uint64_t tick0 = 1ull << 40;
+	const double host0 = 1000.25;
+	const double rate = F_BUS * (1 + ppm * 1e-6);
+
+	unsigned long errors = 0;
+	unsigned long checks = 0;
+	double max_err = 0;
+	double sum_err = 0;
+	double max_bound = 0;
+
+	// the latencies in the window, for the earliest arrival
+	double latency[DeviceClock::window];
+
+	for (unsigned i = 0 ; i < seconds ; i++)
+	{
+		// a TIME frame every second of the tracker's clock
+		const double sent = host0 + i / (1 + ppm * 1e-6);
+		const uint64_t ticks = tick0 + (uint64_t) ((sent - host0) * rate);
+		const double host = arrival(sent);
+		clock.add(ticks, host);
+
+		latency[i % DeviceClock::window] = host - sent;
+		double floor = latency[0];
+		for (unsigned k = 1 ; k < DeviceClock::window && k <= i ; k++)
+			if (latency[k] < floor)
+				floor = latency[k];
+
+		// give the fit a few samples to find the rate
+		if (clock.samples() < DeviceClock::window / 4)
+			continue;
+
+		// a fix some time before the next TIME frame
+		const double when = sent + uniform();
+		const uint64_t fix = tick0 + (uint64_t) ((when - host0) * rate);
+		const double err = clock.host_time(fix) - (when + floor);
+
+		if (fabs(err) > clock.error() && errors++ < 10)
+			fprintf(stderr, "%+.0f ppm: %u s error %.3f ms > %.3f ms\n",
+				ppm, i, err * 1e3, clock.error() * 1e3);
+
+		if (fabs(err) > max_err)
+			max_err = fabs(err);
+		if (clock.error() > max_bound)
+			max_bound = clock.error();
+		sum_err += err;
+		checks++;
+	}
+
+	const bool ppm_ok = fabs(clock.ppm() - ppm) < 5;
+	if (!ppm_ok)
+		errors++;
+
+	printf("clock %+4.0f ppm: fit %+7.2f ppm, mean error %.3f ms,"
+		" max %.3f ms, bound up to %.3f ms, %lu errors\n",
+		ppm, clock.ppm(),
+		checks ? sum_err / checks * 1e3 : 0.0,
+		max_err * 1e3, max_bound * 1e3,
+		errors);
+
+	return errors;
+}
+
+
+int main(int argc, char ** argv)
+{
+	unsigned seconds = 3600;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:")) != -1)
+	{
+		switch (opt)
+		{
+		case 's': seconds = atoi(optarg); break;
+		default:
+			fprintf(stderr, "Usage: %s [-s seconds]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	unsigned long errors = check_timebase();
+
+	srand(2);
+	static const double ppms[] = { -50, -3, 0, 20, 100 };
+	for (unsigned i = 0 ; i < sizeof(ppms) / sizeof(*ppms) ; i++)
+		errors += check_clock(ppms[i], seconds);
+
+	return errors ? 1 : 0;
+}
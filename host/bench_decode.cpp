@@ -0,0 +1,295 @@
+/** \file
+ * Decode synthetic emissions for many sensors and check them against
+ * the ground truth.
+ *
+ * EmissionSim generates the edges for a board of sensors, 32 by default.
+ * That is more than the four pairs of capture channels on FTM0, so the
+ * edges go straight to LighthouseSensor::edge() in time order, as
+ * loop() would take them from the shared queue, and through the shared
+ * LighthouseSyncTracker and its OOTX decoders.  Every angle that comes
+ * out is matched with the sweep that produced it, and the angles are
+ * triangulated by LighthouseXYZ, max_sensors at a time.
+ *
+ * Reported are the angle error and how many of the true sweeps were
+ * decoded, the error of the fixes, how long after the first edge the
+ * first angle, fix and OOTX message from each base station came (in
+ * simulated time), and the decode and triangulation time per edge and
+ * per fix.
+ *
+ * Usage: bench_decode [-n sensors] [-s seconds] [-v speed] [-j ticks]
+ *	[-c ppm] [-m chance] [-r chance]
+ *
+ * The options are the same as lhsim's, but the board holds still and
+ * there are 2 ticks of jitter unless told otherwise.  Exits non-zero
+ * if a base station's info block is not decoded or has the wrong serial
+ * number or, when no pulses are being dropped or reflected, if less
+ * than 99% of the sweeps are decoded, the rms angle error is more than
+ * the timer quantization and jitter account for, or a still board's
+ * fixes are more than a millimeter rms out.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <vector>
+#include "EmissionSim.h"
+#include "LighthouseSensor.h"
+#include "LighthouseXYZ.h"
+#include "HostUtil.h"
+
+#define MAX_SENSORS 32
+#define XYZ_BATCHES ((MAX_SENSORS + LighthouseXYZ::max_sensors - 1) / LighthouseXYZ::max_sensors)
+
+static LighthouseSyncTracker tracker;
+static LighthouseSensor sensors[MAX_SENSORS];
+static LighthouseXYZ xyz[XYZ_BATCHES];
+
+
+struct Decoded {
+	uint8_t sensor;
+	uint8_t ind;
+	uint32_t time;
+	lh_angle_t angle;
+	int truth;	// index of the matching sweep, or -1
+};
+
+
+int main(int argc, char ** argv)
+{
+	EmissionBoard board = { MAX_SENSORS, 0.022, 0 };
+	EmissionSim sim;
+	double seconds = 10;
+	int opt;
+
+	sim.jitter = 2;
+
+	while ((opt = getopt(argc, argv, "n:s:v:j:c:m:r:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n': board.sensors = strtoul(optarg, NULL, 0); break;
+		case 's': seconds = atof(optarg); break;
+		case 'v': board.speed = atof(optarg); break;
+		case 'j': sim.jitter = atof(optarg); break;
+		case 'c': sim.clock_ppm = atof(optarg); break;
+		case 'm': sim.miss_sync = sim.miss_sweep = atof(optarg); break;
+		case 'r': sim.reflect = atof(optarg); break;
+		default:
+			fprintf(stderr, "Usage: %s [-n sensors] [-s seconds] [-v speed] [-j ticks] [-c ppm] [-m chance] [-r chance]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (board.sensors == 0 || board.sensors > MAX_SENSORS)
+	{
+		fprintf(stderr, "%s: 1 to %u sensors\n", argv[0], MAX_SENSORS);
+		return 1;
+	}
+
+	const bool clean = sim.miss_sync == 0 && sim.reflect == 0;
+
+	std::vector<TraceEdge> edges;
+	std::vector<EmissionTruth> truth;
+	sim.begin(board.sensors, EmissionBoard::position, &board);
+	sim.run((unsigned) (seconds * 1e6 / sim.period_usec), edges, &truth);
+
+	tracker.begin();
+	for (unsigned i = 0 ; i < board.sensors ; i++)
+		sensors[i].begin(i, 0, 0, &tracker);
+
+	// decode every edge, keeping the angles for afterwards
+	std::vector<Decoded> decoded;
+	decoded.reserve(truth.size() + truth.size() / 8);
+	uint64_t first_ootx[2] = { 0, 0 };
+	uint32_t ootx_id[2] = { 0, 0 };
+
+	double start = now_sec();
+	for (size_t n = 0 ; n < edges.size() ; n++)
+	{
+		const TraceEdge & e = edges[n];
+		LighthouseSensor * const s = &sensors[e.input];
+		const int ind = s->edge((uint32_t) e.tick, e.rising);
+
+		while (tracker.updated)
+		{
+			const unsigned lh = __builtin_ctz(tracker.updated);
+			tracker.updated &= tracker.updated - 1;
+
+			LighthouseOOTX & o = tracker.ootx[lh];
+			if (!o.complete)
+				continue;
+			o.complete = 0;
+
+			if (first_ootx[lh] == 0 && o.have_calibration)
+			{
+				first_ootx[lh] = e.tick;
+				ootx_id[lh] = o.calibration.id;
+			}
+		}
+
+		if (ind < 0)
+			continue;
+
+		Decoded d = { e.input, (uint8_t) ind, s->times[ind], s->angles[ind], -1 };
+		decoded.push_back(d);
+	}
+	const double decode_ns = (now_sec() - start) * 1e9 / edges.size();
+
+	// match each angle with its sweep; both are in time order for
+	// any one sensor and axis, so one cursor each is enough
+	std::vector<std::vector<unsigned> > sweeps(board.sensors * 4);
+	for (size_t i = 0 ; i < truth.size() ; i++)
+		sweeps[truth[i].sensor * 4 + truth[i].ind].push_back(i);
+
+	std::vector<size_t> cursor(board.sensors * 4, 0);
+	double sum2 = 0, max_err = 0;
+	unsigned long matched = 0;
+
+	for (size_t i = 0 ; i < decoded.size() ; i++)
+	{
+		Decoded & d = decoded[i];
+		const std::vector<unsigned> & list = sweeps[d.sensor * 4 + d.ind];
+		size_t & c = cursor[d.sensor * 4 + d.ind];
+
+		while (c < list.size()
+		&& (int32_t) ((uint32_t) truth[list[c]].tick - d.time) < -1000)
+			c++;
+		if (c == list.size()
+		|| (int32_t) ((uint32_t) truth[list[c]].tick - d.time) > 1000)
+			continue;
+
+		d.truth = list[c];
+		const double err = lh_angle_radians(d.angle) - truth[d.truth].angle;
+		sum2 += err * err;
+		if (fabs(err) > max_err)
+			max_err = fabs(err);
+		matched++;
+	}
+
+	const double angle_rms = matched ? sqrt(sum2 / matched) : 0;
+
+	// triangulate as the angles arrive, like loop() does, from the
+	// poses that the emissions came from
+	for (unsigned b = 0 ; b < XYZ_BATCHES ; b++)
+		xyz[b].begin(LighthouseXYZ::max_sensors, &sim.stations[0], &sim.stations[1]);
+
+	std::vector<float> fixes;
+	std::vector<int> fix_truth;
+	fixes.reserve(decoded.size() * 3);
+	fix_truth.reserve(decoded.size());
+	uint32_t first_fix = 0;
+	bool have_fix = false;
+
+	start = now_sec();
+	for (size_t i = 0 ; i < decoded.size() ; i++)
+	{
+		const Decoded & d = decoded[i];
+		const unsigned b = d.sensor / LighthouseXYZ::max_sensors;
+		const unsigned j = d.sensor % LighthouseXYZ::max_sensors;
+
+		xyz[b].update(j, d.ind, d.angle);
+		if (!(xyz[b].compute() & (1 << j)))
+			continue;
+
+		if (!have_fix)
+		{
+			have_fix = true;
+			first_fix = d.time;
+		}
+
+		float pos[3];
+		xyz[b].position(j, pos);
+		fixes.insert(fixes.end(), pos, pos + 3);
+		fix_truth.push_back(d.truth);
+	}
+	const double xyz_ns = fix_truth.empty() ? 0
+		: (now_sec() - start) * 1e9 / fix_truth.size();
+
+	// against where the sensor was for the last of the four sweeps
+	double fix_sum2 = 0;
+	unsigned long fix_count = 0;
+	for (size_t i = 0 ; i < fix_truth.size() ; i++)
+	{
+		if (fix_truth[i] < 0)
+			continue;
+
+		const double * const p = truth[fix_truth[i]].xyz;
+		double err2 = 0;
+		for (int k = 0 ; k < 3 ; k++)
+			err2 += (fixes[3*i+k] - p[k]) * (fixes[3*i+k] - p[k]);
+		fix_sum2 += err2;
+		fix_count++;
+	}
+	const double fix_rms = fix_count ? sqrt(fix_sum2 / fix_count) : 0;
+
+	// how long the decoder took to get going, in simulated time
+	const uint32_t first_edge = edges.empty() ? 0 : edges[0].tick;
+	const double ms_per_tick = 1e-3 / CLOCKS_PER_MICROSECOND;
+	const double first_angle = decoded.empty() ? -1
+		: (uint32_t) (decoded[0].time - first_edge) * ms_per_tick;
+	const double first_fix_ms = !have_fix ? -1
+		: (uint32_t) (first_fix - first_edge) * ms_per_tick;
+
+	printf("%u sensors, %.1f s: %zu edges, %zu sweeps, %zu angles, %lu matched (%.2f%%)\n",
+		board.sensors, seconds, edges.size(), truth.size(), decoded.size(),
+		matched, truth.empty() ? 0 : 100.0 * matched / truth.size());
+	printf("angle error rms %.1f urad, max %.1f urad\n",
+		angle_rms * 1e6, max_err * 1e6);
+	printf("%zu fixes, error rms %.2f mm\n", fix_truth.size(), fix_rms * 1e3);
+	printf("first angle %.1f ms, fix %.1f ms, ootx lh0 %.1f ms id %08X, lh1 %.1f ms id %08X\n",
+		first_angle,
+		first_fix_ms,
+		first_ootx[0] ? (first_ootx[0] - edges[0].tick) * ms_per_tick : -1,
+		(unsigned) ootx_id[0],
+		first_ootx[1] ? (first_ootx[1] - edges[0].tick) * ms_per_tick : -1,
+		(unsigned) ootx_id[1]);
+	printf("sync flashes %lu, rescued %lu, missed %lu %lu, disputed %lu, drift %ld %ld ppm\n",
+		(unsigned long) tracker.flashes,
+		(unsigned long) tracker.rescued,
+		(unsigned long) tracker.missed[0],
+		(unsigned long) tracker.missed[1],
+		(unsigned long) tracker.disputed,
+		(long) tracker.drift_ppm(0),
+		(long) tracker.drift_ppm(1));
+	printf("decode %.1f ns/edge (%.1f x realtime), triangulation %.1f ns/fix\n",
+		decode_ns,
+		seconds * 1e9 / (decode_ns * edges.size()),
+		xyz_ns);
+
+	unsigned errors = 0;
+
+	// a tick of quantization is uniform, the jitter of the two
+	// edges is halved by taking the middle
+	const double tick_rad = M_PI / (8333 * CLOCKS_PER_MICROSECOND);
+	const double expected = tick_rad * sqrt(1.0 / 12 + sim.jitter * sim.jitter / 2);
+	if (clean && angle_rms > 2 * expected + 1e-6)
+	{
+		printf("FAIL: angle error, expected %.1f urad\n", expected * 1e6);
+		errors++;
+	}
+
+	// EmissionSim's default info blocks have serial 5EED0000 + lh
+	for (int lh = 0 ; lh < 2 ; lh++)
+	{
+		if (first_ootx[lh] == 0 || ootx_id[lh] != 0x5EED0000u + lh)
+		{
+			printf("FAIL: lighthouse %d info block\n", lh);
+			errors++;
+		}
+	}
+
+	if (clean && matched < truth.size() * 0.99)
+	{
+		printf("FAIL: sweeps decoded\n");
+		errors++;
+	}
+
+	if (clean && board.speed == 0 && fix_rms > 1e-3)
+	{
+		printf("FAIL: fix error\n");
+		errors++;
+	}
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,248 @@
+/** \file
+ * Compare per-sweep tracking with four angle triangulation.
+ *
+ * A sensor is moved along a few paths in front of the default
+ * lighthouse poses.  Each sweep is timed as it would be on the real
+ * system (one axis of one base station every 8.333 ms, with the laser
+ * crossing the sensor at its angle) and quantized to timer ticks with
+ * a little jitter.  The angles go through LighthouseXYZ, which gives a
+ * fix every fourth sweep, and through LighthouseFilter, which gives
+ * one every sweep; both are compared with the true position at the
+ * time of the sweep that produced the fix.
+ *
+ * Usage: bench_filter [-s seconds] [-j ticks]
+ *
+ * Exits non-zero if the filter is more than a millimeter less accurate
+ * than triangulation on any of the paths, or gives fewer than three
+ * times as many fixes.  A sensor that isn't moving comes out a little
+ * noisier, since the filter is tuned for hand held motion and trusts
+ * each single sweep more than an average of four.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <vector>
+#include "InputCapture.h"
+#include "LighthouseXYZ.h"
+#include "LighthousePoses.h"
+#include "LighthouseFilter.h"
+#include "EmissionSim.h"
+#include "HostUtil.h"
+
+#define SWEEP_USEC 8333.0
+#define TICKS_PER_RADIAN (SWEEP_USEC * CLOCKS_PER_MICROSECOND / M_PI)
+
+
+struct Path {
+	const char * name;
+	void (*position)(double t, double p[3]);
+};
+
+static void still(double t, double p[3])
+{
+	p[0] = 0.10;
+	p[1] = 0.20;
+	p[2] = 0.05;
+}
+
+// 25 cm radius at 1 Hz, about 1.6 m/s
+static void circle(double t, double p[3])
+{
+	p[0] = 0.25 * cos(2 * M_PI * t);
+	p[1] = 0.20;
+	p[2] = 0.25 * sin(2 * M_PI * t);
+}
+
+// +/- 3 cm at 5 Hz, up to 30 m/s^2
+static void shake(double t, double p[3])
+{
+	p[0] = 0.10 + 0.03 * sin(2 * M_PI * 5 * t);
+	p[1] = 0.20 + 0.02 * cos(2 * M_PI * 3 * t);
+	p[2] = 0.05;
+}
+
+static const Path paths[] = {
+	{ "still", still },
+	{ "circle", circle },
+	{ "shake", shake },
+};
+
+
+struct Measurement {
+	unsigned ind;
+	uint32_t when;
+	float angle;
+	double truth[3];
+};
+
+
+// One sweep every 8.333 ms, cycling through lighthouse 0 and 1
+// on each axis, in the order that the base stations send them.
+static std::vector<Measurement> simulate(const Path & path, double seconds, double jitter)
+{
+	std::vector<Measurement> m;
+	const unsigned slots = seconds * 1e6 / SWEEP_USEC;
+
+	for (unsigned k = 0 ; k < slots ; k++)
+	{
+		const unsigned ind = (k % 2) * 2 + (k / 2) % 2;
+		const double start = k * SWEEP_USEC * 1e-6;
+
+		// the laser crosses the sensor at a time that depends on
+		// where it is, so iterate a couple of times
+		double t = start, p[3], a[2], angle = 0;
+		for (int i = 0 ; i < 3 ; i++)
+		{
+			path.position(t, p);
+			EmissionSim::project(lightsources[ind / 2], p, a);
+			angle = a[ind & 1];
+			t = start + (angle / M_PI * SWEEP_USEC + 4000) * 1e-6;
+		}
+
+		Measurement s;
+		s.ind = ind;
+		s.when = (uint32_t) (t * 1e6 * CLOCKS_PER_MICROSECOND);
+
+		// the firmware's angle from the tick count
+		const double ticks = floor(angle * TICKS_PER_RADIAN + jitter * gaussian() + 0.5);
+		s.angle = ticks / TICKS_PER_RADIAN;
+
+		path.position(t, s.truth);
+		m.push_back(s);
+	}
+
+	return m;
+}
+
+
+struct Error {
+	unsigned long count;
+	double sum2;
+	double max;
+
+	Error() : count(0), sum2(0), max(0) {}
+
+	void add(const float pos[3], const double truth[3])
+	{
+		double e = 0;
+		for (int k = 0 ; k < 3 ; k++)
+			e += (pos[k] - truth[k]) * (pos[k] - truth[k]);
+		e = sqrt(e);
+
+		count++;
+		sum2 += e * e;
+		if (e > max)
+			max = e;
+	}
+
+	double rms() const { return count ? sqrt(sum2 / count) : 0; }
+};
+
+
+// Run the measurements through both, skipping the first half second
+// for the filter to settle.  Returns the seconds spent in each.
+static void run(
+	const std::vector<Measurement> & m,
+	Error & tri,
+	Error & ekf,
+	double * tri_sec,
+	double * ekf_sec,
+	unsigned long * restarts
+)
+{
+	LighthouseXYZ xyz;
+	LighthouseFilter filter;
+	xyz.begin(1, &lightsources[0], &lightsources[1]);
+	filter.begin(&lightsources[0], &lightsources[1]);
+
+	const uint32_t settle = 500000 * CLOCKS_PER_MICROSECOND;
+	double t_tri = 0, t_ekf = 0;
+	*restarts = 0;
+
+	for (size_t n = 0 ; n < m.size() ; n++)
+	{
+		const Measurement & s = m[n];
+
+		double start = now_sec();
+		xyz.update(0, s.ind, lh_angle(s.angle));
+		const bool fix = xyz.compute();
+		t_tri += now_sec() - start;
+
+		float pos[3];
+		if (fix)
+		{
+			xyz.position(0, pos);
+			if (s.when > settle)
+				tri.add(pos, s.truth);
+		}
+
+		start = now_sec();
+		const bool tracked = filter.update(s.ind, s.angle, s.when);
+		t_ekf += now_sec() - start;
+
+		if (tracked)
+		{
+			if (s.when > settle)
+				ekf.add(filter.xyz, s.truth);
+		} else
+		if (fix && !filter.running)
+		{
+			filter.reset(pos, s.when);
+			(*restarts)++;
+		}
+	}
+
+	*tri_sec = t_tri;
+	*ekf_sec = t_ekf;
+}
+
+
+int main(int argc, char ** argv)
+{
+	double seconds = 10;
+	double jitter = 1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:j:")) != -1)
+	{
+		switch (opt)
+		{
+		case 's': seconds = atof(optarg); break;
+		case 'j': jitter = atof(optarg); break;
+		default:
+			fprintf(stderr, "Usage: %s [-s seconds] [-j ticks]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	srand(1);
+	int errors = 0;
+
+	for (unsigned i = 0 ; i < sizeof(paths) / sizeof(*paths) ; i++)
+	{
+		const std::vector<Measurement> m = simulate(paths[i], seconds, jitter);
+
+		Error tri, ekf;
+		double tri_sec, ekf_sec;
+		unsigned long restarts;
+		run(m, tri, ekf, &tri_sec, &ekf_sec, &restarts);
+
+		printf("%-6s triangulated %5lu fixes rms %6.2f mm max %6.2f mm;"
+			" filtered %5lu fixes rms %6.2f mm max %6.2f mm, %lu starts;"
+			" %.0f ns/sweep vs %.0f ns/sweep\n",
+			paths[i].name,
+			tri.count, tri.rms() * 1000, tri.max * 1000,
+			ekf.count, ekf.rms() * 1000, ekf.max * 1000,
+			restarts,
+			ekf_sec * 1e9 / m.size(),
+			tri_sec * 1e9 / m.size()
+		);
+
+		if (ekf.rms() > tri.rms() + 1e-3 || ekf.count < 3 * tri.count)
+			errors++;
+	}
+
+	return errors ? 1 : 0;
+}
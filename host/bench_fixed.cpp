@@ -0,0 +1,373 @@
+/** \file
+ * Error analysis of the fixed point angle pipeline.
+ *
+ * Each stage of the LIGHTHOUSE_FIXED_POINT path is compared with double
+ * precision and with the float path that it replaces:
+ *
+ * - lh_sincos_q30() against sin/cos over the whole circle,
+ * - the tick count to angle conversion of sweep_pulse() over the
+ *   whole +/- 4000 usec sweep,
+ * - lh_fixed_triangulate() for random sensor positions in the tracked
+ *   volume, with the sweep angles rounded to whole ticks as the
+ *   firmware measures them.  LighthouseXYZ is run on the same ticks;
+ *   in the normal host build that is the float path, with
+ *   "make FIXED_POINT=1" it is the fixed one.
+ *
+ * Usage: bench_fixed [-n points]
+ *
+ * Exits non-zero if the fixed point sin/cos is more than a few Q30 ulp
+ * out, the angles are off by more than a thousandth of a tick, or the
+ * fixed point positions are more than 10 microns from double precision.
+ * The float path is a few microns out too, where the rays are closer
+ * to parallel; both are well below the error from whole ticks.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <vector>
+#include "LighthouseXYZ.h"
+#include "LighthouseFixed.h"
+#include "LighthousePoses.h"
+#include "HostUtil.h"
+
+#define TICKS_PER_RADIAN (8333.0 * CLOCKS_PER_MICROSECOND / M_PI)
+
+static const double sincos_tolerance = 4.0 / (1 << 30);
+static const double angle_tolerance = 1e-3 / TICKS_PER_RADIAN;
+static const double position_tolerance = 10e-6;
+
+
+static int check_sincos()
+{
+	double max_fixed = 0, max_float = 0;
+	int32_t sum = 0;
+
+	// every 512th binary angle, about 8 million
+	for (int64_t i = INT32_MIN ; i <= INT32_MAX ; i += 512)
+	{
+		const int32_t a = (int32_t) i;
+		const double x = a * (M_PI / 2147483648.0);
+
+		int32_t s, c;
+		lh_sincos_q30(a, &s, &c);
+		const double es = fabs(s / 1073741824.0 - sin(x));
+		const double ec = fabs(c / 1073741824.0 - cos(x));
+		if (es > max_fixed) max_fixed = es;
+		if (ec > max_fixed) max_fixed = ec;
+
+		float fs, fc;
+		lh_sincosf((float) x, &fs, &fc);
+		const double xf = (float) x;
+		if (fabs(fs - sin(xf)) > max_float) max_float = fabs(fs - sin(xf));
+		if (fabs(fc - cos(xf)) > max_float) max_float = fabs(fc - cos(xf));
+	}
+
+	// and time them on the sweep angles
+	const unsigned count = 1 << 22;
+	double start = now_sec();
+	for (unsigned i = 0 ; i < count ; i++)
+	{
+		int32_t s, c;
+		lh_sincos_q30((int32_t) (i * 2654435761u) >> 1, &s, &c);
+		sum += s ^ c;
+	}
+	const double fixed_ns = (now_sec() - start) * 1e9 / count;
+
+	float fsum = 0;
+	start = now_sec();
+	for (unsigned i = 0 ; i < count ; i++)
+	{
+		float s, c;
+		lh_sincosf(((int32_t) (i * 2654435761u) >> 1) * (float) (M_PI / 2147483648.0), &s, &c);
+		fsum += s + c;
+	}
+	const double float_ns = (now_sec() - start) * 1e9 / count;
+
+	printf("sin/cos: lh_sincos_q30 max error %.2g (%.1f Q30 ulp) %.1f ns,"
+		" lh_sincosf %.2g %.1f ns (checksum %d %.1f)\n",
+		max_fixed, max_fixed * (1 << 30), fixed_ns,
+		max_float, float_ns,
+		(int) sum, fsum);
+
+	return max_fixed > sincos_tolerance;
+}
+
+
+static int check_ticks()
+{
+	const int32_t range = 4000 * CLOCKS_PER_MICROSECOND;
+	double max_fixed = 0, max_float = 0, max_old = 0;
+
+	for (int32_t t = -range ; t <= range ; t++)
+	{
+		const double exact = t / TICKS_PER_RADIAN;
+
+		const double fixed = lh_fixed_from_ticks(t) * (M_PI / 2147483648.0);
+		const float single = t * (float) (M_PI / (8333 * CLOCKS_PER_MICROSECOND));
+
+		// what sweep_pulse() used to do, in double and stored as float
+		const float old = t * M_PI / (8333 * CLOCKS_PER_MICROSECOND);
+
+		if (fabs(fixed - exact) > max_fixed) max_fixed = fabs(fixed - exact);
+		if (fabs(single - exact) > max_float) max_float = fabs(single - exact);
+		if (fabs(old - exact) > max_old) max_old = fabs(old - exact);
+	}
+
+	printf("ticks to angle: binary angle max error %.2g rad (%.2g ticks),"
+		" float %.2g rad (%.2g ticks), double rounded to float %.2g rad\n",
+		max_fixed, max_fixed * TICKS_PER_RADIAN,
+		max_float, max_float * TICKS_PER_RADIAN,
+		max_old);
+
+	return max_fixed > angle_tolerance;
+}
+
+
+// Sweep ticks relative to the middle that a lighthouse would measure
+// for point p, false if it is outside of its +/- 60 degree view.
+static bool
+project(const lightsource & lh, const double p[3], int32_t * t1, int32_t * t2)
+{
+	double r[3];
+	for (int i = 0 ; i < 3 ; i++)
+		r[i] = lh.mat[0*3+i] * (p[0] - lh.origin[0])
+		     + lh.mat[1*3+i] * (p[1] - lh.origin[1])
+		     + lh.mat[2*3+i] * (p[2] - lh.origin[2]);
+
+	if (r[2] >= 0)
+		return false;
+
+	const double a1 = atan2(-r[0], -r[2]);
+	const double a2 = atan2(r[1], -r[2]);
+	*t1 = lrint(a1 * TICKS_PER_RADIAN);
+	*t2 = lrint(a2 * TICKS_PER_RADIAN);
+
+	return fabs(a1) < M_PI / 3 && fabs(a2) < M_PI / 3;
+}
+
+
+// Closest approach of the two rays in double precision
+static bool
+reference(const int32_t ticks[4], double xyz[3])
+{
+	double u[2][3];
+	for (int lh = 0 ; lh < 2 ; lh++)
+	{
+		const double a1 = ticks[lh*2 + 0] / TICKS_PER_RADIAN;
+		const double a2 = ticks[lh*2 + 1] / TICKS_PER_RADIAN;
+		const double r[3] = {
+			-cos(a2) * sin(a1),
+			 sin(a2) * cos(a1),
+			-cos(a1) * cos(a2),
+		};
+		const float * const m = lightsources[lh].mat;
+		for (int i = 0 ; i < 3 ; i++)
+			u[lh][i] = m[i*3+0]*r[0] + m[i*3+1]*r[1] + m[i*3+2]*r[2];
+	}
+
+	const float * const o1 = lightsources[0].origin;
+	const float * const o2 = lightsources[1].origin;
+	double w0[3];
+	for (int i = 0 ; i < 3 ; i++)
+		w0[i] = (double) o1[i] - o2[i];
+
+	double a = 0, b = 0, c = 0, d = 0, e = 0;
+	for (int i = 0 ; i < 3 ; i++)
+	{
+		a += u[0][i] * u[0][i];
+		b += u[0][i] * u[1][i];
+		c += u[1][i] * u[1][i];
+		d += u[0][i] * w0[i];
+		e += u[1][i] * w0[i];
+	}
+
+	const double denom = a * c - b * b;
+	if (denom < 1e-5 * a * c)
+		return false;
+
+	const double t1 = (b * e - c * d) / denom;
+	const double t2 = (a * e - b * d) / denom;
+	for (int i = 0 ; i < 3 ; i++)
+		xyz[i] = (o1[i] + u[0][i] * t1 + o2[i] + u[1][i] * t2) / 2;
+
+	return true;
+}
+
+
+struct Error {
+	unsigned long count;
+	double sum2;
+	double max;
+
+	Error() : count(0), sum2(0), max(0) {}
+
+	void add(const double pos[3], const double ref[3])
+	{
+		double e = 0;
+		for (int k = 0 ; k < 3 ; k++)
+			e += (pos[k] - ref[k]) * (pos[k] - ref[k]);
+		e = sqrt(e);
+
+		count++;
+		sum2 += e * e;
+		if (e > max)
+			max = e;
+	}
+
+	double rms() const { return count ? sqrt(sum2 / count) : 0; }
+};
+
+
+int main(int argc, char ** argv)
+{
+	unsigned count = 100000;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n': count = strtoul(optarg, NULL, 0); break;
+		default:
+			fprintf(stderr, "Usage: %s [-n points]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	int errors = 0;
+	errors += check_sincos();
+	errors += check_ticks();
+
+	// sensor positions somewhere in the room, as in bench_xyz
+	std::vector<int32_t> ticks;
+	std::vector<double> truth;
+	srand(1);
+
+	while (truth.size() < 3 * count)
+	{
+		const double p[3] = {
+			frand(-1.5, 1.5),
+			frand(0.0, 2.0),
+			frand(-1.5, 1.5),
+		};
+
+		int32_t t[4];
+		if (!project(lightsources[0], p, &t[0], &t[1])
+		||  !project(lightsources[1], p, &t[2], &t[3]))
+			continue;
+
+		ticks.insert(ticks.end(), t, t + 4);
+		truth.insert(truth.end(), p, p + 3);
+	}
+
+	lightsource_fixed lh0, lh1;
+	lh_fixed_lightsource(&lightsources[0], &lh0);
+	lh_fixed_lightsource(&lightsources[1], &lh1);
+
+	LighthouseXYZ xyz;
+	xyz.begin(1, &lightsources[0], &lightsources[1]);
+
+	Error quantized, fixed, kernel;
+	unsigned long mismatched = 0;
+
+	for (unsigned n = 0 ; n < count ; n++)
+	{
+		const int32_t * const t = &ticks[4*n];
+
+		double ref[3];
+		const bool ok = reference(t, ref);
+		if (ok)
+			quantized.add(ref, &truth[3*n]);
+
+		const int32_t angles[4] = {
+			lh_fixed_from_ticks(t[0]),
+			lh_fixed_from_ticks(t[1]),
+			lh_fixed_from_ticks(t[2]),
+			lh_fixed_from_ticks(t[3]),
+		};
+
+		int32_t q[3], dist;
+		if (lh_fixed_triangulate(&lh0, &lh1, angles, q, &dist) != ok)
+			mismatched++;
+		else
+		if (ok)
+		{
+			const double pos[3] = {
+				q[0] / (double) LH_Q20_METER,
+				q[1] / (double) LH_Q20_METER,
+				q[2] / (double) LH_Q20_METER,
+			};
+			fixed.add(pos, ref);
+		}
+
+		for (unsigned j = 0 ; j < 4 ; j++)
+			xyz.update(0, j, lh_angle_from_ticks(t[j]));
+		if (xyz.compute() && ok)
+		{
+			const double pos[3] = { xyz.x[0], xyz.y[0], xyz.z[0] };
+			kernel.add(pos, ref);
+		}
+	}
+
+#ifdef LIGHTHOUSE_FIXED_POINT
+	const char * const build = "fixed";
+#else
+	const char * const build = "float";
+#endif
+
+	printf("%u points, whole ticks are %.1f um rms %.1f um max from the truth\n",
+		count, quantized.rms() * 1e6, quantized.max * 1e6);
+	printf("from double: lh_fixed_triangulate rms %.2f max %.2f um,"
+		" %lu validity mismatches; LighthouseXYZ (%s) rms %.2f max %.2f um\n",
+		fixed.rms() * 1e6, fixed.max * 1e6, mismatched,
+		build, kernel.rms() * 1e6, kernel.max * 1e6);
+
+	if (fixed.max > position_tolerance || mismatched)
+		errors++;
+
+	// and time them
+	const unsigned passes = 20;
+	int32_t sum_fixed = 0;
+	float sum_kernel = 0;
+
+	double start = now_sec();
+	for (unsigned p = 0 ; p < passes ; p++)
+	{
+		for (unsigned n = 0 ; n < count ; n++)
+		{
+			const int32_t * const t = &ticks[4*n];
+			const int32_t angles[4] = {
+				lh_fixed_from_ticks(t[0]),
+				lh_fixed_from_ticks(t[1]),
+				lh_fixed_from_ticks(t[2]),
+				lh_fixed_from_ticks(t[3]),
+			};
+			int32_t q[3], dist;
+			if (lh_fixed_triangulate(&lh0, &lh1, angles, q, &dist))
+				sum_fixed += q[0];
+		}
+	}
+	const double fixed_ns = (now_sec() - start) * 1e9 / (count * (double) passes);
+
+	start = now_sec();
+	for (unsigned p = 0 ; p < passes ; p++)
+	{
+		for (unsigned n = 0 ; n < count ; n++)
+		{
+			const int32_t * const t = &ticks[4*n];
+			for (unsigned j = 0 ; j < 4 ; j++)
+				xyz.update(0, j, lh_angle_from_ticks(t[j]));
+			if (xyz.compute())
+				sum_kernel += xyz.x[0];
+		}
+	}
+	const double kernel_ns = (now_sec() - start) * 1e9 / (count * (double) passes);
+
+	printf("lh_fixed_triangulate %.1f ns/fix, LighthouseXYZ (%s) %.1f ns/fix,"
+		" checksum %d %.1f\n",
+		fixed_ns, build, kernel_ns, (int) sum_fixed, sum_kernel);
+
+	return errors ? 1 : 0;
+}
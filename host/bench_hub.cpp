@@ -0,0 +1,354 @@
+/** \file
+ * Check TrackerHub against simulated boards on pseudo-terminals.
+ *
+ * Each board is a thread writing telemetry frames into the master side
+ * of a pty, and the hub opens the slave side with tracker_open() as it
+ * would a Teensy's /dev/ttyACM.  Every board has its own crystal error
+ * and starting time, sends a TIME frame every second of its clock as
+ * the firmware does, and numbers its fixes in their raw values so that
+ * each one can be found again.
+ *
+ * First the boards send fixes at the rate that four sensors would, in
+ * real time, for a few seconds.  Every fix must come out of the hub
+ * once, in host time order across all of the boards, at the host time
+ * that it was written to within a few milliseconds.  Then for one,
+ * two, four and so on up to all of the boards, each sends as fast as
+ * the pty takes it, and the hub's total rate is timed, to see that it
+ * goes up with the boards as long as there are CPUs for them.
+ *
+ * Usage: bench_hub [-b boards] [-s seconds] [-r fixes/sec] [-n fixes]
+ *
+ * Exits non-zero if a fix is lost, repeated, out of order or off in
+ * time.
+ */
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "TrackerHub.h"
+#include "LighthouseTelemetry.h"
+#include "HostUtil.h"
+
+// the most off that a fix's host time may be from when it was written
+#define MAX_ERROR 5e-3
+
+// fixes written in one go when sending flat out
+#define BATCH 64
+
+
+struct Board
+{
+	int master;
+	double ppm;
+	uint64_t start_ticks;
+	double start;
+
+	LighthouseTelemetry telemetry;
+	uint8_t buf[BATCH * LH_FIX_KEY_SIZE + LH_TIME_SIZE];
+	unsigned len;
+
+	// the host time that each fix was written, by number
+	std::vector<double> written;
+	unsigned long sent;
+	std::atomic<unsigned long> received;
+};
+
+
+// a pty with the hub on the slave side, and the master for the board
+static bool open_board(Board * b, TrackerHub * hub)
+{
+	b->master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (b->master < 0 || grantpt(b->master) < 0 || unlockpt(b->master) < 0)
+	{
+		perror("posix_openpt");
+		return false;
+	}
+
+	const char * const name = ptsname(b->master);
+	const int fd = tracker_open(name);
+	if (fd < 0)
+	{
+		perror(name);
+		return false;
+	}
+
+	hub->add(fd);
+	return true;
+}
+
+
+// the board's clock, with its crystal error, now
+static uint64_t board_ticks(const Board * b, double host)
+{
+	return b->start_ticks + (uint64_t) ((host - b->start) * F_BUS * (1 + b->ppm * 1e-6));
+}
+
+
+static void add_fix(Board * b, uint64_t ticks)
+{
+	const unsigned n = b->sent++;
+	const uint32_t raw[4] = { n & 0xFFFFFF, n >> 24, 0, 0 };
+	const float xyz[3] = { 0.1f, 0.2f, 1.5f };
+
+	b->len += b->telemetry.fix(b->buf + b->len, n % 4, ticks, raw, xyz, 1.5f);
+}
+
+
+static bool flush(Board * b)
+{
+	const uint8_t * p = b->buf;
+	while (b->len)
+	{
+		const ssize_t n = write(b->master, p, b->len);
+		if (n <= 0)
+			return false;
+		p += n;
+		b->len -= n;
+	}
+	return true;
+}
+
+
+/*
+ * A board sending fixes at the rate, or as fast as it can if the rate
+ * is 0, until it has sent count of them.  It waits for the hub to have
+ * taken them all before closing, since the pty would drop what is left
+ * when it hangs up.
+ */
+static void board_thread(Board * b, double rate, unsigned long count)
+{
+	uint64_t next_tick = 0;
+
+	while (b->sent < count)
+	{
+		double host = now_sec();
+
+		if (rate)
+		{
+			const double t = b->start + b->sent / rate;
+			if (host < t)
+			{
+				usleep((t - host) * 1e6);
+				host = now_sec();
+			}
+		}
+
+		const uint64_t ticks = board_ticks(b, host);
+		if (ticks >= next_tick)
+		{
+			b->len += b->telemetry.time(b->buf + b->len, ticks);
+			next_tick = ticks + F_BUS;
+		}
+
+		const unsigned batch = rate ? 1 : BATCH;
+		for (unsigned i = 0 ; i < batch && b->sent < count ; i++)
+		{
+			b->written[b->sent] = host;
+			add_fix(b, ticks);
+		}
+
+		if (!flush(b))
+			break;
+	}
+
+	const double give_up = now_sec() + 10;
+	while (b->received < b->sent && now_sec() < give_up)
+		usleep(1000);
+
+	close(b->master);
+}
+
+
+/*
+ * Run the boards for count fixes each at the rate, and check or time
+ * what comes out.  Returns the errors.
+ */
+static unsigned long run(
+	unsigned boards,
+	double rate,
+	unsigned long count,
+	double * elapsed,
+	unsigned * workers,
+	bool verbose
+)
+{
+	TrackerHub hub;
+	std::vector<Board *> board(boards);
+	unsigned long errors = 0;
+
+	for (unsigned i = 0 ; i < boards ; i++)
+	{
+		Board * const b = board[i] = new Board;
+		b->ppm = (uniform() - 0.5) * 100;
+		b->start_ticks = (uint64_t) (uniform() * (1ull << 34));
+		b->len = 0;
+		b->sent = 0;
+		b->received = 0;
+		b->written.resize(count);
+		if (!open_board(b, &hub))
+			return 1;
+	}
+
+	const double start = now_sec();
+	hub.start();
+	*workers = hub.workers();
+
+	std::vector<std::thread> threads;
+	for (Board * b : board)
+	{
+		b->start = now_sec();
+		threads.push_back(std::thread(board_thread, b, rate, count));
+	}
+
+	// the host time of every fix that comes out, by board and number
+	std::vector<std::vector<double> > got(boards, std::vector<double>(count, -1));
+	double last = 0;
+	unsigned long order = 0;
+	unsigned long repeats = 0;
+	unsigned long bad = 0;
+
+	while (!hub.done())
+	{
+		TrackerRecord r;
+		if (!hub.next(&r))
+		{
+			usleep(200);
+			continue;
+		}
+
+		if (r.host < last && order++ < 10 && rate)
+			fprintf(stderr, "board %u at %.6f after %.6f\n", r.board, r.host, last);
+		last = r.host;
+
+		const unsigned long n = r.fix.raw[0] | (unsigned long) r.fix.raw[1] << 24;
+		if (r.type != LH_FRAME_FIX_KEY || r.board >= boards || n >= count)
+		{
+			if (bad++ < 10)
+				fprintf(stderr, "record %d from board %u that was never sent\n", r.type, r.board);
+			continue;
+		}
+
+		if (got[r.board][n] >= 0 && repeats++ < 10)
+			fprintf(stderr, "board %u fix %lu twice\n", r.board, n);
+		got[r.board][n] = r.host;
+		board[r.board]->received++;
+	}
+
+	*elapsed = now_sec() - start;
+
+	for (std::thread & t : threads)
+		t.join();
+	hub.stop();
+
+	unsigned long missing = 0;
+	double max_error = 0;
+	double sum_error = 0;
+	unsigned long timed = 0;
+
+	for (unsigned i = 0 ; i < boards ; i++)
+	{
+		for (unsigned long n = 0 ; n < count ; n++)
+		{
+			if (got[i][n] < 0)
+			{
+				if (missing++ < 10)
+					fprintf(stderr, "board %u fix %lu missing\n", i, n);
+				continue;
+			}
+
+			const double e = got[i][n] - board[i]->written[n];
+			if (fabs(e) > max_error)
+				max_error = fabs(e);
+			sum_error += e;
+			timed++;
+		}
+
+		TrackerStats s;
+		hub.stats(i, &s);
+		if (verbose)
+			printf("board %u: %lu frames, %lu records, %lu unsynced,"
+				" %u clock samples %+.1f ppm (true %+.1f)\n",
+				i, s.frames, s.records, s.unsynced,
+				s.clock_samples, s.clock_ppm, board[i]->ppm);
+
+		if (s.crc_errors || s.lost_frames)
+		{
+			fprintf(stderr, "board %u: %lu crc errors, %lu lost frames\n",
+				i, s.crc_errors, s.lost_frames);
+			errors++;
+		}
+
+		delete board[i];
+	}
+
+	if (verbose)
+		printf("%lu fixes, host time error mean %.3f max %.3f ms,"
+			" %lu late\n",
+			timed, timed ? sum_error / timed * 1e3 : 0.0,
+			max_error * 1e3, hub.late);
+
+	// only real time sends say when the fixes happened
+	if (rate && max_error > MAX_ERROR)
+	{
+		fprintf(stderr, "host time off by %.3f ms\n", max_error * 1e3);
+		errors++;
+	}
+
+	// flat out, the boards' clocks are fit to a few TIME frames sent
+	// in a burst, so only real time says what order is right
+	return errors + repeats + bad + missing + (rate ? order : 0);
+}
+
+
+int main(int argc, char ** argv)
+{
+	unsigned boards = 8;
+	double seconds = 3;
+	double rate = 480;
+	unsigned long count = 200000;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b:s:r:n:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'b': boards = strtoul(optarg, NULL, 0); break;
+		case 's': seconds = atof(optarg); break;
+		case 'r': rate = atof(optarg); break;
+		case 'n': count = strtoul(optarg, NULL, 0); break;
+		default:
+			fprintf(stderr, "Usage: %s [-b boards] [-s seconds] [-r fixes/sec] [-n fixes]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	srand(1);
+
+	double elapsed;
+	unsigned workers;
+	unsigned long errors = run(boards, rate, seconds * rate, &elapsed, &workers, true);
+
+	printf("%u boards in real time on %u workers: %s\n",
+		boards, workers, errors ? "FAILED" : "ok");
+
+	for (unsigned n = 1 ; n <= boards ; n *= 2)
+	{
+		const unsigned long e = run(n, 0, count, &elapsed, &workers, false);
+		errors += e;
+
+		const double total = n * count / elapsed;
+		printf("%2u boards on %u workers: %.0f fixes/s, %.0f per board%s\n",
+			n, workers, total, total / n, e ? " FAILED" : "");
+
+		if (n < boards && n * 2 > boards)
+			n = boards / 2;
+	}
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,275 @@
+/** \file
+ * Check and time the rigid body pose fit.
+ *
+ * The 22 mm sensor board is moved and turned in front of the default
+ * lighthouse poses, and the sweeps are simulated as in bench_filter:
+ * one axis of one base station every 8.333 ms, each sensor hit at the
+ * time the laser crosses it, quantized to timer ticks with jitter.
+ * After every sweep LighthousePose::solve() is run and compared with
+ * the true position and orientation.  The same angles also go through
+ * LighthouseXYZ to count how many separate sensor fixes there would be.
+ *
+ * This is done with both base stations visible and with each one
+ * blocked in turn.
+ *
+ * Usage: bench_pose [-s seconds] [-j ticks] [-v speed]
+ *
+ * -v scales how fast the board moves; 0 holds it still.
+ *
+ * Exits non-zero if tracking is lost, the orientation is ever more than
+ * 5 degrees out, or the position is more than a millimeter worse than
+ * the separate sensor fixes (2 cm rms with only one base station, where
+ * the distance comes from the 22 mm spread of the sensors).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include "InputCapture.h"
+#include "LighthouseXYZ.h"
+#include "LighthousePoses.h"
+#include "LighthousePose.h"
+#include "EmissionSim.h"
+#include "HostUtil.h"
+
+#define SWEEP_USEC 8333.0
+#define TICKS_PER_RADIAN (SWEEP_USEC * CLOCKS_PER_MICROSECOND / M_PI)
+#define NUM_SENSORS 4
+
+static const double layout[NUM_SENSORS][3] = {
+	{ +0.011, -0.011, 0 },
+	{ -0.011, -0.011, 0 },
+	{ -0.011, +0.011, 0 },
+	{ +0.011, +0.011, 0 },
+};
+
+
+// The board lies face up (its Z is XYZ-space Y), wobbling by up to
+// 20 degrees while it moves around a 20 cm circle at 0.5 Hz.
+static double speed = 1;
+
+static void truth(double t, double R[9], double p[3])
+{
+	t *= speed;
+	const double a = 0.35 * sin(2 * M_PI * 0.7 * t);
+	const double b = 0.35 * sin(2 * M_PI * 0.4 * t + 1);
+	const double ca = cos(a), sa = sin(a);
+	const double cb = cos(b), sb = sin(b);
+
+	// face up: board x -> x, board y -> -z, board z -> y
+	const double up[9] = {
+		1, 0, 0,
+		0, 0, 1,
+		0, -1, 0,
+	};
+
+	// then tilt about x by a and about z by b
+	const double tilt[9] = {
+		cb, -sb * ca,  sb * sa,
+		sb,  cb * ca, -cb * sa,
+		 0,       sa,       ca,
+	};
+
+	for (int i = 0 ; i < 3 ; i++)
+		for (int j = 0 ; j < 3 ; j++)
+			R[i*3 + j] = tilt[i*3 + 0] * up[0*3 + j]
+				   + tilt[i*3 + 1] * up[1*3 + j]
+				   + tilt[i*3 + 2] * up[2*3 + j];
+
+	p[0] = 0.2 * cos(2 * M_PI * 0.5 * t);
+	p[1] = 0.1;
+	p[2] = 0.2 * sin(2 * M_PI * 0.5 * t);
+}
+
+
+static void sensor_position(double t, unsigned s, double q[3])
+{
+	double R[9], p[3];
+	truth(t, R, p);
+	for (int i = 0 ; i < 3 ; i++)
+		q[i] = p[i]
+			+ R[i*3 + 0] * layout[s][0]
+			+ R[i*3 + 1] * layout[s][1]
+			+ R[i*3 + 2] * layout[s][2];
+}
+
+
+struct Result {
+	unsigned long sweeps;
+	unsigned long poses;
+	unsigned long fixes;
+	double fix_rms;
+	unsigned long starts;
+	unsigned long lost;
+	double pos_rms;
+	double pos_max;
+	double rot_rms;
+	double rot_max;
+	double solve_ns;
+};
+
+
+// visible is a mask of the base stations that can be seen
+static Result run(unsigned visible, double seconds, double jitter)
+{
+	LighthousePose pose;
+	LighthouseXYZ xyz;
+	pose.begin(&lightsources[0], &lightsources[1]);
+	xyz.begin(NUM_SENSORS, &lightsources[0], &lightsources[1]);
+
+	Result r = {};
+	double pos2 = 0, rot2 = 0, fix2 = 0, solve_sec = 0;
+	const unsigned slots = seconds * 1e6 / SWEEP_USEC;
+
+	for (unsigned k = 0 ; k < slots ; k++)
+	{
+		const unsigned ind = (k % 2) * 2 + (k / 2) % 2;
+		if ((visible & (1 << (ind / 2))) == 0)
+			continue;
+
+		const double start = k * SWEEP_USEC * 1e-6;
+		double t = start;
+
+		for (unsigned s = 0 ; s < NUM_SENSORS ; s++)
+		{
+			double q[3], a[2], angle = 0;
+			t = start;
+			for (int i = 0 ; i < 3 ; i++)
+			{
+				sensor_position(t, s, q);
+				EmissionSim::project(lightsources[ind / 2], q, a);
+				angle = a[ind & 1];
+				t = start + (angle / M_PI * SWEEP_USEC + 4000) * 1e-6;
+			}
+
+			const double ticks = floor(angle * TICKS_PER_RADIAN + jitter * gaussian() + 0.5);
+			const float measured = ticks / TICKS_PER_RADIAN;
+			const uint32_t when = t * 1e6 * CLOCKS_PER_MICROSECOND;
+
+			pose.update(s, ind, measured, when);
+			xyz.update(s, ind, lh_angle(measured));
+		}
+
+		r.sweeps++;
+
+		const uint32_t fixes = xyz.compute();
+		for (unsigned s = 0 ; s < NUM_SENSORS ; s++)
+		{
+			if ((fixes & (1 << s)) == 0)
+				continue;
+
+			float pos[3];
+			double q[3];
+			xyz.position(s, pos);
+			sensor_position(t, s, q);
+			for (int i = 0 ; i < 3 ; i++)
+				fix2 += (pos[i] - q[i]) * (pos[i] - q[i]);
+			r.fixes++;
+		}
+
+		const double t0 = now_sec();
+		const bool tracking = pose.solve(t * 1e6 * CLOCKS_PER_MICROSECOND);
+		solve_sec += now_sec() - t0;
+
+		if (!tracking)
+			continue;
+
+		r.poses++;
+
+		double R[9], p[3];
+		truth(t, R, p);
+
+		double e = 0;
+		for (int i = 0 ; i < 3 ; i++)
+			e += (pose.xyz[i] - p[i]) * (pose.xyz[i] - p[i]);
+		e = sqrt(e);
+		pos2 += e * e;
+		if (e > r.pos_max)
+			r.pos_max = e;
+
+		// angle of the rotation between the two, from the trace
+		// of rot R'
+		double tr = 0;
+		for (int i = 0 ; i < 3 ; i++)
+			for (int j = 0 ; j < 3 ; j++)
+				tr += pose.rot[i*3 + j] * R[i*3 + j];
+		double c = (tr - 1) / 2;
+		const double a = acos(c > 1 ? 1 : c < -1 ? -1 : c);
+		rot2 += a * a;
+		if (a > r.rot_max)
+			r.rot_max = a;
+	}
+
+	r.starts = pose.starts;
+	r.lost = pose.lost;
+	r.pos_rms = r.poses ? sqrt(pos2 / r.poses) : 0;
+	r.rot_rms = r.poses ? sqrt(rot2 / r.poses) : 0;
+	r.fix_rms = r.fixes ? sqrt(fix2 / r.fixes) : 0;
+	r.solve_ns = solve_sec * 1e9 / r.sweeps;
+	return r;
+}
+
+
+int main(int argc, char ** argv)
+{
+	double seconds = 20;
+	double jitter = 1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:j:v:")) != -1)
+	{
+		switch (opt)
+		{
+		case 's': seconds = atof(optarg); break;
+		case 'j': jitter = atof(optarg); break;
+		case 'v': speed = atof(optarg); break;
+		default:
+			fprintf(stderr, "Usage: %s [-s seconds] [-j ticks] [-v speed]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	static const struct {
+		const char * name;
+		unsigned visible;
+	} cases[] = {
+		{ "both", 3 },
+		{ "lh0 only", 1 },
+		{ "lh1 only", 2 },
+	};
+
+	srand(1);
+	int errors = 0;
+
+	for (unsigned i = 0 ; i < sizeof(cases) / sizeof(*cases) ; i++)
+	{
+		const Result r = run(cases[i].visible, seconds, jitter);
+
+		printf("%-8s %5lu sweeps: %5lu poses (%.0f/s) rms %.2f max %.2f mm,"
+			" rotation rms %.2f max %.2f deg;"
+			" %5lu sensor fixes (%.0f/s) rms %.2f mm;"
+			" %lu starts %lu lost; %.0f ns/solve\n",
+			cases[i].name,
+			r.sweeps,
+			r.poses, r.poses / seconds,
+			r.pos_rms * 1000, r.pos_max * 1000,
+			r.rot_rms * 180 / M_PI, r.rot_max * 180 / M_PI,
+			r.fixes, r.fixes / seconds, r.fix_rms * 1000,
+			r.starts, r.lost,
+			r.solve_ns
+		);
+
+		// with both base stations it should be as good as the
+		// separate fixes; with one the depth is less certain.
+		const double max_rms = r.fixes ? r.fix_rms + 1e-3 : 20e-3;
+
+		if (r.lost
+		||  r.poses < r.sweeps * 9 / 10
+		||  r.pos_rms > max_rms
+		||  r.rot_max > 5 * M_PI / 180)
+			errors++;
+	}
+
+	return errors ? 1 : 0;
+}
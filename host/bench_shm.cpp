@@ -0,0 +1,564 @@
+/** \file
+ * Check TrackerShm between processes and time how fast it can be read.
+ *
+ * The parent creates a segment and publishes made up records into it,
+ * and forked readers open it by name as any other program would.  Each
+ * record's fields are all worked out from its number, so a reader can
+ * tell one that was torn by the writer while it was copying it out.
+ * The readers follow the ring, checking that the records come in order
+ * and that every gap is said by -1 and counted in lost, and between
+ * records they check the latest fix, pose and calibration slots, which
+ * must never go backwards.
+ *
+ * First the records are published at a steady rate, stamped with the
+ * time, to see how long they take to reach a reader and that one that
+ * keeps up loses none.  Then they are published as fast as possible
+ * into a small ring, so that the readers are lapped over and over.
+ * Then the time that reading the latest fix takes is measured.  Last,
+ * a slot is left as a writer killed in the middle of it would leave it,
+ * and reading it has to give up rather than wait.
+ *
+ * Usage: bench_shm [-r readers] [-b boards] [-n records] [-s ring]
+ *
+ * Exits non-zero if a record is torn, out of order or unaccounted for,
+ * if reading the latest fix takes a microsecond or more, or if reading
+ * one that the writer died in the middle of doesn't give up as fast.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <vector>
+#include "TrackerShm.h"
+#include "HostUtil.h"
+
+// records per second, and how many, when publishing at a steady rate
+#define RATE 2000
+#define STEADY 2000
+
+// the most that reading the latest fix may take, in seconds
+#define MAX_READ 1e-6
+
+// more than have latest slots
+#define SENSOR_IDS (TRACKER_SHM_SENSORS + 4)
+
+
+struct Result
+{
+	unsigned long received;
+	unsigned long lost;
+	unsigned long order;
+	unsigned long torn;
+	unsigned long latest;
+	unsigned long latest_bad;
+	double latency_sum;
+	double latency_max;
+};
+
+
+/*
+ * Record n: mostly fixes, on sensor ids that go past the ones with a
+ * latest slot, with a pose every eighth and a calibration every 64th.
+ */
+static void make_record(uint64_t n, unsigned boards, double host, TrackerRecord * r)
+{
+	const uint32_t x = n;
+
+	memset(r, 0, sizeof(*r));
+	r->host = host;
+	r->board = (n / SENSOR_IDS) % boards;
+
+	if (n % 64 == 63)
+	{
+		LighthouseCalibration & c = r->calibration.cal;
+		r->type = LH_FRAME_CALIBRATION;
+		r->calibration.id = (n / 64) % TRACKER_SHM_LIGHTHOUSES;
+		c.id = x;
+		c.fw_version = x;
+		c.phase[0] = x & 0xFFFF;
+		c.phase[1] = -(float) (x & 0xFFFF);
+		c.gibmag[1] = x >> 16;
+		c.faults = x;
+	} else
+	if (n % 8 == 7)
+	{
+		TelemetryPose & p = r->pose;
+		r->type = LH_FRAME_POSE;
+		p.id = x % 3;
+		p.time = n;
+		p.xyz[0] = x;
+		p.xyz[1] = ~x;
+		p.xyz[2] = x * 2654435761u;
+		p.q[0] = x & 0xFFFF;
+		p.q[3] = x >> 16;
+		p.used = x;
+		p.rms = x & 0xFF;
+	} else {
+		TelemetryFix & f = r->fix;
+		r->type = LH_FRAME_FIX_KEY;
+		f.id = x % SENSOR_IDS;
+		f.time = n;
+		f.raw[0] = x;
+		f.raw[1] = ~x;
+		f.raw[2] = x * 2654435761u;
+		f.raw[3] = x ^ 0x5A5A5A5A;
+		f.xyz[0] = -(int) x;
+		f.xyz[2] = x >> 8;
+		f.dist = x & 0xFFFF;
+	}
+}
+
+
+// the record's number, if all of it agrees
+static bool check(const TrackerRecord & r, unsigned boards, uint64_t * n)
+{
+	if (r.type == LH_FRAME_CALIBRATION)
+		*n = r.calibration.cal.id;
+	else
+	if (r.type == LH_FRAME_POSE)
+		*n = r.pose.time;
+	else
+	if (r.type == LH_FRAME_FIX_KEY)
+		*n = r.fix.time;
+	else
+		return false;
+
+	TrackerRecord want;
+	make_record(*n, boards, r.host, &want);
+	return memcmp(&r, &want, sizeof(r)) == 0;
+}
+
+
+/*
+ * A look at one of the latest slots, which has to hold an untorn
+ * record for the slot, no older than the one there last time.
+ */
+static void check_latest(
+	bool found,
+	const TrackerRecord & r,
+	unsigned boards,
+	int type,
+	unsigned board,
+	unsigned id,
+	uint64_t * last,
+	Result * res
+)
+{
+	if (!found)
+		return;
+
+	res->latest++;
+
+	uint64_t n;
+	const unsigned got_id = type == LH_FRAME_FIX_KEY ? r.fix.id : r.calibration.id;
+	if (!check(r, boards, &n)
+	||  r.type != type
+	||  r.board != board
+	||  (type != LH_FRAME_POSE && got_id != id)
+	||  (*last != (uint64_t) -1 && n < *last))
+	{
+		if (res->latest_bad++ < 10)
+			fprintf(stderr, "latest %d board %u id %u: bad record\n", type, board, id);
+		return;
+	}
+
+	*last = n;
+}
+
+
+static void reader(const char * name, int ready, int results, unsigned boards, uint64_t count)
+{
+	TrackerShmReader shm;
+	Result res;
+	memset(&res, 0, sizeof(res));
+
+	if (!shm.open(name))
+	{
+		perror(name);
+		_exit(1);
+	}
+
+	if (write(ready, "", 1) != 1)
+		_exit(1);
+
+	// the last record taken from each latest slot
+	std::vector<uint64_t> fixes(boards * TRACKER_SHM_SENSORS, -1);
+	std::vector<uint64_t> poses(boards, -1);
+	std::vector<uint64_t> cals(boards * TRACKER_SHM_LIGHTHOUSES, -1);
+	unsigned slot = 0;
+
+	uint64_t expect = 0;
+	unsigned long lost = 0;
+
+	while (res.received + shm.lost < count)
+	{
+		TrackerRecord r;
+		const int rc = shm.read(&r);
+		const double now = now_sec();
+
+		if (rc != 0)
+		{
+			uint64_t n;
+			if (!check(r, boards, &n))
+			{
+				if (res.torn++ < 10)
+					fprintf(stderr, "record after %lu torn\n", (unsigned long) expect);
+				continue;
+			}
+
+			// a gap has to be what was lost, and said by -1
+			const uint64_t gap = n - expect;
+			if (gap != shm.lost - lost || (rc < 0) != (gap != 0))
+			{
+				if (res.order++ < 10)
+					fprintf(stderr, "record %lu for %lu, rc %d lost %lu\n",
+						(unsigned long) n, (unsigned long) expect,
+						rc, shm.lost - lost);
+			}
+
+			expect = n + 1;
+			lost = shm.lost;
+			res.received++;
+
+			const double latency = now - r.host;
+			res.latency_sum += latency;
+			if (latency > res.latency_max)
+				res.latency_max = latency;
+
+			// keep up with the ring, and only look at the latest
+			// slots now and then
+			if (res.received % 16)
+				continue;
+		}
+
+		const unsigned board = slot % boards;
+		const unsigned sensor = (slot / boards) % TRACKER_SHM_SENSORS;
+		const unsigned lh = slot % TRACKER_SHM_LIGHTHOUSES;
+		slot++;
+
+		bool found = shm.fix(board, sensor, &r);
+		check_latest(found, r, boards, LH_FRAME_FIX_KEY, board, sensor,
+			&fixes[board * TRACKER_SHM_SENSORS + sensor], &res);
+
+		found = shm.pose(board, &r);
+		check_latest(found, r, boards, LH_FRAME_POSE, board, 0,
+			&poses[board], &res);
+
+		found = shm.calibration(board, lh, &r);
+		check_latest(found, r, boards, LH_FRAME_CALIBRATION, board, lh,
+			&cals[board * TRACKER_SHM_LIGHTHOUSES + lh], &res);
+
+		if (rc == 0)
+			sched_yield();
+	}
+
+	res.lost = shm.lost;
+	if (write(results, &res, sizeof(res)) != sizeof(res))
+		_exit(1);
+	_exit(0);
+}
+
+
+/*
+ * Publish count records to readers in their own processes, at the rate
+ * or as fast as possible if it is 0.  Returns the errors.
+ */
+static unsigned long run(
+	const char * name,
+	unsigned readers,
+	unsigned boards,
+	unsigned ring,
+	uint64_t count,
+	double rate
+)
+{
+	TrackerShmWriter shm;
+	if (!shm.create(name, boards, ring))
+	{
+		perror(name);
+		return 1;
+	}
+
+	int ready[2], results[2];
+	if (pipe(ready) < 0 || pipe(results) < 0)
+	{
+		perror("pipe");
+		return 1;
+	}
+
+	std::vector<pid_t> pids;
+	for (unsigned i = 0 ; i < readers ; i++)
+	{
+		const pid_t pid = fork();
+		if (pid < 0)
+		{
+			perror("fork");
+			return 1;
+		}
+		if (pid == 0)
+			reader(name, ready[1], results[1], boards, count);
+		pids.push_back(pid);
+	}
+
+	// they only see what comes after they open it
+	for (unsigned i = 0 ; i < readers ; i++)
+	{
+		char c;
+		if (read(ready[0], &c, 1) != 1)
+		{
+			fprintf(stderr, "reader didn't start\n");
+			return 1;
+		}
+	}
+
+	const double start = now_sec();
+	for (uint64_t n = 0 ; n < count ; n++)
+	{
+		if (rate)
+		{
+			const double t = start + n / rate;
+			const double now = now_sec();
+			if (now < t)
+				usleep((t - now) * 1e6);
+		}
+
+		TrackerRecord r;
+		make_record(n, boards, now_sec(), &r);
+		shm.publish(r);
+	}
+	const double elapsed = now_sec() - start;
+
+	unsigned long errors = 0;
+	unsigned long received = 0;
+	double latency_max = 0;
+	double latency_sum = 0;
+
+	for (unsigned i = 0 ; i < readers ; i++)
+	{
+		Result res;
+		if (read(results[0], &res, sizeof(res)) != sizeof(res))
+		{
+			fprintf(stderr, "reader didn't finish\n");
+			errors++;
+			break;
+		}
+
+		errors += res.order + res.torn + res.latest_bad;
+		if (res.received + res.lost != count)
+		{
+			fprintf(stderr, "%lu received and %lu lost of %lu\n",
+				res.received, res.lost, (unsigned long) count);
+			errors++;
+		}
+
+		// at a steady rate a reader has time to keep up
+		if (rate && res.lost)
+		{
+			fprintf(stderr, "%lu lost at %.0f records/s\n", res.lost, rate);
+			errors++;
+		}
+
+		received += res.received;
+		latency_sum += res.latency_sum;
+		if (res.latency_max > latency_max)
+			latency_max = res.latency_max;
+	}
+
+	for (pid_t pid : pids)
+	{
+		int status;
+		waitpid(pid, &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			errors++;
+	}
+
+	close(ready[0]);
+	close(ready[1]);
+	close(results[0]);
+	close(results[1]);
+
+	if (rate)
+		printf("%u readers at %.0f records/s: latency mean %.1f max %.1f usec: %s\n",
+			readers, rate,
+			received ? latency_sum / received * 1e6 : 0.0,
+			latency_max * 1e6,
+			errors ? "FAILED" : "ok");
+	else
+		printf("%u readers flat out, %u slot ring: %.0f records/s published,"
+			" %.1f%% read: %s\n",
+			readers, ring, count / elapsed,
+			readers ? 100.0 * received / readers / count : 0.0,
+			errors ? "FAILED" : "ok");
+
+	return errors;
+}
+
+
+/*
+ * How long the latest fix takes to read, going round every board and
+ * sensor so that it isn't one cache line the whole time.
+ */
+static unsigned long time_latest(const char * name, unsigned boards, unsigned long reads)
+{
+	TrackerShmWriter shm;
+	if (!shm.create(name, boards, 16))
+	{
+		perror(name);
+		return 1;
+	}
+
+	// a fix in every slot; every eighth record is one
+	const unsigned slots = boards * TRACKER_SHM_SENSORS;
+	for (unsigned s = 0 ; s < slots ; s++)
+	{
+		TrackerRecord r;
+		make_record(8 * s, boards, now_sec(), &r);
+		r.board = s % boards;
+		r.fix.id = s / boards;
+		shm.publish(r);
+	}
+
+	TrackerShmReader reader;
+	if (!reader.open(name))
+	{
+		perror(name);
+		return 1;
+	}
+
+	unsigned long found = 0;
+	uint64_t sum = 0;
+
+	const double start = now_sec();
+	for (unsigned long i = 0 ; i < reads ; i++)
+	{
+		const unsigned s = i % slots;
+		TrackerRecord r;
+		if (reader.fix(s % boards, s / boards, &r))
+		{
+			found++;
+			sum += r.fix.raw[0];
+		}
+	}
+	const double each = (now_sec() - start) / reads;
+
+	// so that the reads can't be left out
+	if (found != reads)
+	{
+		fprintf(stderr, "%lu of %lu latest fixes found (%lu)\n",
+			found, reads, (unsigned long) sum);
+		return 1;
+	}
+
+	printf("latest fix read: %.1f nsec: %s\n", each * 1e9,
+		each < MAX_READ ? "ok" : "FAILED");
+
+	return each < MAX_READ ? 0 : 1;
+}
+
+
+/*
+ * A writer that is killed in store() leaves the slot's sequence odd,
+ * which is done here through a mapping of its own.  The reader has to
+ * say there is no record, as fast as it reads one, and find it again
+ * once the sequence is even.
+ */
+static unsigned long check_stale(const char * name, unsigned boards)
+{
+	TrackerShmWriter shm;
+	if (!shm.create(name, boards, 16))
+	{
+		perror(name);
+		return 1;
+	}
+
+	TrackerRecord r;
+	make_record(0, boards, now_sec(), &r);
+	r.board = 0;
+	r.fix.id = 0;
+	shm.publish(r);
+
+	TrackerShmReader reader;
+	const int fd = shm_open(name, O_RDWR, 0);
+	if (fd < 0 || !reader.open(name))
+	{
+		perror(name);
+		return 1;
+	}
+
+	struct stat st;
+	void * base = MAP_FAILED;
+	if (fstat(fd, &st) == 0)
+		base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+	{
+		perror(name);
+		return 1;
+	}
+
+	// the latest fix of board 0 sensor 0 is the first slot
+	TrackerShmSlot * const slot = (TrackerShmSlot *) ((TrackerShmHeader *) base + 1);
+	slot->seq++;
+
+	const double start = now_sec();
+	const bool found = reader.fix(0, 0, &r);
+	const double took = now_sec() - start;
+
+	slot->seq++;
+	const bool again = reader.fix(0, 0, &r);
+	munmap(base, st.st_size);
+
+	const bool ok = !found && again && took < MAX_READ;
+	printf("stale writer: %s after %.1f nsec, %s once written: %s\n",
+		found ? "found" : "given up",
+		took * 1e9,
+		again ? "found" : "not found",
+		ok ? "ok" : "FAILED");
+
+	return ok ? 0 : 1;
+}
+
+
+int main(int argc, char ** argv)
+{
+	unsigned readers = 2;
+	unsigned boards = 4;
+	unsigned long count = 2000000;
+	unsigned ring = 256;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "r:b:n:s:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'r': readers = strtoul(optarg, NULL, 0); break;
+		case 'b': boards = strtoul(optarg, NULL, 0); break;
+		case 'n': count = strtoul(optarg, NULL, 0); break;
+		case 's': ring = strtoul(optarg, NULL, 0); break;
+		default:
+			fprintf(stderr, "Usage: %s [-r readers] [-b boards] [-n records] [-s ring]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (boards == 0)
+		boards = 1;
+
+	char name[64];
+	snprintf(name, sizeof(name), "/bench_shm.%d", (int) getpid());
+
+	unsigned long errors = 0;
+	errors += run(name, readers, boards, 4096, STEADY, RATE);
+	errors += run(name, readers, boards, ring, count, 0);
+	errors += time_latest(name, boards, 10000000);
+	errors += check_stale(name, boards);
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,265 @@
+/** \file
+ * Check and time the lighthouse pose solve that solve_lighthouse uses.
+ *
+ * The sensor board is at the origin with its sensors in the default
+ * 22 mm square, as solve_lighthouse expects, and each base station
+ * starts at its pose in LighthousePoses.h.  For every trial that pose
+ * is moved by up to half a meter and turned by up to 10 degrees, the
+ * sweep angles of the sensors are worked out with pose_project(), and
+ * pose_solve() has to find the pose again: exactly without noise, and
+ * to within a couple of centimeters and a fraction of a degree with the
+ * angles off by the noise that is left after solve_lighthouse averages
+ * a block of fixes.
+ *
+ * Usage: bench_solve [-n trials] [-j ticks]
+ *
+ * -j is the standard deviation of the noise on each averaged sweep
+ * time, in timer ticks.  The default of 0.2 is a tick of jitter on
+ * each capture averaged over the 50 or so that each sensor gets in a
+ * block.  From about 0.3 on, the noise starts to hide which way the
+ * 22 mm square is tilted, and some solves find the mirrored pose, which
+ * are counted as flipped.
+ *
+ * Exits non-zero if a solve fails, is flipped, or the origin or
+ * rotation is off by more than that.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include "InputCapture.h"
+#include "LighthouseXYZ.h"
+#include "LighthousePoses.h"
+#include "PoseSolver.h"
+#include "HostUtil.h"
+
+#define NUM_SENSORS 4
+#define TICKS_PER_RADIAN (8333.0 * CLOCKS_PER_MICROSECOND / M_PI)
+
+// the most that a solve with no noise may be off by, and with it
+#define EXACT_ORIGIN 1e-6	// meters
+#define EXACT_ROTATION 1e-6	// radians
+#define MAX_ORIGIN 0.02
+#define MAX_ROTATION (0.5 * M_PI / 180)
+
+// a solve this far out has found the board's other, mirrored, tilt
+#define FLIPPED (10 * M_PI / 180)
+
+static const double sensors[NUM_SENSORS][3] = {
+	{ +0.011, -0.011, 0 },
+	{ -0.011, -0.011, 0 },
+	{ -0.011, +0.011, 0 },
+	{ +0.011, +0.011, 0 },
+};
+
+
+// R = A * B
+static void mat_mul(const double A[9], const double B[9], double R[9])
+{
+	for (int i = 0 ; i < 3 ; i++)
+		for (int j = 0 ; j < 3 ; j++)
+			R[3*i + j] = A[3*i + 0] * B[0 + j]
+				   + A[3*i + 1] * B[3 + j]
+				   + A[3*i + 2] * B[6 + j];
+}
+
+
+// A rotation by up to max radians about a random axis
+static void random_rotation(double max, double R[9])
+{
+	double axis[3] = { gaussian(), gaussian(), gaussian() };
+	const double len = sqrt(axis[0]*axis[0] + axis[1]*axis[1] + axis[2]*axis[2]);
+	const double x = axis[0] / len, y = axis[1] / len, z = axis[2] / len;
+	const double a = max * uniform();
+	const double c = cos(a), s = sin(a), C = 1 - c;
+
+	const double r[9] = {
+		x*x*C + c,   x*y*C - z*s, x*z*C + y*s,
+		y*x*C + z*s, y*y*C + c,   y*z*C - x*s,
+		z*x*C - y*s, z*y*C + x*s, z*z*C + c,
+	};
+
+	for (int i = 0 ; i < 9 ; i++)
+		R[i] = r[i];
+}
+
+
+// The matrices in LighthousePoses.h only have five digits, which is
+// not quite a rotation; the nearest one to them is the truth.
+static void orthonormalize(double M[9])
+{
+	double * const r0 = &M[0];
+	double * const r1 = &M[3];
+	double * const r2 = &M[6];
+
+	double len = sqrt(r0[0]*r0[0] + r0[1]*r0[1] + r0[2]*r0[2]);
+	for (int i = 0 ; i < 3 ; i++)
+		r0[i] /= len;
+
+	const double d = r0[0]*r1[0] + r0[1]*r1[1] + r0[2]*r1[2];
+	for (int i = 0 ; i < 3 ; i++)
+		r1[i] -= d * r0[i];
+	len = sqrt(r1[0]*r1[0] + r1[1]*r1[1] + r1[2]*r1[2]);
+	for (int i = 0 ; i < 3 ; i++)
+		r1[i] /= len;
+
+	r2[0] = r0[1]*r1[2] - r0[2]*r1[1];
+	r2[1] = r0[2]*r1[0] - r0[0]*r1[2];
+	r2[2] = r0[0]*r1[1] - r0[1]*r1[0];
+}
+
+
+// The angle of the rotation between two rotation matrices
+static double rotation_error(const double A[9], const double B[9])
+{
+	double trace = 0;
+	for (int i = 0 ; i < 3 ; i++)
+		for (int j = 0 ; j < 3 ; j++)
+			trace += A[3*j + i] * B[3*j + i];
+
+	const double c = (trace - 1) / 2;
+	return acos(c > 1 ? 1 : c < -1 ? -1 : c);
+}
+
+
+struct Result
+{
+	unsigned long solves;
+	unsigned long failed;
+	unsigned long flipped;
+	double origin_rms;
+	double origin_max;
+	double rotation_rms;
+	double rotation_max;
+	double solve_us;
+};
+
+
+static Result run(unsigned trials, double noise)
+{
+	Result r = {};
+	double origin2 = 0;
+	double rotation2 = 0;
+	double elapsed = 0;
+
+	for (unsigned n = 0 ; n < trials ; n++)
+	{
+		const lightsource & ls = lightsources[n % 2];
+
+		double turn[9], mat[9];
+		random_rotation(10 * M_PI / 180, turn);
+		for (int i = 0 ; i < 9 ; i++)
+			mat[i] = ls.mat[i];
+		orthonormalize(mat);
+
+		PoseSolution truth;
+		mat_mul(turn, mat, truth.mat);
+		for (int i = 0 ; i < 3 ; i++)
+			truth.origin[i] = ls.origin[i] + (uniform() - 0.5);
+
+		double angles[NUM_SENSORS][2];
+		bool visible = true;
+		for (int i = 0 ; i < NUM_SENSORS ; i++)
+		{
+			visible &= pose_project(truth, sensors[i], angles[i]);
+			angles[i][0] += gaussian() * noise / TICKS_PER_RADIAN;
+			angles[i][1] += gaussian() * noise / TICKS_PER_RADIAN;
+		}
+
+		// turned away from the board; can't happen at these poses
+		if (!visible)
+		{
+			r.failed++;
+			continue;
+		}
+
+		PoseSolution sol;
+		const double start = now_sec();
+		const bool ok = pose_solve(sensors, angles, NUM_SENSORS, sol);
+		elapsed += now_sec() - start;
+
+		if (!ok)
+		{
+			r.failed++;
+			continue;
+		}
+
+		const double dx = sol.origin[0] - truth.origin[0];
+		const double dy = sol.origin[1] - truth.origin[1];
+		const double dz = sol.origin[2] - truth.origin[2];
+		const double origin = sqrt(dx*dx + dy*dy + dz*dz);
+		const double rotation = rotation_error(truth.mat, sol.mat);
+
+		// tilted the wrong way; see flipped_pose() in PoseSolver.cpp
+		if (rotation > FLIPPED)
+			r.flipped++;
+
+		origin2 += origin * origin;
+		rotation2 += rotation * rotation;
+		if (origin > r.origin_max)
+			r.origin_max = origin;
+		if (rotation > r.rotation_max)
+			r.rotation_max = rotation;
+		r.solves++;
+	}
+
+	if (r.solves)
+	{
+		r.origin_rms = sqrt(origin2 / r.solves);
+		r.rotation_rms = sqrt(rotation2 / r.solves);
+		r.solve_us = elapsed / r.solves * 1e6;
+	}
+
+	return r;
+}
+
+
+int main(int argc, char ** argv)
+{
+	unsigned trials = 2000;
+	double jitter = 0.2;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:j:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n': trials = strtoul(optarg, NULL, 0); break;
+		case 'j': jitter = atof(optarg); break;
+		default:
+			fprintf(stderr, "Usage: %s [-n trials] [-j ticks]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	srand(1);
+	int errors = 0;
+
+	for (int noisy = 0 ; noisy < 2 ; noisy++)
+	{
+		const double noise = noisy ? jitter : 0;
+		const Result r = run(trials, noise);
+
+		const double max_origin = noisy ? MAX_ORIGIN : EXACT_ORIGIN;
+		const double max_rotation = noisy ? MAX_ROTATION : EXACT_ROTATION;
+		const bool ok = r.failed == 0
+			&& r.flipped == 0
+			&& r.origin_max <= max_origin
+			&& r.rotation_max <= max_rotation;
+
+		printf("noise %.2f ticks: %lu solves, %lu failed, %lu flipped;"
+			" origin rms %.3f max %.3f mm,"
+			" rotation rms %.4f max %.4f deg; %.1f us/solve: %s\n",
+			noise, r.solves, r.failed, r.flipped,
+			r.origin_rms * 1000, r.origin_max * 1000,
+			r.rotation_rms * 180 / M_PI, r.rotation_max * 180 / M_PI,
+			r.solve_us,
+			ok ? "ok" : "FAILED");
+
+		if (!ok)
+			errors++;
+	}
+
+	return errors ? 1 : 0;
+}
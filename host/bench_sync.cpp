@@ -0,0 +1,167 @@
+/** \file
+ * Check and time the sync pulse classifier.
+ *
+ * For each supported capture clock rate (Teensy LC at 24 ticks/usec,
+ * Teensy 3.x with a 36, 48 or 60 MHz bus) every possible 32-bit pulse
+ * length is run through LighthouseSyncClassifier and through the
+ * original linear scan from LighthouseSensor::poll(), and any
+ * difference is reported.  Then both are timed on a stream of
+ * realistic pulse lengths.
+ *
+ * Usage: bench_sync [-q]
+ *
+ * -q only checks lengths up to 2^20 instead of the full 32-bit range,
+ * which takes a few minutes.
+ * Exits non-zero if the two disagree.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <vector>
+#include "LighthouseSync.h"
+#include "HostUtil.h"
+
+
+// The linear scan that LighthouseSensor::poll() used to do
+template <unsigned CLOCKS_PER_MICROSECOND>
+static int reference_classify(unsigned len)
+{
+	const unsigned window = 4 * CLOCKS_PER_MICROSECOND;
+
+	static const unsigned midpoints[] = {
+		(unsigned) (62.5 * CLOCKS_PER_MICROSECOND),
+		(unsigned) (83.3 * CLOCKS_PER_MICROSECOND),
+		(unsigned) (72.9 * CLOCKS_PER_MICROSECOND),
+		(unsigned) (93.8 * CLOCKS_PER_MICROSECOND),
+		(unsigned) (104.0 * CLOCKS_PER_MICROSECOND),
+		(unsigned) (125.0 * CLOCKS_PER_MICROSECOND),
+		(unsigned) (115.0 * CLOCKS_PER_MICROSECOND),
+		(unsigned) (135.0 * CLOCKS_PER_MICROSECOND),
+	};
+
+	for (int i = 0 ; i < 8 ; i++)
+	{
+		if (len < midpoints[i] - window)
+			continue;
+		if (len > midpoints[i] + window)
+			continue;
+
+		return i;
+	}
+
+	return -1;
+}
+
+
+template <unsigned CPM>
+static unsigned long check(uint64_t limit)
+{
+	unsigned long errors = 0;
+
+	for (uint64_t len = 0 ; len < limit ; len++)
+	{
+		const int a = reference_classify<CPM>(len);
+		const int b = LighthouseSyncClassifier<CPM>::classify(len);
+		if (a == b)
+			continue;
+
+		if (errors++ < 10)
+			fprintf(stderr, "%u ticks/usec: len %u scan %d table %d\n",
+				CPM, (unsigned) len, a, b);
+	}
+
+	return errors;
+}
+
+
+// Pulse lengths as poll() sees them: mostly sync pulses with some
+// jitter, plus the occasional reflection or noise pulse.
+template <unsigned CPM>
+static std::vector<unsigned> make_pulses(unsigned count)
+{
+	static const double us[] = {
+		62.5, 83.3, 72.9, 93.8, 104.0, 125.0, 115.0, 135.0
+	};
+
+	std::vector<unsigned> lens(count);
+	srand(1);
+
+	for (unsigned i = 0 ; i < count ; i++)
+	{
+		if (rand() % 16 == 0)
+			lens[i] = rand() % (200 * CPM);
+		else
+			lens[i] = us[rand() % 8] * CPM + (rand() % (6 * CPM)) - 3 * CPM;
+	}
+
+	return lens;
+}
+
+
+template <int (*Classify)(unsigned)>
+static double time_it(const std::vector<unsigned> & lens, unsigned passes, int * sum)
+{
+	const double start = now_sec();
+	int s = 0;
+
+	for (unsigned p = 0 ; p < passes ; p++)
+		for (size_t i = 0 ; i < lens.size() ; i++)
+			s += Classify(lens[i]);
+
+	*sum = s;
+	return (now_sec() - start) * 1e9 / (lens.size() * (double) passes);
+}
+
+
+template <unsigned CPM>
+static unsigned long run(uint64_t limit)
+{
+	typedef LighthouseSyncClassifier<CPM> Classifier;
+
+	const unsigned long errors = check<CPM>(limit);
+
+	const std::vector<unsigned> lens = make_pulses<CPM>(1 << 16);
+	int sum_scan, sum_table;
+	const double scan = time_it<reference_classify<CPM> >(lens, 200, &sum_scan);
+	const double table = time_it<Classifier::classify>(lens, 200, &sum_table);
+
+	printf("%2u ticks/usec: %u buckets, shift %u: %lu mismatches;"
+		" scan %.2f ns, table %.2f ns%s\n",
+		CPM,
+		Classifier::windows::buckets(),
+		Classifier::windows::shift,
+		errors,
+		scan,
+		table,
+		sum_scan == sum_table ? "" : " (checksum mismatch)"
+	);
+
+	return errors + (sum_scan != sum_table);
+}
+
+
+int main(int argc, char ** argv)
+{
+	uint64_t limit = 1ULL << 32;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "q")) != -1)
+	{
+		switch (opt)
+		{
+		case 'q': limit = 1 << 20; break;
+		default:
+			fprintf(stderr, "Usage: %s [-q]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	unsigned long errors = 0;
+	errors += run<24>(limit);
+	errors += run<36>(limit);
+	errors += run<48>(limit);
+	errors += run<60>(limit);
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,363 @@
+/** \file
+ * Check and time the triangulation kernel.
+ *
+ * Random sensor positions in the tracked volume are projected into the
+ * four sweep angles of the default lighthouse poses, then triangulated
+ * both by LighthouseXYZ::compute() and by the original CMSIS-DSP
+ * version of the code (with the host stand-ins for the arm_* calls).
+ * The two must agree to within a tenth of a millimeter, and the same
+ * sensors must be rejected as having near parallel rays.
+ * lh_sincosf() is also checked against double precision sin/cos over
+ * the whole range of sweep angles.
+ *
+ * Both are then timed doing the same work for each batch of sensors:
+ * storing the four angles of each, as LighthouseXYZ::update() does and
+ * as the old code did per sensor, and triangulating them all.  On the
+ * host the arm_* stand-ins are inlined libm calls, so this compares
+ * the math rather than the cost of calling CMSIS-DSP on the Teensy,
+ * and the sines and cosines, four of each per fix, are timed on their
+ * own as well since libm's are faster than lh_sincosf() there.
+ *
+ * Usage: bench_xyz [-n points]
+ *
+ * Exits non-zero if anything is out of tolerance.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <vector>
+#include <arm_math.h>
+#include "LighthouseXYZ.h"
+#include "LighthousePoses.h"
+#include "LighthouseMath.h"
+#include "HostUtil.h"
+
+
+static const double position_tolerance = 1e-4;
+static const double sincos_tolerance = 2e-7;
+
+
+/*
+ * The ray and intersection code that LighthouseXYZ used to have,
+ * one sensor at a time through CMSIS-DSP.
+ */
+typedef float vec3d[3];
+
+static void
+reference_ray_vec(
+	float rotation[9],
+	float angle1,
+	float angle2,
+	vec3d &res
+)
+{
+	vec3d a = { +arm_cos_f32(angle1), 0, -arm_sin_f32(angle1) };
+	vec3d b = { 0, +arm_cos_f32(angle2), +arm_sin_f32(angle2) };
+
+	vec3d ray = {
+		b[1]*a[2] - b[2]*a[1],
+		b[2]*a[0] - b[0]*a[2],
+		b[0]*a[1] - b[1]*a[0],
+	};
+
+	float pow, len;
+	arm_power_f32(ray, 3, &pow);
+	arm_sqrt_f32(pow, &len);
+	arm_scale_f32(ray, 1/len, ray, 3);
+
+	arm_matrix_instance_f32 source_rotation_matrix = {3, 3, rotation};
+	arm_matrix_instance_f32 ray_vec = {3, 1, ray};
+	arm_matrix_instance_f32 ray_rotated_vec = {3, 1, res};
+	arm_mat_mult_f32(&source_rotation_matrix, &ray_vec, &ray_rotated_vec);
+}
+
+
+static bool
+reference_intersect(
+	vec3d &orig1,
+	vec3d &vec1,
+	vec3d &orig2,
+	vec3d &vec2,
+	float res[3],
+	float *dist
+)
+{
+	vec3d w0 = {};
+	arm_sub_f32(orig1, orig2, w0, 3);
+
+	float a, b, c, d, e;
+	arm_dot_prod_f32(vec1, vec1, 3, &a);
+	arm_dot_prod_f32(vec1, vec2, 3, &b);
+	arm_dot_prod_f32(vec2, vec2, 3, &c);
+	arm_dot_prod_f32(vec1, w0, 3, &d);
+	arm_dot_prod_f32(vec2, w0, 3, &e);
+
+	float denom = a * c - b * b;
+	if (fabs(denom) < 1e-5f)
+		return false;
+
+	float t1 = (b * e - c * d) / denom;
+	vec3d pt1 = {};
+	arm_scale_f32(vec1, t1, pt1, 3);
+	arm_add_f32(pt1, orig1, pt1, 3);
+
+	float t2 = (a * e - b * d) / denom;
+	vec3d pt2 = {};
+	arm_scale_f32(vec2, t2, pt2, 3);
+	arm_add_f32(pt2, orig2, pt2, 3);
+
+	vec3d tmp = {};
+	arm_add_f32(pt1, pt2, tmp, 3);
+	arm_scale_f32(tmp, 0.5f, res, 3);
+
+	arm_sub_f32(pt1, pt2, tmp, 3);
+	float pow;
+	arm_power_f32(tmp, 3, &pow);
+	arm_sqrt_f32(pow, dist);
+
+	return true;
+}
+
+
+static bool
+reference_compute(const float angles[4], float xyz[3], float * dist)
+{
+	vec3d ray1, ray2;
+	reference_ray_vec(lightsources[0].mat, angles[0], angles[1], ray1);
+	reference_ray_vec(lightsources[1].mat, angles[2], angles[3], ray2);
+
+	return reference_intersect(
+		lightsources[0].origin, ray1,
+		lightsources[1].origin, ray2,
+		xyz, dist
+	);
+}
+
+
+// The sweep angles that a lighthouse would measure for point p,
+// or false if it is outside of its +/- 60 degree field of view.
+static bool
+project(const lightsource & lh, const double p[3], float * a1, float * a2)
+{
+	// lighthouse-relative ray is the transpose of the rotation
+	double r[3];
+	for (int i = 0 ; i < 3 ; i++)
+		r[i] = lh.mat[0*3+i] * (p[0] - lh.origin[0])
+		     + lh.mat[1*3+i] * (p[1] - lh.origin[1])
+		     + lh.mat[2*3+i] * (p[2] - lh.origin[2]);
+
+	// ray is (-cos2 sin1, sin2 cos1, -cos1 cos2)
+	if (r[2] >= 0)
+		return false;
+
+	*a1 = atan2(-r[0], -r[2]);
+	*a2 = atan2(r[1], -r[2]);
+
+	return fabs(*a1) < M_PI / 3 && fabs(*a2) < M_PI / 3;
+}
+
+
+static unsigned long check_sincos()
+{
+	double max_err = 0;
+
+	for (int i = -1000000 ; i <= 1000000 ; i++)
+	{
+		const float x = i * (float) M_PI / 1000000;
+		float s, c;
+		lh_sincosf(x, &s, &c);
+
+		const double es = fabs(s - sin((double) x));
+		const double ec = fabs(c - cos((double) x));
+		if (es > max_err) max_err = es;
+		if (ec > max_err) max_err = ec;
+	}
+
+	printf("lh_sincosf: max error %.2g over +/- pi\n", max_err);
+	return max_err > sincos_tolerance;
+}
+
+
+int main(int argc, char ** argv)
+{
+	unsigned count = 100000;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n': count = strtoul(optarg, NULL, 0); break;
+		default:
+			fprintf(stderr, "Usage: %s [-n points]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	unsigned long errors = check_sincos();
+
+	// sensor positions somewhere in the room, kept only if
+	// both lighthouses can see them
+	std::vector<float> angles[4];
+	std::vector<double> truth;
+	srand(1);
+
+	while (angles[0].size() < count)
+	{
+		const double p[3] = {
+			frand(-1.5, 1.5),
+			frand(0.0, 2.0),
+			frand(-1.5, 1.5),
+		};
+
+		float a[4];
+		if (!project(lightsources[0], p, &a[0], &a[1])
+		||  !project(lightsources[1], p, &a[2], &a[3]))
+			continue;
+
+		for (int j = 0 ; j < 4 ; j++)
+			angles[j].push_back(a[j]);
+		truth.insert(truth.end(), p, p + 3);
+	}
+
+	// compare one batch of sensors at a time
+	const unsigned batch = LighthouseXYZ::max_sensors;
+	LighthouseXYZ xyz;
+	xyz.begin(batch, &lightsources[0], &lightsources[1]);
+
+	double max_diff = 0, max_dist_diff = 0;
+	double max_err_ref = 0, max_err_new = 0;
+	unsigned long mismatched = 0;
+
+	for (unsigned n = 0 ; n + batch <= count ; n += batch)
+	{
+		for (unsigned i = 0 ; i < batch ; i++)
+			for (unsigned j = 0 ; j < 4 ; j++)
+				xyz.update(i, j, lh_angle(angles[j][n+i]));
+
+		const uint32_t valid = xyz.compute();
+
+		for (unsigned i = 0 ; i < batch ; i++)
+		{
+			const float a[4] = {
+				angles[0][n+i], angles[1][n+i],
+				angles[2][n+i], angles[3][n+i],
+			};
+			float ref[3], dist;
+			const bool ok = reference_compute(a, ref, &dist);
+
+			if (ok != ((valid >> i) & 1))
+			{
+				mismatched++;
+				continue;
+			}
+			if (!ok)
+				continue;
+
+			float pos[3];
+			xyz.position(i, pos);
+			const double * t = &truth[3*(n+i)];
+
+			double diff = 0, err_ref = 0, err_new = 0;
+			for (int k = 0 ; k < 3 ; k++)
+			{
+				diff += (pos[k] - ref[k]) * (pos[k] - ref[k]);
+				err_ref += (ref[k] - t[k]) * (ref[k] - t[k]);
+				err_new += (pos[k] - t[k]) * (pos[k] - t[k]);
+			}
+
+			if (sqrt(diff) > max_diff) max_diff = sqrt(diff);
+			if (sqrt(err_ref) > max_err_ref) max_err_ref = sqrt(err_ref);
+			if (sqrt(err_new) > max_err_new) max_err_new = sqrt(err_new);
+			if (fabs(xyz.dist[i] - dist) > max_dist_diff)
+				max_dist_diff = fabs(xyz.dist[i] - dist);
+		}
+	}
+
+	printf("%u points: max difference %.3g m, dist %.3g m, %lu validity mismatches\n",
+		count, max_diff, max_dist_diff, mismatched);
+	printf("max error from truth: reference %.3g m, kernel %.3g m\n",
+		max_err_ref, max_err_new);
+
+	if (max_diff > position_tolerance
+	||  max_dist_diff > position_tolerance
+	||  mismatched)
+		errors++;
+
+	// and time them both, with the same batches and angle stores
+	const unsigned passes = 20;
+	const double fixes = (count / batch) * batch * (double) passes;
+	float sum_ref = 0, sum_new = 0;
+
+	double start = now_sec();
+	for (unsigned p = 0 ; p < passes ; p++)
+	{
+		for (unsigned n = 0 ; n + batch <= count ; n += batch)
+		{
+			float a[LighthouseXYZ::max_sensors][4];
+			for (unsigned i = 0 ; i < batch ; i++)
+				for (unsigned j = 0 ; j < 4 ; j++)
+					a[i][j] = lh_angle_radians(lh_angle(angles[j][n+i]));
+
+			for (unsigned i = 0 ; i < batch ; i++)
+			{
+				float ref[3], dist;
+				if (reference_compute(a[i], ref, &dist))
+					sum_ref += ref[0];
+			}
+		}
+	}
+	const double ref_ns = (now_sec() - start) * 1e9 / fixes;
+
+	start = now_sec();
+	for (unsigned p = 0 ; p < passes ; p++)
+	{
+		for (unsigned n = 0 ; n + batch <= count ; n += batch)
+		{
+			for (unsigned i = 0 ; i < batch ; i++)
+				for (unsigned j = 0 ; j < 4 ; j++)
+					xyz.update(i, j, lh_angle(angles[j][n+i]));
+
+			uint32_t valid = xyz.compute();
+			while (valid)
+			{
+				const unsigned i = __builtin_ctz(valid);
+				valid &= valid - 1;
+				sum_new += xyz.x[i];
+			}
+		}
+	}
+	const double new_ns = (now_sec() - start) * 1e9 / fixes;
+
+	// the sines and cosines on their own
+	const unsigned angle_count = 4 * count;
+	start = now_sec();
+	for (unsigned p = 0 ; p < passes ; p++)
+		for (unsigned n = 0 ; n < angle_count ; n++)
+			sum_ref += arm_sin_f32(angles[n % 4][n / 4])
+				 + arm_cos_f32(angles[n % 4][n / 4]);
+	const double ref_sincos_ns = (now_sec() - start) * 1e9 / (angle_count * (double) passes);
+
+	start = now_sec();
+	for (unsigned p = 0 ; p < passes ; p++)
+	{
+		for (unsigned n = 0 ; n < angle_count ; n++)
+		{
+			float s, c;
+			lh_sincosf(angles[n % 4][n / 4], &s, &c);
+			sum_new += s + c;
+		}
+	}
+	const double new_sincos_ns = (now_sec() - start) * 1e9 / (angle_count * (double) passes);
+
+	printf("sin and cos of an angle: arm_sin_f32 and arm_cos_f32 %.1f ns,"
+		" lh_sincosf %.1f ns\n",
+		ref_sincos_ns, new_sincos_ns);
+	printf("storing angles and triangulating: reference %.1f ns/fix,"
+		" kernel %.1f ns/fix (%+.0f%%), checksum %.1f %.1f\n",
+		ref_ns, new_ns, (new_ns / ref_ns - 1) * 100, sum_ref, sum_new);
+
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,233 @@
+/** \file
+ * Host stand-in for the Teensy 3 kinetis.h register definitions.
+ *
+ * Only the registers and bit fields that the firmware touches are
+ * defined.  The FTM modules are plain structs in memory with the same
+ * layout as the hardware, so that code that takes the address of a
+ * channel register (like InputCapture does) works unchanged.  The
+ * simulated timer in FTMSim.cpp drives them.
+ *
+ * The default is a Teensy 3.2 (MK20DX256, KINETISK, 48 MHz bus), with
+ * FTM0 to FTM2; define __MK66FX1M0__ for a Teensy 3.6 with FTM3 too.
+ */
+#ifndef _host_kinetis_h_
+#define _host_kinetis_h_
+
+#include <stdint.h>
+
+#if !defined(KINETISK) && !defined(KINETISL)
+#define KINETISK
+#endif
+
+#if defined(KINETISK) && !defined(__MK66FX1M0__)
+#define __MK20DX256__
+#endif
+
+#ifndef F_CPU
+#define F_CPU 96000000
+#endif
+
+#ifndef F_PLL
+#define F_PLL 96000000
+#endif
+
+#ifndef F_BUS
+#define F_BUS 48000000
+#endif
+
+
+struct kinetis_ftm_channel_t {
+	volatile uint32_t SC;
+	volatile uint32_t V;
+};
+
+struct kinetis_ftm_t {
+	volatile uint32_t SC;
+	volatile uint32_t CNT;
+	volatile uint32_t MOD;
+	kinetis_ftm_channel_t C[8];
+	volatile uint32_t CNTIN;
+	volatile uint32_t STATUS;
+	volatile uint32_t MODE;
+	volatile uint32_t SYNC;
+	volatile uint32_t OUTINIT;
+	volatile uint32_t OUTMASK;
+	volatile uint32_t COMBINE;
+	volatile uint32_t DEADTIME;
+	volatile uint32_t EXTTRIG;
+	volatile uint32_t POL;
+	volatile uint32_t FMS;
+	volatile uint32_t FILTER;
+	volatile uint32_t FLTCTRL;
+	volatile uint32_t QDCTRL;
+	volatile uint32_t CONF;
+};
+
+extern kinetis_ftm_t host_ftm[4];
+
+// FTMx_STATUS is a mirror of the CHF bits in the channel registers.
+// Reading returns them all at once, writing a 0 to a bit that has
+// been read as set clears that channel's CHF, writing 1 does nothing.
+struct kinetis_ftm_status_t {
+	kinetis_ftm_t & ftm;
+
+	operator uint32_t() const
+	{
+		uint32_t status = 0;
+		for (int i = 0 ; i < 8 ; i++)
+			if (ftm.C[i].SC & 0x80)
+				status |= 1 << i;
+		return status;
+	}
+
+	kinetis_ftm_status_t & operator=(uint32_t val)
+	{
+		for (int i = 0 ; i < 8 ; i++)
+			if ((val & (1 << i)) == 0)
+				ftm.C[i].SC &= ~0x80;
+		return *this;
+	}
+};
+
+#define FTM0_SC		(host_ftm[0].SC)
+#define FTM0_CNT	(host_ftm[0].CNT)
+#define FTM0_MOD	(host_ftm[0].MOD)
+#define FTM0_C0SC	(host_ftm[0].C[0].SC)
+#define FTM0_C0V	(host_ftm[0].C[0].V)
+#define FTM0_C1SC	(host_ftm[0].C[1].SC)
+#define FTM0_C1V	(host_ftm[0].C[1].V)
+#define FTM0_C2SC	(host_ftm[0].C[2].SC)
+#define FTM0_C2V	(host_ftm[0].C[2].V)
+#define FTM0_C3SC	(host_ftm[0].C[3].SC)
+#define FTM0_C3V	(host_ftm[0].C[3].V)
+#define FTM0_C4SC	(host_ftm[0].C[4].SC)
+#define FTM0_C4V	(host_ftm[0].C[4].V)
+#define FTM0_C5SC	(host_ftm[0].C[5].SC)
+#define FTM0_C5V	(host_ftm[0].C[5].V)
+#define FTM0_C6SC	(host_ftm[0].C[6].SC)
+#define FTM0_C6V	(host_ftm[0].C[6].V)
+#define FTM0_C7SC	(host_ftm[0].C[7].SC)
+#define FTM0_C7V	(host_ftm[0].C[7].V)
+#define FTM0_CNTIN	(host_ftm[0].CNTIN)
+#define FTM0_STATUS	(kinetis_ftm_status_t{host_ftm[0]})
+#define FTM0_MODE	(host_ftm[0].MODE)
+#define FTM0_CONF	(host_ftm[0].CONF)
+
+// Only what InputCapture uses of the others; the channels are reached
+// from C0SC.
+#define FTM1_SC		(host_ftm[1].SC)
+#define FTM1_CNT	(host_ftm[1].CNT)
+#define FTM1_MOD	(host_ftm[1].MOD)
+#define FTM1_C0SC	(host_ftm[1].C[0].SC)
+#define FTM1_STATUS	(kinetis_ftm_status_t{host_ftm[1]})
+#define FTM1_MODE	(host_ftm[1].MODE)
+#define FTM1_CONF	(host_ftm[1].CONF)
+
+#define FTM2_SC		(host_ftm[2].SC)
+#define FTM2_CNT	(host_ftm[2].CNT)
+#define FTM2_MOD	(host_ftm[2].MOD)
+#define FTM2_C0SC	(host_ftm[2].C[0].SC)
+#define FTM2_STATUS	(kinetis_ftm_status_t{host_ftm[2]})
+#define FTM2_MODE	(host_ftm[2].MODE)
+#define FTM2_CONF	(host_ftm[2].CONF)
+
+#define FTM3_SC		(host_ftm[3].SC)
+#define FTM3_CNT	(host_ftm[3].CNT)
+#define FTM3_MOD	(host_ftm[3].MOD)
+#define FTM3_C0SC	(host_ftm[3].C[0].SC)
+#define FTM3_STATUS	(kinetis_ftm_status_t{host_ftm[3]})
+#define FTM3_MODE	(host_ftm[3].MODE)
+#define FTM3_CONF	(host_ftm[3].CONF)
+
+#define FTM_SC_TOF		0x80
+#define FTM_SC_TOIE		0x40
+#define FTM_SC_CPWMS		0x20
+#define FTM_SC_CLKS(n)		(((n) & 3) << 3)
+#define FTM_SC_PS(n)		(((n) & 7) << 0)
+
+#define FTM_CSC_CHF		0x80
+#define FTM_CSC_CHIE		0x40
+#define FTM_CSC_MSB		0x20
+#define FTM_CSC_MSA		0x10
+#define FTM_CSC_ELSB		0x08
+#define FTM_CSC_ELSA		0x04
+#define FTM_CSC_DMA		0x01
+
+#define FTM_MODE_FTMEN		0x01
+#define FTM_MODE_WPDIS		0x04
+
+#define FTM_CONF_GTBEEN		0x200
+#define FTM_CONF_GTBEOUT	0x400
+
+
+// DMA request sources and the number of eDMA channels; the channels
+// themselves are modelled in DMAChannel.h.
+#if defined(__MK66FX1M0__)
+#define DMA_NUM_CHANNELS	32
+#else
+#define DMA_NUM_CHANNELS	16
+#endif
+
+#define DMAMUX_SOURCE_FTM0_CH0	20
+#define DMAMUX_SOURCE_FTM0_CH1	21
+#define DMAMUX_SOURCE_FTM0_CH2	22
+#define DMAMUX_SOURCE_FTM0_CH3	23
+#define DMAMUX_SOURCE_FTM0_CH4	24
+#define DMAMUX_SOURCE_FTM0_CH5	25
+#define DMAMUX_SOURCE_FTM0_CH6	26
+#define DMAMUX_SOURCE_FTM0_CH7	27
+#define DMAMUX_SOURCE_FTM1_CH0	28
+#define DMAMUX_SOURCE_FTM1_CH1	29
+#define DMAMUX_SOURCE_FTM2_CH0	30
+#define DMAMUX_SOURCE_FTM2_CH1	31
+#define DMAMUX_SOURCE_FTM3_CH0	32
+
+
+// Port control: each pin has a PCR, only the mux field is modelled.
+extern volatile uint32_t host_port_pcr[64];
+
+#define PORT_PCR_MUX(n)		(((n) & 7) << 8)
+#define PORT_PCR_MUX_MASK	0x00000700
+#define portConfigRegister(pin)	(&host_port_pcr[(pin)])
+
+
+// Interrupt controller.  The host is single threaded and the simulated
+// timer calls the ISRs synchronously, so these are bookkeeping only.
+enum IRQ_NUMBER_t {
+	IRQ_FTM0 = 62,
+	IRQ_FTM1 = 63,
+	IRQ_FTM2 = 64,
+	IRQ_FTM3 = 71,
+};
+
+extern uint8_t host_nvic_enabled[128];
+extern uint8_t host_nvic_priority[128];
+
+#define NVIC_ENABLE_IRQ(n)	(host_nvic_enabled[(n)] = 1)
+#define NVIC_DISABLE_IRQ(n)	(host_nvic_enabled[(n)] = 0)
+#define NVIC_SET_PRIORITY(n, p)	(host_nvic_priority[(n)] = (p))
+
+#define __disable_irq()		do {} while (0)
+#define __enable_irq()		do {} while (0)
+
+// Weak, as in the Teensy core, so that the simulated timer can tell
+// which ones the firmware has
+extern void ftm0_isr(void) __attribute__((weak));
+extern void ftm1_isr(void) __attribute__((weak));
+extern void ftm2_isr(void) __attribute__((weak));
+extern void ftm3_isr(void) __attribute__((weak));
+
+
+// Debug watchpoint unit cycle counter.  The simulation has no
+// interrupt latency, so this just follows simulated time.
+extern volatile uint32_t host_demcr;
+extern volatile uint32_t host_dwt_ctrl;
+uint32_t host_dwt_cyccnt(void);
+
+#define ARM_DEMCR		host_demcr
+#define ARM_DEMCR_TRCENA	(1 << 24)
+#define ARM_DWT_CTRL		host_dwt_ctrl
+#define ARM_DWT_CTRL_CYCCNTENA	(1 << 0)
+#define ARM_DWT_CYCCNT		(host_dwt_cyccnt())
+
+#endif
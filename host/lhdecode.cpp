@@ -0,0 +1,161 @@
+/** \file
+ * Convert the binary telemetry stream back into the text format that
+ * the firmware used to print, so that scripts can keep reading it:
+ *
+ *	sensor,raw0,raw1,raw2,raw3,x_mm,y_mm,z_mm,dist
+ *	pose body x_mm,y_mm,z_mm qw,qx,qy,qz used rms_mrad
+ *	length hex hex hex ...		(OOTX messages)
+ *	cal lighthouse id=... fw=... ...	(base station calibration)
+ *	# text				(diagnostic messages)
+ *
+ * Usage: lhdecode [-T] [-e trace.txt] [/dev/ttyACM0 | capture.bin]
+ *
+ * Reads stdin if no file is given.  Link statistics are printed to
+ * stderr at the end.  With -e the raw edges that the firmware streams
+ * after an 'e' command are written to the file in the trace format
+ * that replay reads, with a "# lost" line wherever some went missing.
+ *
+ * With -T the fix and pose lines start with the tracker's time in
+ * seconds and the host's CLOCK_MONOTONIC time that it maps to, from
+ * when the TIME frames arrived (see DeviceClock.h).  The host times
+ * only mean something when reading from the tracker itself.
+ */
+#include <Arduino.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+#include "TelemetryDecoder.h"
+#include "DeviceClock.h"
+#include "Trace.h"
+#include "HostUtil.h"
+
+
+static void print_time(const DeviceClock & clock, uint64_t ticks)
+{
+	if (clock.samples() == 0)
+		printf("%.6f - ", ticks / (double) F_BUS);
+	else
+		printf("%.6f %.6f ", ticks / (double) F_BUS, clock.host_time(ticks));
+}
+
+
+int main(int argc, char ** argv)
+{
+	FILE * trace = NULL;
+	bool times = false;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "Te:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'T':
+			times = true;
+			break;
+		case 'e':
+			if ((trace = fopen(optarg, "w")) == NULL)
+			{
+				perror(optarg);
+				return 1;
+			}
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-T] [-e trace.txt] [/dev/ttyACM0 | capture.bin]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	FILE * f = stdin;
+	if (optind < argc && (f = fopen(argv[optind], "rb")) == NULL)
+	{
+		perror(argv[optind]);
+		return 1;
+	}
+
+	TelemetryDecoder d;
+	DeviceClock clock(F_BUS);
+	unsigned long fixes = 0;
+	unsigned long edges = 0;
+	int c;
+
+	// the edge times are 32 bits, the trace wants them to count up
+	uint64_t epoch = 0;
+	uint32_t last_edge = 0;
+
+	while ((c = getc(f)) != EOF)
+	{
+		const int type = d.feed(c);
+
+		if (type == LH_FRAME_FIX_KEY || type == LH_FRAME_FIX_DELTA)
+		{
+			if (times)
+				print_time(clock, d.fix.time);
+			telemetry_write_fix(stdout, d.fix);
+			fixes++;
+		} else
+		if (type == LH_FRAME_OOTX)
+		{
+			printf("%u", d.ootx.length);
+			for (unsigned i = 0 ; i < d.ootx.length ; i++)
+				printf(" %02X", d.ootx.bytes[i]);
+			printf("\n");
+		} else
+		if (type == LH_FRAME_POSE)
+		{
+			if (times)
+				print_time(clock, d.pose.time);
+			telemetry_write_pose(stdout, d.pose);
+		} else
+		if (type == LH_FRAME_CALIBRATION)
+		{
+			telemetry_write_calibration(stdout, d.calibration_id, d.calibration);
+		} else
+		if (type == LH_FRAME_TEXT)
+		{
+			printf("# %.*s\n", d.ootx.length, (const char*) d.ootx.bytes);
+		} else
+		if (type == LH_FRAME_TIME)
+		{
+			clock.add(d.device_time, now_sec());
+		} else
+		if (type == LH_FRAME_EDGES && trace)
+		{
+			const TelemetryEdges & e = d.edges;
+			if (e.lost)
+				fprintf(trace, "# lost\n");
+
+			for (unsigned i = 0 ; i < e.count ; i++)
+			{
+				if (e.when[i] < last_edge && last_edge - e.when[i] > 0x80000000u)
+					epoch += 1ull << 32;
+				last_edge = e.when[i];
+
+				const TraceEdge t = { epoch | e.when[i], e.id[i], e.rising[i] };
+				trace_write(trace, t);
+			}
+
+			edges += e.count;
+		}
+	}
+
+	if (trace)
+		fclose(trace);
+
+	fprintf(stderr,
+		"bytes %lu frames %lu fixes %lu (%.1f bytes/fix)"
+		" crc errors %lu lost %lu dropped deltas %lu\n",
+		d.bytes, d.frames, fixes,
+		fixes ? d.bytes / (double) fixes : 0.0,
+		d.crc_errors, d.lost_frames, d.dropped_deltas
+	);
+
+	if (trace)
+		fprintf(stderr, "edges %lu, bad edge frames %lu\n",
+			edges, d.bad_edges);
+
+	if (times && clock.samples() != 0)
+		fprintf(stderr, "clock %u samples, %+.1f ppm, error %.3f ms\n",
+			clock.samples(), clock.ppm(), clock.error() * 1e3);
+
+	return 0;
+}
@@ -0,0 +1,95 @@
+/** \file
+ * Write a synthetic edge trace from two simulated base stations.
+ *
+ * A board of sensors moves in front of the default lighthouse poses
+ * (see EmissionSim.h) and the edges on each sensor line are written in
+ * the trace format that replay reads, so sensors 0 to 3 go through the
+ * real InputCapture ISR there.  With -g the true angle and position of
+ * every sweep is added as comment lines at the end:
+ *
+ *	#truth <tick> <sensor> <lighthouse*2+axis> <radians> <x> <y> <z>
+ *
+ * Usage: lhsim [options] > trace.txt
+ *
+ *	-n sensors	on the board (4)
+ *	-d mm		between sensors on the board (22)
+ *	-v speed	turns per second around the circle (0.5)
+ *	-s seconds	of edges (10)
+ *	-j ticks	rms jitter on every edge (0)
+ *	-c ppm		timer clock error against the rotors (0)
+ *	-m chance	that a sensor misses a pulse (0)
+ *	-r chance	of a reflection per sensor per sweep (0)
+ *	-b lh		block lighthouse 0 or 1
+ *	-g		add the ground truth
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "EmissionSim.h"
+
+
+int main(int argc, char ** argv)
+{
+	EmissionBoard board = { 4, 0.022, 0.5 };
+	EmissionSim sim;
+	double seconds = 10;
+	bool ground_truth = false;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:d:v:s:j:c:m:r:b:g")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n': board.sensors = strtoul(optarg, NULL, 0); break;
+		case 'd': board.spacing = atof(optarg) / 1000; break;
+		case 'v': board.speed = atof(optarg); break;
+		case 's': seconds = atof(optarg); break;
+		case 'j': sim.jitter = atof(optarg); break;
+		case 'c': sim.clock_ppm = atof(optarg); break;
+		case 'm': sim.miss_sync = sim.miss_sweep = atof(optarg); break;
+		case 'r': sim.reflect = atof(optarg); break;
+		case 'b': sim.on[atoi(optarg) & 1] = false; break;
+		case 'g': ground_truth = true; break;
+		default:
+			fprintf(stderr, "Usage: %s [-n sensors] [-d mm] [-v speed] [-s seconds] [-j ticks] [-c ppm] [-m chance] [-r chance] [-b lh] [-g]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (board.sensors == 0 || board.sensors > 255)
+	{
+		fprintf(stderr, "%s: 1 to 255 sensors\n", argv[0]);
+		return 1;
+	}
+
+	std::vector<TraceEdge> edges;
+	std::vector<EmissionTruth> truth;
+
+	sim.begin(board.sensors, EmissionBoard::position, &board);
+	sim.run((unsigned) (seconds * 1e6 / sim.period_usec), edges, &truth);
+
+	printf("# lhsim %u sensors, %.1f s, jitter %.1f ticks, clock %+.1f ppm\n",
+		board.sensors, seconds, sim.jitter, sim.clock_ppm);
+
+	for (size_t i = 0 ; i < edges.size() ; i++)
+		trace_write(stdout, edges[i]);
+
+	if (ground_truth)
+	{
+		for (size_t i = 0 ; i < truth.size() ; i++)
+		{
+			const EmissionTruth & t = truth[i];
+			printf("#truth %llu %u %u %.9f %.6f %.6f %.6f\n",
+				(unsigned long long) t.tick,
+				t.sensor,
+				t.ind,
+				t.angle,
+				t.xyz[0], t.xyz[1], t.xyz[2]
+			);
+		}
+	}
+
+	fprintf(stderr, "%zu edges, %zu sweeps\n", edges.size(), truth.size());
+
+	return 0;
+}
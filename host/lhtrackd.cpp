@@ -0,0 +1,151 @@
+/** \file
+ * Read several trackers at once and print their fixes and poses as
+ * one stream in the order that they happened (see TrackerHub.h).
+ *
+ *	host board sensor,raw0,raw1,raw2,raw3,x_mm,y_mm,z_mm,dist
+ *	host board pose body x_mm,y_mm,z_mm qw,qx,qy,qz used rms_mrad
+ *	host board cal lighthouse id=... fw=... ...
+ *
+ * host is the CLOCK_MONOTONIC time in seconds of the sweep, from that
+ * board's TIME frames, so the lines from different boards can be
+ * compared, and board is the device's place on the command line from
+ * 0.  The rest is as lhdecode prints it.
+ *
+ * Usage: lhtrackd [-w workers] [-d delay_ms] [-m name] [-q] /dev/ttyACM0 [/dev/ttyACM1 ...]
+ *
+ * -w sets the number of decode threads (default one for each CPU, up
+ * to the number of boards) and -d how long a line is held in case an
+ * earlier one from another board is still on its way (default 20 ms).
+ * -m also publishes every record in shared memory for other processes
+ * to read (see TrackerShm.h), under the name given or /lhtrackd if it
+ * is "-", and -q stops the lines being printed.  A delay of 0 gets the
+ * records there soonest, at the cost of the order between boards.
+ * It runs until every device has closed or it is interrupted, and then
+ * prints each board's link and clock statistics to stderr.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include "TrackerHub.h"
+#include "TrackerShm.h"
+
+
+static volatile sig_atomic_t interrupted;
+
+
+static void on_signal(int sig)
+{
+	interrupted = 1;
+}
+
+
+static void print_record(const TrackerRecord & r)
+{
+	printf("%.6f %u ", r.host, r.board);
+
+	if (r.type == LH_FRAME_POSE)
+		telemetry_write_pose(stdout, r.pose);
+	else
+	if (r.type == LH_FRAME_CALIBRATION)
+		telemetry_write_calibration(stdout, r.calibration.id, r.calibration.cal);
+	else
+		telemetry_write_fix(stdout, r.fix);
+}
+
+
+int main(int argc, char ** argv)
+{
+	unsigned workers = 0;
+	double delay = 0.02;
+	const char * shm_name = NULL;
+	bool quiet = false;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "w:d:m:q")) != -1)
+	{
+		switch (opt)
+		{
+		case 'w': workers = strtoul(optarg, NULL, 0); break;
+		case 'd': delay = atof(optarg) / 1000; break;
+		case 'm': shm_name = strcmp(optarg, "-") ? optarg : TRACKER_SHM_NAME; break;
+		case 'q': quiet = true; break;
+		default:
+			fprintf(stderr, "Usage: %s [-w workers] [-d delay_ms] [-m name] [-q] /dev/ttyACM0 [/dev/ttyACM1 ...]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind == argc)
+	{
+		fprintf(stderr, "%s: no devices\n", argv[0]);
+		return 1;
+	}
+
+	TrackerHub hub(delay);
+
+	for (int i = optind ; i < argc ; i++)
+	{
+		const int fd = tracker_open(argv[i]);
+		if (fd < 0)
+		{
+			perror(argv[i]);
+			return 1;
+		}
+		hub.add(fd);
+	}
+
+	TrackerShmWriter shm;
+	if (shm_name && !shm.create(shm_name, hub.boards()))
+	{
+		perror(shm_name);
+		return 1;
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	hub.start(workers);
+
+	while (!interrupted && !hub.done())
+	{
+		TrackerRecord r;
+		if (hub.next(&r))
+		{
+			if (shm_name)
+				shm.publish(r);
+			if (!quiet)
+				print_record(r);
+			continue;
+		}
+
+		// caught up; let the reader have what there is
+		fflush(stdout);
+		usleep(1000);
+	}
+
+	hub.stop();
+	fflush(stdout);
+
+	for (unsigned i = 0 ; i < hub.boards() ; i++)
+	{
+		TrackerStats s;
+		hub.stats(i, &s);
+		fprintf(stderr,
+			"%s: bytes %lu frames %lu crc errors %lu lost %lu"
+			" records %lu unsynced %lu",
+			argv[optind + i], s.bytes, s.frames, s.crc_errors,
+			s.lost_frames, s.records, s.unsynced);
+		if (s.clock_samples)
+			fprintf(stderr, " clock %+.1f ppm error %.3f ms",
+				s.clock_ppm, s.clock_error * 1e3);
+		fprintf(stderr, "\n");
+	}
+
+	if (hub.late)
+		fprintf(stderr, "%lu records later than the %.0f ms delay\n",
+			hub.late, delay * 1e3);
+
+	return 0;
+}
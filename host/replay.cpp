@@ -0,0 +1,510 @@
+/** \file
+ * Replay a recorded edge trace through the decoder.
+ *
+ * The edges are presented to the simulated FTM0 on the same pins as
+ * firmware.ino wires up the four sensors, so the real InputCapture ISR
+ * timestamps them into the shared edge queue, then
+ * LighthouseSensor::edge(), LighthouseXYZ, LighthouseFilter and
+ * LighthousePose run as they do in loop().  Built with
+ * LIGHTHOUSE_FIXED_POINT there is no filter or pose, as in the firmware,
+ * and every triangulated fix is sent.
+ *
+ * The whole trace is loaded before the clock starts so that the
+ * timing covers only the capture and decode path.
+ *
+ * Usage: replay [-v | -t [-r]] [-c] [-n repeat] [-e eeprom.bin] [-b bytes/sec] trace.txt
+ *
+ * With -v the fixes are printed in the text format that lhdecode
+ * produces, with -t they are written to stdout as binary telemetry
+ * frames exactly as the firmware sends them, through LighthouseOutput,
+ * and -r adds the raw edge stream that the firmware sends after an 'e'
+ * command, which lhdecode -e turns back into a trace.
+ * With -b the host reads the frames at that many bytes per second of
+ * trace time, so the queue fills and drops as it would on a slow USB
+ * reader; whatever is still queued at the end is sent anyway.  With -e
+ * the calibration store uses the file as its EEPROM, so that warm
+ * starts can be tested by replaying twice.  With -c each sensor is on
+ * only its first pin, capturing both edges, as firmware.ino built with
+ * LIGHTHOUSE_DUAL_EDGE has it.
+ */
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include "FTMSim.h"
+#include "Trace.h"
+#include "LighthouseSensor.h"
+#include "LighthouseXYZ.h"
+#include "LighthouseFilter.h"
+#include "LighthousePose.h"
+#include "LighthousePoses.h"
+#include "LighthouseTelemetry.h"
+#include "LighthouseCalibrationStore.h"
+#include "LighthouseOutput.h"
+#include "LighthouseEdgeStream.h"
+#include "FileStorage.h"
+#include "HostUtil.h"
+
+#define NUM_SENSORS 4
+
+// same pin assignment as firmware.ino: rising, falling for each sensor
+static const uint8_t sensor_pins[NUM_SENSORS][2] = {
+	{  5,  6 },
+	{  9, 10 },
+	{ 20, 21 },
+	{ 22, 23 },
+};
+
+
+static LighthouseSyncTracker tracker;
+static LighthouseSensor sensors[NUM_SENSORS];
+static LighthouseXYZ xyz;
+#ifndef LIGHTHOUSE_FIXED_POINT
+static LighthouseFilter filters[NUM_SENSORS];
+static LighthousePose pose;
+#endif
+static LighthouseTelemetry telemetry;
+static LighthouseCalibrationStore calstore;
+static FileStorage eeprom;
+
+
+// A host that reads rate bytes per second of trace time, up to a few
+// USB packets at once, or everything as it comes if rate is 0
+class ReplayPort : public LighthouseOutputPort
+{
+public:
+	ReplayPort() : binary(false), rate(0), now(0), last(0), credit(0), bytes(0) {}
+
+	bool binary;
+	double rate;
+	uint64_t now;
+
+	unsigned room()
+	{
+		if (this->rate == 0)
+			return LH_FRAME_MAX;
+
+		this->credit += (this->now - this->last) * this->rate / F_BUS;
+		this->last = this->now;
+		if (this->credit > 512)
+			this->credit = 512;
+		return (unsigned) this->credit;
+	}
+
+	unsigned write(const uint8_t * buf, unsigned len)
+	{
+		if (this->binary)
+			fwrite(buf, 1, len, stdout);
+		this->credit -= len;
+		this->bytes += len;
+		return len;
+	}
+
+	uint64_t last;
+	double credit;
+	unsigned long bytes;
+};
+
+static ReplayPort port;
+static LighthouseOutput output;
+static LighthouseEdgeStream edge_stream;
+
+
+static void print_fix(int i, const LighthouseSensor & s, const float pos[3], float dist)
+{
+	printf("%d,%u,%u,%u,%u,%d,%d,%d,%.2f\n",
+		i,
+		(unsigned) s.raw[0],
+		(unsigned) s.raw[1],
+		(unsigned) s.raw[2],
+		(unsigned) s.raw[3],
+		(int)(pos[0]*1000),
+		(int)(pos[1]*1000),
+		(int)(pos[2]*1000),
+		dist
+	);
+}
+
+
+// Send any calibration restored for lighthouse lh or message
+// completed by its decoder, returns 1 if a message was completed
+static unsigned check_ootx(unsigned lh, unsigned long * warm_starts, unsigned long * tx_bytes)
+{
+	LighthouseOOTX & o = tracker.ootx[lh];
+	uint8_t txbuf[LH_FRAME_MAX];
+
+	if (calstore.update(lh, o, lightsources[lh]) == LighthouseCalibrationStore::LOADED)
+	{
+		(*warm_starts)++;
+		const unsigned len = telemetry.calibration(txbuf, lh, calstore.calibration[lh]);
+		*tx_bytes += len;
+		output.write(txbuf, len);
+	}
+
+	if (!o.complete)
+		return 0;
+
+	const unsigned len = o.have_calibration
+		? telemetry.calibration(txbuf, lh, o.calibration)
+		: telemetry.ootx(txbuf, lh, o.bytes, o.length);
+	*tx_bytes += len;
+	output.write(txbuf, len);
+	o.complete = 0;
+
+	return 1;
+}
+
+
+#ifndef LIGHTHOUSE_FIXED_POINT
+// Fit the pose and send it if it is tracking, returns 1 if it was sent
+static unsigned solve_pose(uint32_t now, bool verbose, unsigned long * tx_bytes)
+{
+	if (!pose.solve(now))
+		return 0;
+
+	float q[4];
+	pose.quaternion(q);
+
+	uint8_t txbuf[LH_FRAME_MAX];
+	const unsigned len = telemetry.pose(txbuf, 0, now, pose.xyz, q, pose.used, pose.rms);
+	*tx_bytes += len;
+	output.write(txbuf, len);
+	if (verbose)
+		printf("pose 0 %d,%d,%d %.4f,%.4f,%.4f,%.4f %u %.3f\n",
+			(int) (pose.xyz[0] * 1000),
+			(int) (pose.xyz[1] * 1000),
+			(int) (pose.xyz[2] * 1000),
+			q[0], q[1], q[2], q[3],
+			pose.used,
+			pose.rms * 1000
+		);
+
+	return 1;
+}
+#endif
+
+
+int main(int argc, char ** argv)
+{
+	bool verbose = false;
+	bool streaming = false;
+	bool change = false;
+	unsigned repeat = 1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "vtrcn:e:b:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'v': verbose = true; break;
+		case 't': port.binary = true; break;
+		case 'r': streaming = true; break;
+		case 'c':
+#ifdef INPUT_CAPTURE_DMA
+			fprintf(stderr, "-c needs the capture interrupt, not INPUT_CAPTURE_DMA\n");
+			return 1;
+#endif
+			change = true;
+			break;
+		case 'n': repeat = strtoul(optarg, NULL, 0); break;
+		case 'b': port.rate = atof(optarg); break;
+		case 'e':
+			if (!eeprom.open(optarg))
+			{
+				perror(optarg);
+				return 1;
+			}
+			calstore.begin(&eeprom, lightsources);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-v | -t [-r]] [-c] [-n repeat] [-e eeprom.bin] [-b bytes/sec] trace.txt\n", argv[0]);
+			return 1;
+		}
+	}
+
+	FILE * f = stdin;
+	if (optind < argc && (f = fopen(argv[optind], "r")) == NULL)
+	{
+		perror(argv[optind]);
+		return 1;
+	}
+
+	std::vector<TraceEdge> edges;
+	if (!trace_read(f, edges))
+		return 1;
+	if (edges.empty())
+	{
+		fprintf(stderr, "trace is empty\n");
+		return 1;
+	}
+
+	ftm_sim_reset();
+
+	tracker.begin();
+	for (int i = 0 ; i < NUM_SENSORS ; i++)
+	{
+		if (change)
+			sensors[i].begin(i, sensor_pins[i][0], &tracker);
+		else
+			sensors[i].begin(i, sensor_pins[i][0], sensor_pins[i][1], &tracker);
+#ifndef LIGHTHOUSE_FIXED_POINT
+		filters[i].begin(&lightsources[0], &lightsources[1]);
+#endif
+	}
+	xyz.begin(NUM_SENSORS, &lightsources[0], &lightsources[1]);
+#ifndef LIGHTHOUSE_FIXED_POINT
+	pose.begin(&lightsources[0], &lightsources[1]);
+#endif
+	output.begin(&port);
+	edge_stream.begin(&telemetry, &output);
+
+	// each pass starts one sync period after the end of the last one
+	const uint64_t span = edges.back().tick - edges.front().tick
+		+ 400000;
+
+	unsigned long angles = 0;
+	unsigned long fixes[NUM_SENSORS] = {};
+	unsigned long tracked = 0;
+	unsigned long poses = 0;
+	unsigned long frames = 0;
+	unsigned long warm_starts = 0;
+	unsigned long tx_bytes = 0;
+	uint32_t output_lost = 0;
+	uint8_t txbuf[LH_FRAME_MAX];
+
+#ifndef LIGHTHOUSE_FIXED_POINT
+	// loop() fits the pose once no sensor has reported for 100 usec
+	bool pose_pending = false;
+	uint32_t pose_time = 0;
+	uint64_t pose_since = 0;
+#endif
+
+	// and the full timer once a second of trace time
+	bool time_sent = false;
+	uint64_t time_tick = 0;
+
+	const double start = now_sec();
+
+	for (unsigned pass = 0 ; pass < repeat ; pass++)
+	{
+		const uint64_t offset = pass * span;
+
+		for (size_t n = 0 ; n < edges.size() ; n++)
+		{
+			const TraceEdge & e = edges[n];
+			if (e.input >= NUM_SENSORS)
+				continue;
+
+			// loop() sends what it can after every pass
+			port.now = e.tick + offset;
+			if (!time_sent || port.now - time_tick >= F_BUS)
+			{
+				time_sent = true;
+				time_tick = port.now;
+				const unsigned len = telemetry.time(txbuf, InputCapture::now());
+				tx_bytes += len;
+				output.write(txbuf, len);
+			}
+			if (streaming)
+				edge_stream.poll(port.now);
+			output.flush();
+
+#ifndef LIGHTHOUSE_FIXED_POINT
+			if (pose_pending && e.tick + offset - pose_since > 100 * CLOCKS_PER_MICROSECOND)
+			{
+				pose_pending = false;
+				poses += solve_pose(pose_time, verbose, &tx_bytes);
+			}
+#endif
+
+			ftm_sim_edge(e.tick + offset, sensor_pins[e.input][0], e.rising);
+			ftm_sim_edge(e.tick + offset, sensor_pins[e.input][1], e.rising);
+
+			// one edge in, so at most one out of the queue
+			InputCaptureEdge edge;
+			const int rc = InputCapture::read(&edge);
+			if (rc == 0)
+				continue;
+			if (rc < 0)
+			{
+				tracker.resync();
+				for (int k = 0 ; k < NUM_SENSORS ; k++)
+					sensors[k].resync();
+				if (streaming)
+					edge_stream.lost();
+			}
+
+			if (streaming)
+				edge_stream.add(edge);
+
+			const int i = edge.id;
+			LighthouseSensor * const s = &sensors[i];
+
+			int ind = s->edge(edge.when, edge.rising);
+
+			// one OOTX decoder per lighthouse in the tracker
+			while (tracker.updated)
+			{
+				const unsigned lh = __builtin_ctz(tracker.updated);
+				tracker.updated &= tracker.updated - 1;
+				frames += check_ootx(lh, &warm_starts, &tx_bytes);
+			}
+
+			if (ind < 0)
+				continue;
+
+			angles++;
+
+#ifndef LIGHTHOUSE_FIXED_POINT
+			const float angle = lh_angle_radians(s->angles[ind]);
+
+			pose.update(i, ind, angle, s->times[ind]);
+			pose_time = s->times[ind];
+			pose_since = e.tick + offset;
+			pose_pending = true;
+#endif
+
+			xyz.update(i, ind, s->angles[ind]);
+			const uint32_t triangulated = xyz.compute();
+
+			// once a sensor is being tracked every sweep gives a fix,
+			// otherwise a triangulated one (re)starts the tracking
+			float pos[3];
+#ifdef LIGHTHOUSE_FIXED_POINT
+			if (!triangulated)
+				continue;
+			xyz.position(i, pos);
+#else
+			LighthouseFilter * const filter = &filters[i];
+
+			if (filter->update(ind, angle, s->times[ind]))
+			{
+				pos[0] = filter->xyz[0];
+				pos[1] = filter->xyz[1];
+				pos[2] = filter->xyz[2];
+				tracked++;
+			} else
+			if (triangulated && !filter->running)
+			{
+				xyz.position(i, pos);
+				filter->reset(pos, s->times[ind]);
+			} else
+				continue;
+#endif
+
+			fixes[i]++;
+
+			// as send_fix() does after frames were dropped
+			if (output.lost != output_lost)
+			{
+				output_lost = output.lost;
+				telemetry.key_frames();
+			}
+
+			const unsigned len = telemetry.fix(txbuf, i, s->times[ind], s->raw, pos, xyz.dist[i]);
+			tx_bytes += len;
+			output.write(txbuf, len);
+			if (verbose)
+				print_fix(i, *s, pos, xyz.dist[i]);
+		}
+
+#ifndef LIGHTHOUSE_FIXED_POINT
+		if (pose_pending)
+		{
+			pose_pending = false;
+			poses += solve_pose(pose_time, verbose, &tx_bytes);
+		}
+#endif
+	}
+
+	const double elapsed = now_sec() - start;
+
+	// the host catches up with whatever is left
+	edge_stream.flush();
+	port.rate = 0;
+	while (!output.idle())
+		output.flush();
+	const unsigned long total_edges = edges.size() * repeat;
+	const unsigned long total_fixes = fixes[0] + fixes[1] + fixes[2] + fixes[3];
+
+	fprintf(stderr,
+		"edges %lu angles %lu fixes %lu (%lu %lu %lu %lu) tracked %lu poses %lu ootx %lu warm starts %lu\n",
+		total_edges, angles, total_fixes,
+		fixes[0], fixes[1], fixes[2], fixes[3],
+		tracked, poses, frames, warm_starts
+	);
+
+	fprintf(stderr,
+		"edges lost %lu unpaired %lu %lu %lu %lu\n",
+		(unsigned long) InputCapture::lost,
+		(unsigned long) sensors[0].unpaired,
+		(unsigned long) sensors[1].unpaired,
+		(unsigned long) sensors[2].unpaired,
+		(unsigned long) sensors[3].unpaired
+	);
+
+	fprintf(stderr,
+		"sync flashes %lu, sweeps rescued from missed flashes %lu\n",
+		(unsigned long) tracker.flashes,
+		(unsigned long) tracker.rescued
+	);
+
+	fprintf(stderr,
+		"ootx missed flashes %lu %lu, disputed bits %lu, crc errors %lu %lu, resyncs %lu %lu\n",
+		(unsigned long) tracker.missed[0],
+		(unsigned long) tracker.missed[1],
+		(unsigned long) tracker.disputed,
+		tracker.ootx[0].crc_errors,
+		tracker.ootx[1].crc_errors,
+		tracker.ootx[0].resyncs,
+		tracker.ootx[1].resyncs
+	);
+
+	fprintf(stderr,
+		"sync period %.3f %.3f usec, drift %ld %ld ppm\n",
+		tracker.period[0] / (256.0 * CLOCKS_PER_MICROSECOND),
+		tracker.period[1] / (256.0 * CLOCKS_PER_MICROSECOND),
+		(long) tracker.drift_ppm(0),
+		(long) tracker.drift_ppm(1)
+	);
+
+	fprintf(stderr,
+		"telemetry %lu bytes, %.1f bytes/fix, %lu sent\n",
+		tx_bytes,
+		total_fixes ? tx_bytes / (double) total_fixes : 0.0,
+		port.bytes
+	);
+
+	fprintf(stderr,
+		"output dropped %lu %lu %lu %lu, peak %lu %lu %lu %lu bytes, stalls %lu\n",
+		(unsigned long) output.dropped[LighthouseOutput::STATE],
+		(unsigned long) output.dropped[LighthouseOutput::FIX],
+		(unsigned long) output.dropped[LighthouseOutput::EDGES],
+		(unsigned long) output.dropped[LighthouseOutput::DEBUG],
+		(unsigned long) output.peak[LighthouseOutput::STATE],
+		(unsigned long) output.peak[LighthouseOutput::FIX],
+		(unsigned long) output.peak[LighthouseOutput::EDGES],
+		(unsigned long) output.peak[LighthouseOutput::DEBUG],
+		(unsigned long) output.stalls
+	);
+
+	if (streaming)
+		fprintf(stderr,
+			"raw edges %lu in %lu bytes, %.2f bytes/edge, %.0f bytes/s\n",
+			(unsigned long) edge_stream.edges,
+			(unsigned long) edge_stream.bytes,
+			edge_stream.edges ? edge_stream.bytes / (double) edge_stream.edges : 0.0,
+			edge_stream.bytes / (span * repeat / (double) F_BUS)
+		);
+
+	fprintf(stderr,
+		"%.3f s, %.1f ns/edge, %.2f Medges/s, %.1f x realtime\n",
+		elapsed,
+		elapsed * 1e9 / total_edges,
+		total_edges / elapsed / 1e6,
+		(span * repeat / (double) F_BUS) / elapsed
+	);
+
+	return 0;
+}
@@ -0,0 +1,276 @@
+/** \file
+ * Measure the poses of the two Lighthouses from the tracker's fixes.
+ *
+ * Put the sensor board at the origin and let this run on the telemetry
+ * stream.  The raw sweep times of each sensor are averaged over blocks
+ * of fixes, and for every block both lighthouse poses are solved (see
+ * PoseSolver.h), printed, and written as a LighthousePoses.h that the
+ * firmware can be rebuilt with, along with the 'l' commands that load
+ * them into the running firmware instead.  It keeps going until the
+ * input ends so that the board can be moved or the base stations
+ * adjusted while watching the result.
+ *
+ * Usage: solve_lighthouse [-t] [-1] [-n fixes] [-s mm] [-c ticks/usec]
+ *	[-o LighthousePoses.h] [/dev/ttyACM0 | capture.bin]
+ *
+ * -t reads the text format from lhdecode (or an old serial log)
+ * instead of binary telemetry, -1 stops after the first solution,
+ * -n sets the block size (default 200), -s the spacing of the sensors
+ * in the default square layout (default 22 mm) and -c the capture clock
+ * rate (default 48).  Reads stdin if no file is given.
+ *
+ * The board's frame has the sensors at (+s/2,-s/2), (-s/2,-s/2),
+ * (-s/2,+s/2) and (+s/2,+s/2) for sensors 0 to 3, Z out of the board,
+ * and is in meters.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include "TelemetryDecoder.h"
+#include "PoseSolver.h"
+#include "HostUtil.h"
+
+#define NUM_SENSORS 4
+
+
+static bool write_poses(
+	const char * filename,
+	const PoseSolution sol[2],
+	unsigned long fixes
+)
+{
+	FILE * f = fopen(filename, "w");
+	if (!f)
+	{
+		perror(filename);
+		return false;
+	}
+
+	fprintf(f,
+		"/** \\file\n"
+		" * Lighthouse sources rotation matrix & 3d-position, in the frame of\n"
+		" * the sensor board.  host/build/solve_lighthouse rewrites this file\n"
+		" * with the poses it measures.\n"
+		" *\n"
+		" * Once a base station is recognized by its OOTX serial number the pose\n"
+		" * stored in EEPROM for it is used, until the firmware is built with a\n"
+		" * different pose here, which then replaces the stored one.\n"
+		" */\n"
+		"#ifndef _LighthousePoses_h_\n"
+		"#define _LighthousePoses_h_\n"
+		"\n"
+		"#include \"LighthouseXYZ.h\"\n"
+		"\n"
+		"// solved from %lu fixes, rms error %.3f and %.3f mrad\n"
+		"static lightsource lightsources[2] = {{\n",
+		fixes,
+		sol[0].rms * 1000,
+		sol[1].rms * 1000
+	);
+
+	for (int lh = 0 ; lh < 2 ; lh++)
+	{
+		const double * m = sol[lh].mat;
+		const double * o = sol[lh].origin;
+
+		if (lh)
+			fprintf(f, "}, {\n");
+
+		fprintf(f,
+			"    { %9.5ff,%9.5ff,%9.5ff,\n"
+			"      %9.5ff,%9.5ff,%9.5ff,\n"
+			"      %9.5ff,%9.5ff,%9.5ff},\n"
+			"    { %9.5ff,%9.5ff,%9.5ff}\n",
+			m[0], m[1], m[2],
+			m[3], m[4], m[5],
+			m[6], m[7], m[8],
+			o[0], o[1], o[2]
+		);
+	}
+
+	fprintf(f, "}};\n\n#endif\n");
+
+	return fclose(f) == 0;
+}
+
+
+int main(int argc, char ** argv)
+{
+	bool text = false;
+	bool once = false;
+	unsigned block = 200;
+	double spacing = 22;
+	double clocks_per_usec = 48;
+	const char * output = "LighthousePoses.h";
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t1n:s:c:o:")) != -1)
+	{
+		switch (opt)
+		{
+		case 't': text = true; break;
+		case '1': once = true; break;
+		case 'n': block = strtoul(optarg, NULL, 0); break;
+		case 's': spacing = atof(optarg); break;
+		case 'c': clocks_per_usec = atof(optarg); break;
+		case 'o': output = optarg; break;
+		default:
+			fprintf(stderr,
+				"Usage: %s [-t] [-1] [-n fixes] [-s mm] [-c ticks/usec]"
+				" [-o LighthousePoses.h] [input]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	FILE * f = stdin;
+	if (optind < argc && (f = fopen(argv[optind], "rb")) == NULL)
+	{
+		perror(argv[optind]);
+		return 1;
+	}
+
+	// the default sensor array is a square, which fits easily
+	// on a breadboard
+	const double h = spacing / 2000;
+	const double sensors[NUM_SENSORS][3] = {
+		{ +h, -h, 0 },
+		{ -h, -h, 0 },
+		{ -h, +h, 0 },
+		{ +h, +h, 0 },
+	};
+
+	TelemetryDecoder d;
+	double sum[NUM_SENSORS][4] = {};
+	unsigned long count[NUM_SENSORS] = {};
+	unsigned long total = 0;
+	unsigned long solutions = 0;
+	char line[256];
+
+	while (1)
+	{
+		unsigned id;
+		uint32_t raw[4];
+
+		if (text)
+		{
+			if (!fgets(line, sizeof(line), f))
+				break;
+			if (sscanf(line, "%u,%u,%u,%u,%u,",
+				&id, &raw[0], &raw[1], &raw[2], &raw[3]) != 5)
+				continue;
+		} else {
+			const int c = getc(f);
+			if (c == EOF)
+				break;
+
+			const int type = d.feed(c);
+			if (type != LH_FRAME_FIX_KEY && type != LH_FRAME_FIX_DELTA)
+				continue;
+
+			id = d.fix.id;
+			for (int j = 0 ; j < 4 ; j++)
+				raw[j] = d.fix.raw[j];
+		}
+
+		if (id >= NUM_SENSORS)
+			continue;
+
+		for (int j = 0 ; j < 4 ; j++)
+			sum[id][j] += raw[j];
+		count[id]++;
+
+		if (++total < block)
+			continue;
+
+		// at least 10% of the samples must be from each sensor
+		bool enough = true;
+		for (int i = 0 ; i < NUM_SENSORS ; i++)
+		{
+			if (count[i] >= total / 10)
+				continue;
+			printf("%d: too few samples (%lu of %lu)\n", i, count[i], total);
+			enough = false;
+		}
+
+		// average and convert to angles, the same as LighthouseSensor
+		double angles[2][NUM_SENSORS][2];
+		for (int i = 0 ; enough && i < NUM_SENSORS ; i++)
+			for (int j = 0 ; j < 4 ; j++)
+				angles[j / 2][i][j % 2] =
+					(sum[i][j] / count[i] - 4000 * clocks_per_usec)
+					* M_PI / (8333 * clocks_per_usec);
+
+		for (int i = 0 ; i < NUM_SENSORS ; i++)
+		{
+			count[i] = 0;
+			for (int j = 0 ; j < 4 ; j++)
+				sum[i][j] = 0;
+		}
+
+		const unsigned long fixes = total;
+		total = 0;
+
+		if (!enough)
+			continue;
+
+		PoseSolution sol[2];
+		bool ok = true;
+		const double start = now_sec();
+
+		for (int lh = 0 ; lh < 2 ; lh++)
+			ok &= pose_solve(sensors, angles[lh], NUM_SENSORS, sol[lh]);
+
+		const double elapsed = now_sec() - start;
+
+		if (!ok)
+		{
+			printf("no solution\n");
+			continue;
+		}
+
+		for (int lh = 0 ; lh < 2 ; lh++)
+		{
+			const PoseSolution & s = sol[lh];
+			printf("lighthouse %d: origin %.4f,%.4f,%.4f m"
+				" distance %.4f m rms %.3f mrad (%u iterations)\n",
+				lh,
+				s.origin[0], s.origin[1], s.origin[2],
+				sqrt(s.origin[0]*s.origin[0]
+				   + s.origin[1]*s.origin[1]
+				   + s.origin[2]*s.origin[2]),
+				s.rms * 1000,
+				s.iterations
+			);
+		}
+
+		// for the firmware's 'l' command, which stores it as well
+		for (int lh = 0 ; lh < 2 ; lh++)
+		{
+			const double * m = sol[lh].mat;
+			const double * o = sol[lh].origin;
+			printf("l%d %.6f %.6f %.6f %.6f %.6f %.6f %.6f %.6f %.6f"
+				" %.6f %.6f %.6f\n",
+				lh,
+				m[0], m[1], m[2],
+				m[3], m[4], m[5],
+				m[6], m[7], m[8],
+				o[0], o[1], o[2]
+			);
+		}
+
+		printf("solved in %.3f ms, written to %s\n", elapsed * 1e3, output);
+		fflush(stdout);
+
+		if (!write_poses(output, sol, fixes))
+			return 1;
+
+		solutions++;
+		if (once)
+			break;
+	}
+
+	return solutions ? 0 : 1;
+}